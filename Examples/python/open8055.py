@@ -478,6 +478,8 @@ class Open8055:
                             ('input_bits', values[0]),
                             ('input_counter', values[1:6]),
                             ('input_adc_value', values[6:8]),
+                            ('input_sequence', (values[8:9] or [0])[0]),
+                            ('input_timestamp', (values[9:10] or [0])[0]),
                         ))
             elif hid_type == OUTPUT:
                 self.cur_output = dict((
@@ -0,0 +1,169 @@
+/********************************************************************
+ FileName:      debounce.h
+ Processor:     PIC18 USB Microcontrollers, or a host compiler for
+                  test/debounce_host.c
+ Compiler:      Microchip C18
+
+ The input debouncing of the tick interrupt. It lives in a header
+ so that the host harness in test/ runs the same code as main.c.
+
+ The includer defines uint8_t, uint16_t, uint32_t and
+ OPEN8055_TICKS_PER_MS and the state variables below.
+
+ Open8055
+
+  0.1	10/18/2026	Moved out of main.c
+********************************************************************/
+
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+// Digital inputs and their debouncing, one bit per input with I1 in
+// bit 0. debounceCount and prescaleCount are vertical counters: bit n
+// of element k is bit k of the counter of input n, so that all inputs
+// count down together. An input whose raw state differs from its
+// debounced state counts down every tick, or every few milliseconds
+// for debounce times above 255 ticks. At zero it takes the new state.
+// An input whose raw state is the debounced state is reloaded.
+//
+// State, defined by the includer:
+//
+//	uint8_t	debounceState				Debounced input bits
+//	uint8_t	debounceBusy				Inputs that counted on the last tick
+//	uint8_t	debounceTickMask			Inputs counting ticks, others ms
+//	uint8_t	debounceMsTicker			Ticks into the current millisecond
+//	uint8_t	debounceCount[DEBOUNCE_COUNT_BITS]
+//	uint8_t	debounceLoad[DEBOUNCE_COUNT_BITS]
+//	uint8_t	prescaleCount[DEBOUNCE_PRESCALE_BITS]
+//	uint8_t	prescaleLoad[DEBOUNCE_PRESCALE_BITS]
+//
+// The millisecond steps of all prescaled inputs come from the shared
+// debounceMsTicker, so the first one comes 1 to TICKS_PER_MS ticks
+// after the change. DEBOUNCE_SPLIT() adds a millisecond less a tick,
+// so a prescaled input is never early, but it can be up to 1 ms plus
+// the rounding to whole steps late. Times up to 255 ticks are exact.
+#define DEBOUNCE_COUNT_BITS		8
+#define DEBOUNCE_PRESCALE_BITS	5
+
+// DEBOUNCE_SPLIT(ticks, steps, prescale)
+//
+// Convert a debounce time of 1 to 65536 ticks (uint32_t, modified)
+// into the load values of one input: steps ticks if prescale is 0,
+// otherwise steps of prescale milliseconds. The products are done in
+// 32 bit, since int is only 16 bit on the PIC.
+#define DEBOUNCE_SPLIT(ticks, steps, prescale)								\
+	do {																	\
+		if ((ticks) <= 255)													\
+		{																	\
+			(steps) = (ticks);												\
+			(prescale) = 0;													\
+		}																	\
+		else																\
+		{																	\
+			(ticks) += OPEN8055_TICKS_PER_MS - 1;							\
+			(prescale) = (ticks) / (255 * OPEN8055_TICKS_PER_MS);			\
+			if ((uint32_t)(prescale) * (255 * OPEN8055_TICKS_PER_MS) < (ticks))	\
+				(prescale)++;												\
+			(steps) = (ticks) / ((prescale) * OPEN8055_TICKS_PER_MS);		\
+			if ((uint32_t)(steps) * (prescale) * OPEN8055_TICKS_PER_MS < (ticks))	\
+				(steps)++;													\
+		}																	\
+	} while (0)
+
+// DEBOUNCE_STEP(raw, done)
+//
+// Debounce all inputs for one tick. raw holds the input bits read on
+// this tick. done is set to the inputs that took their new state, the
+// state itself is in debounceState. Nothing to do if no input differs
+// from its debounced state and all counters are loaded. The counter
+// updates are unrolled, since array access with a constant index is
+// a direct access.
+#define DEBOUNCE_STEP(raw, done)											\
+	do {																	\
+		uint8_t	dbChanged;													\
+		uint8_t	dbLoad;														\
+		uint8_t	dbBorrow;													\
+		uint8_t	dbExpired;													\
+																			\
+		if (++debounceMsTicker >= OPEN8055_TICKS_PER_MS)					\
+			debounceMsTicker = 0;											\
+																			\
+		(done) = 0;															\
+		dbChanged = (raw) ^ debounceState;									\
+		if ((dbChanged | debounceBusy) == 0)								\
+			break;															\
+																			\
+		/* Reload the counters of all inputs that are stable. */			\
+		dbLoad = ~dbChanged;												\
+		debounceCount[0] = (debounceCount[0] & dbChanged) | (debounceLoad[0] & dbLoad);	\
+		debounceCount[1] = (debounceCount[1] & dbChanged) | (debounceLoad[1] & dbLoad);	\
+		debounceCount[2] = (debounceCount[2] & dbChanged) | (debounceLoad[2] & dbLoad);	\
+		debounceCount[3] = (debounceCount[3] & dbChanged) | (debounceLoad[3] & dbLoad);	\
+		debounceCount[4] = (debounceCount[4] & dbChanged) | (debounceLoad[4] & dbLoad);	\
+		debounceCount[5] = (debounceCount[5] & dbChanged) | (debounceLoad[5] & dbLoad);	\
+		debounceCount[6] = (debounceCount[6] & dbChanged) | (debounceLoad[6] & dbLoad);	\
+		debounceCount[7] = (debounceCount[7] & dbChanged) | (debounceLoad[7] & dbLoad);	\
+		prescaleCount[0] = (prescaleCount[0] & dbChanged) | (prescaleLoad[0] & dbLoad);	\
+		prescaleCount[1] = (prescaleCount[1] & dbChanged) | (prescaleLoad[1] & dbLoad);	\
+		prescaleCount[2] = (prescaleCount[2] & dbChanged) | (prescaleLoad[2] & dbLoad);	\
+		prescaleCount[3] = (prescaleCount[3] & dbChanged) | (prescaleLoad[3] & dbLoad);	\
+		prescaleCount[4] = (prescaleCount[4] & dbChanged) | (prescaleLoad[4] & dbLoad);	\
+																			\
+		/* Inputs in tick mode count every tick. Those in millisecond */	\
+		/* mode count their prescaler once per millisecond and the */		\
+		/* debounce counter whenever the prescaler runs out. */				\
+		dbBorrow = dbChanged & debounceTickMask;							\
+		if (debounceMsTicker == 0)											\
+		{																	\
+			dbExpired = dbChanged & ~debounceTickMask;						\
+			(done) = dbExpired;												\
+			prescaleCount[0] ^= (done); (done) &= prescaleCount[0];			\
+			prescaleCount[1] ^= (done); (done) &= prescaleCount[1];			\
+			prescaleCount[2] ^= (done); (done) &= prescaleCount[2];			\
+			prescaleCount[3] ^= (done); (done) &= prescaleCount[3];			\
+			prescaleCount[4] ^= (done);										\
+			dbExpired &= ~(prescaleCount[0] | prescaleCount[1] | prescaleCount[2] |	\
+						   prescaleCount[3] | prescaleCount[4]);			\
+			if (dbExpired)													\
+			{																\
+				dbLoad = ~dbExpired;										\
+				prescaleCount[0] = (prescaleCount[0] & dbLoad) | (prescaleLoad[0] & dbExpired);	\
+				prescaleCount[1] = (prescaleCount[1] & dbLoad) | (prescaleLoad[1] & dbExpired);	\
+				prescaleCount[2] = (prescaleCount[2] & dbLoad) | (prescaleLoad[2] & dbExpired);	\
+				prescaleCount[3] = (prescaleCount[3] & dbLoad) | (prescaleLoad[3] & dbExpired);	\
+				prescaleCount[4] = (prescaleCount[4] & dbLoad) | (prescaleLoad[4] & dbExpired);	\
+				dbBorrow |= dbExpired;										\
+			}																\
+		}																	\
+																			\
+		/* Count down. An input that reaches zero takes its new state */	\
+		/* and its counter is reloaded. */									\
+		debounceCount[0] ^= dbBorrow; dbBorrow &= debounceCount[0];			\
+		debounceCount[1] ^= dbBorrow; dbBorrow &= debounceCount[1];			\
+		debounceCount[2] ^= dbBorrow; dbBorrow &= debounceCount[2];			\
+		debounceCount[3] ^= dbBorrow; dbBorrow &= debounceCount[3];			\
+		debounceCount[4] ^= dbBorrow; dbBorrow &= debounceCount[4];			\
+		debounceCount[5] ^= dbBorrow; dbBorrow &= debounceCount[5];			\
+		debounceCount[6] ^= dbBorrow; dbBorrow &= debounceCount[6];			\
+		debounceCount[7] ^= dbBorrow;										\
+		(done) = dbChanged & ~(debounceCount[0] | debounceCount[1] | debounceCount[2] |	\
+							   debounceCount[3] | debounceCount[4] | debounceCount[5] |	\
+							   debounceCount[6] | debounceCount[7]);		\
+		if (done)															\
+		{																	\
+			dbLoad = ~(done);												\
+			debounceCount[0] = (debounceCount[0] & dbLoad) | (debounceLoad[0] & (done));	\
+			debounceCount[1] = (debounceCount[1] & dbLoad) | (debounceLoad[1] & (done));	\
+			debounceCount[2] = (debounceCount[2] & dbLoad) | (debounceLoad[2] & (done));	\
+			debounceCount[3] = (debounceCount[3] & dbLoad) | (debounceLoad[3] & (done));	\
+			debounceCount[4] = (debounceCount[4] & dbLoad) | (debounceLoad[4] & (done));	\
+			debounceCount[5] = (debounceCount[5] & dbLoad) | (debounceLoad[5] & (done));	\
+			debounceCount[6] = (debounceCount[6] & dbLoad) | (debounceLoad[6] & (done));	\
+			debounceCount[7] = (debounceCount[7] & dbLoad) | (debounceLoad[7] & (done));	\
+			debounceState ^= (done);										\
+			dbChanged &= dbLoad;											\
+		}																	\
+		debounceBusy = dbChanged;											\
+	} while (0)
+
+#endif // DEBOUNCE_H
@@ -52,6 +52,7 @@
 
 #include "usb_config.h"
 #include "open8055_hid_protocol.h"
+#include "debounce.h"
 
 /** CONFIGURATION **************************************************/
 
@@ -146,6 +147,11 @@
 Open8055_hidMessage_t receivedDataBuffer;
 Open8055_hidMessage_t toSendDataBuffer;
 
+/** Output sequence in spare USB RAM *******************************/
+#pragma udata SEQUENCE_TABLE=0x600
+
+Open8055_seqRow_t seqTable[OPEN8055_SEQUENCE_ROWS];
+
 /** VARIABLES ******************************************************/
 #pragma udata
 
@@ -158,44 +164,213 @@ uint8_t		cardConnected = 0;
 uint8_t		tickCounter = 0;
 uint8_t		tickMillisecond = 0;
 uint16_t	tickSecond = 0;
+uint32_t	tickTimestamp = 0;				// Ticks since startup for INPUT reports
 
 uint8_t		analogGoDelay = 2;
 uint8_t		analogInterrupted = 0;
 
 uint16_t	analogValue_1 = 0;
-uint16_t	analogSum_1 = 0;
-uint8_t		analogCount_1 = 0;
+uint32_t	analogSum_1 = 0;
+uint16_t	analogCount_1 = 0;
 uint16_t	analogValue_2 = 0;
-uint16_t	analogSum_2 = 0;
-uint8_t		analogCount_2 = 0;
+uint32_t	analogSum_2 = 0;
+uint16_t	analogCount_2 = 0;
 uint8_t		analogAvgCount = 0;
+uint8_t		analogAvgWindow = OPEN8055_AVERAGE_WINDOW_DEFAULT;	// ms per average
+uint16_t	analogRaw_1 = 0;				// Latest single conversions
+uint16_t	analogRaw_2 = 0;				// for the burst samples
 
 Open8055_hidMessage_t currentConfig1;
+Open8055_hidMessage_t currentConfig2;
 Open8055_hidMessage_t currentOutput;
 Open8055_hidMessage_t currentInput;
 uint8_t		currentOutputMask = 0xFF;
 
+uint16_t	currentInputSequence = 0;
+uint8_t		lastInputState[OPEN8055_INPUT_STATE_SIZE];
+
+// Input report cadence from SETCONFIG2. With a reportPeriod the INPUT
+// report is sent every reportPeriod ms, changed or not. Without, it is
+// sent whenever the input state changed, ignoring ADC changes of up to
+// adcHysteresis.
+uint16_t	reportPeriod = 0;
+uint16_t	reportTicker = 0;
+uint8_t		reportDue = FALSE;
+uint16_t	adcHysteresis = 0;
+
 uint8_t		currentInputRequested = FALSE;
 uint8_t		currentConfig1Requested = FALSE;
+uint8_t		currentConfig2Requested = FALSE;
 uint8_t		currentOutputRequested = FALSE;
 
 // Status data per digital input
 struct {
-	unsigned char	currentState;
-	unsigned char	lastState;
 	unsigned short	counter;
 	unsigned short	frequency;
-	unsigned short	debounceConfig;				// Debounce time in ticks/ms
-	unsigned short	debounceCounter;
+	unsigned short	debounceConfig;				// Debounce time in ticks
+	uint32_t		lastEdge;					// Tick of the last rising edge
+	uint32_t		periodStart;				// Tick the measurement started
+	uint32_t		period;						// Last measured period in ticks
 } switchStatus[5];
 
-// Standard PWM servo control variables
-static unsigned char	servoCycles = 0;		// Number of timer cycles left in this pulse
-static unsigned int		servoLast;				// Timer counter for the last cycle
-static unsigned int		servoNext;				// Timer counter for the cycle after last
-static unsigned char	servoBit;				// PORTB bit to pulse
-static unsigned char	servoPulseHigh;			// Flag if this pulse is high/low
-static unsigned char	servoTicker = 0;		// Servo ticker controlling when to start pulses
+// Period mode. Without edges for this many ticks an input reports 0 Hz.
+#define PERIOD_TIMEOUT		100000
+#define PERIOD_SCALE		((uint32_t)OPEN8055_TICKS_PER_MS * 1000 * OPEN8055_PERIOD_PER_HZ)
+uint8_t		periodTicker = 0;
+uint8_t		periodValid = 0;				// Inputs with a start edge
+
+// Digital inputs and their debouncing, one bit per input with I1 in
+// bit 0. See debounce.h.
+uint8_t		inputRaw = 0;					// Raw input bits of the last tick
+uint8_t		debounceState = 0;				// Debounced input bits
+uint8_t		debounceBusy = 0;				// Inputs that counted on the last tick
+uint8_t		debounceTickMask = 0;			// Inputs counting ticks, others ms
+uint8_t		debounceMsTicker = 0;				// Ticks into the current millisecond
+uint8_t		debounceCount[DEBOUNCE_COUNT_BITS];
+uint8_t		debounceLoad[DEBOUNCE_COUNT_BITS];
+uint8_t		prescaleCount[DEBOUNCE_PRESCALE_BITS];
+uint8_t		prescaleLoad[DEBOUNCE_PRESCALE_BITS];
+
+// Output sequence player. seqTable holds the rows in host byte order.
+// processIO() latches the digital outputs of the next rows that are due
+// together. The tick interrupt starts an armed sequence on its trigger
+// edge, counts seqTick and sets the latched outputs on their tick.
+// processIO() then sets the output values of those rows and latches the
+// next ones.
+#define SEQ_LATCH_EMPTY		0
+#define SEQ_LATCH_READY		1				// Set by processIO()
+#define SEQ_LATCH_FIRED		2				// Set by the tick interrupt
+uint8_t		seqState = OPEN8055_SEQUENCE_IDLE;
+uint8_t		seqLength = 0;					// Rows in the sequence
+uint8_t		seqTrigger = OPEN8055_SEQUENCE_TRIGGER_NONE;
+uint8_t		seqTriggerMask = 0;				// Trigger input bit, 0 = none
+uint16_t	seqLoops = 0;					// Loops left, 0 = forever
+uint8_t		seqRow = 0;						// First latched row
+uint8_t		seqRowEnd = 0;					// Row after the latched ones
+uint16_t	seqTick = 0;					// Ticks since the start of this loop
+uint8_t		seqInputs = 0;					// Debounced inputs of the last tick
+uint8_t		seqLatch = SEQ_LATCH_EMPTY;
+uint16_t	seqLatchTick = 0;				// Tick of the latched rows
+uint8_t		seqLatchBits = 0;				// Their digital outputs
+uint8_t		seqLatchEnd = FALSE;			// They are the last of the loop
+uint8_t		seqStatusRequested = FALSE;
+
+// PID controllers of the PWM outputs in OPEN8055_MODE_PID, run on every
+// new averaged ADC value. The integral has OPEN8055_PID_INTEGRAL_SHIFT
+// fraction bits and is limited to the output range, so it doesn't wind
+// up while the output saturates.
+struct {
+	uint8_t			adc;					// ADC input 1 or 2, 0 = not set
+	uint16_t		setpoint;
+	int16_t			kp;
+	int16_t			ki;
+	int16_t			kd;
+	uint16_t		outMin;
+	uint16_t		outMax;
+	int32_t			integral;
+	uint16_t		lastValue;				// ADC value of the last run
+} pidStatus[2];
+
+// Rule table, evaluated every millisecond in processIO(). A new table
+// is loaded into the inactive buffer and swapped in when complete, so
+// the rules keep working during the upload. The rules force digital
+// outputs on or off, off taking precedence, and PWM outputs to a duty
+// cycle, the first matching rule taking precedence. Outputs return to
+// the host's values when no rule holds any more.
+Open8055_rule_t	ruleBuffer0[OPEN8055_RULES];
+Open8055_rule_t	ruleBuffer1[OPEN8055_RULES];
+Open8055_rule_t	*ruleActive = ruleBuffer0;
+Open8055_rule_t	*ruleLoading = ruleBuffer1;
+uint8_t		ruleCount = 0;
+uint8_t		ruleSet = 0;					// Outputs forced on
+uint8_t		ruleClear = 0;					// Outputs forced off
+uint8_t		rulePwmForced = 0;				// PWM outputs forced
+uint16_t	rulePwmValue[2];
+
+// The rule table in the data EEPROM, saved by SAVECONFIG and SAVEALL
+// and loaded at power up. Byte 0 is the magic, then the rule count, the
+// rules and a checksum. The save writes one byte per millisecond, the
+// magic last, so that an interrupted save leaves no table.
+#define EEPROM_RULES_MAGIC		0x52
+#define EEPROM_RULES_SIZE		(2 + OPEN8055_RULES * sizeof(Open8055_rule_t) + 1)
+uint8_t		eepromStep = 0;					// Next step of the save, 0 = idle
+uint8_t		eepromSum = 0;					// Checksum of the bytes saved
+uint16_t	pwmDuty[2];						// Duty cycles in effect
+
+// Standard PWM servo control variables. All servo outputs start their
+// pulse together at the beginning of a frame, on a tick. The pulse ends
+// are a list sorted by time, and Timer3 interrupts exactly at each of
+// them in addition to the ticks. processIO() prepares the list for the
+// next frame in the inactive buffer whenever the outputs change. An
+// event closer than the guard time to the current interrupt is waited
+// for in that interrupt, since taking another one would make it late.
+// The interrupt for a pulse end is taken a little early and waits for
+// the exact time too, so the interrupt latency adds no jitter. The per
+// tick work only runs when no pulse end is due within its run time.
+#define SERVO_EDGE_LEAD			64			// Timer cycles, 5.3 microseconds
+#define SERVO_EDGE_GUARD		128			// Timer cycles, 10.7 microseconds
+#define SERVO_TICK_GUARD		480			// Timer cycles, 40 microseconds
+
+typedef struct {
+	unsigned char	count;					// Number of distinct pulse ends
+	unsigned char	mask;					// All servo outputs
+	unsigned char	level;					// Output bits high during the pulse
+	unsigned int	time[8];				// Pulse end in timer cycles from frame start
+	unsigned char	end[8];					// Outputs whose pulse ends then
+} servoList_t;
+
+static servoList_t		servoList[2];
+static unsigned char	servoActive = 0;		// Buffer used by the timer interrupt
+static unsigned char	servoListReady = FALSE;	// Other buffer holds a new list
+static unsigned char	servoEdgeNext = 0;		// Next pulse end in this frame
+static unsigned char	servoEdgeCount = 0;
+static unsigned int		servoEdgeRemain = 0;	// Timer cycles to the next pulse end
+static unsigned int		servoTickRemain = 0;	// Timer cycles to the next tick
+static unsigned char	servoTicksPending = 0;	// Ticks whose work is still to do
+static unsigned char	servoFrameTicker = 0;	// Ticks left in this frame
+static unsigned char	servoFramePeriod = OPEN8055_SERVO_PERIOD_DEFAULT;
+
+// Read the running Timer3 in 8 bit mode, retrying on a carry into the
+// high byte.
+#define servoTimerRead(_v) do {								\
+		unsigned char _h;									\
+		do {												\
+			_h = TMR3H;										\
+			(_v) = TMR3L;									\
+		} while (_h != TMR3H);								\
+		(_v) |= (unsigned int)_h << 8;						\
+	} while (0)
+
+// Burst sampling. The tick interrupt takes a sample every burstInterval
+// ticks into this ring and processIO() packs them into INPUTBURST reports.
+// A sample that doesn't fit into the ring is dropped, the host sees the
+// gap in the timestamps.
+#define BURST_RING_SIZE		16
+struct {
+	uint32_t		timestamp;
+	uint8_t			inputBits;
+	uint16_t		adcValue[2];
+} burstRing[BURST_RING_SIZE];
+uint8_t		burstInterval = 0;				// Ticks between samples, 0 = off
+uint8_t		burstTicker = 0;
+uint8_t		burstHead = 0;					// Written by the tick interrupt
+uint8_t		burstTail = 0;					// Written by processIO()
+uint32_t	burstClock = 0;					// Timestamp of the last sample
+
+// Edge capture. The tick interrupt queues every debounced change of the
+// inputs in edgeMask with its tick count, processIO() packs them into
+// EDGES reports. An event that doesn't fit is dropped and counted.
+#define EDGE_RING_SIZE		16
+struct {
+	uint32_t		timestamp;
+	uint8_t			edges;
+	uint8_t			state;
+} edgeRing[EDGE_RING_SIZE];
+uint8_t		edgeMask = 0;					// Inputs captured, 0 = off
+uint8_t		edgeHead = 0;					// Written by the tick interrupt
+uint8_t		edgeTail = 0;					// Written by processIO()
+uint8_t		edgeLost = 0;					// Dropped events, saturating
+uint32_t	edgeClock = 0;					// Ticks seen by the tick interrupt
 
 
 /** PRIVATE PROTOTYPES *********************************************/
@@ -205,6 +380,22 @@ void lowPriorityISRCode();
 static void initializeSystem(void);
 static void userInit(void);
 static void processIO(void);
+static void debounceConfigure(void);
+static uint8_t inputChanged(void);
+static void sendInputBurst(void);
+static void sendEdges(void);
+static void servoPrepare(void);
+static void pwmSet(uint8_t pwm, uint16_t value);
+static void sequenceLatch(void);
+static void sequenceService(void);
+static void pidRun(uint8_t pwm, uint8_t ms);
+static void ruleEvaluate(void);
+static void rulesRestore(void);
+static void rulesSaveStep(void);
+static uint8_t eepromRead(uint8_t addr);
+static void eepromWrite(uint8_t addr, uint8_t data);
+static void periodMeasure(uint8_t port);
+static void outputsUpdate(void);
 static void resetDevice(void);
 
 void USBCBSendResume(void);
@@ -300,178 +491,234 @@ void highPriorityISRCode()
 	if (PIR2bits.TMR3IF)
 	{
 		unsigned int increment;
+		unsigned int now;
+		servoList_t *list;
+		unsigned char tickWork;
+		unsigned char edge;
+		unsigned char raw;
+		unsigned char done;
 		
-		switch (servoCycles)
+		// This interrupt is for the next tick, the next servo pulse end
+		// or both. Timer3 counts the cycles since its scheduled time.
+		// Handle all events up to the guard time from now in order.
+		for (;;)
 		{
-			case 2:
-				// This is the last cycle in the servo pulse. We 
-				// use the adjusted Timer3 countdown value so that
-				// the next interrupt happens exactly when we need
-				// to end the pulse.
-				increment = servoLast;
-				servoCycles--;
-				break;
-				
-			case 1:
-				// End the pulse and use the adjusted Timer3 countdown
-				// for the next cycle. The last and the next cycle
-				// together are the same length as two default cycles.
-				increment = servoNext;
-				
-				if (servoPulseHigh)
-					PORTB &= ~servoBit;
-				else
-					PORTB |= servoBit;
-				servoCycles--;
-				break;
+			servoTimerRead(now);
+			list = &servoList[servoActive];
 			
-			case 0:
-				// We are NOT in a servo cycle at all. Just wind up the
-				// Timer3 counter for 100 microseconds.
-				increment = OPEN8055_TICK_TIMER_CYCLES;
-				break;
+			if (servoEdgeNext < servoEdgeCount && servoEdgeRemain <= servoTickRemain)
+			{
+				// End the pulses of all outputs due at this time.
+				if (servoEdgeRemain > now + SERVO_EDGE_GUARD)
+					break;
+				while (now < servoEdgeRemain)
+					servoTimerRead(now);
 				
-			default:
-				// We start or are in the middle of a servo pulse. Make
-				// sure the pulse is on (high or low as requested). But
-				// let Timer3 tick in 100 microsecond steps as usual.
-				increment = OPEN8055_TICK_TIMER_CYCLES;
-
-				if (servoPulseHigh)
-					PORTB |= servoBit;
-				else
-					PORTB &= ~servoBit;
-				servoCycles--;
-				break;
+				edge = list->end[servoEdgeNext];
+				PORTB = (PORTB & ~edge) | (~list->level & edge);
+				if (++servoEdgeNext < servoEdgeCount)
+					servoEdgeRemain += list->time[servoEdgeNext] - list->time[servoEdgeNext - 1];
+			}
+			else
+			{
+				if (servoTickRemain > now + SERVO_EDGE_GUARD)
+					break;
+				while (now < servoTickRemain)
+					servoTimerRead(now);
+				servoTicksPending++;
+				
+				// Start a new servo frame when the period is over and the
+				// last pulse ended. Switch to a new list if there is one.
+				if (servoFrameTicker != 0)
+					servoFrameTicker--;
+				if (servoFrameTicker == 0 && servoEdgeNext >= servoEdgeCount)
+				{
+					if (servoListReady)
+					{
+						servoActive ^= 1;
+						servoListReady = FALSE;
+						list = &servoList[servoActive];
+					}
+					PORTB = (PORTB & ~list->mask) | list->level;
+					servoEdgeNext = 0;
+					servoEdgeCount = list->count;
+					servoEdgeRemain = servoTickRemain + list->time[0];
+					servoFrameTicker = servoFramePeriod;
+				}
+				servoTickRemain += OPEN8055_TICK_TIMER_CYCLES;
+			}
 		}
+		
+		// Schedule the next interrupt for whichever comes first.
+		increment = servoTickRemain;
+		if (servoEdgeNext < servoEdgeCount && servoEdgeRemain - SERVO_EDGE_LEAD < increment)
+			increment = servoEdgeRemain - SERVO_EDGE_LEAD;
+		servoTickRemain -= increment;
+		servoEdgeRemain -= increment;
+		
+		// The per tick work below must not delay the next pulse end. If
+		// that is close, the work is left to a later interrupt.
+		tickWork = (servoTicksPending != 0 && increment > now + SERVO_TICK_GUARD);
 			
-		// Set Timer3 to the next ticker timeout. We do all the math
+		// Set Timer3 to the next timeout. We do all the math
 		// with the timer disabled to avoid roll-over issues.
 		T3CONbits.TMR3ON = 0;
 		increment = ~(increment - (TMR3L | ((unsigned int)TMR3H << 8))); 
 		TMR3L = increment & 0xFF;
 		TMR3H = (increment >> 8) & 0xFF;
 		T3CONbits.TMR3ON = 1;
+		PIR2bits.TMR3IF = 0;
 		
-		// Get all digital inputs.
-		switchStatus[0].currentState = OPEN8055sw1;
-		switchStatus[1].currentState = OPEN8055sw2;
-		switchStatus[2].currentState = OPEN8055sw3;
-		switchStatus[3].currentState = OPEN8055sw4;
-		switchStatus[4].currentState = OPEN8055sw5;
-		
-		// The following code would be a lot shorter if it
-		// was done in a loop. But accessing array elements via
-		// index is very slow compared to unrolling the loop.
+		if (!tickWork)
+			return;
 		
-		// Digital counter 1 handling
-		if (switchStatus[0].lastState == switchStatus[0].currentState)
-		{
-			switchStatus[0].debounceCounter = 0;
-		}
-		else
+		// Do the work once for every pending tick. Usually that is
+		// one, but a tick whose work was left for a later interrupt
+		// is caught up here. Another pass only starts while the next
+		// interrupt is at least the guard time away.
+		for (;;)
 		{
-			if (switchStatus[0].debounceCounter == 0)
-			{
-				switchStatus[0].debounceCounter = switchStatus[0].debounceConfig;
-			}
-			if (--switchStatus[0].debounceCounter == 0)
+			edgeClock++;
+			
+			// Get all digital inputs.
+			raw = 0;
+			if (OPEN8055sw1)
+				raw |= 0x01;
+			if (OPEN8055sw2)
+				raw |= 0x02;
+			if (OPEN8055sw3)
+				raw |= 0x04;
+			if (OPEN8055sw4)
+				raw |= 0x08;
+			if (OPEN8055sw5)
+				raw |= 0x10;
+			inputRaw = raw;
+			
+			// Debounce all inputs at once. done gets the inputs that took
+			// their new state on this tick.
+			DEBOUNCE_STEP(raw, done);
+			if (done)
 			{
-				switchStatus[0].lastState = switchStatus[0].currentState;
-				if (switchStatus[0].lastState)
+				// Queue the captured inputs that changed.
+				if (done & edgeMask)
+				{
+					unsigned char next = edgeHead + 1;
+					
+					if (next == EDGE_RING_SIZE)
+						next = 0;
+					if (next != edgeTail)
+					{
+						edgeRing[edgeHead].timestamp = edgeClock;
+						edgeRing[edgeHead].edges = done & edgeMask;
+						edgeRing[edgeHead].state = debounceState;
+						edgeHead = next;
+					}
+					else if (edgeLost != 0xFF)
+						edgeLost++;
+				}
+				
+				// A rising edge counts.
+				done &= debounceState;
+				if (done & 0x01)
+				{
 					switchStatus[0].counter++;
-			}	
-		}	
-		
-		// Digital counter 2 handling
-		if (switchStatus[1].lastState == switchStatus[1].currentState)
-		{
-			switchStatus[1].debounceCounter = 0;
-		}
-		else
-		{
-			if (switchStatus[1].debounceCounter == 0)
-			{
-				switchStatus[1].debounceCounter = switchStatus[1].debounceConfig;
-			}
-			if (--switchStatus[1].debounceCounter == 0)
-			{
-				switchStatus[1].lastState = switchStatus[1].currentState;
-				if (switchStatus[1].lastState)
+					switchStatus[0].lastEdge = edgeClock;
+				}
+				if (done & 0x02)
+				{
 					switchStatus[1].counter++;
-			}	
-		}	
-		
-		// Digital counter 3 handling
-		if (switchStatus[2].lastState == switchStatus[2].currentState)
-		{
-			switchStatus[2].debounceCounter = 0;
-		}
-		else
-		{
-			if (switchStatus[2].debounceCounter == 0)
-			{
-				switchStatus[2].debounceCounter = switchStatus[2].debounceConfig;
-			}
-			if (--switchStatus[2].debounceCounter == 0)
-			{
-				switchStatus[2].lastState = switchStatus[2].currentState;
-				if (switchStatus[2].lastState)
+					switchStatus[1].lastEdge = edgeClock;
+				}
+				if (done & 0x04)
+				{
 					switchStatus[2].counter++;
-			}	
-		}	
-		
-		// Digital counter 4 handling
-		if (switchStatus[3].lastState == switchStatus[3].currentState)
-		{
-			switchStatus[3].debounceCounter = 0;
-		}
-		else
-		{
-			if (switchStatus[3].debounceCounter == 0)
+					switchStatus[2].lastEdge = edgeClock;
+				}
+				if (done & 0x08)
+				{
+					switchStatus[3].counter++;
+					switchStatus[3].lastEdge = edgeClock;
+				}
+				if (done & 0x10)
+				{
+					switchStatus[4].counter++;
+					switchStatus[4].lastEdge = edgeClock;
+				}
+			}
+			
+			// Sequence player. Start an armed sequence on its trigger
+			// edge and set the latched outputs when their tick has come.
+			// After the last rows of the loop it starts over on the next
+			// tick.
+			if (seqState == OPEN8055_SEQUENCE_ARMED)
 			{
-				switchStatus[3].debounceCounter = switchStatus[3].debounceConfig;
+				edge = seqInputs ^ debounceState;
+				if (seqTrigger & OPEN8055_SEQUENCE_TRIGGER_FALLING)
+					edge &= seqInputs;
+				else
+					edge &= debounceState;
+				seqInputs = debounceState;
+				if (seqTriggerMask == 0 || (edge & seqTriggerMask) != 0)
+				{
+					seqState = OPEN8055_SEQUENCE_RUNNING;
+					seqTick = 0;
+					seqStatusRequested = TRUE;
+				}
 			}
-			if (--switchStatus[3].debounceCounter == 0)
+			if (seqState == OPEN8055_SEQUENCE_RUNNING)
 			{
-				switchStatus[3].lastState = switchStatus[3].currentState;
-				if (switchStatus[3].lastState)
-					switchStatus[3].counter++;
-			}	
-		}	
-		
-		// Digital counter 5 handling
-		if (switchStatus[4].lastState == switchStatus[4].currentState)
-		{
-			switchStatus[4].debounceCounter = 0;
-		}
-		else
-		{
-			if (switchStatus[4].debounceCounter == 0)
+				if (seqLatch == SEQ_LATCH_READY && seqTick >= seqLatchTick)
+				{
+					PORTB = (PORTB & ~currentOutputMask) |
+							(((seqLatchBits | ruleSet) & ~ruleClear) & currentOutputMask);
+					seqLatch = SEQ_LATCH_FIRED;
+					if (seqLatchEnd)
+						seqTick = 0;
+					else
+						seqTick++;
+				}
+				else
+					seqTick++;
+			}
+			
+			// Take a burst sample if one is due.
+			if (burstInterval != 0 && --burstTicker == 0)
 			{
-				switchStatus[4].debounceCounter = switchStatus[4].debounceConfig;
+				unsigned char next = burstHead + 1;
+				
+				if (next == BURST_RING_SIZE)
+					next = 0;
+				burstTicker = burstInterval;
+				burstClock += burstInterval;
+				if (next != burstTail)
+				{
+					burstRing[burstHead].timestamp = burstClock;
+					burstRing[burstHead].inputBits = raw;
+					burstRing[burstHead].adcValue[0] = analogRaw_1;
+					burstRing[burstHead].adcValue[1] = analogRaw_2;
+					burstHead = next;
+				}
 			}
-			if (--switchStatus[4].debounceCounter == 0)
+			
+			// Check if we need to kick off an ADC.
+			if (analogGoDelay > 0)
 			{
-				switchStatus[4].lastState = switchStatus[4].currentState;
-				if (switchStatus[4].lastState)
-					switchStatus[4].counter++;
+				if (--analogGoDelay == 0)
+				{
+					analogInterrupted = 0;
+					ADCON0bits.GO = 1;
+				}
 			}	
-		}	
-		
-		// Check if we need to kick off an ADC.
-		if (analogGoDelay > 0)
-		{
-			if (--analogGoDelay == 0)
-			{
-				analogInterrupted = 0;
-				ADCON0bits.GO = 1;
-			}
-		}	
 
-		// Count ticks seen and clear the interrupt flag.
-		tickCounter++;
-		PIR2bits.TMR3IF = 0;
+			// Count the tick seen and stop when all are done or there
+			// is no room for another pass before the next interrupt.
+			tickCounter++;
+			if (--servoTicksPending == 0)
+				break;
+			servoTimerRead(now);
+			if (PIR2bits.TMR3IF || (unsigned int)~now < SERVO_TICK_GUARD)
+				break;
+		}
 	}	
 
 }	//This return will be a "retfie fast", since this is in a #pragma interrupt section 
@@ -500,26 +747,38 @@ void lowPriorityISRCode()
 			#if defined(__18F2550)
 				if(ADCON0bits.CHS0==1)
 				{
-					analogSum_2 += ((uint16_t)ADRESH << 8) + (uint16_t)ADRESL;
+					INTCONbits.GIEH = 0;
+					analogRaw_2 = ((uint16_t)ADRESH << 8) + (uint16_t)ADRESL;
+					INTCONbits.GIEH = 1;
+					analogSum_2 += analogRaw_2;
 					analogCount_2 ++;
 					ADCON0bits.CHS0=0;
 				}
 				else
 				{
-					analogSum_1 += ((uint16_t)ADRESH << 8) + (uint16_t)ADRESL;
+					INTCONbits.GIEH = 0;
+					analogRaw_1 = ((uint16_t)ADRESH << 8) + (uint16_t)ADRESL;
+					INTCONbits.GIEH = 1;
+					analogSum_1 += analogRaw_1;
 					analogCount_1 ++;
 					ADCON0bits.CHS0=1;
 				}
 			#elif defined(__18F25K50)
 				if(ADCON0bits.CHS==1)
 				{
-					analogSum_2 += ((uint16_t)ADRESH << 8) + (uint16_t)ADRESL;
+					INTCONbits.GIEH = 0;
+					analogRaw_2 = ((uint16_t)ADRESH << 8) + (uint16_t)ADRESL;
+					INTCONbits.GIEH = 1;
+					analogSum_2 += analogRaw_2;
 					analogCount_2 ++;
 					ADCON0bits.CHS=0;
 				}
 				else
 				{
-					analogSum_1 += ((uint16_t)ADRESH << 8) + (uint16_t)ADRESL;
+					INTCONbits.GIEH = 0;
+					analogRaw_1 = ((uint16_t)ADRESH << 8) + (uint16_t)ADRESL;
+					INTCONbits.GIEH = 1;
+					analogSum_1 += analogRaw_1;
 					analogCount_1 ++;
 					ADCON0bits.CHS=1;
 				}
@@ -527,9 +786,11 @@ void lowPriorityISRCode()
 			}
 		
 		// Clear the interrupt flag. We do not hit go right away. 
-		// Let the ticker code do that after 200us.
+		// Let the ticker code do that after 200us, or on the next
+		// tick while burst sampling, so both inputs are converted
+		// at least once per 200us.
 		PIR1bits.ADIF = 0;
-		analogGoDelay = 2;
+		analogGoDelay = (burstInterval != 0) ? 1 : 2;
 	}
 	else
 	{
@@ -726,16 +987,26 @@ static void userInit(void)
 	memset(&currentOutput, 0, sizeof(currentOutput));
 	currentOutput.msgType			= OPEN8055_HID_MESSAGE_OUTPUT;
 
+	memset(&currentConfig2, 0, sizeof(currentConfig2));
+	currentConfig2.msgType			= OPEN8055_HID_MESSAGE_SETCONFIG2;
+	currentConfig2.averageWindow	= OPEN8055_AVERAGE_WINDOW_DEFAULT;
+	currentConfig2.servoPeriod		= OPEN8055_SERVO_PERIOD_DEFAULT;
+
+	memset(pidStatus, 0, sizeof(pidStatus));
+	memset(pwmDuty, 0, sizeof(pwmDuty));
+	pidStatus[0].outMax				= 1023;
+	pidStatus[1].outMax				= 1023;
+
 	for (i = 0; i < 5; i++)
 	{
-		switchStatus[i].lastState		= 0;
 		switchStatus[i].counter			= 0;
 		switchStatus[i].frequency		= 0;
 		switchStatus[i].debounceConfig	= OPEN8055_COUNTER_DEBOUNCE_DEFAULT * OPEN8055_TICKS_PER_MS + 1;
-		switchStatus[i].debounceCounter	= 0;
 		
 		currentConfig1.debounceValue[i] = htons(switchStatus[i].debounceConfig);
 	}
+	debounceConfigure();
+	rulesRestore();
 	
     //initialize the variable holding the handle for the last
     // transmission
@@ -845,8 +1116,8 @@ static void processIO(void)
 			// used in non-default modes.
 			case OPEN8055_HID_MESSAGE_OUTPUT:
 				currentOutput.msgType = receivedDataBuffer.msgType;				
-				PORTB = (PORTB & ~currentOutputMask) | 
-						((currentOutput.outputBits = receivedDataBuffer.outputBits) & currentOutputMask);
+				currentOutput.outputBits = receivedDataBuffer.outputBits;
+				outputsUpdate();
 				for (i = 0; i < 8; i++)
 				{
 					uint16_t	newVal = ntohs(receivedDataBuffer.outputValue[i]);
@@ -857,16 +1128,14 @@ static void processIO(void)
 						newVal = 30000;
 					currentOutput.outputValue[i] = newVal;
 				}
-									
-				value = currentOutput.outputPwmValue[0] = ntohs(receivedDataBuffer.outputPwmValue[0]);
-				CCPR1L = value >> 2;
-				CCP1CON = (CCP1CON & 0xCF) | 
-					    ((value & 0x03) << 4);
-
-				value = currentOutput.outputPwmValue[1] = ntohs(receivedDataBuffer.outputPwmValue[1]);
-				CCPR2L = value >> 2;
-				CCP2CON = (CCP2CON & 0xCF) | 
-					    ((value & 0x03) << 4);
+				servoPrepare();
+				
+				// PWM outputs driven by their PID controller keep their value.
+				for (i = 0; i < 2; i++)
+				{
+					if (currentConfig1.modePWM[i] != OPEN8055_MODE_PID)
+						pwmSet(i, ntohs(receivedDataBuffer.outputPwmValue[i]));
+				}
 					    
 				for (i = 0; i < 5; i++)
 				{
@@ -877,12 +1146,26 @@ static void processIO(void)
 			
 			// SETCONFIG1 message containing configuration settings.
 			case OPEN8055_HID_MESSAGE_SETCONFIG1:
+				// A PID controller taking over a PWM output starts with
+				// its integral at the current duty cycle, so that the
+				// output doesn't jump.
+				for (i = 0; i < 2; i++)
+				{
+					if (receivedDataBuffer.modePWM[i] == OPEN8055_MODE_PID &&
+						currentConfig1.modePWM[i] != OPEN8055_MODE_PID)
+					{
+						pidStatus[i].integral = (int32_t)currentOutput.outputPwmValue[i] << OPEN8055_PID_INTEGRAL_SHIFT;
+						pidStatus[i].lastValue = (pidStatus[i].adc == 1) ? analogValue_1 : analogValue_2;
+					}
+				}
+				
 			    memcpy((void *)&currentConfig1, (void *)&receivedDataBuffer, sizeof(currentConfig1));
 			    
 			    for (i = 0; i < 5; i++)
 			    {
 				    switchStatus[i].debounceConfig = ntohs(currentConfig1.debounceValue[i]);
 				}
+				debounceConfigure();
 				
 				// Create a new output mask according to the output port modes.
 				currentOutputMask = 0x00;
@@ -898,9 +1181,166 @@ static void processIO(void)
 							break;
 					}
 				}	
+				servoPrepare();
 				
 				break;
 			
+			// SETCONFIG2 message containing extended configuration settings.
+			case OPEN8055_HID_MESSAGE_SETCONFIG2:
+			    memcpy((void *)&currentConfig2, (void *)&receivedDataBuffer, sizeof(currentConfig2));
+			    
+				if (currentConfig2.sampleInterval != 0 &&
+					currentConfig2.sampleInterval < OPEN8055_BURST_INTERVAL_MIN)
+					currentConfig2.sampleInterval = OPEN8055_BURST_INTERVAL_MIN;
+				if (currentConfig2.averageWindow == 0)
+					currentConfig2.averageWindow = OPEN8055_AVERAGE_WINDOW_DEFAULT;
+				if (currentConfig2.servoPeriod == 0)
+					currentConfig2.servoPeriod = OPEN8055_SERVO_PERIOD_DEFAULT;
+				if (currentConfig2.servoPeriod < OPEN8055_SERVO_PERIOD_MIN)
+					currentConfig2.servoPeriod = OPEN8055_SERVO_PERIOD_MIN;
+				servoFramePeriod = currentConfig2.servoPeriod;
+				
+				// Report cadence and ADC averaging. The current average
+				// is finished with the new window length.
+				reportPeriod = ntohs(currentConfig2.reportPeriod);
+				reportTicker = 0;
+				reportDue = FALSE;
+				adcHysteresis = ntohs(currentConfig2.adcHysteresis);
+				analogAvgWindow = currentConfig2.averageWindow;
+				
+				// Restart burst sampling with the new interval. The first
+				// sample is taken one interval from now.
+				INTCONbits.GIEH = 0;
+				burstInterval = currentConfig2.sampleInterval;
+				burstTicker = burstInterval;
+				burstClock = tickTimestamp + tickCounter;
+				burstHead = 0;
+				burstTail = 0;
+				
+				// Restart edge capture with the new inputs.
+				currentConfig2.edgeMask &= OPEN8055_EDGE_INPUT_MASK;
+				edgeMask = currentConfig2.edgeMask;
+				edgeHead = 0;
+				edgeTail = 0;
+				edgeLost = 0;
+				INTCONbits.GIEH = 1;
+				break;
+			
+			// GETCONFIG2 message instructing us to send the extended configuration.
+			case OPEN8055_HID_MESSAGE_GETCONFIG2:
+				currentConfig2Requested = TRUE;
+				break;
+			
+			// SETSEQUENCE message with rows of the output sequence. The
+			// rows of a sequence being played cannot be changed.
+			case OPEN8055_HID_MESSAGE_SETSEQUENCE:
+				if (seqState != OPEN8055_SEQUENCE_IDLE)
+					break;
+				for (i = 0; i < receivedDataBuffer.seqRows && i < OPEN8055_SEQUENCE_ROWS_PER_MSG; i++)
+				{
+					value = receivedDataBuffer.seqIndex + i;
+					if (value >= OPEN8055_SEQUENCE_ROWS)
+						break;
+					seqTable[value].tick		= ntohs(receivedDataBuffer.seqRow[i].tick);
+					seqTable[value].outputBits	= receivedDataBuffer.seqRow[i].outputBits;
+					seqTable[value].channel		= receivedDataBuffer.seqRow[i].channel;
+					seqTable[value].value		= ntohs(receivedDataBuffer.seqRow[i].value);
+				}
+				break;
+			
+			// SEQUENCE message to start or stop the sequence player. We
+			// answer every one of them with the player status.
+			case OPEN8055_HID_MESSAGE_SEQUENCE:
+				switch (receivedDataBuffer.seqCommand)
+				{
+					case OPEN8055_SEQUENCE_START:
+						// A bad START leaves the player as it is. A good
+						// one restarts it with the first rows latched.
+						i = receivedDataBuffer.seqTrigger & ~OPEN8055_SEQUENCE_TRIGGER_FALLING;
+						if (i > 5 || receivedDataBuffer.seqLength == 0 ||
+							receivedDataBuffer.seqLength > OPEN8055_SEQUENCE_ROWS)
+							break;
+						seqState = OPEN8055_SEQUENCE_IDLE;
+						seqLength = receivedDataBuffer.seqLength;
+						seqTrigger = (i == 0) ? OPEN8055_SEQUENCE_TRIGGER_NONE : receivedDataBuffer.seqTrigger;
+						seqTriggerMask = (i == 0) ? 0 : 0x01 << (i - 1);
+						seqLoops = ntohs(receivedDataBuffer.seqLoops);
+						seqRow = 0;
+						sequenceLatch();
+						seqInputs = debounceState;
+						seqState = OPEN8055_SEQUENCE_ARMED;
+						break;
+					
+					case OPEN8055_SEQUENCE_STOP:
+						seqState = OPEN8055_SEQUENCE_IDLE;
+						break;
+					
+					default:
+						break;
+				}
+				seqStatusRequested = TRUE;
+				break;
+			
+			// SETPID message with the parameters of a PWM output's PID
+			// controller. The controller runs while the output is in
+			// OPEN8055_MODE_PID and keeps its integral across changes.
+			case OPEN8055_HID_MESSAGE_SETPID:
+				i = receivedDataBuffer.pidPwm;
+				if (i > 1)
+					break;
+				pidStatus[i].adc = receivedDataBuffer.pidAdc;
+				if (pidStatus[i].adc > 2)
+					pidStatus[i].adc = 0;
+				pidStatus[i].setpoint = ntohs(receivedDataBuffer.pidSetpoint);
+				pidStatus[i].kp = ntohs((uint16_t)receivedDataBuffer.pidKp);
+				pidStatus[i].ki = ntohs((uint16_t)receivedDataBuffer.pidKi);
+				pidStatus[i].kd = ntohs((uint16_t)receivedDataBuffer.pidKd);
+				pidStatus[i].outMax = ntohs(receivedDataBuffer.pidOutMax);
+				if (pidStatus[i].outMax > 1023)
+					pidStatus[i].outMax = 1023;
+				pidStatus[i].outMin = ntohs(receivedDataBuffer.pidOutMin);
+				if (pidStatus[i].outMin > pidStatus[i].outMax)
+					pidStatus[i].outMin = pidStatus[i].outMax;
+				pidStatus[i].lastValue = (pidStatus[i].adc == 1) ? analogValue_1 : analogValue_2;
+				break;
+			
+			// SETRULES message with rules of a new rule table. The table
+			// replaces the active one with its last rule.
+			case OPEN8055_HID_MESSAGE_SETRULES:
+				for (i = 0; i < receivedDataBuffer.ruleRows && i < OPEN8055_RULES_PER_MSG; i++)
+				{
+					value = receivedDataBuffer.ruleIndex + i;
+					if (value >= OPEN8055_RULES)
+						break;
+					ruleLoading[value].source		= receivedDataBuffer.rule[i].source;
+					ruleLoading[value].action		= receivedDataBuffer.rule[i].action;
+					ruleLoading[value].threshold	= ntohs(receivedDataBuffer.rule[i].threshold);
+					ruleLoading[value].value		= ntohs(receivedDataBuffer.rule[i].value);
+				}
+				if ((uint16_t)receivedDataBuffer.ruleIndex + receivedDataBuffer.ruleRows >=
+					receivedDataBuffer.ruleTotal)
+				{
+					Open8055_rule_t	*swap = ruleActive;
+					
+					ruleActive = ruleLoading;
+					ruleLoading = swap;
+					ruleCount = receivedDataBuffer.ruleTotal;
+					if (ruleCount > OPEN8055_RULES)
+						ruleCount = OPEN8055_RULES;
+					
+					// A save in progress starts over with the new table.
+					if (eepromStep != 0)
+						eepromStep = 1;
+				}
+				break;
+			
+			// SAVECONFIG and SAVEALL messages. The rule table is all
+			// this firmware keeps in the EEPROM.
+			case OPEN8055_HID_MESSAGE_SAVECONFIG:
+			case OPEN8055_HID_MESSAGE_SAVEALL:
+				eepromStep = 1;
+				break;
+			
 			// GETINPUT message instructing us to forcefully send the current input.
 			case OPEN8055_HID_MESSAGE_GETINPUT:
 				currentInputRequested = TRUE;
@@ -931,9 +1371,14 @@ static void processIO(void)
 	ticksSeen = tickCounter;
 	tickCounter -= ticksSeen;
 
+	// Finish the sequence rows the tick interrupt has played.
+	if (seqState != OPEN8055_SEQUENCE_IDLE)
+		sequenceService();
+
 	while (ticksSeen-- > 0)
 	{
 		// Per 100 microsecond code comes here
+		tickTimestamp++;
 		
 		if (++tickMillisecond >= OPEN8055_TICKS_PER_MS)
 		{
@@ -941,68 +1386,67 @@ static void processIO(void)
 			
 			// Per 1 millisecond code comes here
 
-			if (++analogAvgCount >= 5)
+			if (reportPeriod != 0 && ++reportTicker >= reportPeriod)
 			{
+				reportTicker = 0;
+				reportDue = TRUE;
+			}
+
+			if (++analogAvgCount >= analogAvgWindow)
+			{
+				uint32_t	sum_1;
+				uint32_t	sum_2;
+				uint16_t	count_1;
+				uint16_t	count_2;
+				uint8_t		ms = analogAvgCount;
+				
 				analogAvgCount = 0;
 				
-				if (analogCount_1 == 0)
-					analogValue_1 = 0;
-				else
-					analogValue_1 = analogSum_1 / analogCount_1;
+				// The sums are 32 bit and updated by the ADC interrupt.
+				INTCONbits.GIEL = 0;
+				sum_1 = analogSum_1;
+				count_1 = analogCount_1;
+				sum_2 = analogSum_2;
+				count_2 = analogCount_2;
 				analogSum_1 = 0;
 				analogCount_1 = 0;
-				
-				if (analogCount_2 == 0)
-					analogValue_2 = 0;
-				else
-					analogValue_2 = analogSum_2 / analogCount_2;
 				analogSum_2 = 0;
 				analogCount_2 = 0;
-			}
+				INTCONbits.GIEL = 1;
 				
-			// Handle Servo ports. We use a 24 microsecond cycle. Every 3 microseconds we check
-			// if one of the ports is configured as servo. If so we let the timer code know to
-			// output a pulse of the desired width.
-			if ((servoTicker % 3) == 0 && servoCycles == 0)
-			{
-				unsigned char	servo = servoTicker / 3;
+				// Without a conversion in the window (the ADC interrupt
+				// drops those disturbed by another interrupt) the last
+				// value stays.
+				if (count_1 != 0)
+					analogValue_1 = sum_1 / count_1;
+				if (count_2 != 0)
+					analogValue_2 = sum_2 / count_2;
 				
-				// See if this port is configured as servo.
-				if (currentConfig1.modeOutput[servo] == OPEN8055_MODE_SERVO ||
-					currentConfig1.modeOutput[servo] == OPEN8055_MODE_ISERVO)
+				// The PID controllers run on each new value.
+				for (i = 0; i < 2; i++)
 				{
-					uint16_t	pulse;
-					uint16_t	cycles;
-					
-					pulse = currentOutput.outputValue[servo];
-					cycles = pulse / OPEN8055_TICK_TIMER_CYCLES;
-					servoLast = pulse - cycles * OPEN8055_TICK_TIMER_CYCLES;
-					
-					if (servoLast < 600)
-					{
-						servoNext = OPEN8055_TICK_TIMER_CYCLES - servoLast;
-						servoLast = OPEN8055_TICK_TIMER_CYCLES + servoLast;
-					}
-					else
-					{
-						servoNext = OPEN8055_TICK_TIMER_CYCLES + servoLast;
-						servoLast = servoLast;
-						cycles++;
-					}
-					
-					servoBit = 0x01 << servo;
-					if (currentConfig1.modeOutput[servo] == OPEN8055_MODE_SERVO)
-						servoPulseHigh = 0;
-					else
-						servoPulseHigh = 1;
-					servoCycles = cycles;
+					if (currentConfig1.modePWM[i] == OPEN8055_MODE_PID && pidStatus[i].adc != 0)
+						pidRun(i, ms);
 				}
 			}
-			servoTicker++;
-			if (servoTicker >= 24)
-				servoTicker = 0;
-	
-
+			
+			// Measure the inputs in period mode before the rules look
+			// at them.
+			if (++periodTicker >= OPEN8055_PERIOD_GATE_MS)
+			{
+				periodTicker = 0;
+				for (i = 0; i < 5; i++)
+					periodMeasure(i);
+			}
+			
+			// The rules run also while the host is not connected.
+			ruleEvaluate();
+			
+			// Save the next byte of the rule table when the last
+			// EEPROM write is done.
+			if (eepromStep != 0 && !EECON1bits.WR)
+				rulesSaveStep();
+				
 			if (++tickSecond >= 1000)
 			{
 				tickSecond = 0;
@@ -1052,10 +1496,48 @@ static void processIO(void)
 			break;
 		}
 		
-		// Suppress the regular input report if not requested.
-		if (!currentInputRequested && memcmp((void *)&currentInput, (void *)&toSendDataBuffer, sizeof(currentInput)) == 0)
+		// If extended config information readback was requested, send that.
+		if (currentConfig2Requested)
+		{
+			currentConfig2Requested = FALSE;
+			memcpy((void *)&toSendDataBuffer, (void *)&currentConfig2, sizeof(toSendDataBuffer));
+			inputHandle = HIDTxPacket(HID_EP, (BYTE*)&toSendDataBuffer, sizeof(toSendDataBuffer));
 			break;
-			
+		}
+		
+		// If the sequence player status changed or was asked for, send it.
+		if (seqStatusRequested)
+		{
+			seqStatusRequested = FALSE;
+			memset((void *)&toSendDataBuffer, 0, sizeof(toSendDataBuffer));
+			toSendDataBuffer.msgType = OPEN8055_HID_MESSAGE_SEQUENCE;
+			toSendDataBuffer.seqCommand = seqState;
+			toSendDataBuffer.seqLength = seqLength;
+			toSendDataBuffer.seqTrigger = seqTrigger;
+			toSendDataBuffer.seqLoops = htons(seqLoops);
+			inputHandle = HIDTxPacket(HID_EP, (BYTE*)&toSendDataBuffer, sizeof(toSendDataBuffer));
+			break;
+		}
+		
+		// A full edge or burst report goes ahead of an input report
+		// that wasn't requested.
+		i = edgeHead;
+		if (i < edgeTail)
+			i += EDGE_RING_SIZE;
+		if (!currentInputRequested && i - edgeTail >= OPEN8055_EDGES_PER_MSG)
+		{
+			sendEdges();
+			break;
+		}
+		i = burstHead;
+		if (i < burstTail)
+			i += BURST_RING_SIZE;
+		if (!currentInputRequested && i - burstTail >= OPEN8055_BURST_SAMPLES)
+		{
+			sendInputBurst();
+			break;
+		}
+		
 		// Construct a standard input state report.
 		memset(&currentInput, 0, sizeof(currentInput));
 		currentInput.msgType			= OPEN8055_HID_MESSAGE_INPUT;
@@ -1063,12 +1545,13 @@ static void processIO(void)
 		switch (currentConfig1.modeInput[0])
 		{
 			case OPEN8055_MODE_INPUT:
-				if (switchStatus[0].currentState)
+				if (inputRaw & 0x01)
 					currentInput.inputBits |= 0x01;
 				currentInput.inputCounter[0] = htons(switchStatus[0].counter);
 				break;
 				
 			case OPEN8055_MODE_FREQUENCY:
+			case OPEN8055_MODE_PERIOD:
 				currentInput.inputCounter[0] = htons(switchStatus[0].frequency);
 				break;
 		}	
@@ -1076,12 +1559,13 @@ static void processIO(void)
 		switch (currentConfig1.modeInput[1])
 		{
 			case OPEN8055_MODE_INPUT:
-				if (switchStatus[1].currentState)
+				if (inputRaw & 0x02)
 					currentInput.inputBits |= 0x02;
 				currentInput.inputCounter[1] = htons(switchStatus[1].counter);
 				break;
 				
 			case OPEN8055_MODE_FREQUENCY:
+			case OPEN8055_MODE_PERIOD:
 				currentInput.inputCounter[1] = htons(switchStatus[1].frequency);
 				break;
 		}	
@@ -1089,12 +1573,13 @@ static void processIO(void)
 		switch (currentConfig1.modeInput[2])
 		{
 			case OPEN8055_MODE_INPUT:
-				if (switchStatus[2].currentState)
+				if (inputRaw & 0x04)
 					currentInput.inputBits |= 0x04;
 				currentInput.inputCounter[2] = htons(switchStatus[2].counter);
 				break;
 				
 			case OPEN8055_MODE_FREQUENCY:
+			case OPEN8055_MODE_PERIOD:
 				currentInput.inputCounter[2] = htons(switchStatus[2].frequency);
 				break;
 		}	
@@ -1102,12 +1587,13 @@ static void processIO(void)
 		switch (currentConfig1.modeInput[3])
 		{
 			case OPEN8055_MODE_INPUT:
-				if (switchStatus[3].currentState)
+				if (inputRaw & 0x08)
 					currentInput.inputBits |= 0x08;
 				currentInput.inputCounter[3] = htons(switchStatus[3].counter);
 				break;
 				
 			case OPEN8055_MODE_FREQUENCY:
+			case OPEN8055_MODE_PERIOD:
 				currentInput.inputCounter[3] = htons(switchStatus[3].frequency);
 				break;
 		}	
@@ -1115,12 +1601,13 @@ static void processIO(void)
 		switch (currentConfig1.modeInput[4])
 		{
 			case OPEN8055_MODE_INPUT:
-				if (switchStatus[4].currentState)
+				if (inputRaw & 0x10)
 					currentInput.inputBits |= 0x10;
 				currentInput.inputCounter[4] = htons(switchStatus[4].counter);
 				break;
 				
 			case OPEN8055_MODE_FREQUENCY:
+			case OPEN8055_MODE_PERIOD:
 				currentInput.inputCounter[4] = htons(switchStatus[4].frequency);
 				break;
 		}	
@@ -1154,6 +1641,33 @@ static void processIO(void)
 				break;
 		}
 		INTCONbits.GIEL	= 1;
+
+		// Suppress the regular input report if not requested and, with a
+		// report period, not due yet or, without, the input state is the
+		// same as in the last report sent. Use the slot for any edges
+		// or burst samples instead.
+		if (!currentInputRequested &&
+			((reportPeriod != 0) ? !reportDue : !inputChanged()))
+		{
+			if (edgeTail != edgeHead || edgeLost != 0)
+				sendEdges();
+			else if (burstTail != burstHead)
+				sendInputBurst();
+			break;
+		}
+		memcpy((void *)lastInputState, (void *)&currentInput, OPEN8055_INPUT_STATE_SIZE);
+		reportDue = FALSE;
+
+		// Number the report and stamp it with the tick count, so that the
+		// host can detect lost reports and measure the report timing.
+		currentInputSequence++;
+		currentInput.inputSequence = htons(currentInputSequence);
+		currentInput.raw[18] = (tickTimestamp >> 24) & 0xFF;
+		currentInput.raw[19] = (tickTimestamp >> 16) & 0xFF;
+		currentInput.raw[20] = (tickTimestamp >> 8) & 0xFF;
+		currentInput.raw[21] = tickTimestamp & 0xFF;
+		currentInput.inputPwmValue[0] = htons(pwmDuty[0]);
+		currentInput.inputPwmValue[1] = htons(pwmDuty[1]);
 										  
 		// Send this report
 		currentInputRequested = FALSE;
@@ -1165,6 +1679,865 @@ static void processIO(void)
 }//end processIO
 
 
+/********************************************************************
+ * Function:        static void debounceConfigure(void)
+ *
+ * PreCondition:    None
+ *
+ * Input:           None
+ *
+ * Output:          None
+ *
+ * Side Effects:    Restarts the debouncing of all inputs.
+ *
+ * Overview:        Convert the debounce times of the inputs into the
+ *					load values of the vertical counters. A time of up
+ *					to 255 ticks is counted in ticks, exactly as
+ *					configured. Longer times are counted in steps of
+ *					as few milliseconds as make them fit, rounded up.
+ *
+ * Note:            As before, a time of 0 means 65536 ticks.
+ *					A prescaled input is never early, but up to 1 ms
+ *					plus the rounding late, see debounce.h.
+ *******************************************************************/
+static void debounceConfigure(void)
+{
+	uint8_t		i;
+	uint8_t		k;
+	uint8_t		mask;
+	uint8_t		tickMask = 0;
+	uint8_t		countLoad[DEBOUNCE_COUNT_BITS];
+	uint8_t		scaleLoad[DEBOUNCE_PRESCALE_BITS];
+	uint32_t	ticks;
+	uint16_t	steps;
+	uint16_t	prescale;
+
+	memset((void *)countLoad, 0, sizeof(countLoad));
+	memset((void *)scaleLoad, 0, sizeof(scaleLoad));
+	for (i = 0, mask = 0x01; i < 5; i++, mask <<= 1)
+	{
+		ticks = switchStatus[i].debounceConfig;
+		if (ticks == 0)
+			ticks = 65536;
+		DEBOUNCE_SPLIT(ticks, steps, prescale);
+		if (prescale == 0)
+			tickMask |= mask;
+		for (k = 0; k < DEBOUNCE_COUNT_BITS; k++)
+			if (steps & (1 << k))
+				countLoad[k] |= mask;
+		for (k = 0; k < DEBOUNCE_PRESCALE_BITS; k++)
+			if (prescale & (1 << k))
+				scaleLoad[k] |= mask;
+	}
+
+	INTCONbits.GIEH = 0;
+	memcpy((void *)debounceLoad, (void *)countLoad, sizeof(countLoad));
+	memcpy((void *)debounceCount, (void *)countLoad, sizeof(countLoad));
+	memcpy((void *)prescaleLoad, (void *)scaleLoad, sizeof(scaleLoad));
+	memcpy((void *)prescaleCount, (void *)scaleLoad, sizeof(scaleLoad));
+	debounceTickMask = tickMask;
+	debounceBusy = 0;
+	INTCONbits.GIEH = 1;
+}//end debounceConfigure
+
+
+/********************************************************************
+ * Function:        static uint8_t inputChanged(void)
+ *
+ * PreCondition:    currentInput holds the new input state
+ *
+ * Input:           None
+ *
+ * Output:          TRUE if the input state differs from the last
+ *					report sent.
+ *
+ * Side Effects:    None
+ *
+ * Overview:        Compare the digital inputs and counters exactly
+ *					and the ADC values with the configured hysteresis.
+ *
+ * Note:            None
+ *******************************************************************/
+static uint8_t inputChanged(void)
+{
+	uint8_t		i;
+	uint16_t	now;
+	uint16_t	last;
+	uint16_t	diff;
+
+	// Message type, input bits and counters.
+	if (memcmp((void *)&currentInput, (void *)lastInputState, 12) != 0)
+		return TRUE;
+
+	// ADC values in network byte order.
+	for (i = 12; i < OPEN8055_INPUT_STATE_SIZE; i += 2)
+	{
+		now = ((uint16_t)currentInput.raw[i] << 8) + currentInput.raw[i + 1];
+		last = ((uint16_t)lastInputState[i] << 8) + lastInputState[i + 1];
+		diff = (now > last) ? now - last : last - now;
+		if (diff > adcHysteresis)
+			return TRUE;
+	}
+	return FALSE;
+}//end inputChanged
+
+
+/********************************************************************
+ * Function:        static void servoPrepare(void)
+ *
+ * PreCondition:    None
+ *
+ * Input:           None
+ *
+ * Output:          None
+ *
+ * Side Effects:    The timer interrupt uses the new list from the
+ *					start of the next servo frame.
+ *
+ * Overview:        Build the sorted list of servo pulse ends from the
+ *					output modes and values. Outputs whose pulses end
+ *					at the same time share one entry.
+ *
+ * Note:            None
+ *******************************************************************/
+static void servoPrepare(void)
+{
+	servoList_t	   *list;
+	uint8_t			i;
+	uint8_t			j;
+	uint8_t			bit;
+	uint16_t		pulse;
+
+	// The interrupt only switches to a list marked ready, so the
+	// inactive buffer is ours until we set the flag again.
+	servoListReady = FALSE;
+	list = &servoList[servoActive ^ 1];
+	list->count = 0;
+	list->mask = 0;
+	list->level = 0;
+
+	for (i = 0, bit = 0x01; i < 8; i++, bit <<= 1)
+	{
+		if (currentConfig1.modeOutput[i] == OPEN8055_MODE_ISERVO)
+			list->level |= bit;
+		else if (currentConfig1.modeOutput[i] != OPEN8055_MODE_SERVO)
+			continue;
+		list->mask |= bit;
+		pulse = currentOutput.outputValue[i];
+
+		for (j = 0; j < list->count && list->time[j] < pulse; j++)
+			;
+		if (j < list->count && list->time[j] == pulse)
+		{
+			list->end[j] |= bit;
+			continue;
+		}
+		memmove((void *)&list->time[j + 1], (void *)&list->time[j],
+				(list->count - j) * sizeof(list->time[0]));
+		memmove((void *)&list->end[j + 1], (void *)&list->end[j],
+				list->count - j);
+		list->time[j] = pulse;
+		list->end[j] = bit;
+		list->count++;
+	}
+
+	servoListReady = TRUE;
+}//end servoPrepare
+
+
+/********************************************************************
+ * Function:        static void outputsUpdate(void)
+ *
+ * PreCondition:    None
+ *
+ * Input:           None
+ *
+ * Output:          None
+ *
+ * Side Effects:    None
+ *
+ * Overview:        Set the digital outputs to the host's values, as
+ *					overridden by the rules.
+ *
+ * Note:            None
+ *******************************************************************/
+static void outputsUpdate(void)
+{
+	INTCONbits.GIEH = 0;
+	PORTB = (PORTB & ~currentOutputMask) | 
+			(((currentOutput.outputBits | ruleSet) & ~ruleClear) & currentOutputMask);
+	INTCONbits.GIEH = 1;
+}//end outputsUpdate
+
+
+/********************************************************************
+ * Function:        static void pwmSet(uint8_t pwm, uint16_t value)
+ *
+ * PreCondition:    None
+ *
+ * Input:           The PWM output (0 or 1) and its 10 bit duty cycle
+ *
+ * Output:          None
+ *
+ * Side Effects:    None
+ *
+ * Overview:        Set the duty cycle of a PWM output. While a rule
+ *					forces the output, the rule's duty cycle is used
+ *					and the value is kept for later.
+ *
+ * Note:            None
+ *******************************************************************/
+static void pwmSet(uint8_t pwm, uint16_t value)
+{
+	currentOutput.outputPwmValue[pwm] = value;
+	if (rulePwmForced & (1 << pwm))
+		value = rulePwmValue[pwm];
+	pwmDuty[pwm] = value;
+	if (pwm == 0)
+	{
+		CCPR1L = value >> 2;
+		CCP1CON = (CCP1CON & 0xCF) | 
+			    ((value & 0x03) << 4);
+	}
+	else
+	{
+		CCPR2L = value >> 2;
+		CCP2CON = (CCP2CON & 0xCF) | 
+			    ((value & 0x03) << 4);
+	}
+}//end pwmSet
+
+
+/********************************************************************
+ * Function:        static void pidRun(uint8_t pwm, uint8_t ms)
+ *
+ * PreCondition:    The PWM output is in OPEN8055_MODE_PID
+ *
+ * Input:           The PWM output (0 or 1) and the milliseconds since
+ *					the last run
+ *
+ * Output:          None
+ *
+ * Side Effects:    Sets the duty cycle of the PWM output.
+ *
+ * Overview:        One step of the PID controller. The proportional
+ *					and integral terms act on the error, the derivative
+ *					term on the change of the ADC value. The integral
+ *					and derivative gains are per millisecond and scaled
+ *					to the time since the last run. All terms are 32
+ *					bit, which holds the products of a 10 bit error
+ *					and a 16 bit gain.
+ *
+ * Note:            Called on every new averaged ADC value.
+ *******************************************************************/
+static void pidRun(uint8_t pwm, uint8_t ms)
+{
+	int32_t		error;
+	int32_t		output;
+	int32_t		limit;
+	int32_t		step;
+	uint16_t	value;
+
+	value = (pidStatus[pwm].adc == 1) ? analogValue_1 : analogValue_2;
+	error = (int32_t)pidStatus[pwm].setpoint - (int32_t)value;
+
+	// The integral grows by ki times the error for every millisecond
+	// and stays within the output range. Over 16 ms a step beyond
+	// 0x3FFFFF crosses the whole range, limiting it keeps the product
+	// in 32 bit.
+	step = error * pidStatus[pwm].ki;
+	if (ms >= 16)
+	{
+		if (step > 0x3FFFFFL)
+			step = 0x3FFFFFL;
+		else if (step < -0x3FFFFFL)
+			step = -0x3FFFFFL;
+	}
+	pidStatus[pwm].integral += step * ms;
+	limit = (int32_t)pidStatus[pwm].outMin << OPEN8055_PID_INTEGRAL_SHIFT;
+	if (pidStatus[pwm].integral < limit)
+		pidStatus[pwm].integral = limit;
+	limit = (int32_t)pidStatus[pwm].outMax << OPEN8055_PID_INTEGRAL_SHIFT;
+	if (pidStatus[pwm].integral > limit)
+		pidStatus[pwm].integral = limit;
+
+	// The derivative is the change of the ADC value per millisecond.
+	step = ((int32_t)value - (int32_t)pidStatus[pwm].lastValue) * pidStatus[pwm].kd;
+	if (ms > 1)
+		step /= ms;
+
+	output = error * pidStatus[pwm].kp - step +
+			 (pidStatus[pwm].integral >> (OPEN8055_PID_INTEGRAL_SHIFT - OPEN8055_PID_GAIN_SHIFT));
+	pidStatus[pwm].lastValue = value;
+
+	// Limit the output. Inside the range it is positive and shifting
+	// it is safe.
+	if (output < ((int32_t)pidStatus[pwm].outMin << OPEN8055_PID_GAIN_SHIFT))
+		value = pidStatus[pwm].outMin;
+	else if (output > ((int32_t)pidStatus[pwm].outMax << OPEN8055_PID_GAIN_SHIFT))
+		value = pidStatus[pwm].outMax;
+	else
+		value = output >> OPEN8055_PID_GAIN_SHIFT;
+	pwmSet(pwm, value);
+}//end pidRun
+
+
+/********************************************************************
+ * Function:        static void periodMeasure(uint8_t port)
+ *
+ * PreCondition:    None
+ *
+ * Input:           port - digital input 0..4
+ *
+ * Output:          None
+ *
+ * Side Effects:    Resets the counter of an input in period mode.
+ *
+ * Overview:        Update the frequency of an input in period mode
+ *					from the rising edges counted since the last call
+ *					and the tick of the last one. Without new edges
+ *					the frequency drops once the time since the last
+ *					edge is more than twice the measured period, and
+ *					to zero after PERIOD_TIMEOUT.
+ *
+ * Note:            Called every OPEN8055_PERIOD_GATE_MS.
+ *******************************************************************/
+static void periodMeasure(uint8_t port)
+{
+	uint8_t		mask = 1 << port;
+	uint16_t	edges;
+	uint32_t	last;
+	uint32_t	now;
+	uint32_t	span;
+	uint32_t	value;
+
+	if (currentConfig1.modeInput[port] != OPEN8055_MODE_PERIOD)
+	{
+		periodValid &= ~mask;
+		return;
+	}
+
+	// Take the edges counted by the tick interrupt.
+	INTCONbits.GIEH = 0;
+	edges = switchStatus[port].counter;
+	switchStatus[port].counter = 0;
+	last = switchStatus[port].lastEdge;
+	now = edgeClock;
+	INTCONbits.GIEH = 1;
+
+	if (edges != 0)
+	{
+		// The first edge after a mode change only starts the
+		// measurement.
+		if (periodValid & mask)
+		{
+			span = last - switchStatus[port].periodStart;
+			switchStatus[port].period = span / edges;
+			value = (uint32_t)edges * PERIOD_SCALE / span;
+			if (value > 0xFFFF)
+				value = 0xFFFF;
+			switchStatus[port].frequency = value;
+		}
+		switchStatus[port].periodStart = last;
+		periodValid |= mask;
+	}
+	else if (periodValid & mask)
+	{
+		// A late edge means the signal slowed down or stopped.
+		span = now - switchStatus[port].periodStart;
+		if (span >= PERIOD_TIMEOUT)
+		{
+			switchStatus[port].frequency = 0;
+			periodValid &= ~mask;
+		}
+		else if (span > 2 * switchStatus[port].period)
+			switchStatus[port].frequency = PERIOD_SCALE / span;
+	}
+}//end periodMeasure
+
+
+/********************************************************************
+ * Function:        static void ruleEvaluate(void)
+ *
+ * PreCondition:    None
+ *
+ * Input:           None
+ *
+ * Output:          None
+ *
+ * Side Effects:    Changes the outputs the rules force.
+ *
+ * Overview:        Check the condition of every rule and collect the
+ *					actions of those that hold. The outputs are only
+ *					touched when that changes what is forced.
+ *
+ * Note:            Called once per millisecond.
+ *******************************************************************/
+static void ruleEvaluate(void)
+{
+	Open8055_rule_t	*rule;
+	uint8_t		i;
+	uint8_t		port;
+	uint8_t		set = 0;
+	uint8_t		clear = 0;
+	uint8_t		pwmForced = 0;
+	uint16_t	pwmValue[2];
+	uint16_t	value;
+
+	pwmValue[0] = 0;
+	pwmValue[1] = 0;
+	for (i = 0; i < ruleCount; i++)
+	{
+		rule = &ruleActive[i];
+		port = rule->source & OPEN8055_RULE_PORT_MASK;
+		switch (rule->source & OPEN8055_RULE_SOURCE_MASK)
+		{
+			case OPEN8055_RULE_INPUT:
+				if (port > 4)
+					continue;
+				value = (debounceState >> port) & 0x01;
+				break;
+			
+			case OPEN8055_RULE_COUNTER:
+				if (port > 4)
+					continue;
+				if (currentConfig1.modeInput[port] == OPEN8055_MODE_FREQUENCY ||
+					currentConfig1.modeInput[port] == OPEN8055_MODE_PERIOD)
+					value = switchStatus[port].frequency;
+				else
+					value = switchStatus[port].counter;
+				break;
+			
+			case OPEN8055_RULE_ADC:
+				if (port > 1)
+					continue;
+				value = (port == 0) ? analogValue_1 : analogValue_2;
+				break;
+			
+			default:
+				continue;
+		}
+		if ((value >= rule->threshold) == ((rule->source & OPEN8055_RULE_BELOW) != 0))
+			continue;
+		
+		switch (rule->action)
+		{
+			case OPEN8055_RULE_SET_OUTPUTS:
+				set |= rule->value;
+				break;
+			
+			case OPEN8055_RULE_CLEAR_OUTPUTS:
+				clear |= rule->value;
+				break;
+			
+			case OPEN8055_RULE_SET_PWM1:
+			case OPEN8055_RULE_SET_PWM2:
+				port = rule->action - OPEN8055_RULE_SET_PWM1;
+				if (pwmForced & (1 << port))
+					break;
+				pwmForced |= (1 << port);
+				pwmValue[port] = (rule->value > 1023) ? 1023 : rule->value;
+				break;
+			
+			default:
+				break;
+		}
+	}
+	
+	set &= ~clear;
+	if (set != ruleSet || clear != ruleClear)
+	{
+		ruleSet = set;
+		ruleClear = clear;
+		outputsUpdate();
+	}
+	if (pwmForced != rulePwmForced || pwmValue[0] != rulePwmValue[0] ||
+		pwmValue[1] != rulePwmValue[1])
+	{
+		rulePwmForced = pwmForced;
+		rulePwmValue[0] = pwmValue[0];
+		rulePwmValue[1] = pwmValue[1];
+		pwmSet(0, currentOutput.outputPwmValue[0]);
+		pwmSet(1, currentOutput.outputPwmValue[1]);
+	}
+}//end ruleEvaluate
+
+
+/********************************************************************
+ * Function:        static void rulesRestore(void)
+ *
+ * PreCondition:    None
+ *
+ * Input:           None
+ *
+ * Output:          None
+ *
+ * Side Effects:    Loads the active rule table.
+ *
+ * Overview:        Load the rule table saved in the EEPROM, if there
+ *					is a complete one with a good checksum.
+ *
+ * Note:            Called from userInit(), so that the rules hold
+ *					from the first millisecond.
+ *******************************************************************/
+static void rulesRestore(void)
+{
+	uint8_t		i;
+	uint8_t		count;
+	uint8_t		sum;
+
+	if (eepromRead(0) != EEPROM_RULES_MAGIC)
+		return;
+	count = eepromRead(1);
+	if (count > OPEN8055_RULES)
+		return;
+	sum = count;
+	for (i = 2; i < EEPROM_RULES_SIZE - 1; i++)
+		sum += eepromRead(i);
+	if (sum != eepromRead(EEPROM_RULES_SIZE - 1))
+		return;
+
+	for (i = 2; i < EEPROM_RULES_SIZE - 1; i++)
+		((uint8_t *)ruleActive)[i - 2] = eepromRead(i);
+	ruleCount = count;
+}//end rulesRestore
+
+
+/********************************************************************
+ * Function:        static void rulesSaveStep(void)
+ *
+ * PreCondition:    A save is in progress and the EEPROM is not busy.
+ *
+ * Input:           None
+ *
+ * Output:          None
+ *
+ * Side Effects:    Writes one byte of the EEPROM.
+ *
+ * Overview:        One step of saving the active rule table. Step 1
+ *					clears the magic, the following ones write the
+ *					count, the rules and the checksum, the last one the
+ *					magic. Bytes that are already right are not
+ *					written again.
+ *
+ * Note:            Called once per millisecond while saving. A byte
+ *					takes up to 4 ms, so the whole table is saved in
+ *					about 100 to 400 ms.
+ *******************************************************************/
+static void rulesSaveStep(void)
+{
+	uint8_t		addr;
+	uint8_t		data;
+
+	if (eepromStep == 1)
+	{
+		addr = 0;
+		data = 0xFF;
+		eepromSum = 0;
+	}
+	else if (eepromStep <= EEPROM_RULES_SIZE)
+	{
+		addr = eepromStep - 1;
+		if (addr == 1)
+			data = ruleCount;
+		else if (addr < EEPROM_RULES_SIZE - 1)
+			data = ((uint8_t *)ruleActive)[addr - 2];
+		else
+			data = eepromSum;
+		eepromSum += data;
+	}
+	else
+	{
+		addr = 0;
+		data = EEPROM_RULES_MAGIC;
+	}
+
+	if (eepromRead(addr) != data)
+		eepromWrite(addr, data);
+	if (++eepromStep > EEPROM_RULES_SIZE + 1)
+		eepromStep = 0;
+}//end rulesSaveStep
+
+
+/********************************************************************
+ * Function:        static uint8_t eepromRead(uint8_t addr)
+ *
+ * PreCondition:    No EEPROM write is in progress.
+ *
+ * Input:           The EEPROM address
+ *
+ * Output:          The byte at that address
+ *
+ * Side Effects:    None
+ *
+ * Overview:        Read one byte of the data EEPROM.
+ *
+ * Note:            None
+ *******************************************************************/
+static uint8_t eepromRead(uint8_t addr)
+{
+	EEADR = addr;
+	EECON1bits.EEPGD = 0;
+	EECON1bits.CFGS = 0;
+	EECON1bits.RD = 1;
+	return EEDATA;
+}//end eepromRead
+
+
+/********************************************************************
+ * Function:        static void eepromWrite(uint8_t addr, uint8_t data)
+ *
+ * PreCondition:    No EEPROM write is in progress.
+ *
+ * Input:           The EEPROM address and the byte to write
+ *
+ * Output:          None
+ *
+ * Side Effects:    Starts an EEPROM write, EECON1bits.WR is set until
+ *					it is done.
+ *
+ * Overview:        Start writing one byte of the data EEPROM. The
+ *					unlock sequence must not be interrupted.
+ *
+ * Note:            None
+ *******************************************************************/
+static void eepromWrite(uint8_t addr, uint8_t data)
+{
+	EEADR = addr;
+	EEDATA = data;
+	EECON1bits.EEPGD = 0;
+	EECON1bits.CFGS = 0;
+	EECON1bits.WREN = 1;
+	INTCONbits.GIEH = 0;
+	EECON2 = 0x55;
+	EECON2 = 0xAA;
+	EECON1bits.WR = 1;
+	INTCONbits.GIEH = 1;
+	EECON1bits.WREN = 0;
+}//end eepromWrite
+
+
+/********************************************************************
+ * Function:        static void sequenceLatch(void)
+ *
+ * PreCondition:    seqRow is a row of the sequence and nothing is
+ *					latched.
+ *
+ * Input:           None
+ *
+ * Output:          None
+ *
+ * Side Effects:    None
+ *
+ * Overview:        Latch the rows from seqRow on that are due on the
+ *					same tick for the tick interrupt. Each row sets all
+ *					digital outputs, so the last one of them wins.
+ *
+ * Note:            None
+ *******************************************************************/
+static void sequenceLatch(void)
+{
+	uint8_t		end = seqRow + 1;
+	uint16_t	tick = seqTable[seqRow].tick;
+
+	while (end < seqLength && seqTable[end].tick <= tick)
+		end++;
+	seqRowEnd = end;
+	seqLatchTick = tick;
+	seqLatchBits = seqTable[end - 1].outputBits;
+	seqLatchEnd = (end >= seqLength);
+	seqLatch = SEQ_LATCH_READY;
+}//end sequenceLatch
+
+
+/********************************************************************
+ * Function:        static void sequenceService(void)
+ *
+ * PreCondition:    The sequence player is not idle
+ *
+ * Input:           None
+ *
+ * Output:          None
+ *
+ * Side Effects:    Changes the outputs as the sequence says.
+ *
+ * Overview:        Called from processIO(). When the tick interrupt
+ *					has played the latched rows, take over their
+ *					digital outputs, set their output values and
+ *					latch the next rows. After the last row count the
+ *					loop and stop when the loop count runs out.
+ *
+ * Note:            The digital outputs change on their tick, up to
+ *					the time the tick work waits for a servo pulse end
+ *					late. The output values and PWM follow when
+ *					processIO() gets here. Rows that are due sooner
+ *					after the previous ones than processIO() comes
+ *					around are late by that much too.
+ *******************************************************************/
+static void sequenceService(void)
+{
+	Open8055_seqRow_t  *row;
+	uint8_t				servo = FALSE;
+	uint16_t			value;
+
+	if (seqLatch != SEQ_LATCH_FIRED)
+		return;
+
+	currentOutput.outputBits = seqLatchBits;
+	while (seqRow < seqRowEnd)
+	{
+		row = &seqTable[seqRow++];
+
+		if (row->channel >= 1 && row->channel <= 8)
+		{
+			value = row->value;
+			if (value < 6000)
+				value = 6000;
+			if (value > 30000)
+				value = 30000;
+			currentOutput.outputValue[row->channel - 1] = value;
+			servo = TRUE;
+		}
+		else if (row->channel == OPEN8055_SEQUENCE_CHANNEL_PWM1 ||
+				 row->channel == OPEN8055_SEQUENCE_CHANNEL_PWM2)
+		{
+			if (currentConfig1.modePWM[row->channel - OPEN8055_SEQUENCE_CHANNEL_PWM1] != OPEN8055_MODE_PID)
+				pwmSet(row->channel - OPEN8055_SEQUENCE_CHANNEL_PWM1, row->value);
+		}
+	}
+	if (servo)
+		servoPrepare();
+
+	seqLatch = SEQ_LATCH_EMPTY;
+	if (seqRow >= seqLength)
+	{
+		seqRow = 0;
+		if (seqLoops != 0 && --seqLoops == 0)
+		{
+			seqState = OPEN8055_SEQUENCE_IDLE;
+			seqStatusRequested = TRUE;
+			return;
+		}
+	}
+	sequenceLatch();
+}//end sequenceService
+
+
+/********************************************************************
+ * Function:        static void sendInputBurst(void)
+ *
+ * PreCondition:    The IN endpoint is not busy and there is at
+ *					least one burst sample.
+ *
+ * Input:           None
+ *
+ * Output:          None
+ *
+ * Side Effects:    None
+ *
+ * Overview:        Send up to OPEN8055_BURST_SAMPLES consecutive
+ *					burst samples in one INPUTBURST report. The
+ *					report carries the timestamp of the first one,
+ *					the others follow at burstInterval ticks.
+ *
+ * Note:            None
+ *******************************************************************/
+static void sendInputBurst(void)
+{
+	uint8_t		n = 0;
+	uint8_t		next;
+	uint16_t	value;
+	uint32_t	expected;
+
+	memset((void *)&toSendDataBuffer, 0, sizeof(toSendDataBuffer));
+	toSendDataBuffer.msgType = OPEN8055_HID_MESSAGE_INPUTBURST;
+	toSendDataBuffer.burstInterval = burstInterval;
+
+	while (n < OPEN8055_BURST_SAMPLES && burstTail != burstHead)
+	{
+		// A gap from dropped samples ends the report.
+		if (n == 0)
+		{
+			expected = burstRing[burstTail].timestamp;
+			toSendDataBuffer.raw[4] = (expected >> 24) & 0xFF;
+			toSendDataBuffer.raw[5] = (expected >> 16) & 0xFF;
+			toSendDataBuffer.raw[6] = (expected >> 8) & 0xFF;
+			toSendDataBuffer.raw[7] = expected & 0xFF;
+		}
+		else if (burstRing[burstTail].timestamp != expected)
+			break;
+
+		value = ((uint16_t)burstRing[burstTail].inputBits << 11) | burstRing[burstTail].adcValue[0];
+		toSendDataBuffer.burstSample[n][0] = htons(value);
+		value = burstRing[burstTail].adcValue[1];
+		toSendDataBuffer.burstSample[n][1] = htons(value);
+		expected += burstInterval;
+		n++;
+
+		// The tick interrupt must never see an out of range tail.
+		next = burstTail + 1;
+		if (next == BURST_RING_SIZE)
+			next = 0;
+		burstTail = next;
+	}
+	toSendDataBuffer.burstCount = n;
+
+	inputHandle = HIDTxPacket(HID_EP, (BYTE*)&toSendDataBuffer, sizeof(toSendDataBuffer));
+}//end sendInputBurst
+
+
+/********************************************************************
+ * Function:        static void sendEdges(void)
+ *
+ * PreCondition:    The IN endpoint is not busy.
+ *
+ * Input:           None
+ *
+ * Output:          None
+ *
+ * Side Effects:    Clears the count of dropped edge events.
+ *
+ * Overview:        Send up to OPEN8055_EDGES_PER_MSG queued edge
+ *					events in one EDGES report, together with the
+ *					number of events dropped since the last one.
+ *
+ * Note:            None
+ *******************************************************************/
+static void sendEdges(void)
+{
+	uint8_t		n = 0;
+	uint8_t		next;
+	uint32_t	timestamp;
+
+	memset((void *)&toSendDataBuffer, 0, sizeof(toSendDataBuffer));
+	toSendDataBuffer.msgType = OPEN8055_HID_MESSAGE_EDGES;
+
+	INTCONbits.GIEH = 0;
+	toSendDataBuffer.edgeLost = edgeLost;
+	edgeLost = 0;
+	INTCONbits.GIEH = 1;
+
+	while (n < OPEN8055_EDGES_PER_MSG && edgeTail != edgeHead)
+	{
+		timestamp = edgeRing[edgeTail].timestamp;
+		toSendDataBuffer.edge[n].timestamp[0] = htons((uint16_t)(timestamp >> 16));
+		toSendDataBuffer.edge[n].timestamp[1] = htons((uint16_t)timestamp);
+		toSendDataBuffer.edge[n].edges = edgeRing[edgeTail].edges;
+		toSendDataBuffer.edge[n].state = edgeRing[edgeTail].state;
+		n++;
+
+		// The tick interrupt must never see an out of range tail.
+		next = edgeTail + 1;
+		if (next == EDGE_RING_SIZE)
+			next = 0;
+		edgeTail = next;
+	}
+	toSendDataBuffer.edgeCount = n;
+
+	inputHandle = HIDTxPacket(HID_EP, (BYTE*)&toSendDataBuffer, sizeof(toSendDataBuffer));
+}//end sendEdges
+
+
 /********************************************************************
  * Function:        static void resetDevice(void)
  *
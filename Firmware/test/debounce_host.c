@@ -0,0 +1,347 @@
+/* ------------------------------------------------------------
+ * debounce_host.c
+ *
+ *	Host harness for the input debouncing of the firmware tick
+ *	interrupt. It runs the old per-input 16 bit counters and the
+ *	vertical counters of ../debounce.h side by side on random
+ *	bouncing inputs, checks that they agree and measures the cost
+ *	per tick.
+ *
+ *	DEBOUNCE_STEP() and DEBOUNCE_SPLIT() come from the same header
+ *	main.c includes. debounceConfigure() below is the one of main.c
+ *	without the interrupt disable.
+ *
+ *	Build and run:
+ *
+ *		cc -O2 -o debounce_host debounce_host.c
+ *		./debounce_host [seed]
+ *
+ *	The timing is host cycles (x86 TSC) or nanoseconds and only
+ *	compares the two versions with each other on the host, where the
+ *	new one is the slower. It says nothing about the PIC, whose
+ *	cycle counts have to come from the MPLAB simulator stopwatch.
+ * ------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#define OPEN8055_TICKS_PER_MS	10
+#define NUM_INPUTS				5
+
+#include "../debounce.h"
+
+/* ----
+ * Old firmware: one 16 bit counter per input.
+ * ----
+ */
+static struct {
+	unsigned char	currentState;
+	unsigned char	lastState;
+	unsigned short	debounceCounter;
+	unsigned short	debounceConfig;
+	unsigned long	counter;
+} switchStatus[NUM_INPUTS];
+
+static void
+old_tick(unsigned char raw)
+{
+	unsigned char	i;
+
+	for (i = 0; i < NUM_INPUTS; i++)
+	{
+		switchStatus[i].currentState = (raw >> i) & 1;
+		if (switchStatus[i].lastState == switchStatus[i].currentState)
+		{
+			switchStatus[i].debounceCounter = 0;
+		}
+		else
+		{
+			if (switchStatus[i].debounceCounter == 0)
+			{
+				switchStatus[i].debounceCounter = switchStatus[i].debounceConfig;
+			}
+			if (--switchStatus[i].debounceCounter == 0)
+			{
+				switchStatus[i].lastState = switchStatus[i].currentState;
+				if (switchStatus[i].lastState)
+					switchStatus[i].counter++;
+			}
+		}
+	}
+}
+
+/* ----
+ * New firmware: vertical counters from debounce.h.
+ * ----
+ */
+static uint8_t	debounceState = 0;
+static uint8_t	debounceBusy = 0;
+static uint8_t	debounceTickMask = 0;
+static uint8_t	debounceMsTicker = 0;
+static uint8_t	debounceCount[DEBOUNCE_COUNT_BITS];
+static uint8_t	debounceLoad[DEBOUNCE_COUNT_BITS];
+static uint8_t	prescaleCount[DEBOUNCE_PRESCALE_BITS];
+static uint8_t	prescaleLoad[DEBOUNCE_PRESCALE_BITS];
+static uint32_t	newCounter[NUM_INPUTS];
+
+static uint16_t	newSteps[NUM_INPUTS];
+static uint16_t	newPrescale[NUM_INPUTS];
+
+static void
+debounceConfigure(void)
+{
+	uint8_t		i;
+	uint8_t		k;
+	uint8_t		mask;
+	uint8_t		tickMask = 0;
+	uint8_t		countLoad[DEBOUNCE_COUNT_BITS];
+	uint8_t		scaleLoad[DEBOUNCE_PRESCALE_BITS];
+	uint32_t	ticks;
+	uint16_t	steps;
+	uint16_t	prescale;
+
+	memset((void *)countLoad, 0, sizeof(countLoad));
+	memset((void *)scaleLoad, 0, sizeof(scaleLoad));
+	for (i = 0, mask = 0x01; i < 5; i++, mask <<= 1)
+	{
+		ticks = switchStatus[i].debounceConfig;
+		if (ticks == 0)
+			ticks = 65536;
+		DEBOUNCE_SPLIT(ticks, steps, prescale);
+		if (prescale == 0)
+			tickMask |= mask;
+		newSteps[i] = steps;
+		newPrescale[i] = prescale;
+		for (k = 0; k < DEBOUNCE_COUNT_BITS; k++)
+			if (steps & (1 << k))
+				countLoad[k] |= mask;
+		for (k = 0; k < DEBOUNCE_PRESCALE_BITS; k++)
+			if (prescale & (1 << k))
+				scaleLoad[k] |= mask;
+	}
+
+	memcpy((void *)debounceLoad, (void *)countLoad, sizeof(countLoad));
+	memcpy((void *)debounceCount, (void *)countLoad, sizeof(countLoad));
+	memcpy((void *)prescaleLoad, (void *)scaleLoad, sizeof(scaleLoad));
+	memcpy((void *)prescaleCount, (void *)scaleLoad, sizeof(scaleLoad));
+	debounceTickMask = tickMask;
+	debounceBusy = 0;
+}
+
+static void
+new_tick(unsigned char raw)
+{
+	uint8_t		done;
+
+	DEBOUNCE_STEP(raw, done);
+	done &= debounceState;
+	if (done & 0x01)
+		newCounter[0]++;
+	if (done & 0x02)
+		newCounter[1]++;
+	if (done & 0x04)
+		newCounter[2]++;
+	if (done & 0x08)
+		newCounter[3]++;
+	if (done & 0x10)
+		newCounter[4]++;
+}
+
+/* ----
+ * Random bouncing inputs. Each input alternates between a bounce
+ * burst and a stable level held for a random time around its
+ * debounce time.
+ * ----
+ */
+static struct {
+	unsigned char	level;
+	uint32_t		left;			/* ticks left in this phase */
+	uint32_t		bounce;			/* ticks left bouncing */
+} gen[NUM_INPUTS];
+
+static unsigned char
+gen_tick(const uint32_t *debounceTicks)
+{
+	unsigned char	raw = 0;
+	int				i;
+
+	for (i = 0; i < NUM_INPUTS; i++)
+	{
+		if (gen[i].left == 0)
+		{
+			gen[i].level ^= 1;
+			gen[i].bounce = rand() % 40;
+			gen[i].left = gen[i].bounce + 1 + rand() % (2 * debounceTicks[i] + 40);
+		}
+		gen[i].left--;
+		if (gen[i].bounce > 0)
+		{
+			gen[i].bounce--;
+			if (rand() & 1)
+				raw |= (!gen[i].level) << i;
+			else
+				raw |= gen[i].level << i;
+		}
+		else
+			raw |= gen[i].level << i;
+	}
+	return raw;
+}
+
+static uint64_t
+now_cycles(void)
+{
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static const unsigned short configs[] = {
+	0, 1, 2, 3, 10, 11, 100, 254, 255, 256, 257, 999, 1000, 1001,
+	2549, 2550, 2551, 5000, 12345, 40000, 65535
+};
+#define NUM_CONFIGS		(sizeof(configs) / sizeof(configs[0]))
+
+int
+main(int argc, char **argv)
+{
+	unsigned int	seed = (argc > 1) ? atoi(argv[1]) : 1;
+	uint32_t		debounceTicks[NUM_INPUTS];
+	uint32_t		run[NUM_INPUTS];
+	unsigned char	*rawLog;
+	uint32_t		numTicks;
+	uint32_t		t;
+	int				round;
+	int				i;
+	int				errors = 0;
+	uint64_t		oldCycles = 0;
+	uint64_t		newCycles = 0;
+	uint64_t		totalTicks = 0;
+	uint64_t		start;
+
+	srand(seed);
+	for (round = 0; round < 40; round++)
+	{
+		memset(switchStatus, 0, sizeof(switchStatus));
+		memset(newCounter, 0, sizeof(newCounter));
+		memset(gen, 0, sizeof(gen));
+		memset(run, 0, sizeof(run));
+		debounceState = 0;
+		debounceMsTicker = rand() % OPEN8055_TICKS_PER_MS;
+
+		for (i = 0; i < NUM_INPUTS; i++)
+		{
+			switchStatus[i].debounceConfig = configs[rand() % NUM_CONFIGS];
+			debounceTicks[i] = switchStatus[i].debounceConfig ?
+					switchStatus[i].debounceConfig : 65536;
+		}
+		debounceConfigure();
+
+		/* Generate the input first so that only the debouncing is timed. */
+		numTicks = 2000000;
+		rawLog = malloc(numTicks);
+		for (t = 0; t < numTicks; t++)
+			rawLog[t] = gen_tick(debounceTicks);
+
+		start = now_cycles();
+		for (t = 0; t < numTicks; t++)
+			old_tick(rawLog[t]);
+		oldCycles += now_cycles() - start;
+		for (i = 0; i < NUM_INPUTS; i++)
+			switchStatus[i].lastState = 0;
+
+		/*
+		 * Run both versions tick by tick and check every transition of
+		 * the new one against the run of differing raw input that led
+		 * to it. Tick mode inputs must match the old version exactly.
+		 * Prescaled inputs must never be early and at most the rounded
+		 * up time late.
+		 */
+		memset(switchStatus, 0, sizeof(switchStatus));
+		for (i = 0; i < NUM_INPUTS; i++)
+			switchStatus[i].debounceConfig = debounceTicks[i] & 0xFFFF;
+		for (t = 0; t < numTicks; t++)
+		{
+			unsigned char	before = debounceState;
+			unsigned char	raw = rawLog[t];
+
+			old_tick(raw);
+			new_tick(raw);
+			for (i = 0; i < NUM_INPUTS; i++)
+			{
+				uint32_t	late;
+
+				if (((raw ^ before) >> i) & 1)
+					run[i]++;
+				else
+					run[i] = 0;
+				if (!(((debounceState ^ before) >> i) & 1))
+					continue;
+				late = newPrescale[i] ?
+						(uint32_t)newSteps[i] * newPrescale[i] * OPEN8055_TICKS_PER_MS :
+						debounceTicks[i];
+				if (run[i] < debounceTicks[i] || run[i] > late)
+				{
+					if (errors++ < 10)
+						printf("input %d config %u: changed after %u ticks, "
+							   "expected %u..%u\n", i + 1,
+							   switchStatus[i].debounceConfig, run[i],
+							   debounceTicks[i], late);
+				}
+				run[i] = 0;
+			}
+			for (i = 0; i < NUM_INPUTS; i++)
+			{
+				if (newPrescale[i] == 0 &&
+					((debounceState >> i) & 1) != switchStatus[i].lastState)
+				{
+					if (errors++ < 10)
+						printf("input %d config %u: state differs at tick %u\n",
+							   i + 1, switchStatus[i].debounceConfig, t);
+				}
+			}
+		}
+		for (i = 0; i < NUM_INPUTS; i++)
+		{
+			if (newPrescale[i] == 0 && newCounter[i] != switchStatus[i].counter)
+			{
+				if (errors++ < 10)
+					printf("input %d config %u: counter %u, old %lu\n", i + 1,
+						   switchStatus[i].debounceConfig, newCounter[i],
+						   switchStatus[i].counter);
+			}
+		}
+
+		/* Time the new version alone on the same input. */
+		debounceState = 0;
+		debounceConfigure();
+		start = now_cycles();
+		for (t = 0; t < numTicks; t++)
+			new_tick(rawLog[t]);
+		newCycles += now_cycles() - start;
+		totalTicks += numTicks;
+
+		free(rawLog);
+	}
+
+	printf("%llu ticks, %d errors\n", (unsigned long long)totalTicks, errors);
+#ifdef HAVE_TSC
+	printf("old: %.2f cycles/tick, new: %.2f cycles/tick\n",
+#else
+	printf("old: %.2f ns/tick, new: %.2f ns/tick\n",
+#endif
+		   (double)oldCycles / totalTicks, (double)newCycles / totalTicks);
+	return errors ? 1 : 0;
+}
@@ -123,6 +123,36 @@ OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_Reset(int h);
 OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_Wait(int h);
 OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_WaitTimeout(int h, int timeout);
 OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_WaitEx(int h, int timeout, int skipMessages);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetLostReports(int h);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetDroppedReports(int h);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetInputSequence(int h);
+OPEN8055_EXTERN double  OPEN8055_CDECL Open8055_GetInputTimestamp(int h);
+OPEN8055_EXTERN double  OPEN8055_CDECL Open8055_GetLatency(int h);
+OPEN8055_EXTERN double  OPEN8055_CDECL Open8055_GetClockDrift(int h);
+OPEN8055_EXTERN double  OPEN8055_CDECL Open8055_GetSampleInterval(int h);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_SetSampleInterval(int h, double ms);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_ReadSamples(int h, double *timestamp,
+                                int *inputBits, int *adcValue1, int *adcValue2, int maxSamples);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetLostSamples(int h);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetEdgeCapture(int h);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_SetEdgeCapture(int h, int mask);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_ReadEdges(int h, double *timestamp,
+                                int *port, int *level, int maxEdges);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetLostEdges(int h);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetReportPeriod(int h);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_SetReportPeriod(int h, int ms);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetAdcHysteresis(int h);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_SetAdcHysteresis(int h, int value);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetAverageWindow(int h);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_SetAverageWindow(int h, int ms);
+OPEN8055_EXTERN double  OPEN8055_CDECL Open8055_GetServoPeriod(int h);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_SetServoPeriod(int h, double ms);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_LoadSequence(int h, int numRows,
+                                const double *time_ms, const int *outputBits,
+                                const int *channel, const int *value);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_StartSequence(int h, int loops, int trigger);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_StopSequence(int h);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetSequenceState(int h);
 OPEN8055_EXTERN void    OPEN8055_CDECL Open8055_Sleep(int ms);
 OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetAutoFlush(int h);
 OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_SetAutoFlush(int h, int flag);
@@ -131,6 +161,7 @@ OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_Flush(int h);
 OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetInput(int h, int port);
 OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetInputAll(int h);
 OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetCounter(int h, int port);
+OPEN8055_EXTERN double  OPEN8055_CDECL Open8055_GetFrequency(int h, int port);
 OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_ResetCounter(int h, int port);
 OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_ResetCounterAll(int h);
 OPEN8055_EXTERN double  OPEN8055_CDECL Open8055_GetDebounce(int h, int port);
@@ -152,6 +183,13 @@ OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetModeInput(int h, int port);
 OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_SetModeInput(int h, int port, int mode);
 OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetModeOutput(int h, int port);
 OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_SetModeOutput(int h, int port, int mode);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_GetModePWM(int h, int port);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_SetModePWM(int h, int port, int mode);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_SetPID(int h, int port, int adcPort, int setpoint,
+                                double kp, double ki, double kd, int outMin, int outMax);
+OPEN8055_EXTERN int     OPEN8055_CDECL Open8055_SetRules(int h, int numRules,
+                                const int *source, const int *threshold,
+                                const int *action, const int *value);
 
 
 #ifdef __cplusplus
@@ -43,11 +43,32 @@
 #define OPEN8055_MODE_INPUT         20  // I1..I5 - port is digital input
 #define OPEN8055_MODE_FREQUENCY     21  // I1..I5 - port is a frequency counter
 #define OPEN8055_MODE_EUSART        22  // I4&I5 - ports used as EUSART
+#define OPEN8055_MODE_PERIOD        23  // I1..I5 - frequency from the edge times
 #define OPEN8055_MODE_OUTPUT        30  // O1..O8 - port is digital output
 #define OPEN8055_MODE_SERVO         31  // O1..O8 - port is in servo mode
 #define OPEN8055_MODE_ISERVO        32  // O1..O8 - port is in inverted servo mode
 #define OPEN8055_MODE_I2C           33  // O1&O2 - ports used as I2C bus.
 #define OPEN8055_MODE_PWM           40  // PWM1,PWM2 - port used as PWM output
+#define OPEN8055_MODE_PID           41  // PWM1,PWM2 - PWM driven by the on-card PID controller
+
+#define OPEN8055_SEQUENCE_ROWS          40  // Rows in the output sequence
+#define OPEN8055_SEQUENCE_CHANNEL_NONE  0   // Row only sets the digital outputs
+#define OPEN8055_SEQUENCE_CHANNEL_PWM1  9   // 1..8 are the output values
+#define OPEN8055_SEQUENCE_CHANNEL_PWM2  10
+#define OPEN8055_SEQUENCE_IDLE          0   // Sequence player states
+#define OPEN8055_SEQUENCE_ARMED         1   // Waiting for the trigger
+#define OPEN8055_SEQUENCE_RUNNING       2
+
+#define OPEN8055_RULES                  16  // Rules in the rule table
+#define OPEN8055_RULE_INPUT             0x00    // Rule sources, plus the port
+#define OPEN8055_RULE_COUNTER           0x10    // number counting from 0
+#define OPEN8055_RULE_ADC               0x20
+#define OPEN8055_RULE_BELOW             0x80    // Source below threshold, else at or above
+#define OPEN8055_RULE_NONE              0   // Rule actions
+#define OPEN8055_RULE_SET_OUTPUTS       1   // Value is the output bits
+#define OPEN8055_RULE_CLEAR_OUTPUTS     2
+#define OPEN8055_RULE_SET_PWM1          3   // Value is the duty cycle
+#define OPEN8055_RULE_SET_PWM2          4
 
 
 #endif
@@ -42,6 +42,7 @@ extern "C" {
 #ifdef _WIN32
 
 #include <winsock2.h>
+#include <ws2tcpip.h>
 #include <windows.h>
 #include <basetyps.h>
 #include <setupapi.h>
@@ -65,6 +66,7 @@ typedef int     socklen_t;
 #include <libusb.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 
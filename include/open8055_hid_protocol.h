@@ -30,6 +30,16 @@ typedef unsigned short uint16_t;
 #define _UINT16_T_DECLARED
 #endif
 
+#ifndef _INT32_T_DECLARED
+typedef long int32_t;
+#define _INT32_T_DECLARED
+#endif
+
+#ifndef _UINT32_T_DECLARED
+typedef unsigned long uint32_t;
+#define _UINT32_T_DECLARED
+#endif
+
 #endif /* _STDINT_H */
 
 
@@ -42,10 +52,115 @@ typedef unsigned short uint16_t;
 #define OPEN8055_HID_MESSAGE_GETCONFIG  0x04    // Request current config
 #define OPEN8055_HID_MESSAGE_SAVECONFIG 0x05    // Save current config to EEPROM
 #define OPEN8055_HID_MESSAGE_SAVEALL    0x06    // Save config and values to EEPROM
+#define OPEN8055_HID_MESSAGE_SETCONFIG2 0x07    // Change extended configuration
+#define OPEN8055_HID_MESSAGE_GETCONFIG2 0x08    // Request extended config
+#define OPEN8055_HID_MESSAGE_SETSEQUENCE 0x09   // Load output sequence rows
+#define OPEN8055_HID_MESSAGE_SEQUENCE   0x0A    // Start/stop sequence, status
+#define OPEN8055_HID_MESSAGE_SETPID     0x0B    // Set PID controller parameters
+#define OPEN8055_HID_MESSAGE_SETRULES   0x0C    // Load the rule table
 
 #define OPEN8055_HID_MESSAGE_RESET  0x7F    // Restart PIC
 
 #define OPEN8055_HID_MESSAGE_INPUT  0x81    // Report current input values
+#define OPEN8055_HID_MESSAGE_INPUTBURST 0x82    // Report a burst of input samples
+#define OPEN8055_HID_MESSAGE_EDGES  0x84    // Report timestamped input edges
+
+// The part of an INPUT report that describes the input state. The
+// sequence number and timestamp following it change with every report.
+#define OPEN8055_INPUT_STATE_SIZE   16
+
+// Resolution of the INPUT report timestamp.
+#define OPEN8055_TIMESTAMP_PER_MS   10
+
+// Samples per INPUTBURST report and the shortest sample interval in
+// timestamp ticks. A sample is the five input bits in the top of the
+// first word with ADC 1 below, and ADC 2 in the second word.
+#define OPEN8055_BURST_SAMPLES      6
+#define OPEN8055_BURST_INTERVAL_MIN 2
+
+// Default length of the ADC averaging window in milliseconds. A zero
+// averageWindow in SETCONFIG2 selects this.
+#define OPEN8055_AVERAGE_WINDOW_DEFAULT 5
+
+// Servo frame period in timestamp ticks. Every frame all servo outputs
+// send one pulse. A zero servoPeriod in SETCONFIG2 selects the default
+// of 20 ms, the shortest period is 2.5 ms, the longest servo pulse.
+#define OPEN8055_SERVO_PERIOD_DEFAULT 200
+#define OPEN8055_SERVO_PERIOD_MIN   25
+
+// The output sequence player. A sequence is a table of rows, each
+// setting the digital outputs and one output value at a tick offset
+// from the start of the sequence. Rows must be sorted by tick. The
+// sequence repeats one tick after its last row. The table size,
+// channels and states are in open8055_common.h.
+#define OPEN8055_SEQUENCE_ROWS_PER_MSG  4
+
+#define OPEN8055_SEQUENCE_STOP          0   // SEQUENCE commands
+#define OPEN8055_SEQUENCE_START         1
+#define OPEN8055_SEQUENCE_GETSTATUS     2
+
+// Start triggers. Without one the sequence starts right away, with
+// one on the given edge of a digital input (1..5).
+#define OPEN8055_SEQUENCE_TRIGGER_NONE      0x00
+#define OPEN8055_SEQUENCE_TRIGGER_RISING    0x00
+#define OPEN8055_SEQUENCE_TRIGGER_FALLING   0x80
+
+// PID controller of a PWM output in OPEN8055_MODE_PID. It runs on every
+// new averaged value of one ADC input, once per averaging window. The
+// proportional gain is in 1/256, the integral gain in 1/65536 per
+// millisecond and the derivative gain in 1/256 of the change per
+// millisecond. The derivative acts on the ADC value, not the error, so
+// that setpoint changes don't kick the output.
+#define OPEN8055_PID_GAIN_SHIFT     8
+#define OPEN8055_PID_INTEGRAL_SHIFT 16
+
+// The rule table. Every millisecond each rule compares an input bit,
+// counter or ADC value with its threshold and, while the condition
+// holds, forces digital outputs on or off or a PWM output to a duty
+// cycle. The sources, conditions and actions are in open8055_common.h.
+// A table is loaded in messages of up to OPEN8055_RULES_PER_MSG rules
+// and takes effect with the one holding its last rule.
+#define OPEN8055_RULES_PER_MSG      4
+#define OPEN8055_RULE_SOURCE_MASK   0x70
+#define OPEN8055_RULE_PORT_MASK     0x0F
+
+// Edge capture. The card stamps every debounced change of the digital
+// inputs selected by edgeMask in SETCONFIG2 with the tick count and
+// reports up to OPEN8055_EDGES_PER_MSG of them per EDGES report. An
+// event holds the inputs that changed and the debounced state of all
+// five after the change. edgeLost counts events dropped since the last
+// report because the card's queue was full.
+#define OPEN8055_EDGES_PER_MSG      4
+#define OPEN8055_EDGE_INPUT_MASK    0x1F
+
+// Reciprocal frequency measurement of inputs in OPEN8055_MODE_PERIOD.
+// Every OPEN8055_PERIOD_GATE_MS the card divides the rising edges since
+// the last measurement by the time from the last edge before them to
+// the last one of them. The counter reports the frequency in
+// 1/OPEN8055_PERIOD_PER_HZ Hz, up to 655.35 Hz.
+#define OPEN8055_PERIOD_GATE_MS     20
+#define OPEN8055_PERIOD_PER_HZ      100
+
+
+typedef struct {
+    uint16_t            tick;
+    uint8_t             outputBits;
+    uint8_t             channel;
+    uint16_t            value;
+} Open8055_seqRow_t;
+
+typedef struct {
+    uint8_t             source;
+    uint8_t             action;
+    uint16_t            threshold;
+    uint16_t            value;
+} Open8055_rule_t;
+
+typedef struct {
+    uint16_t            timestamp[2];   // High word first
+    uint8_t             edges;
+    uint8_t             state;
+} Open8055_edge_t;
 
 
 typedef union {
@@ -58,6 +173,10 @@ typedef union {
         uint8_t         inputBits;
         uint16_t        inputCounter[5];
         uint16_t        inputAdcValue[2];
+        uint16_t        inputSequence;
+        uint16_t        inputTimestamp[2];  // High word first, keeps
+                                            // hosts from padding it
+        uint16_t        inputPwmValue[2];   // Current PWM duty cycles
     };
     
     struct {
@@ -80,6 +199,77 @@ typedef union {
         uint16_t        debounceValue[5];
         uint8_t         cardAddress;
     };
+
+    struct {
+        uint8_t         _msgType_config2;
+
+        uint8_t         sampleInterval;
+        uint16_t        reportPeriod;
+        uint16_t        adcHysteresis;
+        uint8_t         averageWindow;
+        uint8_t         servoPeriod;
+        uint8_t         edgeMask;       // Inputs to capture edges of
+    };
+
+    struct {
+        uint8_t         _msgType_setsequence;
+
+        uint8_t         seqIndex;
+        uint8_t         seqRows;
+        uint8_t         _seqReserved;
+        Open8055_seqRow_t seqRow[OPEN8055_SEQUENCE_ROWS_PER_MSG];
+    };
+
+    struct {
+        uint8_t         _msgType_setpid;
+
+        uint8_t         pidPwm;         // PWM output, 0 or 1
+        uint8_t         pidAdc;         // ADC input, 1 or 2
+        uint8_t         _pidReserved;
+        uint16_t        pidSetpoint;
+        int16_t         pidKp;
+        int16_t         pidKi;
+        int16_t         pidKd;
+        uint16_t        pidOutMin;
+        uint16_t        pidOutMax;
+    };
+
+    struct {
+        uint8_t         _msgType_setrules;
+
+        uint8_t         ruleIndex;
+        uint8_t         ruleRows;
+        uint8_t         ruleTotal;      // Rules in the new table
+        Open8055_rule_t rule[OPEN8055_RULES_PER_MSG];
+    };
+
+    struct {
+        uint8_t         _msgType_sequence;
+
+        uint8_t         seqCommand;     // Command, or state in a report
+        uint8_t         seqLength;
+        uint8_t         seqTrigger;
+        uint16_t        seqLoops;       // 0 = forever, reports loops left
+    };
+
+    struct {
+        uint8_t         _msgType_burst;
+
+        uint8_t         burstCount;
+        uint8_t         burstInterval;
+        uint8_t         _burstReserved;
+        uint32_t        burstTimestamp;
+        uint16_t        burstSample[OPEN8055_BURST_SAMPLES][2];
+    };
+
+    struct {
+        uint8_t         _msgType_edges;
+
+        uint8_t         edgeCount;
+        uint8_t         edgeLost;
+        uint8_t         _edgeReserved;
+        Open8055_edge_t edge[OPEN8055_EDGES_PER_MSG];
+    };
     
 } Open8055_hidMessage_t;    
 
@@ -44,6 +44,8 @@
 
 #ifndef _WIN32
 #include <pthread.h>
+#include <poll.h>
+#include <sys/time.h>
 #endif
 
 /* ----------------------------------------------------------------------
@@ -51,9 +53,40 @@
  * ----------------------------------------------------------------------
  */
 
+#define OPEN8055_REMOTE_QUEUE_SIZE  64
+#define OPEN8055_REMOTE_OUT_SIZE    4096
+#define OPEN8055_CLOCK_WINDOW_MS    1000.0
+#define OPEN8055_HISTORY_SIZE       4096
+#define OPEN8055_EDGE_HISTORY_SIZE  1024
+#define OPEN8055_NET_RESTART_GAP    10000
+
+/* ----
+ * One sample of an INPUTBURST report, with the card time in ms.
+ * ----
+ */
+typedef struct {
+    double                  timestamp;
+    int                     inputBits;
+    int                     adcValue[2];
+} Open8055_sample_t;
+
+/* ----
+ * One input edge of an EDGES report, with the card time in ms.
+ * ----
+ */
+typedef struct {
+    double                  timestamp;
+    int                     port;
+    int                     level;
+} Open8055_edgeEvent_t;
+
+
 typedef struct {
     int                     isLocal;
     int                     idLocal;
+    int                     isMulticast;
+    int                     isReadOnly;
+    int                     idRemote;
     char                    destination[1024];
 
     SOCKET		    sock;
@@ -62,16 +95,102 @@ typedef struct {
     int			    net_input_have;
     char		    net_input_line[1024];
     char		   *net_input_out;
+    unsigned long	    net_input_seq;
+    int			    net_input_lost;
+    int			    net_input_last[13];
+    int			    net_input_have_last;
+    int			    net_accept_burst;
+    int			    net_accept_sequence;
+    int			    net_accept_edges;
+
+#ifndef _WIN32
+    /* ----
+     * Remote cards are serviced by the reactor thread, which parses
+     * the incoming messages into this queue and sends what the
+     * application put into remoteOut.
+     * ----
+     */
+    int                     remoteRegistered;
+    pthread_cond_t          remoteCond;
+    pthread_cond_t          remoteDrained;
+    char                    remoteOut[OPEN8055_REMOTE_OUT_SIZE];
+    int                     remoteOutLen;
+    Open8055_hidMessage_t   remoteQueue[OPEN8055_REMOTE_QUEUE_SIZE];
+    int                     remoteQueueHead;
+    int                     remoteQueueCount;
+    int                     remoteDropped;
+    int                     remoteWaiters;
+    int                     reactorBusy;
+    int                     remoteFailed;
+    char                    remoteError[256];
+#endif
 
     char                    errorMessage[1024];
 
     Open8055_hidMessage_t   currentConfig1;
+    Open8055_hidMessage_t   currentConfig2;
+    int                     haveConfig2;
+    int                     sequenceRows;
+    int                     sequenceState;
     Open8055_hidMessage_t   currentOutput;
     Open8055_hidMessage_t   currentInput;
     int                     currentInputUnconsumed;
 
+    /* ----
+     * Samples unpacked from INPUTBURST reports, oldest first. When
+     * the application doesn't read them fast enough, the oldest
+     * ones are overwritten and counted as lost.
+     * ----
+     */
+    Open8055_sample_t       history[OPEN8055_HISTORY_SIZE];
+    int                     historyHead;
+    int                     historyCount;
+    int                     historyLost;
+    int                     burstHaveLast;
+    uint32_t                burstLastTimestamp;
+    uint32_t                burstNextTimestamp;
+    int                     burstLastInterval;
+    double                  burstDeviceTime;
+
+    /* ----
+     * Input edges unpacked from EDGES reports, oldest first, handled
+     * like the burst samples.
+     * ----
+     */
+    Open8055_edgeEvent_t    edgeHistory[OPEN8055_EDGE_HISTORY_SIZE];
+    int                     edgeHead;
+    int                     edgeCount;
+    int                     edgeLost;
+    int                     edgeHaveLast;
+    uint32_t                edgeLastTimestamp;
+    double                  edgeDeviceTime;
+
+    /* ----
+     * Report timing derived from the INPUT sequence numbers and
+     * timestamps. The clock offset is the host time minus the card
+     * time of a report. Its minimum over a window of about one second
+     * is the transfer time of the fastest report plus the difference
+     * of the clocks. Comparing the first and the latest window gives
+     * the clock drift.
+     * ----
+     */
+    int                     inputHaveTiming;
+    uint16_t                inputLastSequence;
+    uint32_t                inputLastTimestamp;
+    int                     inputDropped;
+    double                  inputDeviceTime;
+    double                  inputLatency;
+    double                  clockWindowStart;
+    double                  clockWindowMin;
+    int                     clockHaveFirst;
+    double                  clockFirstStart;
+    double                  clockFirstMin;
+    double                  clockLastStart;
+    double                  clockLastMin;
+
     int                     autoFlush;
     int                     pendingConfig1;
+    int                     pendingConfig2;
     int                     pendingOutput;
     int                     cardClosed;
     int                     cardRefcount;
@@ -119,9 +238,32 @@ static void SetError(Open8055_card_t *card, char *fmt, ...);
 
 static int CardRead(Open8055_card_t *card, void *buffer, int timeout);
 static int CardReadLine(Open8055_card_t *card, char *buffer, int len, int timeout);
+static int CardNextLine(Open8055_card_t *card, char *buffer, int buflen);
+static int CardReadDatagram(Open8055_card_t *card, char *buffer, int len, int timeout);
+static int CardParseDatagram(Open8055_card_t *card, char *buffer, int buflen);
+static int CardParseLine(Open8055_card_t *card, char *line, void *buffer);
+static int CardDecodeDelta(Open8055_card_t *card, char *hex, int *values);
 static int CardWrite(Open8055_card_t *card, void *buffer);
 static int CardWriteLine(Open8055_card_t *card, char *fmt, ...);
 static int CardClose(Open8055_card_t *card);
+static void CardInputReceived(Open8055_card_t *card, Open8055_hidMessage_t *message);
+static void CardBurstReceived(Open8055_card_t *card, Open8055_hidMessage_t *message);
+static void CardEdgesReceived(Open8055_card_t *card, Open8055_hidMessage_t *message);
+static void CardConfig2Received(Open8055_card_t *card, Open8055_hidMessage_t *message);
+static int CardAcceptBurst(Open8055_card_t *card);
+static int CardAcceptEdges(Open8055_card_t *card);
+static void CardSequenceReceived(Open8055_card_t *card, Open8055_hidMessage_t *message);
+static int CardSequenceCommand(Open8055_card_t *card, int command, int trigger, int loops);
+static int CardConfig2Changed(Open8055_card_t *card);
+static double HostTime(void);
+
+#ifndef _WIN32
+static int ReactorAdd(Open8055_card_t *card);
+static void ReactorRemove(Open8055_card_t *card);
+static void *ReactorMain(void *arg);
+static void ReactorQueueLine(Open8055_card_t *card, char *line);
+static void ReactorFail(Open8055_card_t *card, char *fmt, ...);
+#endif
 
 static int DeviceInit(void);
 static int DevicePresent(int cardNumber);
@@ -149,6 +291,15 @@ static CRITICAL_SECTION connectionsLock;
 WSADATA			WSAData;
 #else
 static pthread_mutex_t  connectionsLock;
+
+static pthread_mutex_t  reactorLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t        reactorThread;
+static int              reactorStarted = FALSE;
+static int              reactorWakeup[2];
+static Open8055_card_t  *reactorCards[OPEN8055_MAX_CARDS * 4];
+static int              reactorNumCards = 0;
+static int              reactorGeneration = 0;
+static pthread_cond_t   reactorIdle = PTHREAD_COND_INITIALIZER;
 #endif
 
 
@@ -219,6 +370,8 @@ Open8055_Connect(char *destination, char *password)
     Open8055_hidMessage_t   outputMessage;
     Open8055_hidMessage_t   inputMessage;
     int                     handle;
+    int                     rc;
+    int                     timeouts = 0;
 
     /* ----
      * Make sure the library is initialized.
@@ -243,6 +396,7 @@ Open8055_Connect(char *destination, char *password)
     memset(card, 0, sizeof(Open8055_card_t));
     strncpy(card->destination, destination, sizeof(card->destination));
     card->autoFlush = TRUE;
+    card->currentConfig2.msgType = OPEN8055_HID_MESSAGE_SETCONFIG2;
 
     /* ----
      * Parse the destination. We first check for the remote
@@ -261,7 +415,47 @@ Open8055_Connect(char *destination, char *password)
 	struct sockaddr_in	addr;
 	char		line[256];
 	char		salt[256];
-	int		rc;
+	int		useDelta = FALSE;
+	int		useObserve = FALSE;
+	int		useBurst = FALSE;
+	int		useEdges = FALSE;
+	int		one = 1;
+
+	/* ----
+	 * Options follow a '?', separated by '&'. "delta" requests the
+	 * delta encoded INPUT stream, "observe" opens the card as a read
+	 * only observer that shares it with the controlling client,
+	 * "burst" asks for the burst sampling reports and "edges" for
+	 * the edge capture reports.
+	 * ----
+	 */
+	if ((pos = strchr(parsepos, '?')) != NULL)
+	{
+	    char       *opt;
+
+	    *pos++ = '\0';
+	    while ((opt = pos) != NULL)
+	    {
+		if ((pos = strchr(opt, '&')) != NULL)
+		    *pos++ = '\0';
+
+		if (strcasecmp(opt, "delta") == 0)
+		    useDelta = TRUE;
+		else if (strcasecmp(opt, "observe") == 0)
+		    useObserve = TRUE;
+		else if (strcasecmp(opt, "burst") == 0)
+		    useBurst = TRUE;
+		else if (strcasecmp(opt, "edges") == 0)
+		    useEdges = TRUE;
+		else
+		{
+		    SetError(NULL, "Invalid destination option '%s'", opt);
+		    free(card);
+		    free(destcopy);
+		    return -1;
+		}
+	    }
+	}
 
 	/* ----
 	 * If present, extract the USER@ part at the beginning of the destination.
@@ -370,6 +564,7 @@ Open8055_Connect(char *destination, char *password)
 	    free(card);
 	    return -1;
 	}
+	setsockopt(card->sock, IPPROTO_TCP, TCP_NODELAY, (char *)&one, sizeof(one));
 
 	/* ----
 	 * Create and acquire the card lock and mark the card being remote.
@@ -378,12 +573,59 @@ Open8055_Connect(char *destination, char *password)
 	LockCreate(&(card->cardLock));
 	LockAcquire(&(card->cardLock));
 	card->isLocal   = FALSE;
+	card->isReadOnly = useObserve;
 	card->idLocal   = -1;
 	card->net_input_pos = card->net_input_buffer;
 	card->net_input_out = card->net_input_line;
 
 	/* ----
-	 * Get the HELLO and SALT messages.
+	 * Switch to delta encoding if requested. This must happen before
+	 * the OPEN, so that the initial INPUT report already serves as
+	 * the first keyframe.
+	 * ----
+	 */
+	if (useDelta && CardWriteLine(card, "ENCODING DELTA\n") < 0)
+	{
+	    strncpy(lastErrorMessage, card->errorMessage, sizeof(lastErrorMessage));
+	    CardClose(card);
+	    LockRelease(&(card->cardLock));
+	    LockDestroy(&(card->cardLock));
+	    free(card);
+	    return -1;
+	}
+	if ((useBurst && CardAcceptBurst(card) < 0) ||
+	    (useEdges && CardAcceptEdges(card) < 0))
+	{
+	    strncpy(lastErrorMessage, card->errorMessage, sizeof(lastErrorMessage));
+	    CardClose(card);
+	    LockRelease(&(card->cardLock));
+	    LockDestroy(&(card->cardLock));
+	    free(card);
+	    return -1;
+	}
+
+	/* ----
+	 * Send the OPEN command with username and password. We don't wait
+	 * for HELLO and SALT first, the server processes pipelined commands
+	 * after sending those. This saves a round trip on slow links, but
+	 * only works as long as we don't need the SALT for the password.
+	 * TODO: MD5 hashing
+	 * ----
+	 */
+    	if (CardWriteLine(card, "open %d %s %s%s\n", cardNumber, user, "dummy",
+		useObserve ? " observe" : "") < 0)
+	{
+	    strncpy(lastErrorMessage, card->errorMessage, sizeof(lastErrorMessage));
+	    CardClose(card);
+	    LockRelease(&(card->cardLock));
+	    LockDestroy(&(card->cardLock));
+	    free(card);
+	    return -1;
+	}
+
+	/* ----
+	 * Now get the HELLO and SALT messages. The server answers the OPEN
+	 * from its cached card state right after those.
 	 * ----
 	 */
 	if ((rc = CardReadLine(card, line, sizeof(line), 60000)) <= 0)
@@ -429,21 +671,108 @@ Open8055_Connect(char *destination, char *password)
 	    free(card);
 	    return -1;
 	}
+    }
+    else if (strncasecmp(destination, "open8055udp://", 14) == 0)
+    {
+    	char           *destcopy = strdup(&destination[14]);
+	char           *group;
+	int	        port = 8056;
+	char           *parsepos = destcopy;
+	char           *pos;
+	struct sockaddr_in	addr;
+	struct ip_mreq	mreq;
+	int		one = 1;
 
 	/* ----
-	 * Send the OPEN command with username and password.
-	 * TODO: MD5 hashing
+	 * This is a read-only subscription to the INPUT reports, an
+	 * Open8055Server publishes via UDP multicast. We expect either
+	 * "group:port/cardN" or "group/cardN".
 	 * ----
 	 */
-    	if (CardWriteLine(card, "open %d %s %s\n", cardNumber, user, "dummy") < 0)
+	group = parsepos;
+	if ((pos = strchr(parsepos, '/')) == NULL)
 	{
-	    strncpy(lastErrorMessage, card->errorMessage, sizeof(lastErrorMessage));
-	    CardClose(card);
-	    LockRelease(&(card->cardLock));
-	    LockDestroy(&(card->cardLock));
+	    SetError(NULL, "Invalid destination");
+	    free(card);
+	    free(destcopy);
+	    return -1;
+	}
+	*pos++ = '\0';
+	parsepos = pos;
+	if ((pos = strchr(group, ':')) != NULL)
+	{
+	    *pos++ = '\0';
+	    if (sscanf(pos, "%d", &port) != 1)
+	    {
+		SetError(NULL, "Invalid destination");
+		free(card);
+		free(destcopy);
+		return -1;
+	    }
+	}
+	if (sscanf(parsepos, "card%d", &cardNumber) != 1)
+	{
+	    SetError(NULL, "Invalid destination");
+	    free(card);
+	    free(destcopy);
+	    return -1;
+	}
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.imr_multiaddr.s_addr = inet_addr(group);
+	mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+	if (!IN_MULTICAST(ntohl(mreq.imr_multiaddr.s_addr)))
+	{
+	    SetError(NULL, "%s: not an IPv4 multicast group", group);
+	    free(card);
+	    free(destcopy);
+	    return -1;
+	}
+	free(destcopy);
+
+	/* ----
+	 * Bind to the port and join the multicast group. Multiple
+	 * listeners on the same host share the port.
+	 * ----
+	 */
+	card->sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (card->sock == INVALID_SOCKET)
+	{
+	    SetError(NULL, "%s", ErrorString());
+	    free(card);
+	    return -1;
+	}
+	setsockopt(card->sock, SOL_SOCKET, SO_REUSEADDR, (char *)&one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(card->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    setsockopt(card->sock, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+	    	       (char *)&mreq, sizeof(mreq)) != 0)
+	{
+	    SetError(NULL, "%s", ErrorString());
+	    closesocket(card->sock);
 	    free(card);
 	    return -1;
 	}
+
+	/* ----
+	 * Create and acquire the card lock and mark the card being remote.
+	 * We never learn the card's configuration and output state this
+	 * way, so those are treated as all zero and only the first INPUT
+	 * report is awaited below.
+	 * ----
+	 */
+	LockCreate(&(card->cardLock));
+	LockAcquire(&(card->cardLock));
+	card->isLocal   = FALSE;
+	card->idLocal   = -1;
+	card->isMulticast = TRUE;
+	card->isReadOnly = TRUE;
+	card->idRemote  = cardNumber;
+	card->currentConfig1.msgType = OPEN8055_HID_MESSAGE_SETCONFIG1;
+	card->currentOutput.msgType = OPEN8055_HID_MESSAGE_OUTPUT;
     }
     else
     {
@@ -497,6 +826,23 @@ Open8055_Connect(char *destination, char *password)
 	card->idLocal   = cardNumber;
     }
 
+#ifndef _WIN32
+    /* ----
+     * From here on the reactor thread receives everything for a remote
+     * card.
+     * ----
+     */
+    if (!card->isLocal && ReactorAdd(card) < 0)
+    {
+	strncpy(lastErrorMessage, card->errorMessage, sizeof(lastErrorMessage));
+	CardClose(card);
+	LockRelease(&(card->cardLock));
+	LockDestroy(&(card->cardLock));
+	free(card);
+	return -1;
+    }
+#endif
+
     /* ----
      * Query current card status. When connecting to an Open8055Server,
      * The OPEN command automatically responds with those messages.
@@ -506,7 +852,9 @@ Open8055_Connect(char *destination, char *password)
     {
 	memset(&outputMessage, 0, sizeof(outputMessage));
 	outputMessage.msgType = OPEN8055_HID_MESSAGE_GETCONFIG;
-	if (CardWrite(card, &outputMessage) < 0)
+	if (CardWrite(card, &outputMessage) < 0 ||
+	    (outputMessage.msgType = OPEN8055_HID_MESSAGE_GETCONFIG2,
+	     CardWrite(card, &outputMessage) < 0))
 	{
 	    strncpy(lastErrorMessage, card->errorMessage, sizeof(lastErrorMessage));
 	    CardClose(card);
@@ -520,7 +868,7 @@ Open8055_Connect(char *destination, char *password)
         || card->currentOutput.msgType == 0x00
         || card->currentInput.msgType == 0x00)
     {
-        if (CardRead(card, &inputMessage, 1000) < 0)
+        if ((rc = CardRead(card, &inputMessage, 1000)) < 0)
         {
 	    strncpy(lastErrorMessage, card->errorMessage, sizeof(lastErrorMessage));
             CardClose(card);
@@ -529,6 +877,18 @@ Open8055_Connect(char *destination, char *password)
             free(card);
             return -1;
         }
+        if (rc == 0 && card->isMulticast && ++timeouts >= 10)
+        {
+            SetError(NULL, "No INPUT reports for card%d received from %s",
+                card->idRemote, destination);
+            CardClose(card);
+            LockRelease(&(card->cardLock));
+            LockDestroy(&(card->cardLock));
+            free(card);
+            return -1;
+        }
+        if (rc == 0)
+            continue;
         switch(inputMessage.msgType)
         {
             case OPEN8055_HID_MESSAGE_SETCONFIG1:
@@ -541,10 +901,24 @@ Open8055_Connect(char *destination, char *password)
                     sizeof(card->currentOutput));
                 break;
 
+            case OPEN8055_HID_MESSAGE_SETCONFIG2:
+                CardConfig2Received(card, &inputMessage);
+                break;
+
+            case OPEN8055_HID_MESSAGE_SEQUENCE:
+                CardSequenceReceived(card, &inputMessage);
+                break;
+
             case OPEN8055_HID_MESSAGE_INPUT:
-                card->currentInputUnconsumed = OPEN8055_INPUT_ANY;
-                memcpy(&(card->currentInput), &inputMessage, 
-                    sizeof(card->currentInput));
+                CardInputReceived(card, &inputMessage);
+                break;
+
+            case OPEN8055_HID_MESSAGE_INPUTBURST:
+                CardBurstReceived(card, &inputMessage);
+                break;
+
+            case OPEN8055_HID_MESSAGE_EDGES:
+                CardEdgesReceived(card, &inputMessage);
                 break;
         }
     }
@@ -646,7 +1020,7 @@ Open8055_Close(int h)
         memset(&message, 0, sizeof(message));
         message.msgType = OPEN8055_HID_MESSAGE_GETINPUT;
 
-        if (CardWrite(card, &message) < 0)
+        if (!card->isReadOnly && CardWrite(card, &message) < 0)
         {
             UnlockAndRefcount(card);
             return -1;
@@ -739,7 +1113,7 @@ Open8055_Reset(int h)
         memset(&message, 0, sizeof(message));
         message.msgType = OPEN8055_HID_MESSAGE_GETINPUT;
 
-        if (CardWrite(card, &message) < 0)
+        if (!card->isReadOnly && CardWrite(card, &message) < 0)
         {
             UnlockAndRefcount(card);
             return -1;
@@ -862,14 +1236,39 @@ Open8055_WaitEx(int h, int timeout, int skipMessages)
             switch (inputMessage.msgType)
             {
                 case OPEN8055_HID_MESSAGE_INPUT:
-                    memcpy(&(card->currentInput), &inputMessage, sizeof(card->currentInput));
-                    card->currentInputUnconsumed = OPEN8055_INPUT_ANY;
+                    CardInputReceived(card, &inputMessage);
+                    haveInput = 1;
+#ifdef _WIN32
+                    rc = 0;
+#endif
+                    break;
+
+                case OPEN8055_HID_MESSAGE_INPUTBURST:
+                    CardBurstReceived(card, &inputMessage);
+                    haveInput = 1;
+#ifdef _WIN32
+                    rc = 0;
+#endif
+                    break;
+
+                case OPEN8055_HID_MESSAGE_EDGES:
+                    CardEdgesReceived(card, &inputMessage);
                     haveInput = 1;
 #ifdef _WIN32
                     rc = 0;
 #endif
                     break;
 
+                case OPEN8055_HID_MESSAGE_SETCONFIG2:
+                    CardConfig2Received(card, &inputMessage);
+                    rc = 0;
+                    break;
+
+                case OPEN8055_HID_MESSAGE_SEQUENCE:
+                    CardSequenceReceived(card, &inputMessage);
+                    rc = 0;
+                    break;
+
                 case OPEN8055_HID_MESSAGE_SETCONFIG1:
                 case OPEN8055_HID_MESSAGE_OUTPUT:
                     rc = 0;
@@ -919,7 +1318,7 @@ Open8055_WaitEx(int h, int timeout, int skipMessages)
         }
 
         if (rc == 0)
-            return 0;
+            break;
 
         /* ----
          * Handle by message type.
@@ -928,11 +1327,30 @@ Open8055_WaitEx(int h, int timeout, int skipMessages)
         switch (inputMessage.msgType)
         {
             case OPEN8055_HID_MESSAGE_INPUT:
-                memcpy(&(card->currentInput), &inputMessage, sizeof(card->currentInput));
-                card->currentInputUnconsumed = OPEN8055_INPUT_ANY;
+                CardInputReceived(card, &inputMessage);
+                haveInput = 1;
+                break;
+
+            case OPEN8055_HID_MESSAGE_INPUTBURST:
+                CardBurstReceived(card, &inputMessage);
+                haveInput = 1;
+                break;
+
+            case OPEN8055_HID_MESSAGE_EDGES:
+                CardEdgesReceived(card, &inputMessage);
                 haveInput = 1;
                 break;
 
+            case OPEN8055_HID_MESSAGE_SETCONFIG2:
+                CardConfig2Received(card, &inputMessage);
+                rc = 0;
+                break;
+
+            case OPEN8055_HID_MESSAGE_SEQUENCE:
+                CardSequenceReceived(card, &inputMessage);
+                rc = 0;
+                break;
+
             case OPEN8055_HID_MESSAGE_SETCONFIG1:
             case OPEN8055_HID_MESSAGE_OUTPUT:
                 rc = 0;
@@ -950,50 +1368,51 @@ Open8055_WaitEx(int h, int timeout, int skipMessages)
 
 
 /* ----
- * Open8055_GetAutoFlush()
+ * Open8055_GetLostReports()
  *
- *  Return the current autoFlush setting.
+ *  Return the number of INPUT reports missed on a multicast
+ *  destination, or dropped because the application didn't read
+ *  those of a remote card fast enough. Always zero for local cards.
  * ----
  */
-OPEN8055_EXTERN void OPEN8055_CDECL
-Open8055_Sleep(int ms)
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_GetLostReports(int h)
 {
-#ifdef _WIN32
-    if (ms < 0)
-        ms = 0;
-
-    Sleep((DWORD)ms);
-#else
-    struct timeval  tv;
-
-    if (ms < 0)
-        ms = 0;
+    Open8055_card_t *card;
+    int             rc;
 
-    tv.tv_sec = ms / 1000;
-    tv.tv_usec = (ms % 1000) * 1000;
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
 
-    select (0, NULL, NULL, NULL, &tv);
+    rc = card->net_input_lost;
+#ifndef _WIN32
+    rc += card->remoteDropped;
 #endif
+
+    UnlockAndRefcount(card);
+    return rc;
 }
 
 
 /* ----
- * Open8055_GetAutoFlush()
+ * Open8055_GetDroppedReports()
  *
- *  Return the current autoFlush setting.
+ *  Return the number of INPUT reports the card sent but this
+ *  connection never received, detected by gaps in the report
+ *  sequence numbers. A server side SUBSCRIBE filter causes gaps
+ *  as well.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_GetAutoFlush(int h)
+Open8055_GetDroppedReports(int h)
 {
     Open8055_card_t *card;
-    int             rc = 0;
+    int             rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if(card->autoFlush)
-        rc = 1;
+    rc = card->inputDropped;
 
     UnlockAndRefcount(card);
     return rc;
@@ -1001,43 +1420,44 @@ Open8055_GetAutoFlush(int h)
 
 
 /* ----
- * Open8055_SetAutoFlush()
+ * Open8055_GetInputSequence()
  *
- *  Set the auto flush feature.
+ *  Return the sequence number of the current INPUT report.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_SetAutoFlush(int h, int flag)
+Open8055_GetInputSequence(int h)
 {
     Open8055_card_t *card;
-    int             rc = 0;
+    int             rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    card->autoFlush = (flag != FALSE);
+    rc = ntohs(card->currentInput.inputSequence);
 
-    if (card->autoFlush)
-    {
-        if (card->pendingConfig1)
-        {
-            if (CardWrite(card, &(card->currentConfig1)) < 0)
-                rc = -1;
-            else
-                card->pendingConfig1 = FALSE;
-        }
+    UnlockAndRefcount(card);
+    return rc;
+}
 
-        if (rc == 0 && card->pendingOutput)
-        {
-            if (CardWrite(card, &(card->currentOutput)) < 0)
-                rc = -1;
-            else
-            {
-                card->pendingOutput = FALSE;
-                card->currentOutput.resetCounter = 0x00;
-            }
-        }
-    }
+
+/* ----
+ * Open8055_GetInputTimestamp()
+ *
+ *  Return the card time in milliseconds, with 0.1 ms resolution,
+ *  at which the current INPUT report was created.
+ * ----
+ */
+OPEN8055_EXTERN double OPEN8055_CDECL
+Open8055_GetInputTimestamp(int h)
+{
+    Open8055_card_t *card;
+    double          rc;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1.0;
+
+    rc = card->inputDeviceTime;
 
     UnlockAndRefcount(card);
     return rc;
@@ -1045,71 +1465,48 @@ Open8055_SetAutoFlush(int h, int flag)
 
 
 /* ----
- * Open8055_Flush()
+ * Open8055_GetLatency()
  *
- *  Send pending changes to the card.
+ *  Return how much longer in milliseconds the current INPUT report
+ *  took from the card to us than the fastest recent one.
  * ----
  */
-OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_Flush(int h)
+OPEN8055_EXTERN double OPEN8055_CDECL
+Open8055_GetLatency(int h)
 {
     Open8055_card_t *card;
-    int         rc = 0;
+    double          rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
-        return -1;
-
-    if (card->pendingConfig1)
-    {
-        if (CardWrite(card, &(card->currentConfig1)) < 0)
-            rc = -1;
-        else
-            card->pendingConfig1 = FALSE;
-    }
+        return -1.0;
 
-    if (rc == 0 && card->pendingOutput)
-    {
-        if (CardWrite(card, &(card->currentOutput)) < 0)
-            return -1;
-        else
-        {
-            card->pendingOutput = FALSE;
-            card->currentOutput.resetCounter = 0x00;
-        }
-    }
+    rc = card->inputLatency;
 
+    UnlockAndRefcount(card);
     return rc;
 }
 
 
 /* ----
- * Open8055_GetInput()
+ * Open8055_GetClockDrift()
  *
- *  Read a digital input port.
+ *  Return the deviation of the card clock from the host clock in
+ *  parts per million. Positive values mean the card clock is fast.
+ *  This is zero until the card has been reporting for a few seconds.
  * ----
  */
-OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_GetInput(int h, int port)
+OPEN8055_EXTERN double OPEN8055_CDECL
+Open8055_GetClockDrift(int h)
 {
     Open8055_card_t *card;
-    int         rc = 0;
+    double          rc = 0.0;
 
     if ((card = LockAndRefcount(h)) == NULL)
-        return -1;
-
-    if (port < 0 || port > 4)
-    {
-        SetError(card, "parameter invalid");
-        UnlockAndRefcount(card);
-        return -1;
-    }
+        return 0.0;
 
-    /* ----
-     * Mark all digital inputs as consumed and return the current state.
-     * ----
-     */
-    rc = (card->currentInput.inputBits & (1 << port)) ? 1 : 0;
-    card->currentInputUnconsumed &= ~(OPEN8055_INPUT_I1 << port);
+    if (card->clockHaveFirst && card->clockLastStart > card->clockFirstStart)
+        rc = (card->clockFirstMin - card->clockLastMin) * 1000000.0 /
+             (card->clockLastStart - card->clockFirstStart);
 
     UnlockAndRefcount(card);
     return rc;
@@ -1117,26 +1514,22 @@ Open8055_GetInput(int h, int port)
 
 
 /* ----
- * Open8055_GetInputAll()
+ * Open8055_GetSampleInterval()
  *
- *  Read the 5 digital input ports
+ *  Return the burst sampling interval in milliseconds. Zero means
+ *  burst sampling is off.
  * ----
  */
-OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_GetInputAll(int h)
+OPEN8055_EXTERN double OPEN8055_CDECL
+Open8055_GetSampleInterval(int h)
 {
     Open8055_card_t *card;
-    int         rc = 0;
+    double          rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
-        return -1;
+        return -1.0;
 
-    /* ----
-     * Mark all digital inputs as consumed and return the current state.
-     * ----
-     */
-    card->currentInputUnconsumed &= ~OPEN8055_INPUT_I_ANY;
-    rc = card->currentInput.inputBits;
+    rc = (double)card->currentConfig2.sampleInterval / OPEN8055_TIMESTAMP_PER_MS;
 
     UnlockAndRefcount(card);
     return rc;
@@ -1144,33 +1537,47 @@ Open8055_GetInputAll(int h)
 
 
 /* ----
- * Open8055_GetCounter()
+ * Open8055_SetSampleInterval()
  *
- *  Read the current value of a counter.
+ *  Turn burst sampling on with the given interval in milliseconds,
+ *  rounded to 0.1 ms, or off with zero. The card then sends the ADC
+ *  values and digital inputs of several samples per report, which
+ *  Open8055_ReadSamples() returns.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_GetCounter(int h, int port)
+Open8055_SetSampleInterval(int h, double ms)
 {
     Open8055_card_t *card;
-    int         rc = 0;
+    int             ticks;
+    int             rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 4)
+    ticks = (int)floor(ms * OPEN8055_TIMESTAMP_PER_MS + 0.5);
+    if (ticks < 0 || ticks > 255)
     {
         SetError(card, "parameter invalid");
         UnlockAndRefcount(card);
         return -1;
     }
+    if (ticks != 0 && ticks < OPEN8055_BURST_INTERVAL_MIN)
+        ticks = OPEN8055_BURST_INTERVAL_MIN;
 
     /* ----
-     * Mark the counter consumed.
+     * A server only sends the burst reports if we ask for them.
      * ----
      */
-    card->currentInputUnconsumed &= ~(OPEN8055_INPUT_COUNT1 << port);
-    rc = ntohs(card->currentInput.inputCounter[port]);
+    if (!card->isLocal && CardAcceptBurst(card) < 0)
+    {
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    card->currentConfig2.sampleInterval = ticks;
+    card->burstLastInterval = 0;
+    rc = CardConfig2Changed(card);
 
     UnlockAndRefcount(card);
     return rc;
@@ -1178,46 +1585,22 @@ Open8055_GetCounter(int h, int port)
 
 
 /* ----
- * Open8055_ResetCounter()
+ * Open8055_GetReportPeriod()
  *
- *  Reset an individual input counter.
+ *  Return the INPUT report period in milliseconds. Zero means the
+ *  card reports whenever the input state changes.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_ResetCounter(int h, int port)
+Open8055_GetReportPeriod(int h)
 {
     Open8055_card_t *card;
-    int         rc = 0;
+    int             rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 4)
-    {
-        SetError(card, "parameter invalid");
-        UnlockAndRefcount(card);
-        return -1;
-    }
-
-    /* ----
-     * Set the value and send it if in autoFlush mode.
-     * ----
-     */
-    card->currentOutput.resetCounter |= (1 << port);
-    if (card->autoFlush)
-    {
-        if (CardWrite(card, &(card->currentOutput)) < 0)
-            rc = -1;
-        else
-        {
-            card->pendingOutput = FALSE;
-            card->currentOutput.resetCounter = 0x00;
-        }
-    }
-    else
-    {
-        card->pendingOutput = TRUE;
-    }
+    rc = ntohs(card->currentConfig2.reportPeriod);
 
     UnlockAndRefcount(card);
     return rc;
@@ -1225,68 +1608,52 @@ Open8055_ResetCounter(int h, int port)
 
 
 /* ----
- * Open8055_ResetCounterAll()
+ * Open8055_SetReportPeriod()
  *
- *  Reset all input counters.
+ *  Make the card send an INPUT report every ms milliseconds, changed
+ *  or not, or with zero only when the input state changed.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_ResetCounterAll(int h)
+Open8055_SetReportPeriod(int h, int ms)
 {
     Open8055_card_t *card;
-    int         rc = 0;
+    int             rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    /* ----
-     * Set the value and send it if in autoFlush mode.
-     * ----
-     */
-    card->currentOutput.resetCounter |= 0x1F;
-    if (card->autoFlush)
-    {
-        if (CardWrite(card, &(card->currentOutput)) < 0)
-            rc = -1;
-        else
-        {
-            card->pendingOutput = FALSE;
-            card->currentOutput.resetCounter = 0x00;
-        }
-    }
-    else
+    if (ms < 0 || ms > 65535)
     {
-        card->pendingOutput = TRUE;
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
     }
 
+    card->currentConfig2.reportPeriod = htons((uint16_t)ms);
+    rc = CardConfig2Changed(card);
+
     UnlockAndRefcount(card);
     return rc;
 }
 
 
 /* ----
- * Open8055_GetDebounce()
+ * Open8055_GetAdcHysteresis()
  *
- *  Set the debounce value of a digital input.
+ *  Return the ADC hysteresis of the report on change mode.
  * ----
  */
-OPEN8055_EXTERN double OPEN8055_CDECL
-Open8055_GetDebounce(int h, int port)
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_GetAdcHysteresis(int h)
 {
     Open8055_card_t *card;
-    double      rc;
+    int             rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 4)
-    {
-        SetError(card, "parameter invalid");
-        UnlockAndRefcount(card);
-        return -1.0;
-    }
-
-    rc = (double)(ntohs(card->currentConfig1.debounceValue[port]) - 1) / 10.0;
+    rc = ntohs(card->currentConfig2.adcHysteresis);
 
     UnlockAndRefcount(card);
     return rc;
@@ -1294,48 +1661,30 @@ Open8055_GetDebounce(int h, int port)
 
 
 /* ----
- * Open8055_SetDebounce()
+ * Open8055_SetAdcHysteresis()
  *
- *  Set the debounce value of a digital input.
+ *  Without a report period, an ADC value must change by more than
+ *  this many units to cause an INPUT report.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_SetDebounce(int h, int port, double ms)
+Open8055_SetAdcHysteresis(int h, int value)
 {
     Open8055_card_t *card;
-    int         rc = 0;
+    int             rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 4)
+    if (value < 0 || value > 1023)
     {
         SetError(card, "parameter invalid");
         UnlockAndRefcount(card);
         return -1;
     }
 
-    if (ms < 0.0)
-        ms = 0.0;
-    if (ms > 5000.0)
-        ms = 5000.0;
-
-    /* ----
-     * Set the value and send it if in autoFlush mode.
-     * ----
-     */
-    card->currentConfig1.debounceValue[port] = htons((uint16_t)floor(ms * 10.0) + 1);
-    if (card->autoFlush)
-    {
-        if (CardWrite(card, &(card->currentConfig1)) < 0)
-            rc = -1;
-        else
-            card->pendingConfig1 = FALSE;
-    }
-    else
-    {
-        card->pendingConfig1 = TRUE;
-    }
+    card->currentConfig2.adcHysteresis = htons((uint16_t)value);
+    rc = CardConfig2Changed(card);
 
     UnlockAndRefcount(card);
     return rc;
@@ -1343,40 +1692,23 @@ Open8055_SetDebounce(int h, int port, double ms)
 
 
 /* ----
- * Open8055_GetADC()
+ * Open8055_GetAverageWindow()
  *
- *  Read the current value of an ADC
+ *  Return the length of the ADC averaging window in milliseconds.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_GetADC(int h, int port)
+Open8055_GetAverageWindow(int h)
 {
     Open8055_card_t *card;
-    int         rc = 0;
+    int             rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 1)
-    {
-        SetError(card, "parameter error");
-        UnlockAndRefcount(card);
-        return -1;
-    }
-
-    /* ----
-     * Mark the counter consumed.
-     * ----
-     */
-    card->currentInputUnconsumed &= ~(OPEN8055_INPUT_ADC1 << port);
-    rc = ntohs(card->currentInput.inputAdcValue[port]);
-    switch(card->currentConfig1.modeADC[port])
-    {
-        case OPEN8055_MODE_ADC9:        rc >>= 1;
-                                        break;
-        case OPEN8055_MODE_ADC8:        rc >>= 2;
-                                        break;
-    }
+    rc = card->currentConfig2.averageWindow;
+    if (rc == 0)
+        rc = OPEN8055_AVERAGE_WINDOW_DEFAULT;
 
     UnlockAndRefcount(card);
     return rc;
@@ -1384,178 +1716,211 @@ Open8055_GetADC(int h, int port)
 
 
 /* ----
- * Open8055_GetOutput()
+ * Open8055_SetAverageWindow()
  *
- *  Return one current digital output settings.
+ *  Set the number of milliseconds the card averages the ADC values
+ *  over. Shorter windows lower the latency, longer ones the noise.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_GetOutput(int h, int port)
+Open8055_SetAverageWindow(int h, int ms)
 {
     Open8055_card_t *card;
-    int         rc = 0;
+    int             rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 7)
+    if (ms < 1 || ms > 255)
     {
         SetError(card, "parameter invalid");
         UnlockAndRefcount(card);
         return -1;
     }
 
-    /* ----
-     * We have queried them at Connect and tracked them all the time.
-     * ----
-     */
-    rc = (card->currentOutput.outputBits & (1 << port)) ? 1 : 0;
+    card->currentConfig2.averageWindow = ms;
+    rc = CardConfig2Changed(card);
 
     UnlockAndRefcount(card);
     return rc;
 }
 
 
-
 /* ----
- * Open8055_GetOutputAll()
+ * Open8055_GetServoPeriod()
  *
- *  Return the current digital output settings.
+ *  Return the servo frame period in milliseconds.
  * ----
  */
-OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_GetOutputAll(int h)
+OPEN8055_EXTERN double OPEN8055_CDECL
+Open8055_GetServoPeriod(int h)
 {
     Open8055_card_t *card;
-    int         rc = 0;
+    int             ticks;
 
     if ((card = LockAndRefcount(h)) == NULL)
-        return -1;
+        return -1.0;
 
-    /* ----
-     * We have queried them at Connect and tracked them all the time.
-     * ----
-     */
-    rc = card->currentOutput.outputBits;
+    ticks = card->currentConfig2.servoPeriod;
+    if (ticks == 0)
+        ticks = OPEN8055_SERVO_PERIOD_DEFAULT;
 
     UnlockAndRefcount(card);
-    return rc;
+    return (double)ticks / OPEN8055_TIMESTAMP_PER_MS;
 }
 
 
-
 /* ----
- * Open8055_GetOutputValue()
+ * Open8055_SetServoPeriod()
  *
- *  Return the current digital output value used for modes like SERVO.
+ *  Set the time between the pulses of the servo outputs in
+ *  milliseconds, rounded to 0.1 ms. All servo outputs pulse
+ *  together once per period, 2.5 to 25.5 ms.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_GetOutputValue(int h, int port)
+Open8055_SetServoPeriod(int h, double ms)
 {
     Open8055_card_t *card;
-    int         rc = 0;
+    int             ticks;
+    int             rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 7)
+    ticks = (int)floor(ms * OPEN8055_TIMESTAMP_PER_MS + 0.5);
+    if (ticks < OPEN8055_SERVO_PERIOD_MIN || ticks > 255)
     {
         SetError(card, "parameter invalid");
         UnlockAndRefcount(card);
         return -1;
     }
 
-    /* ----
-     * We have queried them at Connect and tracked them all the time.
-     * ----
-     */
-    rc = ntohs(card->currentOutput.outputValue[port]);
+    card->currentConfig2.servoPeriod = ticks;
+    rc = CardConfig2Changed(card);
 
     UnlockAndRefcount(card);
     return rc;
 }
 
 
-
 /* ----
- * Open8055_GetPWM()
+ * Open8055_LoadSequence()
  *
- *  Return the current setting of a PWM output
+ *  Load an output sequence of up to OPEN8055_SEQUENCE_ROWS rows into
+ *  the card. Row i sets the digital outputs to outputBits[i] and, if
+ *  channel[i] isn't OPEN8055_SEQUENCE_CHANNEL_NONE, the output value
+ *  or PWM channel to value[i], time_ms[i] milliseconds after the
+ *  start of the sequence. The times are rounded to 0.1 ms and must
+ *  not decrease. The sequence of a running player cannot be changed.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_GetPWM(int h, int port)
+Open8055_LoadSequence(int h, int numRows, const double *time_ms,
+		      const int *outputBits, const int *channel, const int *value)
 {
-    Open8055_card_t *card;
-    int         rc = 0;
+    Open8055_card_t	    *card;
+    Open8055_hidMessage_t   message;
+    Open8055_seqRow_t	    *row;
+    int			    ticks;
+    int			    lastTicks = 0;
+    int			    i;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 1)
+    if (numRows < 1 || numRows > OPEN8055_SEQUENCE_ROWS)
     {
         SetError(card, "parameter invalid");
         UnlockAndRefcount(card);
         return -1;
     }
+    if (card->sequenceState != OPEN8055_SEQUENCE_IDLE)
+    {
+        SetError(card, "sequence is running");
+        UnlockAndRefcount(card);
+        return -1;
+    }
 
-    /* ----
-     * We have queried them at Connect and tracked them all the time.
-     * ----
-     */
-    rc = ntohs(card->currentOutput.outputPwmValue[port]);
+    memset(&message, 0, sizeof(message));
+    for (i = 0; i < numRows; i++)
+    {
+	ticks = (int)floor(time_ms[i] * OPEN8055_TIMESTAMP_PER_MS + 0.5);
+	if (ticks < lastTicks || ticks > 65535 ||
+	    outputBits[i] < 0 || outputBits[i] > 255 ||
+	    channel[i] < OPEN8055_SEQUENCE_CHANNEL_NONE ||
+	    channel[i] > OPEN8055_SEQUENCE_CHANNEL_PWM2 ||
+	    value[i] < 0 || value[i] > 65535)
+	{
+	    SetError(card, "parameter invalid");
+	    UnlockAndRefcount(card);
+	    return -1;
+	}
+	lastTicks = ticks;
+
+	/* ----
+	 * Send the rows in chunks of OPEN8055_SEQUENCE_ROWS_PER_MSG.
+	 * ----
+	 */
+	if (i % OPEN8055_SEQUENCE_ROWS_PER_MSG == 0)
+	{
+	    message.msgType = OPEN8055_HID_MESSAGE_SETSEQUENCE;
+	    message.seqIndex = i;
+	    message.seqRows = 0;
+	}
+	row = &(message.seqRow[message.seqRows++]);
+	row->tick = htons((uint16_t)ticks);
+	row->outputBits = outputBits[i];
+	row->channel = channel[i];
+	row->value = htons((uint16_t)value[i]);
+
+	if (message.seqRows == OPEN8055_SEQUENCE_ROWS_PER_MSG || i == numRows - 1)
+	{
+	    if (CardWrite(card, &message) < 0)
+	    {
+		UnlockAndRefcount(card);
+		return -1;
+	    }
+	}
+    }
+    card->sequenceRows = numRows;
 
     UnlockAndRefcount(card);
-    return rc;
+    return 0;
 }
 
 
 /* ----
- * Open8055_SetOutput()
+ * Open8055_StartSequence()
  *
- *  Change one digital output.
+ *  Start the loaded sequence. It is played loops times, or forever
+ *  with zero. Without a trigger it starts right away, a trigger of
+ *  n starts it on the rising edge of digital input n (1..5), one of
+ *  -n on the falling edge.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_SetOutput(int h, int port, int val)
+Open8055_StartSequence(int h, int loops, int trigger)
 {
     Open8055_card_t *card;
-    int         rc = 0;
+    int             rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 7)
+    if (card->sequenceRows == 0 || loops < 0 || loops > 65535 ||
+	trigger < -5 || trigger > 5)
     {
         SetError(card, "parameter invalid");
         UnlockAndRefcount(card);
         return -1;
     }
+    if (trigger < 0)
+	trigger = -trigger | OPEN8055_SEQUENCE_TRIGGER_FALLING;
 
-    /* ----
-     * Set or clear the bit and send the new info if in autoFlush mode.
-     * ----
-     */
-    if (val)
-        card->currentOutput.outputBits |= (1 << port);
-    else
-        card->currentOutput.outputBits &= ~(1 << port);
-
-    if (card->autoFlush)
-    {
-        if (CardWrite(card, &(card->currentOutput)) < 0)
-            rc = -1;
-        else
-        {
-            card->pendingOutput = FALSE;
-            card->currentOutput.resetCounter = 0x00;
-        }
-    }
-    else
-    {
-        card->pendingOutput = TRUE;
-    }
+    rc = CardSequenceCommand(card, OPEN8055_SEQUENCE_START, trigger, loops);
+    if (rc == 0)
+	card->sequenceState = OPEN8055_SEQUENCE_ARMED;
 
     UnlockAndRefcount(card);
     return rc;
@@ -1563,41 +1928,23 @@ Open8055_SetOutput(int h, int port, int val)
 
 
 /* ----
- * Open8055_SetOutputAll()
+ * Open8055_StopSequence()
  *
- *  Change all 8 digital outputs.
+ *  Stop the sequence player. The outputs keep their current state.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_SetOutputAll(int h, int bits)
+Open8055_StopSequence(int h)
 {
     Open8055_card_t *card;
-    int         rc = 0;
+    int             rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    bits &= 0xff;
-
-    /* ----
-     * Set the bits and send them if in autoFlush mode.
-     * ----
-     */
-    card->currentOutput.outputBits = bits;
-    if (card->autoFlush)
-    {
-        if (CardWrite(card, &(card->currentOutput)) < 0)
-            rc = -1;
-        else
-        {
-            card->pendingOutput = FALSE;
-            card->currentOutput.resetCounter = 0x00;
-        }
-    }
-    else
-    {
-        card->pendingOutput = TRUE;
-    }
+    rc = CardSequenceCommand(card, OPEN8055_SEQUENCE_STOP, 0, 0);
+    if (rc == 0)
+	card->sequenceState = OPEN8055_SEQUENCE_IDLE;
 
     UnlockAndRefcount(card);
     return rc;
@@ -1605,133 +1952,101 @@ Open8055_SetOutputAll(int h, int bits)
 
 
 /* ----
- * Open8055_SetOutputValue()
+ * Open8055_GetSequenceState()
  *
- *  Change one digital output value used in modes like SERVO.
+ *  Return the state of the sequence player as last reported by the
+ *  card, OPEN8055_SEQUENCE_IDLE, _ARMED or _RUNNING.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_SetOutputValue(int h, int port, int val)
+Open8055_GetSequenceState(int h)
 {
     Open8055_card_t *card;
-    int         rc = 0;
+    int             rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 7)
-    {
-        SetError(card, "parameter invalid");
-        UnlockAndRefcount(card);
-        return -1;
-    }
+    rc = card->sequenceState;
 
-    switch(card->currentConfig1.modeOutput[port])
-    {
-        case OPEN8055_MODE_OUTPUT:      // value makes no sense in OUTPUT mode.
-            val = 0;
-            break;
+    UnlockAndRefcount(card);
+    return rc;
+}
 
-        case OPEN8055_MODE_SERVO:       // limit value to 500..2500ms in SERVO modes.
-        case OPEN8055_MODE_ISERVO:
-            if (val < 6000)
-                val = 6000;
-            if (val > 30000)
-                val = 30000;
-            break;
 
-        default:
-            val = 0;
-            break;
-    }
+/* ----
+ * Open8055_ReadSamples()
+ *
+ *  Return up to maxSamples of the burst samples received so far,
+ *  oldest first, and remove them from the history. Each of the
+ *  arrays may be NULL. Samples are collected while Open8055_Wait()
+ *  and friends read the reports of the card.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_ReadSamples(int h, double *timestamp, int *inputBits,
+		     int *adcValue1, int *adcValue2, int maxSamples)
+{
+    Open8055_card_t	*card;
+    Open8055_sample_t	*sample;
+    int			n;
 
-    /* ----
-     * Set the value in currentOutput and send the new info if in autoFlush mode.
-     * ----
-     */
-    card->currentOutput.outputValue[port] = htons(val);
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
 
-    if (card->autoFlush)
-    {
-        if (CardWrite(card, &(card->currentOutput)) < 0)
-            rc = -1;
-        else
-        {
-            card->pendingOutput = FALSE;
-            card->currentOutput.resetCounter = 0x00;
-        }
-    }
-    else
+    for (n = 0; n < maxSamples && card->historyCount > 0; n++)
     {
-        card->pendingOutput = TRUE;
+	sample = &(card->history[card->historyHead]);
+	if (timestamp != NULL)
+	    timestamp[n] = sample->timestamp;
+	if (inputBits != NULL)
+	    inputBits[n] = sample->inputBits;
+	if (adcValue1 != NULL)
+	    adcValue1[n] = sample->adcValue[0];
+	if (adcValue2 != NULL)
+	    adcValue2[n] = sample->adcValue[1];
+
+	card->historyHead = (card->historyHead + 1) % OPEN8055_HISTORY_SIZE;
+	card->historyCount--;
     }
 
     UnlockAndRefcount(card);
-    return rc;
+    return n;
 }
 
 
 /* ----
- * Open8055_SetPWM()
+ * Open8055_GetLostSamples()
  *
- *  Change one of the PWM outputs.
+ *  Return the number of burst samples that were lost, because the
+ *  card, the server or the history dropped them.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_SetPWM(int h, int port, int value)
+Open8055_GetLostSamples(int h)
 {
     Open8055_card_t *card;
-    int         rc = 0;
+    int             rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 1)
-    {
-        SetError(card, "parameter invalid");
-        UnlockAndRefcount(card);
-        return 0;
-    }
-
-    if (value < 0)
-        value = 0;
-    if (value > 1023)
-        value = 1023;
-
-    /* ----
-     * Set the new PWM value and send it if in autoFlush mode.
-     * ----
-     */
-    card->currentOutput.outputPwmValue[port] = htons(value);
-    if (card->autoFlush)
-    {
-        if (CardWrite(card, &(card->currentOutput)) < 0)
-            rc = -1;
-        else
-        {
-            card->pendingOutput = FALSE;
-            card->currentOutput.resetCounter = 0x00;
-        }
-    }
-    else
-    {
-        card->pendingOutput = TRUE;
-    }
+    rc = card->historyLost;
 
     UnlockAndRefcount(card);
     return rc;
 }
 
 
-
 /* ----
- * Open8055_GetModeADC()
+ * Open8055_GetEdgeCapture()
  *
- *  Return the operation mode of an analog input.
+ *  Return the bit mask of the digital inputs whose edges are
+ *  captured.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_GetModeADC(int h, int port)
+Open8055_GetEdgeCapture(int h)
 {
     Open8055_card_t *card;
     int             rc;
@@ -1739,14 +2054,7 @@ Open8055_GetModeADC(int h, int port)
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 1)
-    {
-        SetError(card, "parameter invalid");
-        UnlockAndRefcount(card);
-        return -1;
-    }
-
-    rc = card->currentConfig1.modeADC[port];
+    rc = card->currentConfig2.edgeMask;
 
     UnlockAndRefcount(card);
     return rc;
@@ -1754,133 +2062,106 @@ Open8055_GetModeADC(int h, int port)
 
 
 /* ----
- * Open8055_SetModeADC()
+ * Open8055_SetEdgeCapture()
  *
- *  Set the operation mode of an analog input.
+ *  Capture the edges of the digital inputs in mask (bit 0 is input
+ *  1), or of none with zero. The card stamps every debounced change
+ *  of these inputs with its 0.1 ms clock, Open8055_ReadEdges()
+ *  returns them.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_SetModeADC(int h, int port, int mode)
+Open8055_SetEdgeCapture(int h, int mask)
 {
     Open8055_card_t *card;
-    int             rc = 0;
+    int             rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 1)
+    if (mask < 0 || mask > OPEN8055_EDGE_INPUT_MASK)
     {
-        SetError(card, "parameter error");
+        SetError(card, "parameter invalid");
         UnlockAndRefcount(card);
         return -1;
     }
 
-    if (mode == OPEN8055_MODE_ADC10 || mode == OPEN8055_MODE_ADC9 || mode == OPEN8055_MODE_ADC8)
+    /* ----
+     * A server only sends the edge reports if we ask for them.
+     * ----
+     */
+    if (!card->isLocal && CardAcceptEdges(card) < 0)
     {
-        card->currentConfig1.modeADC[port] = mode;
-        if (card->autoFlush)
-        {
-            if (CardWrite(card, &(card->currentConfig1)) < 0)
-                rc = -1;
-            else
-                card->pendingConfig1 = FALSE;
-        }
-        else
-        {
-            card->pendingConfig1 = TRUE;
-        }
+        UnlockAndRefcount(card);
+        return -1;
     }
 
+    card->currentConfig2.edgeMask = mask;
+    rc = CardConfig2Changed(card);
+
     UnlockAndRefcount(card);
     return rc;
 }
 
 
 /* ----
- * Open8055_GetModeInput()
+ * Open8055_ReadEdges()
  *
- *  Return the operation mode of a digital input.
+ *  Return up to maxEdges of the input edges received so far, oldest
+ *  first, and remove them from the history. For each edge the card
+ *  time in ms, the input port and the level after the edge are
+ *  returned. The time is one debounce time after the raw edge. Each
+ *  of the arrays may be NULL.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_GetModeInput(int h, int port)
+Open8055_ReadEdges(int h, double *timestamp, int *port, int *level,
+		   int maxEdges)
 {
-    Open8055_card_t *card;
-    int             rc;
+    Open8055_card_t	*card;
+    Open8055_edgeEvent_t *event;
+    int			n;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 4)
+    for (n = 0; n < maxEdges && card->edgeCount > 0; n++)
     {
-        SetError(card, "parameter invalid");
-        UnlockAndRefcount(card);
-        return -1;
+	event = &(card->edgeHistory[card->edgeHead]);
+	if (timestamp != NULL)
+	    timestamp[n] = event->timestamp;
+	if (port != NULL)
+	    port[n] = event->port;
+	if (level != NULL)
+	    level[n] = event->level;
+
+	card->edgeHead = (card->edgeHead + 1) % OPEN8055_EDGE_HISTORY_SIZE;
+	card->edgeCount--;
     }
 
-    rc = card->currentConfig1.modeInput[port];
-
     UnlockAndRefcount(card);
-    return rc;
+    return n;
 }
 
 
 /* ----
- * Open8055_SetModeInput()
+ * Open8055_GetLostEdges()
  *
- *  Set the operation mode of a digital input.
+ *  Return the number of edges that were lost, because the card's
+ *  queue or the history was full. A lost event of the card may have
+ *  held edges of several inputs.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_SetModeInput(int h, int port, int mode)
+Open8055_GetLostEdges(int h)
 {
     Open8055_card_t *card;
-    int             rc = 0;
+    int             rc;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 4)
-    {
-        SetError(card, "parameter error");
-        UnlockAndRefcount(card);
-        return -1;
-    }
-
-    if (mode == OPEN8055_MODE_INPUT || mode == OPEN8055_MODE_FREQUENCY)
-    {
-        card->currentConfig1.modeInput[port] = mode;
-        if (card->autoFlush)
-        {
-            if (CardWrite(card, &(card->currentConfig1)) < 0)
-                rc = -1;
-            else
-                card->pendingConfig1 = FALSE;
-        }
-        else
-        {
-            card->pendingConfig1 = TRUE;
-        }
-        /* ----
-         * Changing input mode also causes a counter reset.
-         * ----
-         */
-        card->currentOutput.resetCounter |= (1 << port);
-        if (card->autoFlush)
-        {
-            if (CardWrite(card, &(card->currentOutput)) < 0)
-                rc = -1;
-            else
-            {
-                card->pendingOutput = FALSE;
-                card->currentOutput.resetCounter = 0x00;
-            }
-        }
-        else
-        {
-            card->pendingOutput = TRUE;
-        }
-    }
+    rc = card->edgeLost;
 
     UnlockAndRefcount(card);
     return rc;
@@ -1888,28 +2169,50 @@ Open8055_SetModeInput(int h, int port, int mode)
 
 
 /* ----
- * Open8055_GetModeOutput()
+ * Open8055_GetAutoFlush()
  *
- *  Return the operation mode of a digital output.
+ *  Return the current autoFlush setting.
+ * ----
+ */
+OPEN8055_EXTERN void OPEN8055_CDECL
+Open8055_Sleep(int ms)
+{
+#ifdef _WIN32
+    if (ms < 0)
+        ms = 0;
+
+    Sleep((DWORD)ms);
+#else
+    struct timeval  tv;
+
+    if (ms < 0)
+        ms = 0;
+
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+
+    select (0, NULL, NULL, NULL, &tv);
+#endif
+}
+
+
+/* ----
+ * Open8055_GetAutoFlush()
+ *
+ *  Return the current autoFlush setting.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_GetModeOutput(int h, int port)
+Open8055_GetAutoFlush(int h)
 {
     Open8055_card_t *card;
-    int             rc;
+    int             rc = 0;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 7)
-    {
-        SetError(card, "parameter invalid");
-        UnlockAndRefcount(card);
-        return -1;
-    }
-
-    rc = card->currentConfig1.modeOutput[port];
+    if(card->autoFlush)
+        rc = 1;
 
     UnlockAndRefcount(card);
     return rc;
@@ -1917,90 +2220,48 @@ Open8055_GetModeOutput(int h, int port)
 
 
 /* ----
- * Open8055_SetModeOutput()
+ * Open8055_SetAutoFlush()
  *
- *  Set the operation mode of a digital output.
+ *  Set the auto flush feature.
  * ----
  */
 OPEN8055_EXTERN int OPEN8055_CDECL
-Open8055_SetModeOutput(int h, int port, int mode)
+Open8055_SetAutoFlush(int h, int flag)
 {
     Open8055_card_t *card;
     int             rc = 0;
-    int             val;
 
     if ((card = LockAndRefcount(h)) == NULL)
         return -1;
 
-    if (port < 0 || port > 7)
-    {
-        SetError(card, "parameter invalid");
-        UnlockAndRefcount(card);
-        return -1;
-    }
-
-    val = ntohs(card->currentOutput.outputValue[port]);
-    switch (mode)
-    {
-        case OPEN8055_MODE_OUTPUT:
-            val = 0;
-            break;
-
-        case OPEN8055_MODE_SERVO:
-        case OPEN8055_MODE_ISERVO:
-            /* ----
-             * When we enter SERVO mode, we set the pulse width to center.
-             * Otherwise we constrain the pulse width to 0.5 .. 2.5 ms.
-             * ----
-             */
-            if (card->currentConfig1.modeOutput[port] != OPEN8055_MODE_SERVO &&
-                card->currentConfig1.modeOutput[port] != OPEN8055_MODE_ISERVO)
-            {
-                val = 18000;
-            }
-            else
-            {
-                if (val < 6000)
-                    val = 6000;
-                if (val > 30000)
-                    val = 30000;
-            }
-            break;
-
-        default:
-            val = 0;
-            break;
-    }
-    val = htons(val);
+    card->autoFlush = (flag != FALSE);
 
-    if (mode == OPEN8055_MODE_OUTPUT || mode == OPEN8055_MODE_SERVO || mode == OPEN8055_MODE_ISERVO)
+    if (card->autoFlush)
     {
-        card->currentConfig1.modeOutput[port] = mode;
-        if (card->autoFlush)
+        if (card->pendingConfig1)
         {
             if (CardWrite(card, &(card->currentConfig1)) < 0)
                 rc = -1;
             else
                 card->pendingConfig1 = FALSE;
         }
-        else
+
+        if (rc == 0 && card->pendingConfig2)
         {
-            card->pendingConfig1 = TRUE;
+            if (CardWrite(card, &(card->currentConfig2)) < 0)
+                rc = -1;
+            else
+                card->pendingConfig2 = FALSE;
         }
 
-        if (val != card->currentOutput.outputValue[port])
+        if (rc == 0 && card->pendingOutput)
         {
-            card->currentOutput.outputValue[port] = val;
-            if (card->autoFlush)
-            {
-                if (CardWrite(card, &(card->currentOutput)) < 0)
-                    rc = -1;
-                else
-                    card->pendingOutput = FALSE;
-            }
+            if (CardWrite(card, &(card->currentOutput)) < 0)
+                rc = -1;
             else
             {
-                card->pendingOutput = TRUE;
+                card->pendingOutput = FALSE;
+                card->currentOutput.resetCounter = 0x00;
             }
         }
     }
@@ -2010,342 +2271,2341 @@ Open8055_SetModeOutput(int h, int port, int mode)
 }
 
 
-/* ----------------------------------------------------------------------
- * Local functions follow
- * ----------------------------------------------------------------------
+/* ----
+ * Open8055_Flush()
+ *
+ *  Send pending changes to the card.
+ * ----
  */
-
-static int
-Open8055_Init(void)
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_Flush(int h)
 {
-    if (initialized)
-        return 0;
+    Open8055_card_t *card;
+    int         rc = 0;
 
-    LockCreate(&connectionsLock);
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
 
-    connectionsSize = 16;
-    connections = (Open8055_card_t **)malloc(sizeof(Open8055_card_t *) * 16);
-    if (connections == NULL)
+    if (card->pendingConfig1)
     {
-        SetError(NULL, "out of memory");
-        return -1;
+        if (CardWrite(card, &(card->currentConfig1)) < 0)
+            rc = -1;
+        else
+            card->pendingConfig1 = FALSE;
     }
 
-    if (DeviceInit() < 0)
-        return -1;
+    if (rc == 0 && card->pendingConfig2)
+    {
+        if (CardWrite(card, &(card->currentConfig2)) < 0)
+            rc = -1;
+        else
+            card->pendingConfig2 = FALSE;
+    }
 
-#ifdef _WIN32
-    if (WSAStartup(MAKEWORD(2,2), &WSAData) != 0)
+    if (rc == 0 && card->pendingOutput)
     {
-    	SetError(NULL, "WSAStartup() failed");
-	return -1;
+        if (CardWrite(card, &(card->currentOutput)) < 0)
+            return -1;
+        else
+        {
+            card->pendingOutput = FALSE;
+            card->currentOutput.resetCounter = 0x00;
+        }
     }
-#endif
 
-    initialized = TRUE;
-    return 0;
+    return rc;
 }
 
 
-static Open8055_card_t *
-LockAndRefcount(int h)
+/* ----
+ * Open8055_GetInput()
+ *
+ *  Read a digital input port.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_GetInput(int h, int port)
 {
-    Open8055_card_t     *card;
-
-    if (!initialized)
-    {
-        if (Open8055_Init() < 0)
-            return NULL;
-    }
+    Open8055_card_t *card;
+    int         rc = 0;
 
-    LockAcquire(&connectionsLock);
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
 
-    if (h < 0 || h >= connectionsUsed || connections[h] == NULL)
+    if (port < 0 || port > 4)
     {
-        SetError(NULL, "invalid card handle %d", h);
-        LockRelease(&connectionsLock);
-        return NULL;
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
     }
 
-    card = connections[h];
-    LockAcquire(&(card->cardLock));
-    LockRelease(&connectionsLock);
-    card->cardRefcount++;
-
-    return card;
-}
-
+    /* ----
+     * Mark all digital inputs as consumed and return the current state.
+     * ----
+     */
+    rc = (card->currentInput.inputBits & (1 << port)) ? 1 : 0;
+    card->currentInputUnconsumed &= ~(OPEN8055_INPUT_I1 << port);
 
-static void
-UnlockAndRefcount(Open8055_card_t *card)
-{
-    card->cardRefcount--;
-    LockRelease(&(card->cardLock));
-    return;
+    UnlockAndRefcount(card);
+    return rc;
 }
 
 
 /* ----
- * SetError()
+ * Open8055_GetInputAll()
  *
- *  Save an error message in the lastErrorMessage buffer.
+ *  Read the 5 digital input ports
  * ----
  */
-static void
-SetError(Open8055_card_t *card, char *fmt, ...)
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_GetInputAll(int h)
 {
-    va_list     ap;
+    Open8055_card_t *card;
+    int         rc = 0;
 
-    va_start(ap, fmt);
-    if (card == NULL)
-        vsnprintf(lastErrorMessage, sizeof(lastErrorMessage), fmt, ap);
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    /* ----
+     * Mark all digital inputs as consumed and return the current state.
+     * ----
+     */
+    card->currentInputUnconsumed &= ~OPEN8055_INPUT_I_ANY;
+    rc = card->currentInput.inputBits;
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_GetCounter()
+ *
+ *  Read the current value of a counter.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_GetCounter(int h, int port)
+{
+    Open8055_card_t *card;
+    int         rc = 0;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 4)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    /* ----
+     * Mark the counter consumed.
+     * ----
+     */
+    card->currentInputUnconsumed &= ~(OPEN8055_INPUT_COUNT1 << port);
+    rc = ntohs(card->currentInput.inputCounter[port]);
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_GetFrequency()
+ *
+ *  Read the frequency in Hz of an input in frequency or period mode.
+ *  In frequency mode the card counts the edges of one second, in
+ *  period mode it measures the time between them with 0.01 Hz
+ *  resolution every OPEN8055_PERIOD_GATE_MS.
+ * ----
+ */
+OPEN8055_EXTERN double OPEN8055_CDECL
+Open8055_GetFrequency(int h, int port)
+{
+    Open8055_card_t *card;
+    double      rc;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1.0;
+
+    if (port < 0 || port > 4)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1.0;
+    }
+
+    switch (card->currentConfig1.modeInput[port])
+    {
+        case OPEN8055_MODE_FREQUENCY:
+            rc = (double)ntohs(card->currentInput.inputCounter[port]);
+            break;
+
+        case OPEN8055_MODE_PERIOD:
+            rc = (double)ntohs(card->currentInput.inputCounter[port]) /
+                    OPEN8055_PERIOD_PER_HZ;
+            break;
+
+        default:
+            SetError(card, "input not in frequency or period mode");
+            UnlockAndRefcount(card);
+            return -1.0;
+    }
+
+    /* ----
+     * Mark the counter consumed.
+     * ----
+     */
+    card->currentInputUnconsumed &= ~(OPEN8055_INPUT_COUNT1 << port);
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_ResetCounter()
+ *
+ *  Reset an individual input counter.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_ResetCounter(int h, int port)
+{
+    Open8055_card_t *card;
+    int         rc = 0;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 4)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    /* ----
+     * Set the value and send it if in autoFlush mode.
+     * ----
+     */
+    card->currentOutput.resetCounter |= (1 << port);
+    if (card->autoFlush)
+    {
+        if (CardWrite(card, &(card->currentOutput)) < 0)
+            rc = -1;
+        else
+        {
+            card->pendingOutput = FALSE;
+            card->currentOutput.resetCounter = 0x00;
+        }
+    }
     else
-        vsnprintf(card->errorMessage, sizeof(card->errorMessage), fmt, ap);
-    va_end(ap);
+    {
+        card->pendingOutput = TRUE;
+    }
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_ResetCounterAll()
+ *
+ *  Reset all input counters.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_ResetCounterAll(int h)
+{
+    Open8055_card_t *card;
+    int         rc = 0;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    /* ----
+     * Set the value and send it if in autoFlush mode.
+     * ----
+     */
+    card->currentOutput.resetCounter |= 0x1F;
+    if (card->autoFlush)
+    {
+        if (CardWrite(card, &(card->currentOutput)) < 0)
+            rc = -1;
+        else
+        {
+            card->pendingOutput = FALSE;
+            card->currentOutput.resetCounter = 0x00;
+        }
+    }
+    else
+    {
+        card->pendingOutput = TRUE;
+    }
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_GetDebounce()
+ *
+ *  Set the debounce value of a digital input.
+ * ----
+ */
+OPEN8055_EXTERN double OPEN8055_CDECL
+Open8055_GetDebounce(int h, int port)
+{
+    Open8055_card_t *card;
+    double      rc;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 4)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1.0;
+    }
+
+    rc = (double)(ntohs(card->currentConfig1.debounceValue[port]) - 1) / 10.0;
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_SetDebounce()
+ *
+ *  Set the debounce value of a digital input.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_SetDebounce(int h, int port, double ms)
+{
+    Open8055_card_t *card;
+    int         rc = 0;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 4)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    if (ms < 0.0)
+        ms = 0.0;
+    if (ms > 5000.0)
+        ms = 5000.0;
+
+    /* ----
+     * Set the value and send it if in autoFlush mode.
+     * ----
+     */
+    card->currentConfig1.debounceValue[port] = htons((uint16_t)floor(ms * 10.0) + 1);
+    if (card->autoFlush)
+    {
+        if (CardWrite(card, &(card->currentConfig1)) < 0)
+            rc = -1;
+        else
+            card->pendingConfig1 = FALSE;
+    }
+    else
+    {
+        card->pendingConfig1 = TRUE;
+    }
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_GetADC()
+ *
+ *  Read the current value of an ADC
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_GetADC(int h, int port)
+{
+    Open8055_card_t *card;
+    int         rc = 0;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 1)
+    {
+        SetError(card, "parameter error");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    /* ----
+     * Mark the counter consumed.
+     * ----
+     */
+    card->currentInputUnconsumed &= ~(OPEN8055_INPUT_ADC1 << port);
+    rc = ntohs(card->currentInput.inputAdcValue[port]);
+    switch(card->currentConfig1.modeADC[port])
+    {
+        case OPEN8055_MODE_ADC9:        rc >>= 1;
+                                        break;
+        case OPEN8055_MODE_ADC8:        rc >>= 2;
+                                        break;
+    }
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_GetOutput()
+ *
+ *  Return one current digital output settings.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_GetOutput(int h, int port)
+{
+    Open8055_card_t *card;
+    int         rc = 0;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 7)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    /* ----
+     * We have queried them at Connect and tracked them all the time.
+     * ----
+     */
+    rc = (card->currentOutput.outputBits & (1 << port)) ? 1 : 0;
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+
+/* ----
+ * Open8055_GetOutputAll()
+ *
+ *  Return the current digital output settings.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_GetOutputAll(int h)
+{
+    Open8055_card_t *card;
+    int         rc = 0;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    /* ----
+     * We have queried them at Connect and tracked them all the time.
+     * ----
+     */
+    rc = card->currentOutput.outputBits;
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+
+/* ----
+ * Open8055_GetOutputValue()
+ *
+ *  Return the current digital output value used for modes like SERVO.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_GetOutputValue(int h, int port)
+{
+    Open8055_card_t *card;
+    int         rc = 0;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 7)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    /* ----
+     * We have queried them at Connect and tracked them all the time.
+     * ----
+     */
+    rc = ntohs(card->currentOutput.outputValue[port]);
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+
+/* ----
+ * Open8055_GetPWM()
+ *
+ *  Return the current setting of a PWM output
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_GetPWM(int h, int port)
+{
+    Open8055_card_t *card;
+    int         rc = 0;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 1)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    /* ----
+     * We have queried them at Connect and tracked them all the time.
+     * The value of a PID driven output is reported by the card.
+     * ----
+     */
+    if (card->currentConfig1.modePWM[port] == OPEN8055_MODE_PID)
+        rc = ntohs(card->currentInput.inputPwmValue[port]);
+    else
+        rc = ntohs(card->currentOutput.outputPwmValue[port]);
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_SetOutput()
+ *
+ *  Change one digital output.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_SetOutput(int h, int port, int val)
+{
+    Open8055_card_t *card;
+    int         rc = 0;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 7)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    /* ----
+     * Set or clear the bit and send the new info if in autoFlush mode.
+     * ----
+     */
+    if (val)
+        card->currentOutput.outputBits |= (1 << port);
+    else
+        card->currentOutput.outputBits &= ~(1 << port);
+
+    if (card->autoFlush)
+    {
+        if (CardWrite(card, &(card->currentOutput)) < 0)
+            rc = -1;
+        else
+        {
+            card->pendingOutput = FALSE;
+            card->currentOutput.resetCounter = 0x00;
+        }
+    }
+    else
+    {
+        card->pendingOutput = TRUE;
+    }
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_SetOutputAll()
+ *
+ *  Change all 8 digital outputs.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_SetOutputAll(int h, int bits)
+{
+    Open8055_card_t *card;
+    int         rc = 0;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    bits &= 0xff;
+
+    /* ----
+     * Set the bits and send them if in autoFlush mode.
+     * ----
+     */
+    card->currentOutput.outputBits = bits;
+    if (card->autoFlush)
+    {
+        if (CardWrite(card, &(card->currentOutput)) < 0)
+            rc = -1;
+        else
+        {
+            card->pendingOutput = FALSE;
+            card->currentOutput.resetCounter = 0x00;
+        }
+    }
+    else
+    {
+        card->pendingOutput = TRUE;
+    }
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_SetOutputValue()
+ *
+ *  Change one digital output value used in modes like SERVO.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_SetOutputValue(int h, int port, int val)
+{
+    Open8055_card_t *card;
+    int         rc = 0;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 7)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    switch(card->currentConfig1.modeOutput[port])
+    {
+        case OPEN8055_MODE_OUTPUT:      // value makes no sense in OUTPUT mode.
+            val = 0;
+            break;
+
+        case OPEN8055_MODE_SERVO:       // limit value to 500..2500ms in SERVO modes.
+        case OPEN8055_MODE_ISERVO:
+            if (val < 6000)
+                val = 6000;
+            if (val > 30000)
+                val = 30000;
+            break;
+
+        default:
+            val = 0;
+            break;
+    }
+
+    /* ----
+     * Set the value in currentOutput and send the new info if in autoFlush mode.
+     * ----
+     */
+    card->currentOutput.outputValue[port] = htons(val);
+
+    if (card->autoFlush)
+    {
+        if (CardWrite(card, &(card->currentOutput)) < 0)
+            rc = -1;
+        else
+        {
+            card->pendingOutput = FALSE;
+            card->currentOutput.resetCounter = 0x00;
+        }
+    }
+    else
+    {
+        card->pendingOutput = TRUE;
+    }
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_SetPWM()
+ *
+ *  Change one of the PWM outputs.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_SetPWM(int h, int port, int value)
+{
+    Open8055_card_t *card;
+    int         rc = 0;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 1)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return 0;
+    }
+
+    if (value < 0)
+        value = 0;
+    if (value > 1023)
+        value = 1023;
+
+    /* ----
+     * Set the new PWM value and send it if in autoFlush mode.
+     * ----
+     */
+    card->currentOutput.outputPwmValue[port] = htons(value);
+    if (card->autoFlush)
+    {
+        if (CardWrite(card, &(card->currentOutput)) < 0)
+            rc = -1;
+        else
+        {
+            card->pendingOutput = FALSE;
+            card->currentOutput.resetCounter = 0x00;
+        }
+    }
+    else
+    {
+        card->pendingOutput = TRUE;
+    }
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+
+/* ----
+ * Open8055_GetModeADC()
+ *
+ *  Return the operation mode of an analog input.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_GetModeADC(int h, int port)
+{
+    Open8055_card_t *card;
+    int             rc;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 1)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    rc = card->currentConfig1.modeADC[port];
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_SetModeADC()
+ *
+ *  Set the operation mode of an analog input.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_SetModeADC(int h, int port, int mode)
+{
+    Open8055_card_t *card;
+    int             rc = 0;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 1)
+    {
+        SetError(card, "parameter error");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    if (mode == OPEN8055_MODE_ADC10 || mode == OPEN8055_MODE_ADC9 || mode == OPEN8055_MODE_ADC8)
+    {
+        card->currentConfig1.modeADC[port] = mode;
+        if (card->autoFlush)
+        {
+            if (CardWrite(card, &(card->currentConfig1)) < 0)
+                rc = -1;
+            else
+                card->pendingConfig1 = FALSE;
+        }
+        else
+        {
+            card->pendingConfig1 = TRUE;
+        }
+    }
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_GetModeInput()
+ *
+ *  Return the operation mode of a digital input.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_GetModeInput(int h, int port)
+{
+    Open8055_card_t *card;
+    int             rc;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 4)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    rc = card->currentConfig1.modeInput[port];
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_SetModeInput()
+ *
+ *  Set the operation mode of a digital input.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_SetModeInput(int h, int port, int mode)
+{
+    Open8055_card_t *card;
+    int             rc = 0;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 4)
+    {
+        SetError(card, "parameter error");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    if (mode == OPEN8055_MODE_INPUT || mode == OPEN8055_MODE_FREQUENCY ||
+        mode == OPEN8055_MODE_PERIOD)
+    {
+        card->currentConfig1.modeInput[port] = mode;
+        if (card->autoFlush)
+        {
+            if (CardWrite(card, &(card->currentConfig1)) < 0)
+                rc = -1;
+            else
+                card->pendingConfig1 = FALSE;
+        }
+        else
+        {
+            card->pendingConfig1 = TRUE;
+        }
+        /* ----
+         * Changing input mode also causes a counter reset.
+         * ----
+         */
+        card->currentOutput.resetCounter |= (1 << port);
+        if (card->autoFlush)
+        {
+            if (CardWrite(card, &(card->currentOutput)) < 0)
+                rc = -1;
+            else
+            {
+                card->pendingOutput = FALSE;
+                card->currentOutput.resetCounter = 0x00;
+            }
+        }
+        else
+        {
+            card->pendingOutput = TRUE;
+        }
+    }
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_GetModeOutput()
+ *
+ *  Return the operation mode of a digital output.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_GetModeOutput(int h, int port)
+{
+    Open8055_card_t *card;
+    int             rc;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 7)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    rc = card->currentConfig1.modeOutput[port];
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_SetModeOutput()
+ *
+ *  Set the operation mode of a digital output.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_SetModeOutput(int h, int port, int mode)
+{
+    Open8055_card_t *card;
+    int             rc = 0;
+    int             val;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 7)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    val = ntohs(card->currentOutput.outputValue[port]);
+    switch (mode)
+    {
+        case OPEN8055_MODE_OUTPUT:
+            val = 0;
+            break;
+
+        case OPEN8055_MODE_SERVO:
+        case OPEN8055_MODE_ISERVO:
+            /* ----
+             * When we enter SERVO mode, we set the pulse width to center.
+             * Otherwise we constrain the pulse width to 0.5 .. 2.5 ms.
+             * ----
+             */
+            if (card->currentConfig1.modeOutput[port] != OPEN8055_MODE_SERVO &&
+                card->currentConfig1.modeOutput[port] != OPEN8055_MODE_ISERVO)
+            {
+                val = 18000;
+            }
+            else
+            {
+                if (val < 6000)
+                    val = 6000;
+                if (val > 30000)
+                    val = 30000;
+            }
+            break;
+
+        default:
+            val = 0;
+            break;
+    }
+    val = htons(val);
+
+    if (mode == OPEN8055_MODE_OUTPUT || mode == OPEN8055_MODE_SERVO || mode == OPEN8055_MODE_ISERVO)
+    {
+        card->currentConfig1.modeOutput[port] = mode;
+        if (card->autoFlush)
+        {
+            if (CardWrite(card, &(card->currentConfig1)) < 0)
+                rc = -1;
+            else
+                card->pendingConfig1 = FALSE;
+        }
+        else
+        {
+            card->pendingConfig1 = TRUE;
+        }
+
+        if (val != card->currentOutput.outputValue[port])
+        {
+            card->currentOutput.outputValue[port] = val;
+            if (card->autoFlush)
+            {
+                if (CardWrite(card, &(card->currentOutput)) < 0)
+                    rc = -1;
+                else
+                    card->pendingOutput = FALSE;
+            }
+            else
+            {
+                card->pendingOutput = TRUE;
+            }
+        }
+    }
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_GetModePWM()
+ *
+ *  Return the operation mode of a PWM output.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_GetModePWM(int h, int port)
+{
+    Open8055_card_t *card;
+    int             rc;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 1)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    rc = card->currentConfig1.modePWM[port];
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_SetModePWM()
+ *
+ *  Set the operation mode of a PWM output. In OPEN8055_MODE_PID the
+ *  output is driven by the PID controller set up with Open8055_SetPID().
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_SetModePWM(int h, int port, int mode)
+{
+    Open8055_card_t *card;
+    int             rc = 0;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (port < 0 || port > 1)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    if (mode == OPEN8055_MODE_PWM || mode == OPEN8055_MODE_PID)
+    {
+        card->currentConfig1.modePWM[port] = mode;
+        if (card->autoFlush)
+        {
+            if (CardWrite(card, &(card->currentConfig1)) < 0)
+                rc = -1;
+            else
+                card->pendingConfig1 = FALSE;
+        }
+        else
+        {
+            card->pendingConfig1 = TRUE;
+        }
+    }
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_SetPID()
+ *
+ *  Set up the PID controller of a PWM output. It controls the value
+ *  of ADC input adcPort towards setpoint, with the proportional gain
+ *  kp, the integral gain ki per second and the derivative gain kd in
+ *  seconds, and keeps the PWM value within outMin..outMax. The card
+ *  works with the gains in fixed point, kp in steps of 1/256 up to
+ *  +/-128. The controller runs while the output is in OPEN8055_MODE_PID.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_SetPID(int h, int port, int adcPort, int setpoint,
+		double kp, double ki, double kd, int outMin, int outMax)
+{
+    Open8055_card_t	    *card;
+    Open8055_hidMessage_t   message;
+    long		    gain[3];
+    int			    i;
+    int			    rc;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    gain[0] = (long)floor(kp * (1 << OPEN8055_PID_GAIN_SHIFT) + 0.5);
+    gain[1] = (long)floor(ki / 1000.0 * (1L << OPEN8055_PID_INTEGRAL_SHIFT) + 0.5);
+    gain[2] = (long)floor(kd * 1000.0 * (1 << OPEN8055_PID_GAIN_SHIFT) + 0.5);
+    for (i = 0; i < 3; i++)
+    {
+	if (gain[i] < -32768 || gain[i] > 32767)
+	    break;
+    }
+    if (port < 0 || port > 1 || adcPort < 0 || adcPort > 1 || i < 3 ||
+	setpoint < 0 || setpoint > 1023 ||
+	outMin < 0 || outMax > 1023 || outMin > outMax)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+
+    memset(&message, 0, sizeof(message));
+    message.msgType = OPEN8055_HID_MESSAGE_SETPID;
+    message.pidPwm = port;
+    message.pidAdc = adcPort + 1;
+    message.pidSetpoint = htons((uint16_t)setpoint);
+    message.pidKp = (int16_t)htons((uint16_t)gain[0]);
+    message.pidKi = (int16_t)htons((uint16_t)gain[1]);
+    message.pidKd = (int16_t)htons((uint16_t)gain[2]);
+    message.pidOutMin = htons((uint16_t)outMin);
+    message.pidOutMax = htons((uint16_t)outMax);
+    rc = CardWrite(card, &message);
+
+    UnlockAndRefcount(card);
+    return rc;
+}
+
+
+/* ----
+ * Open8055_SetRules()
+ *
+ *  Replace the rule table of the card with numRules rules, none
+ *  clears it. Rule i holds while the value of source[i] is at or
+ *  above threshold[i], or below it if source[i] includes
+ *  OPEN8055_RULE_BELOW. While it holds, the card applies action[i]
+ *  with value[i] every millisecond, even without a host. The old
+ *  rules stay in effect until the whole table is loaded.
+ * ----
+ */
+OPEN8055_EXTERN int OPEN8055_CDECL
+Open8055_SetRules(int h, int numRules, const int *source, const int *threshold,
+		  const int *action, const int *value)
+{
+    Open8055_card_t	    *card;
+    Open8055_hidMessage_t   message;
+    Open8055_rule_t	    *rule;
+    int			    maxPort;
+    int			    i;
+
+    if ((card = LockAndRefcount(h)) == NULL)
+        return -1;
+
+    if (numRules < 0 || numRules > OPEN8055_RULES)
+    {
+        SetError(card, "parameter invalid");
+        UnlockAndRefcount(card);
+        return -1;
+    }
+    for (i = 0; i < numRules; i++)
+    {
+	maxPort = 4;
+	if ((source[i] & OPEN8055_RULE_SOURCE_MASK) == OPEN8055_RULE_ADC)
+	    maxPort = 1;
+	if (source[i] < 0 || source[i] > 255 ||
+	    (source[i] & OPEN8055_RULE_SOURCE_MASK) > OPEN8055_RULE_ADC ||
+	    (source[i] & OPEN8055_RULE_PORT_MASK) > maxPort ||
+	    threshold[i] < 0 || threshold[i] > 65535 ||
+	    action[i] < OPEN8055_RULE_NONE || action[i] > OPEN8055_RULE_SET_PWM2 ||
+	    value[i] < 0 || value[i] > 65535)
+	{
+	    SetError(card, "parameter invalid");
+	    UnlockAndRefcount(card);
+	    return -1;
+	}
+    }
+
+    /* ----
+     * Send the rules in chunks of OPEN8055_RULES_PER_MSG. An empty
+     * table still takes one message.
+     * ----
+     */
+    memset(&message, 0, sizeof(message));
+    message.msgType = OPEN8055_HID_MESSAGE_SETRULES;
+    message.ruleTotal = numRules;
+    i = 0;
+    do {
+	message.ruleIndex = i;
+	message.ruleRows = 0;
+	while (i < numRules && message.ruleRows < OPEN8055_RULES_PER_MSG)
+	{
+	    rule = &(message.rule[message.ruleRows++]);
+	    rule->source = source[i];
+	    rule->action = action[i];
+	    rule->threshold = htons((uint16_t)threshold[i]);
+	    rule->value = htons((uint16_t)value[i]);
+	    i++;
+	}
+	if (CardWrite(card, &message) < 0)
+	{
+	    UnlockAndRefcount(card);
+	    return -1;
+	}
+    } while (i < numRules);
+
+    UnlockAndRefcount(card);
+    return 0;
+}
+
+
+/* ----------------------------------------------------------------------
+ * Local functions follow
+ * ----------------------------------------------------------------------
+ */
+
+static int
+Open8055_Init(void)
+{
+    if (initialized)
+        return 0;
+
+    LockCreate(&connectionsLock);
+
+    connectionsSize = 16;
+    connections = (Open8055_card_t **)malloc(sizeof(Open8055_card_t *) * 16);
+    if (connections == NULL)
+    {
+        SetError(NULL, "out of memory");
+        return -1;
+    }
+
+    if (DeviceInit() < 0)
+        return -1;
+
+#ifdef _WIN32
+    if (WSAStartup(MAKEWORD(2,2), &WSAData) != 0)
+    {
+    	SetError(NULL, "WSAStartup() failed");
+	return -1;
+    }
+#endif
+
+    initialized = TRUE;
+    return 0;
+}
+
+
+static Open8055_card_t *
+LockAndRefcount(int h)
+{
+    Open8055_card_t     *card;
+
+    if (!initialized)
+    {
+        if (Open8055_Init() < 0)
+            return NULL;
+    }
+
+    LockAcquire(&connectionsLock);
+
+    if (h < 0 || h >= connectionsUsed || connections[h] == NULL)
+    {
+        SetError(NULL, "invalid card handle %d", h);
+        LockRelease(&connectionsLock);
+        return NULL;
+    }
+
+    card = connections[h];
+    LockAcquire(&(card->cardLock));
+    LockRelease(&connectionsLock);
+    card->cardRefcount++;
+
+    return card;
+}
+
+
+static void
+UnlockAndRefcount(Open8055_card_t *card)
+{
+    card->cardRefcount--;
+    LockRelease(&(card->cardLock));
+    return;
+}
+
+
+/* ----
+ * SetError()
+ *
+ *  Save an error message in the lastErrorMessage buffer.
+ * ----
+ */
+static void
+SetError(Open8055_card_t *card, char *fmt, ...)
+{
+    va_list     ap;
+
+    va_start(ap, fmt);
+    if (card == NULL)
+        vsnprintf(lastErrorMessage, sizeof(lastErrorMessage), fmt, ap);
+    else
+        vsnprintf(card->errorMessage, sizeof(card->errorMessage), fmt, ap);
+    va_end(ap);
+}
+
+
+/* ----
+ * CardRead()
+ *
+ *  Read one HID report from an open card. In case of a local card, DeviceRead()
+ *  is used. In the case of a remote card, this function handles the TCP/IP
+ *  communication with the server.
+ * ----
+ */
+static int
+CardRead(Open8055_card_t *card, void *buffer, int timeout)
+{
+    char	line[256];
+    int		rc;
+#ifndef _WIN32
+    struct timeval	now;
+    struct timespec	deadline;
+#endif
+
+    if (card->isLocal)
+    	return DeviceRead(card, buffer, timeout);
+
+#ifndef _WIN32
+    /* ----
+     * The reactor thread does all the socket IO. We only wait for it
+     * to put something into the queue.
+     * ----
+     */
+    if (card->remoteRegistered)
+    {
+	if (timeout < 0)
+	    timeout = 0;
+	gettimeofday(&now, NULL);
+	deadline.tv_sec  = now.tv_sec + timeout / 1000;
+	deadline.tv_nsec = (now.tv_usec + (timeout % 1000) * 1000) * 1000;
+	if (deadline.tv_nsec >= 1000000000)
+	{
+	    deadline.tv_sec++;
+	    deadline.tv_nsec -= 1000000000;
+	}
+
+	while (card->remoteQueueCount == 0)
+	{
+	    if (card->remoteFailed)
+	    {
+		SetError(card, "%s", card->remoteError);
+		return -1;
+	    }
+	    card->remoteWaiters++;
+	    rc = pthread_cond_timedwait(&(card->remoteCond), &(card->cardLock),
+					&deadline);
+	    if (--card->remoteWaiters == 0)
+		pthread_cond_signal(&(card->remoteDrained));
+	    if (rc == ETIMEDOUT)
+	    {
+		if (card->remoteQueueCount > 0)
+		    break;
+		return 0;
+	    }
+	}
+
+	memcpy(buffer, &(card->remoteQueue[card->remoteQueueHead]),
+	       OPEN8055_HID_MESSAGE_SIZE);
+	card->remoteQueueHead = (card->remoteQueueHead + 1) % OPEN8055_REMOTE_QUEUE_SIZE;
+	card->remoteQueueCount--;
+
+	/* ----
+	 * A message type of zero marks an error the reactor ran into
+	 * while parsing.
+	 * ----
+	 */
+	if (((Open8055_hidMessage_t *)buffer)->msgType == 0x00)
+	{
+	    SetError(card, "%s", card->remoteError);
+	    return -1;
+	}
+	return 1;
+    }
+#endif
+
+    if (card->isMulticast)
+	rc = CardReadDatagram(card, line, sizeof(line), timeout);
+    else
+	rc = CardReadLine(card, line, sizeof(line), timeout);
+    if (rc <= 0)
+	return rc;
+
+    return CardParseLine(card, line, buffer);
+}
+
+
+/* ----
+ * CardParseLine()
+ *
+ *  Helper function for CardRead() to convert a line received from
+ *  the server into the binary HID message.
+ * ----
+ */
+static int
+CardParseLine(Open8055_card_t *card, char *line, void *buffer)
+{
+    int		msgType;
+    int		values[24];
+    int		rc;
+    Open8055_hidMessage_t *message;
+
+    memset(buffer, 0, OPEN8055_HID_MESSAGE_SIZE);
+    message = (Open8055_hidMessage_t *)buffer;
+
+    /* ----
+     * A DELTA line is an INPUT report relative to the previous one.
+     * ----
+     */
+    if (strncmp(line, "DELTA ", 6) == 0)
+    {
+	if (CardDecodeDelta(card, line + 6, values) < 0)
+	    return -1;
+	msgType = OPEN8055_HID_MESSAGE_INPUT;
+    }
+    else if (sscanf(line, "RECV %d ", &msgType) != 1)
+    {
+	if (strncmp(line, "ERROR ", 6) == 0)
+	    SetError(card, "%s", line);
+	else
+	    SetError(card, "Expected RECV - got '%s'", line);
+	return -1;
+    }
+
+    switch (msgType)
+    {
+	case OPEN8055_HID_MESSAGE_INPUT:
+		/* ----
+		 * Servers before sequence numbers and timestamps were added
+		 * send only 9 values, before the PWM values only 11.
+		 * ----
+		 */
+		if (line[0] == 'R')
+		{
+		    values[9] = 0;
+		    values[10] = 0;
+		    values[11] = 0;
+		    values[12] = 0;
+		    rc = sscanf(line, "RECV %d %d %d %d %d %d %d %d %d %d %u %d %d",
+			&values[0], &values[1], &values[2], &values[3],
+			&values[4], &values[5], &values[6], &values[7],
+			&values[8], &values[9], (unsigned int *)&values[10],
+			&values[11], &values[12]);
+		    if (rc != 9 && rc != 11 && rc != 13)
+		    {
+			SetError(card, "CardRead(): incomplete INPUT message");
+			return -1;
+		    }
+		}
+		memcpy(card->net_input_last, values, sizeof(card->net_input_last));
+		card->net_input_have_last = TRUE;
+		message->msgType = values[0];
+		message->inputBits = values[1];
+		message->inputCounter[0] = ntohs(values[2]);
+		message->inputCounter[1] = ntohs(values[3]);
+		message->inputCounter[2] = ntohs(values[4]);
+		message->inputCounter[3] = ntohs(values[5]);
+		message->inputCounter[4] = ntohs(values[6]);
+		message->inputAdcValue[0] = ntohs(values[7]);
+		message->inputAdcValue[1] = ntohs(values[8]);
+		message->inputSequence = ntohs(values[9]);
+		message->inputTimestamp[0] = htons((uint32_t)values[10] >> 16);
+		message->inputTimestamp[1] = htons((uint32_t)values[10] & 0xFFFF);
+		message->inputPwmValue[0] = ntohs(values[11]);
+		message->inputPwmValue[1] = ntohs(values[12]);
+		return 1;
+
+	case OPEN8055_HID_MESSAGE_OUTPUT:
+		if (sscanf(line, "RECV %d %d %d %d %d %d %d %d %d %d %d %d %d",
+			&values[0], &values[1], &values[2], &values[3],
+			&values[4], &values[5], &values[6], &values[7],
+			&values[8], &values[9], &values[10], &values[11],
+			&values[12]) != 13)
+		{
+		    SetError(card, "CardRead(): incomplete INPUT message");
+		    return -1;
+		}
+		message->msgType = values[0];
+		message->outputBits = values[1];
+		message->outputValue[0] = ntohs(values[2]);
+		message->outputValue[1] = ntohs(values[3]);
+		message->outputValue[2] = ntohs(values[4]);
+		message->outputValue[3] = ntohs(values[5]);
+		message->outputValue[4] = ntohs(values[6]);
+		message->outputValue[5] = ntohs(values[7]);
+		message->outputValue[6] = ntohs(values[8]);
+		message->outputValue[7] = ntohs(values[9]);
+		message->outputPwmValue[0] = ntohs(values[10]);
+		message->outputPwmValue[1] = ntohs(values[11]);
+		message->resetCounter = values[12];
+		return 1;
+
+	case OPEN8055_HID_MESSAGE_SETCONFIG1:
+		if (sscanf(line, "RECV %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d",
+			&values[0], &values[1], &values[2], &values[3],
+			&values[4], &values[5], &values[6], &values[7],
+			&values[8], &values[9], &values[10], &values[11],
+			&values[12], &values[13], &values[14], &values[15],
+			&values[16], &values[17], &values[18], &values[19],
+			&values[20], &values[21], &values[22], &values[23]) != 24)
+		{
+		    SetError(card, "CardRead(): incomplete SETCONFIG1 message");
+		    return -1;
+		}
+		message->msgType = values[0];
+		message->modeADC[0] = values[1];
+		message->modeADC[1] = values[2];
+		message->modeInput[0] = values[3];
+		message->modeInput[1] = values[4];
+		message->modeInput[2] = values[5];
+		message->modeInput[3] = values[6];
+		message->modeInput[4] = values[7];
+		message->modeOutput[0] = values[8];
+		message->modeOutput[1] = values[9];
+		message->modeOutput[2] = values[10];
+		message->modeOutput[3] = values[11];
+		message->modeOutput[4] = values[12];
+		message->modeOutput[5] = values[13];
+		message->modeOutput[6] = values[14];
+		message->modeOutput[7] = values[15];
+		message->modePWM[0] = values[16];
+		message->modePWM[1] = values[17];
+		message->debounceValue[0] = ntohs(values[18]);
+		message->debounceValue[1] = ntohs(values[19]);
+		message->debounceValue[2] = ntohs(values[20]);
+		message->debounceValue[3] = ntohs(values[21]);
+		message->debounceValue[4] = ntohs(values[22]);
+		message->cardAddress = values[23];
+		return 1;
+
+	case OPEN8055_HID_MESSAGE_SETCONFIG2:
+		/* ----
+		 * Servers before the report cadence settings send only
+		 * the sample interval.
+		 * ----
+		 */
+		values[2] = 0;
+		values[3] = 0;
+		values[4] = 0;
+		values[5] = 0;
+		values[6] = 0;
+		if (sscanf(line, "RECV %d %d %d %d %d %d %d", &values[0], &values[1],
+			&values[2], &values[3], &values[4], &values[5],
+			&values[6]) < 2)
+		{
+		    SetError(card, "CardRead(): incomplete SETCONFIG2 message");
+		    return -1;
+		}
+		message->msgType = values[0];
+		message->sampleInterval = values[1];
+		message->reportPeriod = htons(values[2]);
+		message->adcHysteresis = htons(values[3]);
+		message->averageWindow = values[4];
+		message->servoPeriod = values[5];
+		message->edgeMask = values[6];
+		return 1;
+
+	case OPEN8055_HID_MESSAGE_INPUTBURST:
+		if (sscanf(line, "RECV %d %d %d %d %u %d %d %d %d %d %d %d %d %d %d %d %d",
+			&values[0], &values[1], &values[2], &values[3],
+			(unsigned int *)&values[4], &values[5], &values[6],
+			&values[7], &values[8], &values[9], &values[10],
+			&values[11], &values[12], &values[13], &values[14],
+			&values[15], &values[16]) != 17)
+		{
+		    SetError(card, "CardRead(): incomplete INPUTBURST message");
+		    return -1;
+		}
+		message->msgType = values[0];
+		message->burstCount = values[1];
+		message->burstInterval = values[2];
+		message->burstTimestamp = ntohl((uint32_t)values[4]);
+		for (rc = 0; rc < OPEN8055_BURST_SAMPLES; rc++)
+		{
+		    message->burstSample[rc][0] = ntohs(values[5 + rc * 2]);
+		    message->burstSample[rc][1] = ntohs(values[6 + rc * 2]);
+		}
+		return 1;
+
+	case OPEN8055_HID_MESSAGE_EDGES:
+		if (sscanf(line, "RECV %d %d %d %d %u %d %d %u %d %d %u %d %d %u %d %d",
+			&values[0], &values[1], &values[2], &values[3],
+			(unsigned int *)&values[4], &values[5], &values[6],
+			(unsigned int *)&values[7], &values[8], &values[9],
+			(unsigned int *)&values[10], &values[11], &values[12],
+			(unsigned int *)&values[13], &values[14], &values[15]) != 16)
+		{
+		    SetError(card, "CardRead(): incomplete EDGES message");
+		    return -1;
+		}
+		message->msgType = values[0];
+		message->edgeCount = values[1];
+		message->edgeLost = values[2];
+		for (rc = 0; rc < OPEN8055_EDGES_PER_MSG; rc++)
+		{
+		    message->edge[rc].timestamp[0] = htons((uint32_t)values[4 + rc * 3] >> 16);
+		    message->edge[rc].timestamp[1] = htons((uint32_t)values[4 + rc * 3] & 0xFFFF);
+		    message->edge[rc].edges = values[5 + rc * 3];
+		    message->edge[rc].state = values[6 + rc * 3];
+		}
+		return 1;
+
+	case OPEN8055_HID_MESSAGE_SEQUENCE:
+		if (sscanf(line, "RECV %d %d %d %d %d", &values[0], &values[1],
+			&values[2], &values[3], &values[4]) != 5)
+		{
+		    SetError(card, "CardRead(): incomplete SEQUENCE message");
+		    return -1;
+		}
+		message->msgType = values[0];
+		message->seqCommand = values[1];
+		message->seqLength = values[2];
+		message->seqTrigger = values[3];
+		message->seqLoops = htons(values[4]);
+		return 1;
+
+    	default:
+		// SetError(card, "CardRead(): unknown message type 0x%02x", msgType);
+		SetError(card, "CardRead(): line='%s'", line);
+		return -1;
+    }
+}
+
+
+/* ----
+ * CardReadLine()
+ *
+ *  Helper function for CardRead() to receive one single line at a time
+ *  with IO buffering.
+ * ----
+ */
+static int
+CardReadLine(Open8055_card_t *card, char *buffer, int buflen, int timeout)
+{
+    fd_set		rfds;
+    struct timeval	tv;
+    int			rc;
+
+    /* ----
+     * Don't allow the caller to request more than what we can handle with
+     * the cards line buffering.
+     * ----
+     */
+    if (buflen > sizeof(card->net_input_line))
+    	buflen = sizeof(card->net_input_line);
+
+    /* ----
+     * Receive one line from the server.
+     * ----
+     */
+    for (;;)
+    {
+	if ((rc = CardNextLine(card, buffer, buflen)) != 0)
+	    return rc;
+
+	/* ----
+	 * We ran out of data from the server. Check if there is more
+	 * according to our timeout requirements.
+	 * ----
+	 */
+	if (timeout < 0)
+	    timeout = 0;
+	FD_ZERO(&rfds);
+	FD_SET(card->sock, &rfds);
+	tv.tv_sec  = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	LockRelease(&(card->cardLock));
+	rc = select(card->sock + 1, &rfds, NULL, NULL, &tv);
+	LockAcquire(&(card->cardLock));
+	if (rc < 0)
+	{
+	    SetError(card, "select(): %s", ErrorString());
+	    return -1;
+	}
+	if (rc == 0)
+	    return 0;
+
+	/* ----
+	 * More data is available. Receive it.
+	 * ----
+	 */
+	rc = recv(card->sock, card->net_input_buffer, sizeof(card->net_input_buffer), 0);
+	if (rc < 0)
+	{
+	    SetError(card, "%s", ErrorString());
+	    return -1;
+	}
+	if (rc == 0)
+	{
+	    SetError(card, "Server closed connection");
+	    return -1;
+	}
+	card->net_input_have = rc;
+	card->net_input_pos = card->net_input_buffer;
+    }
+}
+
+
+/* ----
+ * CardNextLine()
+ *
+ *  Extract the next complete line from the data already received.
+ *  Returns 0 if more data is needed.
+ * ----
+ */
+static int
+CardNextLine(Open8055_card_t *card, char *buffer, int buflen)
+{
+    if (buflen > sizeof(card->net_input_line))
+    	buflen = sizeof(card->net_input_line);
+
+    while (card->net_input_have > 0)
+    {
+	/* ----
+	 * Discard any carriage return characters.
+	 * ----
+	 */
+	if (*(card->net_input_pos) == '\r')
+	{
+	    card->net_input_pos++;
+	    card->net_input_have--;
+	    continue;
+	}
+
+	/* ----
+	 * If we found a line feed, we got a complete line. Terminate
+	 * the line buffer, copy the content to the user buffer and
+	 * reset it.
+	 * ----
+	 */
+	if (*(card->net_input_pos) == '\n')
+	{
+	    card->net_input_pos++;
+	    card->net_input_have--;
+	    *(card->net_input_out) = '\0';
+	    strncpy(buffer, card->net_input_line, buflen);
+
+	    card->net_input_out = card->net_input_line;
+	    return 1;
+	}
+
+	/* ----
+	 * Ordinary character. Just copy it into the line buffer
+	 * and keep moving, unless we run out of space.
+	 * ----
+	 */
+	*(card->net_input_out++) = *(card->net_input_pos++);
+	card->net_input_have--;
+
+	if (card->net_input_out >= (card->net_input_line + buflen))
+	{
+	    SetError(card, "Server sent oversize line");
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+
+/* ----
+ * CardDecodeDelta()
+ *
+ *  Helper function for CardRead() to reconstruct the INPUT report values
+ *  from a DELTA line. The hex data holds a varint bitmask of changed
+ *  fields followed by one zigzag varint per changed field, to be added
+ *  to the previous report.
+ * ----
+ */
+static int
+CardDecodeDelta(Open8055_card_t *card, char *hex, int *values)
+{
+    unsigned char   data[64];
+    int		    len = 0;
+    int		    pos = 0;
+    unsigned int    byte;
+    unsigned long   mask;
+    unsigned long   delta;
+    int		    field;
+    int		    shift;
+
+    if (!card->net_input_have_last)
+    {
+	SetError(card, "CardRead(): DELTA without previous INPUT report");
+	return -1;
+    }
+
+    while (isxdigit((unsigned char)hex[0]) && isxdigit((unsigned char)hex[1]))
+    {
+	if (len >= sizeof(data) || sscanf(hex, "%2x", &byte) != 1)
+	{
+	    SetError(card, "CardRead(): malformed DELTA message");
+	    return -1;
+	}
+	data[len++] = (unsigned char)byte;
+	hex += 2;
+    }
+
+    /* ----
+     * Field -1 is the change mask, 0..11 are the fields of the report
+     * following the message type.
+     * ----
+     */
+    memcpy(values, card->net_input_last, sizeof(card->net_input_last));
+    mask = 0;
+    for (field = -1; field < 12; field++)
+    {
+	if (field >= 0 && (mask & (1 << field)) == 0)
+	    continue;
+
+	delta = 0;
+	shift = 0;
+	do {
+	    if (pos >= len || shift > 28)
+	    {
+		SetError(card, "CardRead(): malformed DELTA message");
+		return -1;
+	    }
+	    delta |= (unsigned long)(data[pos] & 0x7F) << shift;
+	    shift += 7;
+	} while (data[pos++] & 0x80);
+
+	if (field < 0)
+	    mask = delta;
+	else if (delta & 1)
+	    values[field + 1] = (int)((unsigned int)values[field + 1] -
+				      (unsigned int)((delta + 1) >> 1));
+	else
+	    values[field + 1] = (int)((unsigned int)values[field + 1] +
+				      (unsigned int)(delta >> 1));
+    }
+
+    values[1] &= 0xFF;
+    for (field = 2; field < 10; field++)
+	values[field] &= 0xFFFF;
+    values[11] &= 0xFFFF;
+    values[12] &= 0xFFFF;
+
+    return 0;
+}
+
+
+/* ----
+ * CardReadDatagram()
+ *
+ *  Helper function for CardRead() to receive the next INPUT report of
+ *  our card from a multicast group. The datagram is returned in the form
+ *  of a RECV line. Sequence number gaps are counted as lost reports.
+ * ----
+ */
+static int
+CardReadDatagram(Open8055_card_t *card, char *buffer, int buflen, int timeout)
+{
+    fd_set		rfds;
+    struct timeval	tv;
+    int			rc;
+
+    if (timeout < 0)
+	timeout = 0;
+
+    for (;;)
+    {
+	FD_ZERO(&rfds);
+	FD_SET(card->sock, &rfds);
+	tv.tv_sec  = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	LockRelease(&(card->cardLock));
+	rc = select(card->sock + 1, &rfds, NULL, NULL, &tv);
+	LockAcquire(&(card->cardLock));
+	if (rc < 0)
+	{
+	    SetError(card, "select(): %s", ErrorString());
+	    return -1;
+	}
+	if (rc == 0)
+	    return 0;
+
+	rc = recv(card->sock, card->net_input_line, sizeof(card->net_input_line) - 1, 0);
+	if (rc < 0)
+	{
+	    SetError(card, "%s", ErrorString());
+	    return -1;
+	}
+	card->net_input_line[rc] = '\0';
+
+	if (CardParseDatagram(card, buffer, buflen))
+	    return 1;
+    }
+}
+
+
+/* ----
+ * CardParseDatagram()
+ *
+ *  Check the datagram in net_input_line and return it as RECV line if it
+ *  is an INPUT report of our card. Anything else is ignored.
+ * ----
+ */
+static int
+CardParseDatagram(Open8055_card_t *card, char *buffer, int buflen)
+{
+    int			cardNumber;
+    unsigned long	seq;
+    double		timestamp;
+    int			offset;
+
+    if (sscanf(card->net_input_line, "INPUT %d %lu %lf %n",
+	       &cardNumber, &seq, &timestamp, &offset) < 3)
+	return 0;
+    if (cardNumber != card->idRemote)
+	return 0;
+
+    /* ----
+     * A datagram at or below the last sequence number was reordered or
+     * duplicated and is dropped. Only sequence 1 or a large jump back
+     * means the server restarted.
+     * ----
+     */
+    if (card->net_input_seq != 0)
+    {
+	if (seq <= card->net_input_seq)
+	{
+	    if (seq != 1 && card->net_input_seq - seq < OPEN8055_NET_RESTART_GAP)
+		return 0;
+	}
+	else
+	    card->net_input_lost += (int)(seq - card->net_input_seq - 1);
+    }
+    card->net_input_seq = seq;
+
+    snprintf(buffer, buflen, "RECV %s", card->net_input_line + offset);
+    return 1;
 }
 
 
 /* ----
- * CardRead()
+ * CardInputReceived()
  *
- *  Read one HID report from an open card. In case of a local card, DeviceRead()
- *  is used. In the case of a remote card, this function handles the TCP/IP
- *  communication with the server.
+ *  Make a received INPUT report the current one and account for
+ *  its sequence number and timestamp. Reports from firmware without
+ *  those have both zero.
  * ----
  */
-static int
-CardRead(Open8055_card_t *card, void *buffer, int timeout)
+static void
+CardInputReceived(Open8055_card_t *card, Open8055_hidMessage_t *message)
 {
-    char	line[256];
-    int		rc;
-    int		msgType;
-    int		values[24];
-    Open8055_hidMessage_t *message;
-
-    if (card->isLocal)
-    	return DeviceRead(card, buffer, timeout);
-
-    if ((rc = CardReadLine(card, line, sizeof(line), timeout)) <= 0)
-	return rc;
-
-    if (sscanf(line, "RECV %d ", &msgType) != 1)
+    uint16_t	    sequence;
+    uint32_t	    timestamp;
+    uint16_t	    gap;
+    double	    now;
+    double	    offset;
+    double	    baseline;
+
+    memcpy(&(card->currentInput), message, sizeof(card->currentInput));
+    card->currentInputUnconsumed = OPEN8055_INPUT_ANY;
+
+    sequence = ntohs(message->inputSequence);
+    timestamp = ((uint32_t)ntohs(message->inputTimestamp[0]) << 16) |
+		ntohs(message->inputTimestamp[1]);
+    if (sequence == 0 && timestamp == 0)
+	return;
+
+    now = HostTime();
+    if (!card->inputHaveTiming)
     {
-	if (strncmp(line, "ERROR ", 6) == 0)
-	    SetError(card, "%s", line);
-	else
-	    SetError(card, "Expected RECV - got '%s'", line);
-	return -1;
+	card->inputHaveTiming = TRUE;
+	card->inputDeviceTime = (double)timestamp / OPEN8055_TIMESTAMP_PER_MS;
+	card->clockWindowStart = now;
+	card->clockWindowMin = now - card->inputDeviceTime;
     }
+    else
+    {
+	/* ----
+	 * A gap in the sequence numbers is lost reports. Anything that
+	 * looks like going backwards is a duplicate or a restarted card.
+	 * ----
+	 */
+	gap = (uint16_t)(sequence - card->inputLastSequence - 1);
+	if (gap < 0x8000)
+	    card->inputDropped += gap;
 
-    memset(buffer, 0, OPEN8055_HID_MESSAGE_SIZE);
-    message = (Open8055_hidMessage_t *)buffer;
+	card->inputDeviceTime += (double)(uint32_t)(timestamp -
+		card->inputLastTimestamp) / OPEN8055_TIMESTAMP_PER_MS;
+    }
+    card->inputLastSequence = sequence;
+    card->inputLastTimestamp = timestamp;
 
-    switch (msgType)
+    /* ----
+     * Track the minimum clock offset per window. The latency is the
+     * difference of this report's offset to the lowest one of the
+     * current and the last complete window.
+     * ----
+     */
+    offset = now - card->inputDeviceTime;
+    if (now - card->clockWindowStart >= OPEN8055_CLOCK_WINDOW_MS)
     {
-	case OPEN8055_HID_MESSAGE_INPUT:
-		if (sscanf(line, "RECV %d %d %d %d %d %d %d %d %d",
-			&values[0], &values[1], &values[2], &values[3],
-			&values[4], &values[5], &values[6], &values[7],
-			&values[8]) != 9)
-		{
-		    SetError(card, "CardRead(): incomplete INPUT message");
-		    return -1;
-		}
-		message->msgType = values[0];
-		message->inputBits = values[1];
-		message->inputCounter[0] = ntohs(values[2]);
-		message->inputCounter[1] = ntohs(values[3]);
-		message->inputCounter[2] = ntohs(values[4]);
-		message->inputCounter[3] = ntohs(values[5]);
-		message->inputCounter[4] = ntohs(values[6]);
-		message->inputAdcValue[0] = ntohs(values[7]);
-		message->inputAdcValue[1] = ntohs(values[8]);
-		return 1;
+	if (!card->clockHaveFirst)
+	{
+	    card->clockHaveFirst = TRUE;
+	    card->clockFirstStart = card->clockWindowStart;
+	    card->clockFirstMin = card->clockWindowMin;
+	}
+	card->clockLastStart = card->clockWindowStart;
+	card->clockLastMin = card->clockWindowMin;
+	card->clockWindowStart = now;
+	card->clockWindowMin = offset;
+    }
+    else if (offset < card->clockWindowMin)
+	card->clockWindowMin = offset;
 
-	case OPEN8055_HID_MESSAGE_OUTPUT:
-		if (sscanf(line, "RECV %d %d %d %d %d %d %d %d %d %d %d %d %d",
-			&values[0], &values[1], &values[2], &values[3],
-			&values[4], &values[5], &values[6], &values[7],
-			&values[8], &values[9], &values[10], &values[11],
-			&values[12]) != 13)
-		{
-		    SetError(card, "CardRead(): incomplete INPUT message");
-		    return -1;
-		}
-		message->msgType = values[0];
-		message->outputBits = values[1];
-		message->outputValue[0] = ntohs(values[2]);
-		message->outputValue[1] = ntohs(values[3]);
-		message->outputValue[2] = ntohs(values[4]);
-		message->outputValue[3] = ntohs(values[5]);
-		message->outputValue[4] = ntohs(values[6]);
-		message->outputValue[5] = ntohs(values[7]);
-		message->outputValue[6] = ntohs(values[8]);
-		message->outputValue[7] = ntohs(values[9]);
-		message->outputPwmValue[0] = ntohs(values[10]);
-		message->outputPwmValue[1] = ntohs(values[11]);
-		message->resetCounter = values[12];
-		return 1;
+    baseline = card->clockWindowMin;
+    if (card->clockHaveFirst && card->clockLastMin < baseline)
+	baseline = card->clockLastMin;
+    card->inputLatency = offset - baseline;
+}
 
-	case OPEN8055_HID_MESSAGE_SETCONFIG1:
-		if (sscanf(line, "RECV %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d",
-			&values[0], &values[1], &values[2], &values[3],
-			&values[4], &values[5], &values[6], &values[7],
-			&values[8], &values[9], &values[10], &values[11],
-			&values[12], &values[13], &values[14], &values[15],
-			&values[16], &values[17], &values[18], &values[19],
-			&values[20], &values[21], &values[22], &values[23]) != 24)
-		{
-		    SetError(card, "CardRead(): incomplete SETCONFIG1 message");
-		    return -1;
-		}
-		message->msgType = values[0];
-		message->modeADC[0] = values[1];
-		message->modeADC[1] = values[2];
-		message->modeInput[0] = values[3];
-		message->modeInput[1] = values[4];
-		message->modeInput[2] = values[5];
-		message->modeInput[3] = values[6];
-		message->modeInput[4] = values[7];
-		message->modeOutput[0] = values[8];
-		message->modeOutput[1] = values[9];
-		message->modeOutput[2] = values[10];
-		message->modeOutput[3] = values[11];
-		message->modeOutput[4] = values[12];
-		message->modeOutput[5] = values[13];
-		message->modeOutput[6] = values[14];
-		message->modeOutput[7] = values[15];
-		message->modePWM[0] = values[16];
-		message->modePWM[1] = values[17];
-		message->debounceValue[0] = ntohs(values[18]);
-		message->debounceValue[1] = ntohs(values[19]);
-		message->debounceValue[2] = ntohs(values[20]);
-		message->debounceValue[3] = ntohs(values[21]);
-		message->debounceValue[4] = ntohs(values[22]);
-		message->cardAddress = values[23];
-		return 1;
 
-    	default:
-		// SetError(card, "CardRead(): unknown message type 0x%02x", msgType);
-		SetError(card, "CardRead(): line='%s'", line);
-		return -1;
+/* ----
+ * CardBurstReceived()
+ *
+ *  Unpack the samples of an INPUTBURST report into the history.
+ *  The report has the card time of its first sample, the others
+ *  follow at the report's interval. A later first sample than
+ *  expected means samples were lost on the way.
+ * ----
+ */
+static void
+CardBurstReceived(Open8055_card_t *card, Open8055_hidMessage_t *message)
+{
+    Open8055_sample_t	*sample;
+    uint32_t		timestamp;
+    int32_t		gap;
+    int			interval;
+    int			i;
+    int			value;
+
+    timestamp = ntohl(message->burstTimestamp);
+    interval = message->burstInterval;
+    if (message->burstCount == 0 || interval == 0)
+	return;
+
+    if (!card->burstHaveLast)
+    {
+	card->burstHaveLast = TRUE;
+	card->burstDeviceTime = (double)timestamp / OPEN8055_TIMESTAMP_PER_MS;
+    }
+    else
+    {
+	/* ----
+	 * A changed interval restarts the sampling, the gap is not loss.
+	 * ----
+	 */
+	gap = (int32_t)(timestamp - card->burstNextTimestamp);
+	if (gap > 0 && interval == card->burstLastInterval)
+	    card->historyLost += gap / interval;
+	card->burstDeviceTime += (double)(int32_t)(timestamp -
+		card->burstLastTimestamp) / OPEN8055_TIMESTAMP_PER_MS;
+    }
+    card->burstLastTimestamp = timestamp;
+    card->burstNextTimestamp = timestamp + message->burstCount * interval;
+    card->burstLastInterval = interval;
+
+    for (i = 0; i < message->burstCount && i < OPEN8055_BURST_SAMPLES; i++)
+    {
+	/* ----
+	 * If the history is full, the oldest sample is lost.
+	 * ----
+	 */
+	if (card->historyCount == OPEN8055_HISTORY_SIZE)
+	{
+	    card->historyHead = (card->historyHead + 1) % OPEN8055_HISTORY_SIZE;
+	    card->historyCount--;
+	    card->historyLost++;
+	}
+	sample = &(card->history[(card->historyHead + card->historyCount) %
+				 OPEN8055_HISTORY_SIZE]);
+	card->historyCount++;
+
+	value = ntohs(message->burstSample[i][0]);
+	sample->timestamp = card->burstDeviceTime +
+		(double)(i * interval) / OPEN8055_TIMESTAMP_PER_MS;
+	sample->inputBits = value >> 11;
+	sample->adcValue[0] = value & 0x03FF;
+	sample->adcValue[1] = ntohs(message->burstSample[i][1]);
     }
 }
 
 
 /* ----
- * CardReadLine()
+ * CardEdgesReceived()
  *
- *  Helper function for CardRead() to receive one single line at a time
- *  with IO buffering.
+ *  Unpack the events of an EDGES report into the edge history, one
+ *  entry per input that changed. Events the card had to drop are
+ *  counted as lost.
  * ----
  */
-static int
-CardReadLine(Open8055_card_t *card, char *buffer, int buflen, int timeout)
+static void
+CardEdgesReceived(Open8055_card_t *card, Open8055_hidMessage_t *message)
 {
-    fd_set		rfds;
-    struct timeval	tv;
-    int			rc;
+    Open8055_edgeEvent_t *event;
+    uint32_t		timestamp;
+    int			i;
+    int			port;
 
-    /* ----
-     * Don't allow the caller to request more than what we can handle with
-     * the cards line buffering.
-     * ----
-     */
-    if (buflen > sizeof(card->net_input_line))
-    	buflen = sizeof(card->net_input_line);
+    card->edgeLost += message->edgeLost;
 
-    /* ----
-     * Receive one line from the server.
-     * ----
-     */
-    for (;;)
+    for (i = 0; i < message->edgeCount && i < OPEN8055_EDGES_PER_MSG; i++)
     {
-	while (card->net_input_have > 0)
+	timestamp = ((uint32_t)ntohs(message->edge[i].timestamp[0]) << 16) |
+		ntohs(message->edge[i].timestamp[1]);
+	if (!card->edgeHaveLast)
 	{
-	    /* ----
-	     * Discard any carriage return characters.
-	     * ----
-	     */
-	    if (*(card->net_input_pos) == '\r')
-	    {
-		card->net_input_pos++;
-		card->net_input_have--;
+	    card->edgeHaveLast = TRUE;
+	    card->edgeDeviceTime = (double)timestamp / OPEN8055_TIMESTAMP_PER_MS;
+	}
+	else
+	    card->edgeDeviceTime += (double)(int32_t)(timestamp -
+		    card->edgeLastTimestamp) / OPEN8055_TIMESTAMP_PER_MS;
+	card->edgeLastTimestamp = timestamp;
+
+	for (port = 0; port < 5; port++)
+	{
+	    if ((message->edge[i].edges & (1 << port)) == 0)
 		continue;
-	    }
 
 	    /* ----
-	     * If we found a line feed, we got a complete line. Terminate
-	     * the line buffer, copy the content to the user buffer and
-	     * reset it.
+	     * If the history is full, the oldest edge is lost.
 	     * ----
 	     */
-	    if (*(card->net_input_pos) == '\n')
+	    if (card->edgeCount == OPEN8055_EDGE_HISTORY_SIZE)
 	    {
-		card->net_input_pos++;
-		card->net_input_have--;
-		*(card->net_input_out) = '\0';
-		strncpy(buffer, card->net_input_line, buflen);
-
-		card->net_input_out = card->net_input_line;
-		return 1;
+		card->edgeHead = (card->edgeHead + 1) % OPEN8055_EDGE_HISTORY_SIZE;
+		card->edgeCount--;
+		card->edgeLost++;
 	    }
+	    event = &(card->edgeHistory[(card->edgeHead + card->edgeCount) %
+					OPEN8055_EDGE_HISTORY_SIZE]);
+	    card->edgeCount++;
 
-	    /* ----
-	     * Ordinary character. Just copy it into the line buffer
-	     * and keep moving, unless we run out of space.
-	     * ----
-	     */
-	    *(card->net_input_out++) = *(card->net_input_pos++);
-	    card->net_input_have--;
+	    event->timestamp = card->edgeDeviceTime;
+	    event->port = port;
+	    event->level = (message->edge[i].state >> port) & 0x01;
+	}
+    }
+}
 
-	    if (card->net_input_out >= (card->net_input_line + buflen))
-	    {
-	    	SetError(card, "Server sent oversize line");
-		return -1;
-	    }
-    	}
 
-	/* ----
-	 * We ran out of data from the server. Check if there is more
-	 * according to our timeout requirements.
-	 * ----
-	 */
-	if (timeout < 0)
-	    timeout = 0;
-	FD_ZERO(&rfds);
-	FD_SET(card->sock, &rfds);
-	tv.tv_sec  = timeout / 1000;
-	tv.tv_usec = (timeout % 1000) * 1000;
-	LockRelease(&(card->cardLock));
-	rc = select(card->sock + 1, &rfds, NULL, NULL, &tv);
-	LockAcquire(&(card->cardLock));
-	if (rc < 0)
-	{
-	    SetError(card, "select(): %s", ErrorString());
-	    return -1;
-	}
-	if (rc == 0)
-	    return 0;
+/* ----
+ * CardConfig2Received()
+ *
+ *  Take the extended configuration reported by the card. Cards
+ *  with older firmware never report it. The report answers our
+ *  GETCONFIG2 at connect time and may arrive late, so once the
+ *  application changed the configuration, we keep ours.
+ * ----
+ */
+static void
+CardConfig2Received(Open8055_card_t *card, Open8055_hidMessage_t *message)
+{
+    if (card->haveConfig2)
+	return;
+    memcpy(&(card->currentConfig2), message, sizeof(card->currentConfig2));
+    card->haveConfig2 = TRUE;
+}
+
+
+/* ----
+ * CardConfig2Changed()
+ *
+ *  The application changed the extended configuration. Send it if
+ *  in autoFlush mode, otherwise remember to do so on Flush.
+ * ----
+ */
+static int
+CardConfig2Changed(Open8055_card_t *card)
+{
+    card->haveConfig2 = TRUE;
+    if (!card->autoFlush)
+    {
+	card->pendingConfig2 = TRUE;
+	return 0;
+    }
+    if (CardWrite(card, &(card->currentConfig2)) < 0)
+	return -1;
+    card->pendingConfig2 = FALSE;
+    return 0;
+}
+
+
+/* ----
+ * CardAcceptBurst()
+ *
+ *  Ask the server for the CONFIG2 and INPUTBURST reports, which it
+ *  doesn't send to clients by default.
+ * ----
+ */
+static int
+CardAcceptBurst(Open8055_card_t *card)
+{
+    if (card->net_accept_burst)
+	return 0;
+    if (CardWriteLine(card, "ACCEPT %d %d\n", OPEN8055_HID_MESSAGE_SETCONFIG2,
+		      OPEN8055_HID_MESSAGE_INPUTBURST) < 0)
+	return -1;
+    card->net_accept_burst = TRUE;
+    return 0;
+}
+
+
+/* ----
+ * CardAcceptEdges()
+ *
+ *  Ask the server for the CONFIG2 and EDGES reports.
+ * ----
+ */
+static int
+CardAcceptEdges(Open8055_card_t *card)
+{
+    if (card->net_accept_edges)
+	return 0;
+    if (CardWriteLine(card, "ACCEPT %d %d\n", OPEN8055_HID_MESSAGE_SETCONFIG2,
+		      OPEN8055_HID_MESSAGE_EDGES) < 0)
+	return -1;
+    card->net_accept_edges = TRUE;
+    return 0;
+}
+
+
+/* ----
+ * CardSequenceReceived()
+ *
+ *  Take the state of the sequence player reported by the card.
+ * ----
+ */
+static void
+CardSequenceReceived(Open8055_card_t *card, Open8055_hidMessage_t *message)
+{
+    card->sequenceState = message->seqCommand;
+}
 
-	/* ----
-	 * More data is available. Receive it.
-	 * ----
-	 */
-	rc = recv(card->sock, card->net_input_buffer, sizeof(card->net_input_buffer), 0);
-	if (rc < 0)
-	{
-	    SetError(card, "%s", ErrorString());
-	    return -1;
-	}
-	if (rc == 0)
-	{
-	    SetError(card, "Server closed connection");
+
+/* ----
+ * CardSequenceCommand()
+ *
+ *  Send a SEQUENCE command. A server only forwards the status reports
+ *  of the sequence player if we ask for them.
+ * ----
+ */
+static int
+CardSequenceCommand(Open8055_card_t *card, int command, int trigger, int loops)
+{
+    Open8055_hidMessage_t   message;
+
+    if (!card->isLocal && !card->net_accept_sequence)
+    {
+	if (CardWriteLine(card, "ACCEPT %d\n", OPEN8055_HID_MESSAGE_SEQUENCE) < 0)
 	    return -1;
-	}
-	card->net_input_have = rc;
-	card->net_input_pos = card->net_input_buffer;
+	card->net_accept_sequence = TRUE;
     }
+
+    memset(&message, 0, sizeof(message));
+    message.msgType = OPEN8055_HID_MESSAGE_SEQUENCE;
+    message.seqCommand = command;
+    message.seqLength = card->sequenceRows;
+    message.seqTrigger = trigger;
+    message.seqLoops = htons((uint16_t)loops);
+
+    return CardWrite(card, &message);
+}
+
+
+/* ----
+ * HostTime()
+ *
+ *  Return the host time in milliseconds.
+ * ----
+ */
+static double
+HostTime(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER   freq;
+    LARGE_INTEGER   now;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart * 1000.0 / (double)freq.QuadPart;
+#else
+    struct timeval  now;
+
+    gettimeofday(&now, NULL);
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_usec / 1000.0;
+#endif
 }
 
 
@@ -2364,6 +4624,12 @@ CardWrite(Open8055_card_t *card, void *buffer)
     if (card->isLocal)
     	return DeviceWrite(card, buffer);
 
+    if (card->isReadOnly)
+    {
+    	SetError(card, "CardWrite(): %s is read-only", card->destination);
+	return -1;
+    }
+
     message = (Open8055_hidMessage_t *)buffer;
     switch (message->msgType)
     {
@@ -2393,8 +4659,57 @@ CardWrite(Open8055_card_t *card, void *buffer)
 			htons(message->debounceValue[4]),
 			message->cardAddress);
 
+	case OPEN8055_HID_MESSAGE_SETCONFIG2:
+		return CardWriteLine(card, "SEND %d %d %d %d %d %d %d\n",
+			message->msgType, message->sampleInterval,
+			ntohs(message->reportPeriod), ntohs(message->adcHysteresis),
+			message->averageWindow, message->servoPeriod,
+			message->edgeMask);
+
+	case OPEN8055_HID_MESSAGE_SETSEQUENCE:
+		return CardWriteLine(card, "SEND %d %d %d"
+			" %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d\n",
+			message->msgType, message->seqIndex, message->seqRows,
+			ntohs(message->seqRow[0].tick), message->seqRow[0].outputBits,
+			message->seqRow[0].channel, ntohs(message->seqRow[0].value),
+			ntohs(message->seqRow[1].tick), message->seqRow[1].outputBits,
+			message->seqRow[1].channel, ntohs(message->seqRow[1].value),
+			ntohs(message->seqRow[2].tick), message->seqRow[2].outputBits,
+			message->seqRow[2].channel, ntohs(message->seqRow[2].value),
+			ntohs(message->seqRow[3].tick), message->seqRow[3].outputBits,
+			message->seqRow[3].channel, ntohs(message->seqRow[3].value));
+
+	case OPEN8055_HID_MESSAGE_SEQUENCE:
+		return CardWriteLine(card, "SEND %d %d %d %d %d\n",
+			message->msgType, message->seqCommand, message->seqLength,
+			message->seqTrigger, ntohs(message->seqLoops));
+
+	case OPEN8055_HID_MESSAGE_SETRULES:
+		return CardWriteLine(card, "SEND %d %d %d %d"
+			" %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d\n",
+			message->msgType, message->ruleIndex, message->ruleRows,
+			message->ruleTotal,
+			message->rule[0].source, message->rule[0].action,
+			ntohs(message->rule[0].threshold), ntohs(message->rule[0].value),
+			message->rule[1].source, message->rule[1].action,
+			ntohs(message->rule[1].threshold), ntohs(message->rule[1].value),
+			message->rule[2].source, message->rule[2].action,
+			ntohs(message->rule[2].threshold), ntohs(message->rule[2].value),
+			message->rule[3].source, message->rule[3].action,
+			ntohs(message->rule[3].threshold), ntohs(message->rule[3].value));
+
+	case OPEN8055_HID_MESSAGE_SETPID:
+		return CardWriteLine(card, "SEND %d %d %d %d %d %d %d %d %d\n",
+			message->msgType, message->pidPwm, message->pidAdc,
+			ntohs(message->pidSetpoint),
+			(int16_t)ntohs((uint16_t)message->pidKp),
+			(int16_t)ntohs((uint16_t)message->pidKi),
+			(int16_t)ntohs((uint16_t)message->pidKd),
+			ntohs(message->pidOutMin), ntohs(message->pidOutMax));
+
 	case OPEN8055_HID_MESSAGE_GETINPUT:
 	case OPEN8055_HID_MESSAGE_GETCONFIG:
+	case OPEN8055_HID_MESSAGE_GETCONFIG2:
 	case OPEN8055_HID_MESSAGE_SAVECONFIG:
 	case OPEN8055_HID_MESSAGE_SAVEALL:
 	case OPEN8055_HID_MESSAGE_RESET:
@@ -2421,6 +4736,9 @@ CardWriteLine(Open8055_card_t *card, char *fmt, ...)
 {
     char	buf[256];
     va_list     ap;
+#ifndef _WIN32
+    int		len;
+#endif
 
     if (card->sock == INVALID_SOCKET)
     {
@@ -2432,6 +4750,36 @@ CardWriteLine(Open8055_card_t *card, char *fmt, ...)
     vsnprintf(buf, sizeof(buf), fmt, ap);
     va_end(ap);
 
+#ifndef _WIN32
+    /* ----
+     * The reactor thread sends for a registered card. We only append
+     * to its output buffer, waiting while that is full.
+     * ----
+     */
+    if (card->remoteRegistered)
+    {
+	len = strlen(buf);
+	for (;;)
+	{
+	    if (card->remoteFailed)
+	    {
+		SetError(card, "%s", card->remoteError);
+		return -1;
+	    }
+	    if (card->remoteOutLen + len <= OPEN8055_REMOTE_OUT_SIZE)
+		break;
+	    card->remoteWaiters++;
+	    pthread_cond_wait(&(card->remoteCond), &(card->cardLock));
+	    if (--card->remoteWaiters == 0)
+		pthread_cond_signal(&(card->remoteDrained));
+	}
+	memcpy(card->remoteOut + card->remoteOutLen, buf, len);
+	card->remoteOutLen += len;
+	write(reactorWakeup[1], "", 1);
+	return 0;
+    }
+#endif
+
     if (send(card->sock, buf, strlen(buf), 0) != strlen(buf))
     {
     	SetError(card, "send(): %s", ErrorString());
@@ -2456,6 +4804,48 @@ CardClose(Open8055_card_t *card)
     if (card->isLocal)
     	return DeviceClose(card);
 
+#ifndef _WIN32
+    /* ----
+     * Take the card away from the reactor first. It may be waiting
+     * for our card lock, so we must release that meanwhile.
+     * ----
+     */
+    if (card->remoteRegistered)
+    {
+	LockRelease(&(card->cardLock));
+	ReactorRemove(card);
+	LockAcquire(&(card->cardLock));
+
+	/* ----
+	 * Readers and writers still waiting for the reactor must leave
+	 * before the condition variables go away. The last one to leave
+	 * signals remoteDrained.
+	 * ----
+	 */
+	ReactorFail(card, "card closed");
+	pthread_cond_broadcast(&(card->remoteCond));
+	while (card->remoteWaiters > 0)
+	    pthread_cond_wait(&(card->remoteDrained), &(card->cardLock));
+	pthread_cond_destroy(&(card->remoteCond));
+	pthread_cond_destroy(&(card->remoteDrained));
+
+	/* ----
+	 * Whatever the reactor didn't send yet goes out before the quit.
+	 * ----
+	 */
+	if (card->remoteOutLen > 0 && card->sock != INVALID_SOCKET)
+	    send(card->sock, card->remoteOut, card->remoteOutLen, 0);
+	card->remoteOutLen = 0;
+    }
+#endif
+
+    if (card->isMulticast && card->sock != INVALID_SOCKET)
+    {
+	closesocket(card->sock);
+	card->sock = INVALID_SOCKET;
+	return 0;
+    }
+
     if (card->sock != INVALID_SOCKET)
     {
 	send(card->sock, "quit\n", 5, 0);
@@ -2472,6 +4862,393 @@ CardClose(Open8055_card_t *card)
 }
 
 
+#ifndef _WIN32
+
+/* ----------------------------------------------------------------------
+ * The reactor thread
+ *
+ *  A single thread per process does all the socket IO of the remote
+ *  cards once they are open. It parses the server messages into the
+ *  queue of the card and sends the lines CardWriteLine() buffered, so
+ *  that application calls never block on a socket.
+ *
+ *  The connect handshake and the final quit are still done by the
+ *  calling thread, while the card is not registered. Local cards are
+ *  read by the calling thread with DeviceRead(), since their libusb
+ *  transfers are not sockets this loop could poll. On Windows remote
+ *  cards are read by the calling thread as well.
+ * ----------------------------------------------------------------------
+ */
+
+
+/* ----
+ * ReactorAdd()
+ *
+ *  Hand a connected remote card over to the reactor. Called with the
+ *  card lock held. Starts the reactor thread on first use.
+ * ----
+ */
+static int
+ReactorAdd(Open8055_card_t *card)
+{
+    char    line[256];
+    int     rc;
+
+    /* ----
+     * Lines received during the handshake may already contain the
+     * first messages. Queue those right away.
+     * ----
+     */
+    pthread_cond_init(&(card->remoteCond), NULL);
+    pthread_cond_init(&(card->remoteDrained), NULL);
+    card->remoteOutLen = 0;
+    card->remoteQueueHead = 0;
+    card->remoteQueueCount = 0;
+    card->remoteDropped = 0;
+    card->remoteWaiters = 0;
+    card->reactorBusy = 0;
+    card->remoteFailed = FALSE;
+    if (!card->isMulticast)
+    {
+	while ((rc = CardNextLine(card, line, sizeof(line))) != 0)
+	{
+	    if (rc < 0)
+	    {
+		pthread_cond_destroy(&(card->remoteCond));
+		pthread_cond_destroy(&(card->remoteDrained));
+		return -1;
+	    }
+	    ReactorQueueLine(card, line);
+	}
+    }
+
+    pthread_mutex_lock(&reactorLock);
+
+    if (!reactorStarted)
+    {
+	if (pipe(reactorWakeup) != 0)
+	{
+	    SetError(card, "pipe(): %s", ErrorString());
+	    pthread_mutex_unlock(&reactorLock);
+	    pthread_cond_destroy(&(card->remoteCond));
+	    pthread_cond_destroy(&(card->remoteDrained));
+	    return -1;
+	}
+	if (pthread_create(&reactorThread, NULL, ReactorMain, NULL) != 0)
+	{
+	    SetError(card, "pthread_create(): %s", ErrorString());
+	    close(reactorWakeup[0]);
+	    close(reactorWakeup[1]);
+	    pthread_mutex_unlock(&reactorLock);
+	    pthread_cond_destroy(&(card->remoteCond));
+	    pthread_cond_destroy(&(card->remoteDrained));
+	    return -1;
+	}
+	pthread_detach(reactorThread);
+	reactorStarted = TRUE;
+    }
+
+    if (reactorNumCards >= sizeof(reactorCards) / sizeof(reactorCards[0]))
+    {
+	SetError(card, "too many remote cards");
+	pthread_mutex_unlock(&reactorLock);
+	pthread_cond_destroy(&(card->remoteCond));
+	pthread_cond_destroy(&(card->remoteDrained));
+	return -1;
+    }
+    reactorCards[reactorNumCards++] = card;
+    reactorGeneration++;
+    card->remoteRegistered = TRUE;
+
+    pthread_mutex_unlock(&reactorLock);
+    write(reactorWakeup[1], "", 1);
+
+    return 0;
+}
+
+
+/* ----
+ * ReactorRemove()
+ *
+ *  Take a card away from the reactor. Must be called without holding
+ *  the card lock. Once this returns, the reactor will not touch the
+ *  card any more. The caller destroys the condition variable once no
+ *  reader waits on it.
+ * ----
+ */
+static void
+ReactorRemove(Open8055_card_t *card)
+{
+    int     i;
+
+    pthread_mutex_lock(&reactorLock);
+    for (i = 0; i < reactorNumCards; i++)
+    {
+	if (reactorCards[i] == card)
+	{
+	    reactorCards[i] = reactorCards[--reactorNumCards];
+	    reactorGeneration++;
+	    break;
+	}
+    }
+    card->remoteRegistered = FALSE;
+    while (card->reactorBusy > 0)
+	pthread_cond_wait(&reactorIdle, &reactorLock);
+    pthread_mutex_unlock(&reactorLock);
+
+    write(reactorWakeup[1], "", 1);
+}
+
+
+/* ----
+ * ReactorMain()
+ *
+ *  The reactor thread itself.
+ * ----
+ */
+static void *
+ReactorMain(void *arg)
+{
+    struct pollfd   pfd[OPEN8055_MAX_CARDS * 4 + 1];
+    Open8055_card_t *cards[OPEN8055_MAX_CARDS * 4];
+    short           events[OPEN8055_MAX_CARDS * 4];
+    Open8055_card_t *card;
+    int             numCards;
+    int             numReady;
+    int             generation;
+    char            line[256];
+    char            buf[64];
+    int             i;
+    int             rc;
+
+    for (;;)
+    {
+	/* ----
+	 * Build the poll set from the currently registered cards. Cards
+	 * that failed are no longer polled. A card with buffered output
+	 * waits for its socket to take it too. Both flags are read without
+	 * the card lock; whoever changes them writes to the wakeup pipe,
+	 * so a stale value only costs one more pass.
+	 * ----
+	 */
+	pthread_mutex_lock(&reactorLock);
+	generation = reactorGeneration;
+	numCards = 0;
+	for (i = 0; i < reactorNumCards; i++)
+	{
+	    if (reactorCards[i]->remoteFailed)
+		continue;
+	    cards[numCards] = reactorCards[i];
+	    pfd[numCards].fd = reactorCards[i]->sock;
+	    pfd[numCards].events = POLLIN;
+	    if (reactorCards[i]->remoteOutLen > 0)
+		pfd[numCards].events |= POLLOUT;
+	    pfd[numCards].revents = 0;
+	    numCards++;
+	}
+	pthread_mutex_unlock(&reactorLock);
+	pfd[numCards].fd = reactorWakeup[0];
+	pfd[numCards].events = POLLIN;
+	pfd[numCards].revents = 0;
+
+	if (poll(pfd, numCards + 1, -1) < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+	    usleep(10000);
+	    continue;
+	}
+
+	if (pfd[numCards].revents & POLLIN)
+	    read(reactorWakeup[0], buf, sizeof(buf));
+
+	/* ----
+	 * If cards were added or removed since we built the poll set,
+	 * the card pointers may be stale. Data not received now will
+	 * still be reported by the next poll(). Otherwise the ready cards
+	 * are marked busy, so that ReactorRemove() waits for us, and are
+	 * serviced without the reactor lock. An application thread may
+	 * hold a card lock for long, blocked in send(), and must only
+	 * stall its own card.
+	 * ----
+	 */
+	pthread_mutex_lock(&reactorLock);
+	if (generation != reactorGeneration)
+	{
+	    pthread_mutex_unlock(&reactorLock);
+	    continue;
+	}
+	numReady = 0;
+	for (i = 0; i < numCards; i++)
+	{
+	    if ((pfd[i].revents & (POLLIN | POLLOUT | POLLHUP | POLLERR)) == 0)
+		continue;
+	    cards[i]->reactorBusy++;
+	    events[numReady] = pfd[i].revents;
+	    cards[numReady++] = cards[i];
+	}
+	pthread_mutex_unlock(&reactorLock);
+
+	for (i = 0; i < numReady; i++)
+	{
+	    card = cards[i];
+
+	    pthread_mutex_lock(&(card->cardLock));
+
+	    /* ----
+	     * Send as much of the buffered output as the socket takes.
+	     * ----
+	     */
+	    if ((events[i] & POLLOUT) && card->remoteOutLen > 0 &&
+		!card->remoteFailed)
+	    {
+		rc = send(card->sock, card->remoteOut, card->remoteOutLen,
+			  MSG_DONTWAIT);
+		if (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		    ReactorFail(card, "send(): %s", ErrorString());
+		else if (rc > 0)
+		{
+		    card->remoteOutLen -= rc;
+		    memmove(card->remoteOut, card->remoteOut + rc,
+			    card->remoteOutLen);
+		}
+	    }
+
+	    if ((events[i] & (POLLIN | POLLHUP | POLLERR)) == 0)
+		;		/* only writable */
+	    else if (card->isMulticast)
+	    {
+		rc = recv(card->sock, card->net_input_line,
+			  sizeof(card->net_input_line) - 1, 0);
+		if (rc < 0)
+		    ReactorFail(card, "%s", ErrorString());
+		else
+		{
+		    card->net_input_line[rc] = '\0';
+		    if (CardParseDatagram(card, line, sizeof(line)))
+			ReactorQueueLine(card, line);
+		}
+	    }
+	    else
+	    {
+		rc = recv(card->sock, card->net_input_buffer,
+			  sizeof(card->net_input_buffer), 0);
+		if (rc < 0)
+		    ReactorFail(card, "%s", ErrorString());
+		else if (rc == 0)
+		    ReactorFail(card, "Server closed connection");
+		else
+		{
+		    card->net_input_have = rc;
+		    card->net_input_pos = card->net_input_buffer;
+		    while ((rc = CardNextLine(card, line, sizeof(line))) > 0)
+			ReactorQueueLine(card, line);
+		    if (rc < 0)
+			ReactorFail(card, "%s", card->errorMessage);
+		}
+	    }
+
+	    pthread_cond_broadcast(&(card->remoteCond));
+	    pthread_mutex_unlock(&(card->cardLock));
+
+	    pthread_mutex_lock(&reactorLock);
+	    if (--card->reactorBusy == 0)
+		pthread_cond_broadcast(&reactorIdle);
+	    pthread_mutex_unlock(&reactorLock);
+	}
+    }
+
+    return NULL;
+}
+
+
+/* ----
+ * ReactorQueueLine()
+ *
+ *  Parse one server line into the card's message queue. Called with
+ *  the card lock held.
+ * ----
+ */
+static void
+ReactorQueueLine(Open8055_card_t *card, char *line)
+{
+    Open8055_hidMessage_t   message;
+    int                     i;
+
+    if (CardParseLine(card, line, &message) < 0)
+    {
+	strncpy(card->remoteError, card->errorMessage, sizeof(card->remoteError));
+	card->remoteError[sizeof(card->remoteError) - 1] = '\0';
+	message.msgType = 0x00;
+    }
+
+    /* ----
+     * If the queue is full, make room by dropping the oldest INPUT
+     * report, a later one supersedes it. Without one a new INPUT
+     * report is dropped itself. Other messages are never dropped,
+     * the connection fails instead.
+     * ----
+     */
+    if (card->remoteQueueCount == OPEN8055_REMOTE_QUEUE_SIZE)
+    {
+	for (i = 0; i < card->remoteQueueCount; i++)
+	{
+	    if (card->remoteQueue[(card->remoteQueueHead + i) %
+			OPEN8055_REMOTE_QUEUE_SIZE].msgType == OPEN8055_HID_MESSAGE_INPUT)
+		break;
+	}
+	if (i < card->remoteQueueCount)
+	{
+	    for (; i > 0; i--)
+		memcpy(&(card->remoteQueue[(card->remoteQueueHead + i) %
+					   OPEN8055_REMOTE_QUEUE_SIZE]),
+		       &(card->remoteQueue[(card->remoteQueueHead + i - 1) %
+					   OPEN8055_REMOTE_QUEUE_SIZE]),
+		       sizeof(Open8055_hidMessage_t));
+	    card->remoteQueueHead = (card->remoteQueueHead + 1) % OPEN8055_REMOTE_QUEUE_SIZE;
+	    card->remoteQueueCount--;
+	    card->remoteDropped++;
+	}
+	else if (message.msgType == OPEN8055_HID_MESSAGE_INPUT)
+	{
+	    card->remoteDropped++;
+	    return;
+	}
+	else
+	{
+	    ReactorFail(card, "message queue overflow");
+	    return;
+	}
+    }
+
+    memcpy(&(card->remoteQueue[(card->remoteQueueHead + card->remoteQueueCount) %
+			       OPEN8055_REMOTE_QUEUE_SIZE]),
+	   &message, sizeof(Open8055_hidMessage_t));
+    card->remoteQueueCount++;
+}
+
+
+/* ----
+ * ReactorFail()
+ *
+ *  Record a fatal error on the connection. CardRead() reports it once
+ *  the queue is drained.
+ * ----
+ */
+static void
+ReactorFail(Open8055_card_t *card, char *fmt, ...)
+{
+    va_list     ap;
+
+    va_start(ap, fmt);
+    vsnprintf(card->remoteError, sizeof(card->remoteError), fmt, ap);
+    va_end(ap);
+    card->remoteFailed = TRUE;
+}
+
+#endif /* !_WIN32 */
+
+
 /* ----------------------------------------------------------------------
  * OS specific USB IO code follows
  * ----------------------------------------------------------------------
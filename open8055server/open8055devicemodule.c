@@ -42,8 +42,12 @@
 #include "open8055_hid_protocol.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <sys/time.h>
 
 
 /* ----
@@ -54,15 +58,44 @@
 #define OPEN8055_VID    0x10cf
 #define OPEN8055_PID    0x55f0
 
+/* ----
+ * Number of IN transfers kept submitted per card, size of the ring
+ * buffer holding received reports until they are read, the max
+ * number of queued asynchronous OUT transfers and how many ms a
+ * write waits for the card before it fails.
+ * ----
+ */
+#define OPEN8055_READ_POOL		4
+#define OPEN8055_READ_RING		256
+#define OPEN8055_WRITE_QUEUE	64
+#define OPEN8055_WRITE_TIMEOUT	100
+
 typedef struct Open8055Card
 {
 	pthread_mutex_t			lock;
 	libusb_device_handle   *handle;
 	int						hadKernelDriver;
-	struct libusb_transfer *readTransfer;
-	int						readCompleted;
 	struct libusb_transfer *writeTransfer;
 	int						writeCompleted;
+
+	struct libusb_transfer *poolTransfer[OPEN8055_READ_POOL];
+	unsigned char			poolBuf[OPEN8055_READ_POOL][OPEN8055_HID_MESSAGE_SIZE];
+	int						poolActive;
+	int						poolStatus;
+	int						closing;
+	int						drained;
+	int						eventPipe[2];
+	int						eventSignalled;
+
+	unsigned char			ring[OPEN8055_READ_RING][OPEN8055_HID_MESSAGE_SIZE];
+	int						ringHead;
+	int						ringCount;
+	int						ringDropped;
+	int						readReady;
+
+	int						writesPending;
+	int						writeStatus;
+	int						writeReady;
 } Open8055Card;
 
 
@@ -71,13 +104,26 @@ typedef struct Open8055Card
  * ----
  */
 static int device_init(void);
-static int device_handle_events(Open8055Card *card, int *complete);
+static int device_handle_events(Open8055Card *card, int *complete,
+			int timeout);
 static void device_transfer_callback(struct libusb_transfer *transfer);
+static void device_pool_callback(struct libusb_transfer *transfer);
+static void device_write_callback(struct libusb_transfer *transfer);
+static void device_pool_free(Open8055Card *card);
+static void device_signal(Open8055Card *card);
+static void device_unsignal(Open8055Card *card);
+static void *device_event_thread(void *arg);
+static int device_ring_get(Open8055Card *card, unsigned char *buf,
+			int max, int timeout);
+static Open8055Card *device_get_card(int cardNumber);
 static PyObject *device_present(PyObject *self, PyObject *args);
 static PyObject *device_open(PyObject *self, PyObject *args);
 static PyObject *device_close(PyObject *self, PyObject *args);
 static PyObject *device_read(PyObject *self, PyObject *args);
+static PyObject *device_read_many(PyObject *self, PyObject *args);
 static PyObject *device_write(PyObject *self, PyObject *args);
+static PyObject *device_write_many(PyObject *self, PyObject *args);
+static PyObject *device_fileno(PyObject *self, PyObject *args);
 
 #ifndef HAVE_LIBUSB_STRERROR
 static char *libusb_strerror(int errnum);
@@ -90,6 +136,8 @@ static char *libusb_strerror(int errnum);
  */
 static int				initialized = 0;
 static libusb_context  *libusbCxt;
+static pthread_t		eventThread;
+static int				eventThreadStarted = 0;
 pthread_mutex_t			deviceGlobalLock = PTHREAD_MUTEX_INITIALIZER;
 Open8055Card			deviceCard[OPEN8055_MAX_CARDS];
 
@@ -103,8 +151,14 @@ static PyMethodDef device_methods[] = {
 			"Close a Open8055"},
 	{"read", device_read, METH_VARARGS, 
 			"Read an HID report from a Open8055"},
+	{"read_many", device_read_many, METH_VARARGS, 
+			"Read all queued HID reports from a Open8055"},
 	{"write", device_write, METH_VARARGS, 
 			"Write an HID report to a Open8055"},
+	{"write_many", device_write_many, METH_VARARGS, 
+			"Queue several HID reports for a Open8055"},
+	{"fileno", device_fileno, METH_VARARGS, 
+			"Get a file descriptor that is readable when reports are queued"},
 	{NULL, NULL, 0, NULL}
 };
 
@@ -146,6 +200,8 @@ device_init(void)
 			PyErr_SetString(PyExc_RuntimeError, "pthread_mutex_init() failed");
 			return -1;
 		}
+		deviceCard[i].eventPipe[0] = -1;
+		deviceCard[i].eventPipe[1] = -1;
 	}
 
 	initialized = 1;
@@ -158,64 +214,70 @@ device_init(void)
  * device_handle_events()
  *
  *	Function called by device_read() and device_write() to perform
- *	the multi-thread correct event handling.
+ *	the multi-thread correct event handling. Returns when *completed
+ *	is set or after timeout milliseconds (negative means forever).
  * ----
  */
 static int
-device_handle_events(Open8055Card *card, int *completed)
+device_handle_events(Open8055Card *card, int *completed, int timeout)
 {
 	int				rc = 0;
 	struct timeval	tv;
+	struct timeval	now;
+	struct timeval	deadline;
 
 	Py_BEGIN_ALLOW_THREADS
 
+	gettimeofday(&deadline, NULL);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_usec += (timeout % 1000) * 1000;
+	if (deadline.tv_usec >= 1000000)
+	{
+		deadline.tv_sec++;
+		deadline.tv_usec -= 1000000;
+	}
+
 	while (!*completed && rc == 0)
 	{
+		/* ----
+		 * Compute how long we may wait in this round.
+		 * ----
+		 */
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		if (timeout >= 0)
+		{
+			gettimeofday(&now, NULL);
+			if (!timercmp(&now, &deadline, <))
+				break;
+			timersub(&deadline, &now, &now);
+			if (timercmp(&now, &tv, <))
+				tv = now;
+		}
+
 		if (libusb_try_lock_events(libusbCxt) == 0)
 		{
 			/* ----
 			 * We got the event lock, so we are the event handler.
 			 * ----
 			 */
-			while(!*completed)
-			{
-				if (!libusb_event_handling_ok(libusbCxt))
-				{
-					libusb_unlock_events(libusbCxt);
-					break;
-				}
-
-				tv.tv_sec = 1;
-				tv.tv_usec = 0;
+			if (libusb_event_handling_ok(libusbCxt))
 				rc = libusb_handle_events_locked(libusbCxt, &tv);
-				if (rc != 0)
-					break;
-			}
 			libusb_unlock_events(libusbCxt);
 		}
 		else
 		{
 			/* ----
 			 * Somebody else is handling events ... wait for them.
+			 * Now that we have the waiters lock, recheck that our
+			 * transfer isn't done yet and that somebody is really
+			 * processing events. The outer loop takes over again
+			 * after one event or the timeout.
 			 * ----
 			 */
 			libusb_lock_event_waiters(libusbCxt);
-			while (!completed)
-			{
-				/* ----
-				 * Now that we have the waiters lock, recheck that
-				 * somebody is really processing events.
-				 * ----
-				 */
-				if (!libusb_event_handler_active(libusbCxt))
-					break;
-				
-				/* ----
-				 * OK to really wait now.
-				 * ----
-				 */
-				libusb_wait_for_event(libusbCxt, NULL);
-			}
+			if (!*completed && libusb_event_handler_active(libusbCxt))
+				libusb_wait_for_event(libusbCxt, &tv);
 			libusb_unlock_event_waiters(libusbCxt);
 		}
 	}
@@ -241,6 +303,294 @@ device_transfer_callback(struct libusb_transfer *transfer)
 }
 
 
+/* ----
+ * device_pool_callback()
+ *
+ *	Called by libusb when one of the pre-submitted IN transfers has
+ *	finished. The report is appended to the card's ring buffer and
+ *	the transfer submitted again. If the ring is full, the oldest
+ *	report is dropped.
+ * ----
+ */
+static void
+device_pool_callback(struct libusb_transfer *transfer)
+{
+	Open8055Card   *card = (Open8055Card *)(transfer->user_data);
+	int				idx;
+
+	pthread_mutex_lock(&(card->lock));
+
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED)
+	{
+		if (card->ringCount == OPEN8055_READ_RING)
+		{
+			card->ringHead = (card->ringHead + 1) % OPEN8055_READ_RING;
+			card->ringCount--;
+			card->ringDropped++;
+		}
+		idx = (card->ringHead + card->ringCount) % OPEN8055_READ_RING;
+		memcpy(card->ring[idx], transfer->buffer, OPEN8055_HID_MESSAGE_SIZE);
+		card->ringCount++;
+		card->readReady = TRUE;
+		device_signal(card);
+	}
+	else if (transfer->status != LIBUSB_TRANSFER_CANCELLED)
+	{
+		card->poolStatus = transfer->status;
+		card->readReady = TRUE;
+		device_signal(card);
+	}
+
+	if (card->closing || transfer->status != LIBUSB_TRANSFER_COMPLETED ||
+		libusb_submit_transfer(transfer) != 0)
+	{
+		if (!card->closing && card->poolStatus == 0)
+		{
+			card->poolStatus = LIBUSB_TRANSFER_ERROR;
+			card->readReady = TRUE;
+			device_signal(card);
+		}
+		if (--card->poolActive == 0 && card->writesPending == 0)
+			card->drained = TRUE;
+	}
+
+	pthread_mutex_unlock(&(card->lock));
+}
+
+
+/* ----
+ * device_write_callback()
+ *
+ *	Called by libusb when an OUT transfer queued by write_many() has
+ *	finished. libusb frees the transfer and its buffer afterwards.
+ * ----
+ */
+static void
+device_write_callback(struct libusb_transfer *transfer)
+{
+	Open8055Card   *card = (Open8055Card *)(transfer->user_data);
+
+	pthread_mutex_lock(&(card->lock));
+
+	if (transfer->status != LIBUSB_TRANSFER_COMPLETED &&
+		card->writeStatus == 0)
+		card->writeStatus = transfer->status;
+	card->writeReady = TRUE;
+	if (--card->writesPending == 0 && card->poolActive == 0)
+		card->drained = TRUE;
+
+	pthread_mutex_unlock(&(card->lock));
+}
+
+
+/* ----
+ * device_pool_free()
+ *
+ *	Cancel all outstanding transfers of a card, wait for them to
+ *	finish and free the IN transfer pool.
+ * ----
+ */
+static void
+device_pool_free(Open8055Card *card)
+{
+	int		i;
+
+	pthread_mutex_lock(&(card->lock));
+	card->closing = TRUE;
+	card->drained = (card->poolActive == 0 && card->writesPending == 0);
+	for (i = 0; i < OPEN8055_READ_POOL; i++)
+	{
+		if (card->poolTransfer[i] != NULL)
+			libusb_cancel_transfer(card->poolTransfer[i]);
+	}
+	pthread_mutex_unlock(&(card->lock));
+
+	/* ----
+	 * Pending OUT transfers are not cancelled, they should finish
+	 * quickly. We don't wait forever for a device that is gone though.
+	 * ----
+	 */
+	if (!card->drained)
+		device_handle_events(card, &(card->drained), 2000);
+
+	for (i = 0; i < OPEN8055_READ_POOL; i++)
+	{
+		if (card->poolTransfer[i] != NULL)
+			libusb_free_transfer(card->poolTransfer[i]);
+		card->poolTransfer[i] = NULL;
+	}
+
+	card->poolActive = 0;
+	card->poolStatus = 0;
+	card->ringHead = 0;
+	card->ringCount = 0;
+	card->ringDropped = 0;
+	card->readReady = FALSE;
+	card->writeStatus = 0;
+	card->closing = FALSE;
+
+	if (card->eventPipe[0] >= 0)
+	{
+		close(card->eventPipe[0]);
+		close(card->eventPipe[1]);
+	}
+	card->eventPipe[0] = -1;
+	card->eventPipe[1] = -1;
+	card->eventSignalled = FALSE;
+}
+
+
+/* ----
+ * device_signal()
+ *
+ *	Make the card's event pipe readable. Called with the card lock
+ *	held whenever readReady is set.
+ * ----
+ */
+static void
+device_signal(Open8055Card *card)
+{
+	if (card->eventSignalled || card->eventPipe[1] < 0)
+		return;
+	if (write(card->eventPipe[1], "x", 1) == 1)
+		card->eventSignalled = TRUE;
+}
+
+
+/* ----
+ * device_unsignal()
+ *
+ *	Drain the card's event pipe. Called with the card lock held
+ *	whenever readReady is cleared.
+ * ----
+ */
+static void
+device_unsignal(Open8055Card *card)
+{
+	char	buf[16];
+
+	if (!card->eventSignalled)
+		return;
+	while (read(card->eventPipe[0], buf, sizeof(buf)) > 0)
+		;
+	card->eventSignalled = FALSE;
+}
+
+
+/* ----
+ * device_event_thread()
+ *
+ *	Once fileno() was used, nobody might be calling read() to drive
+ *	libusb. This thread handles all events from then on. Threads in
+ *	read() or write() become event waiters instead.
+ * ----
+ */
+static void *
+device_event_thread(void *arg)
+{
+	struct timeval	tv;
+
+	for (;;)
+	{
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		libusb_handle_events_timeout(libusbCxt, &tv);
+	}
+
+	return NULL;
+}
+
+
+/* ----
+ * device_ring_get()
+ *
+ *	Get up to max reports from the card's ring buffer, waiting up to
+ *	timeout milliseconds (negative means forever) for the first one.
+ *	Returns the number of reports or -1 with a Python exception set.
+ * ----
+ */
+static int
+device_ring_get(Open8055Card *card, unsigned char *buf, int max, int timeout)
+{
+	int				rc;
+	int				n;
+	char			errbuf[1024];
+
+	pthread_mutex_lock(&(card->lock));
+	if (card->ringCount == 0 && card->poolStatus == 0)
+	{
+		card->readReady = FALSE;
+		device_unsignal(card);
+	}
+	pthread_mutex_unlock(&(card->lock));
+
+	if (!card->readReady && timeout != 0)
+	{
+		if ((rc = device_handle_events(card, &(card->readReady),
+				timeout)) < 0)
+		{
+			snprintf(errbuf, sizeof(errbuf),
+					"device_handle_transfer(): %s", 
+					libusb_strerror(rc));
+			PyErr_SetString(PyExc_IOError, errbuf);
+			return -1;
+		}
+	}
+
+	pthread_mutex_lock(&(card->lock));
+
+	if (card->ringCount == 0 && card->poolStatus != 0)
+	{
+		snprintf(errbuf, sizeof(errbuf),
+				"asynchronous transfer failed: status %d",
+				card->poolStatus);
+		pthread_mutex_unlock(&(card->lock));
+		PyErr_SetString(PyExc_IOError, errbuf);
+		return -1;
+	}
+
+	for (n = 0; n < max && card->ringCount > 0; n++)
+	{
+		memcpy(buf + n * OPEN8055_HID_MESSAGE_SIZE,
+				card->ring[card->ringHead], OPEN8055_HID_MESSAGE_SIZE);
+		card->ringHead = (card->ringHead + 1) % OPEN8055_READ_RING;
+		card->ringCount--;
+	}
+	if (card->ringCount == 0 && card->poolStatus == 0)
+	{
+		card->readReady = FALSE;
+		device_unsignal(card);
+	}
+
+	pthread_mutex_unlock(&(card->lock));
+
+	return n;
+}
+
+
+/* ----
+ * device_get_card()
+ *
+ *	Check the card number and return the card if it is open.
+ * ----
+ */
+static Open8055Card *
+device_get_card(int cardNumber)
+{
+	if (cardNumber < 0 || cardNumber >= OPEN8055_MAX_CARDS)
+	{
+		PyErr_SetString(PyExc_ValueError, "invalid card number");
+		return NULL;
+	}
+	if (deviceCard[cardNumber].handle == NULL)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "card not open");
+		return NULL;
+	}
+	return &deviceCard[cardNumber];
+}
+
+
 /* ----
  * device_present()
  *
@@ -327,6 +677,7 @@ device_open(PyObject *self, PyObject *args)
 	libusb_device_handle   *dev;
 	int						rc;
 	int						interface = 0;
+	int						i;
 	char					errbuf[1024];
 
 	/* ----
@@ -359,15 +710,19 @@ device_open(PyObject *self, PyObject *args)
 	 * ----
 	 */
 	card = &deviceCard[cardNumber];
-	if ((card->readTransfer = libusb_alloc_transfer(0)) == NULL)
+	for (i = 0; i < OPEN8055_READ_POOL; i++)
 	{
-		PyErr_SetString(PyExc_RuntimeError, "libusb_alloc_transfer() failed");
-		return NULL;
+		if ((card->poolTransfer[i] = libusb_alloc_transfer(0)) == NULL)
+		{
+			PyErr_SetString(PyExc_RuntimeError, "libusb_alloc_transfer() failed");
+			device_pool_free(card);
+			return NULL;
+		}
 	}
 	if ((card->writeTransfer = libusb_alloc_transfer(0)) == NULL)
 	{
 		PyErr_SetString(PyExc_RuntimeError, "libusb_alloc_transfer() failed");
-		libusb_free_transfer(card->readTransfer);
+		device_pool_free(card);
 		return NULL;
 	}
 
@@ -381,7 +736,7 @@ device_open(PyObject *self, PyObject *args)
 	{
 		PyErr_SetString(PyExc_RuntimeError,
 				"libusb_open_device_with_vid_pid() failed");
-		libusb_free_transfer(card->readTransfer);
+		device_pool_free(card);
 		libusb_free_transfer(card->writeTransfer);
 		return NULL;
 	}
@@ -397,7 +752,7 @@ device_open(PyObject *self, PyObject *args)
 				libusb_strerror(rc));
 		PyErr_SetString(PyExc_RuntimeError, errbuf);
 		libusb_close(dev);
-		libusb_free_transfer(card->readTransfer);
+		device_pool_free(card);
 		libusb_free_transfer(card->writeTransfer);
 		return NULL;
 	}
@@ -413,7 +768,7 @@ device_open(PyObject *self, PyObject *args)
 						libusb_strerror(rc));
 				PyErr_SetString(PyExc_RuntimeError, errbuf);
 				libusb_close(dev);
-				libusb_free_transfer(card->readTransfer);
+				device_pool_free(card);
 				libusb_free_transfer(card->writeTransfer);
 				return NULL;
 			}
@@ -433,7 +788,7 @@ device_open(PyObject *self, PyObject *args)
 		if (deviceCard[cardNumber].hadKernelDriver)
 			libusb_attach_kernel_driver(dev, interface);
 		libusb_close(dev);
-		libusb_free_transfer(card->readTransfer);
+		device_pool_free(card);
 		libusb_free_transfer(card->writeTransfer);
 		return NULL;
 	}
@@ -451,7 +806,7 @@ device_open(PyObject *self, PyObject *args)
 		if (deviceCard[cardNumber].hadKernelDriver)
 			libusb_attach_kernel_driver(dev, interface);
 		libusb_close(dev);
-		libusb_free_transfer(card->readTransfer);
+		device_pool_free(card);
 		libusb_free_transfer(card->writeTransfer);
 		return NULL;
 	}
@@ -470,11 +825,65 @@ device_open(PyObject *self, PyObject *args)
 		if (deviceCard[cardNumber].hadKernelDriver)
 			libusb_attach_kernel_driver(dev, interface);
 		libusb_close(dev);
-		libusb_free_transfer(card->readTransfer);
+		device_pool_free(card);
 		libusb_free_transfer(card->writeTransfer);
 		return NULL;
 	}
 
+	/* ----
+	 * Create the pipe returned by fileno().
+	 * ----
+	 */
+	if (pipe(card->eventPipe) != 0)
+	{
+		snprintf(errbuf, sizeof(errbuf), "pipe() failed - %s",
+				strerror(errno));
+		PyErr_SetString(PyExc_RuntimeError, errbuf);
+		card->eventPipe[0] = -1;
+		card->eventPipe[1] = -1;
+		device_pool_free(card);
+		libusb_free_transfer(card->writeTransfer);
+		libusb_release_interface(dev, interface);
+		if (deviceCard[cardNumber].hadKernelDriver)
+			libusb_attach_kernel_driver(dev, interface);
+		libusb_close(dev);
+		return NULL;
+	}
+	fcntl(card->eventPipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(card->eventPipe[1], F_SETFL, O_NONBLOCK);
+	card->eventSignalled = FALSE;
+
+	/* ----
+	 * Submit the pool of IN transfers. From now on all reports the
+	 * card sends are collected in the ring buffer.
+	 * ----
+	 */
+	for (i = 0; i < OPEN8055_READ_POOL; i++)
+	{
+		libusb_fill_interrupt_transfer(card->poolTransfer[i], dev,
+				LIBUSB_ENDPOINT_IN | 1, card->poolBuf[i], 
+				OPEN8055_HID_MESSAGE_SIZE,
+				device_pool_callback, (void *)card, 0);
+		pthread_mutex_lock(&(card->lock));
+		if ((rc = libusb_submit_transfer(card->poolTransfer[i])) == 0)
+			card->poolActive++;
+		pthread_mutex_unlock(&(card->lock));
+		if (rc != 0)
+		{
+			snprintf(errbuf, sizeof(errbuf),
+					"libusb_submit_transfer(): %s", 
+					libusb_strerror(rc));
+			PyErr_SetString(PyExc_IOError, errbuf);
+			device_pool_free(card);
+			libusb_free_transfer(card->writeTransfer);
+			libusb_release_interface(dev, interface);
+			if (deviceCard[cardNumber].hadKernelDriver)
+				libusb_attach_kernel_driver(dev, interface);
+			libusb_close(dev);
+			return NULL;
+		}
+	}
+
 	deviceCard[cardNumber].handle = dev;
 
 	return Py_BuildValue("i", cardNumber);
@@ -510,7 +919,7 @@ device_close(PyObject *self, PyObject *args)
 		return NULL;
 	}
 
-	libusb_free_transfer(deviceCard[cardNumber].readTransfer);
+	device_pool_free(&deviceCard[cardNumber]);
 	libusb_free_transfer(deviceCard[cardNumber].writeTransfer);
 	libusb_release_interface(deviceCard[cardNumber].handle, interface);
 	if (deviceCard[cardNumber].hadKernelDriver)
@@ -534,10 +943,7 @@ device_read(PyObject *self, PyObject *args)
 {
 	int				cardNumber;
 	Open8055Card   *card;
-	int				rc;
 	unsigned char	ioBuf[OPEN8055_HID_MESSAGE_SIZE];
-	char			errbuf[1024];
-
 
 	/* ----
 	 * Parse command arguments
@@ -545,49 +951,50 @@ device_read(PyObject *self, PyObject *args)
 	 */
 	if (!PyArg_ParseTuple(args, "i", &cardNumber))
 		return NULL;
-	if (cardNumber < 0 || cardNumber >= OPEN8055_MAX_CARDS)
-	{
-		PyErr_SetString(PyExc_ValueError, "invalid card number");
+	if ((card = device_get_card(cardNumber)) == NULL)
 		return NULL;
-	}
-	if (deviceCard[cardNumber].handle == NULL)
-	{
-		PyErr_SetString(PyExc_RuntimeError, "card not open");
-		return NULL;
-	}
-	card = &deviceCard[cardNumber];
 
-	libusb_fill_interrupt_transfer(card->readTransfer, card->handle,
-			LIBUSB_ENDPOINT_IN | 1, ioBuf, 
-			OPEN8055_HID_MESSAGE_SIZE,
-			device_transfer_callback, (void *)&(card->readCompleted), 0);
-	card->readCompleted = FALSE;
-	if ((rc = libusb_submit_transfer(card->readTransfer)) != 0)
-	{
-		snprintf(errbuf, sizeof(errbuf),
-				"libusb_submit_transfer(): %s", 
-				libusb_strerror(rc));
-		PyErr_SetString(PyExc_IOError, errbuf);
+	if (device_ring_get(card, ioBuf, 1, -1) < 0)
 		return NULL;
-	}
 
-	if ((rc = device_handle_events(card, &(card->readCompleted))) < 0)
-	{
-		snprintf(errbuf, sizeof(errbuf),
-				"device_handle_transfer(): %s", 
-				libusb_strerror(rc));
-		PyErr_SetString(PyExc_IOError, errbuf);
+	return Py_BuildValue("s#", &ioBuf, OPEN8055_HID_MESSAGE_SIZE);
+}
+
+
+/* ----
+ * device_read_many()
+ *
+ *	Receive up to max messages from the Open8055 as one string of
+ *	back to back HID reports. Waits up to timeout milliseconds for
+ *	the first one (negative means forever) and returns an empty
+ *	string if none arrived.
+ * ----
+ */
+static PyObject *
+device_read_many(PyObject *self, PyObject *args)
+{
+	int				cardNumber;
+	int				max = OPEN8055_READ_RING;
+	int				timeout = -1;
+	int				n;
+	Open8055Card   *card;
+	unsigned char	ioBuf[OPEN8055_READ_RING * OPEN8055_HID_MESSAGE_SIZE];
+
+	/* ----
+	 * Parse command arguments
+	 * ----
+	 */
+	if (!PyArg_ParseTuple(args, "i|ii", &cardNumber, &max, &timeout))
 		return NULL;
-	}
+	if ((card = device_get_card(cardNumber)) == NULL)
+		return NULL;
+	if (max < 1 || max > OPEN8055_READ_RING)
+		max = OPEN8055_READ_RING;
 
-	if (card->readTransfer->status != LIBUSB_TRANSFER_COMPLETED)
-	{
-		PyErr_SetString(PyExc_IOError, 
-				"asynchronous transfer failed: unknown reason");
+	if ((n = device_ring_get(card, ioBuf, max, timeout)) < 0)
 		return NULL;
-	}
 
-	return Py_BuildValue("s#", &ioBuf, OPEN8055_HID_MESSAGE_SIZE);
+	return Py_BuildValue("s#", &ioBuf, n * OPEN8055_HID_MESSAGE_SIZE);
 }
 
 
@@ -648,7 +1055,8 @@ device_write(PyObject *self, PyObject *args)
 		return NULL;
 	}
 
-	if (device_handle_events(card, &(card->writeCompleted)) < 0)
+	if (device_handle_events(card, &(card->writeCompleted),
+			OPEN8055_WRITE_TIMEOUT) < 0)
 	{
 		snprintf(errbuf, sizeof(errbuf),
 				"device_handle_transfer(): %s", 
@@ -657,6 +1065,19 @@ device_write(PyObject *self, PyObject *args)
 		return NULL;
 	}
 
+	/* ----
+	 * The transfer uses our stack buffer, so on a timeout it must be
+	 * cancelled and finished before we return.
+	 * ----
+	 */
+	if (!card->writeCompleted)
+	{
+		libusb_cancel_transfer(card->writeTransfer);
+		device_handle_events(card, &(card->writeCompleted), -1);
+		PyErr_SetString(PyExc_IOError, "write timed out");
+		return NULL;
+	}
+
 	if (card->writeTransfer->status != LIBUSB_TRANSFER_COMPLETED)
 	{
 		snprintf(errbuf, sizeof(errbuf),
@@ -670,6 +1091,182 @@ device_write(PyObject *self, PyObject *args)
 }
 
 
+/* ----
+ * device_write_many()
+ *
+ *	Queue several messages for the Open8055 without waiting for them
+ *	to be sent. The data holds the HID reports back to back, a short
+ *	last one is padded with zeroes. A failed transfer is reported by
+ *	the next call.
+ * ----
+ */
+static PyObject *
+device_write_many(PyObject *self, PyObject *args)
+{
+	int						cardNumber;
+	Open8055Card		   *card;
+	unsigned char		   *data;
+	unsigned char		   *ioBuf;
+	struct libusb_transfer *transfer;
+	int						data_len;
+	int						count = 0;
+	int						waited = FALSE;
+	int						len;
+	int						status;
+	char					errbuf[1024];
+	int						rc;
+
+	/* ----
+	 * Parse command args and check card number
+	 * ----
+	 */
+	if (!PyArg_ParseTuple(args, "is#", &cardNumber, 
+			&data, &data_len))
+		return NULL;
+	if ((card = device_get_card(cardNumber)) == NULL)
+		return NULL;
+
+	/* ----
+	 * Report an error of a previously queued transfer.
+	 * ----
+	 */
+	pthread_mutex_lock(&(card->lock));
+	status = card->writeStatus;
+	card->writeStatus = 0;
+	pthread_mutex_unlock(&(card->lock));
+	if (status != 0)
+	{
+		snprintf(errbuf, sizeof(errbuf),
+				"asynchronous transfer failed: status %d", status);
+		PyErr_SetString(PyExc_IOError, errbuf);
+		return NULL;
+	}
+
+	while (data_len > 0)
+	{
+		/* ----
+		 * If too many transfers are queued, wait for some to finish,
+		 * but not longer than OPEN8055_WRITE_TIMEOUT. This is called
+		 * from the server's reactor, which must not hang on a card.
+		 * ----
+		 */
+		pthread_mutex_lock(&(card->lock));
+		if (card->writesPending >= OPEN8055_WRITE_QUEUE)
+			card->writeReady = FALSE;
+		else
+			card->writeReady = TRUE;
+		pthread_mutex_unlock(&(card->lock));
+		if (!card->writeReady)
+		{
+			if (waited)
+			{
+				PyErr_SetString(PyExc_IOError, "write queue is full");
+				return NULL;
+			}
+			waited = TRUE;
+			if ((rc = device_handle_events(card, &(card->writeReady),
+					OPEN8055_WRITE_TIMEOUT)) < 0)
+			{
+				snprintf(errbuf, sizeof(errbuf),
+						"device_handle_transfer(): %s", 
+						libusb_strerror(rc));
+				PyErr_SetString(PyExc_IOError, errbuf);
+				return NULL;
+			}
+			continue;
+		}
+
+		/* ----
+		 * libusb frees the transfer and buffer after the callback.
+		 * ----
+		 */
+		if ((transfer = libusb_alloc_transfer(0)) == NULL)
+		{
+			PyErr_SetString(PyExc_RuntimeError, "libusb_alloc_transfer() failed");
+			return NULL;
+		}
+		if ((ioBuf = calloc(1, OPEN8055_HID_MESSAGE_SIZE)) == NULL)
+		{
+			libusb_free_transfer(transfer);
+			PyErr_NoMemory();
+			return NULL;
+		}
+		len = (data_len > OPEN8055_HID_MESSAGE_SIZE) ?
+				OPEN8055_HID_MESSAGE_SIZE : data_len;
+		memcpy(ioBuf, data, len);
+		data += len;
+		data_len -= len;
+
+		libusb_fill_interrupt_transfer(transfer, card->handle,
+				LIBUSB_ENDPOINT_OUT | 1, ioBuf, 
+				OPEN8055_HID_MESSAGE_SIZE,
+				device_write_callback, (void *)card, 0);
+		transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER |
+				LIBUSB_TRANSFER_FREE_TRANSFER;
+
+		pthread_mutex_lock(&(card->lock));
+		if ((rc = libusb_submit_transfer(transfer)) == 0)
+			card->writesPending++;
+		pthread_mutex_unlock(&(card->lock));
+		if (rc != 0)
+		{
+			libusb_free_transfer(transfer);
+			snprintf(errbuf, sizeof(errbuf),
+					"libusb_submit_transfer(): %s", 
+					libusb_strerror(rc));
+			PyErr_SetString(PyExc_IOError, errbuf);
+			return NULL;
+		}
+		waited = FALSE;
+		count++;
+	}
+
+	return Py_BuildValue("i", count);
+}
+
+
+/* ----
+ * device_fileno()
+ *
+ *	Return a file descriptor that becomes readable when reports or
+ *	an error are waiting to be read with read_many(). The first call
+ *	starts the event handling thread.
+ * ----
+ */
+static PyObject *
+device_fileno(PyObject *self, PyObject *args)
+{
+	int				cardNumber;
+	Open8055Card   *card;
+	char			errbuf[1024];
+	int				rc;
+
+	if (!PyArg_ParseTuple(args, "i", &cardNumber))
+		return NULL;
+	if ((card = device_get_card(cardNumber)) == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&deviceGlobalLock);
+	if (!eventThreadStarted)
+	{
+		if ((rc = pthread_create(&eventThread, NULL,
+				device_event_thread, NULL)) != 0)
+		{
+			snprintf(errbuf, sizeof(errbuf),
+					"pthread_create() failed - %s", strerror(rc));
+			PyErr_SetString(PyExc_RuntimeError, errbuf);
+			pthread_mutex_unlock(&deviceGlobalLock);
+			return NULL;
+		}
+		pthread_detach(eventThread);
+		eventThreadStarted = 1;
+	}
+	pthread_mutex_unlock(&deviceGlobalLock);
+
+	return Py_BuildValue("i", card->eventPipe[0]);
+}
+
+
 #ifndef HAVE_LIBUSB_STRERROR
 static char libusb_strerror_message[64];
 static char *
@@ -0,0 +1,491 @@
+"""
+This module emulates Open8055 cards for testing the open8055server
+without hardware. It provides the same functions as open8055io.
+"""
+
+# ----------------------------------------------------------------------
+# open8055iofake.py
+#
+#	Emulated Open8055 cards with realistic report timing
+#
+# ----------------------------------------------------------------------
+#
+#  Copyright (c) 2012, Jan Wieck
+#  All rights reserved.
+#
+#  Redistribution and use in source and binary forms, with or without
+#  modification, are permitted provided that the following conditions are met:
+#      * Redistributions of source code must retain the above copyright
+#        notice, this list of conditions and the following disclaimer.
+#      * Redistributions in binary form must reproduce the above copyright
+#        notice, this list of conditions and the following disclaimer in the
+#        documentation and/or other materials provided with the distribution.
+#      * Neither the name of the <organization> nor the
+#        names of its contributors may be used to endorse or promote products
+#        derived from this software without specific prior written permission.
+#
+#  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+#  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+#  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+#  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+#  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+#  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+#  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+#  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+#  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+#  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+# ----------------------------------------------------------------------
+import collections
+import os
+import struct
+import threading
+import time
+
+# ----------
+# The emulation is controlled by environment variables.
+#
+#   OPEN8055FAKE_CARDS          number of cards present (default 4)
+#   OPEN8055FAKE_INTERVAL       ms between INPUT reports (default 10)
+#   OPEN8055FAKE_WRITE_DELAY    ms a write takes (default 1, the
+#                               interval of the OUT endpoint)
+#
+# write() sleeps that long. write_many() returns right away and the
+# commands take effect in order, one per delay, like the queued OUT
+# transfers of the device module.
+# Every INPUT report carries a sequence number in counter 1 and the
+# time it was created, in milliseconds modulo 2^32, in counters 4
+# (low word) and 5 (high word). open8055loadgen.py uses this to measure
+# the end to end latency. The report sequence number and timestamp
+# fields count like the firmware's, from the time the card was opened.
+# With burst sampling on, INPUTBURST reports are sent once per ms with
+# a sawtooth on ADC 1 and the sample number in units of 1000 on the
+# input bits. A report period set with SETCONFIG2 replaces the INPUT
+# report interval, the ADC hysteresis, averaging window and servo
+# period are only remembered, as are the PID parameters and rules. The
+# inputs selected for edge capture toggle together every 5 ms in the
+# EDGES reports, the INPUT reports don't show that. The counter of an
+# input in mode 23 (period) reports the 100 Hz of that square wave, in
+# 0.01 Hz, in place of the values above. INPUT reports
+# carry the PWM values of the last OUTPUT command. A sequence started
+# without a trigger reports RUNNING and, after its loops, IDLE at the
+# right times, but does not change the outputs. A triggered one stays
+# ARMED, the emulated inputs never change.
+# ----------
+NUM_CARDS = int(os.environ.get('OPEN8055FAKE_CARDS', '4'))
+INTERVAL = float(os.environ.get('OPEN8055FAKE_INTERVAL', '10')) / 1000.0
+WRITE_DELAY = float(os.environ.get('OPEN8055FAKE_WRITE_DELAY', '1')) / 1000.0
+
+WRITE_QUEUE = 64
+BURST_SAMPLES = 6
+BURST_INTERVAL_MIN = 2
+BURST_RING_SIZE = 16
+AVERAGE_WINDOW_DEFAULT = 5
+SERVO_PERIOD_DEFAULT = 200
+SERVO_PERIOD_MIN = 25
+SEQUENCE_ROWS = 40
+SEQUENCE_ROWS_PER_MSG = 4
+SEQUENCE_IDLE = 0
+SEQUENCE_ARMED = 1
+SEQUENCE_RUNNING = 2
+RULES = 16
+RULES_PER_MSG = 4
+EDGES_PER_MSG = 4
+EDGE_RING_SIZE = 16
+EDGE_INPUT_MASK = 0x1F
+EDGE_PERIOD = 50
+TICKS_PER_SEC = 10000
+MODE_PERIOD = 23
+PERIOD_PER_HZ = 100
+PERIOD_VALUE = TICKS_PER_SEC * PERIOD_PER_HZ // (2 * EDGE_PERIOD)
+
+cards = {}
+cards_lock = threading.Lock()
+
+
+# ----------------------------------------------------------------------
+# FakeCard
+#
+#   State of one emulated card.
+# ----------------------------------------------------------------------
+class FakeCard:
+    def __init__(self, card_num):
+        self.card_num = card_num
+        self.cond = threading.Condition()
+        self.queue = collections.deque()
+        self.writes = collections.deque()
+        self.closed = False
+        self.seq = 0
+        self.start = time.time()
+        self.next_input = self.start
+        self.output = struct.pack('!BB8H2HB', 0x01, 0,
+                0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0)
+        self.config1 = struct.pack('!B2B5B8B2B5HB', 0x03, 1, 1,
+                10, 10, 10, 10, 10, 1, 1, 1, 1, 1, 1, 1, 1,
+                0, 0, 1, 1, 1, 1, 1, 0)
+        self.config2 = struct.pack('!BBHHBBB', 0x07, 0, 0, 0,
+                AVERAGE_WINDOW_DEFAULT, SERVO_PERIOD_DEFAULT, 0)
+        self.report_interval = INTERVAL
+        self.burst_interval = 0
+        self.burst_tick = 0
+        self.next_burst = None
+        self.edge_mask = 0
+        self.edge_num = 0
+        self.next_edges = None
+        self.seq_table = [(0, 0, 0, 0)] * SEQUENCE_ROWS
+        self.seq_status = (SEQUENCE_IDLE, 0, 0, 0)
+        self.seq_end = None
+        self.pid = [None, None]
+        self.rules = []
+        self.rules_loading = [None] * RULES
+
+    # ----------
+    # read()
+    #
+    #   Return the next queued report, or the next periodic INPUT
+    #   report once it is due.
+    # ----------
+    def read(self):
+        self.cond.acquire()
+        try:
+            while True:
+                if self.closed:
+                    raise IOError('card closed')
+                now = time.time()
+                while self.writes and now >= self.writes[0][0]:
+                    self.process(self.writes.popleft()[1])
+                if self.queue:
+                    return self.queue.popleft()
+                if now >= self.next_input:
+                    self.next_input = max(self.next_input +
+                            self.report_interval, now - self.report_interval)
+                    return self.make_input()
+                if self.seq_end is not None and now >= self.seq_end:
+                    self.seq_end = None
+                    self.seq_status = (SEQUENCE_IDLE,) + self.seq_status[1:3] + (0,)
+                    return self.make_sequence()
+                if self.next_burst is not None and now >= self.next_burst:
+                    self.next_burst = now + 0.001
+                    data = self.make_burst(now)
+                    if data is not None:
+                        return data
+                if self.next_edges is not None and now >= self.next_edges:
+                    self.next_edges = now + 0.001
+                    data = self.make_edges(now)
+                    if data is not None:
+                        return data
+                wakeup = self.next_input
+                if self.next_burst is not None:
+                    wakeup = min(wakeup, self.next_burst)
+                if self.next_edges is not None:
+                    wakeup = min(wakeup, self.next_edges)
+                if self.seq_end is not None:
+                    wakeup = min(wakeup, self.seq_end)
+                if self.writes:
+                    wakeup = min(wakeup, self.writes[0][0])
+                self.cond.wait(max(wakeup - now, 0.0))
+        finally:
+            self.cond.release()
+
+    # ----------
+    # write()
+    #
+    #   Send one HID command and wait until it is done.
+    # ----------
+    def write(self, data):
+        time.sleep(WRITE_DELAY)
+        self.process(data)
+
+    # ----------
+    # write_many()
+    #
+    #   Queue HID commands to take effect one per WRITE_DELAY, after
+    #   the ones still queued. Like the device module it only waits
+    #   while WRITE_QUEUE commands are pending, until the oldest one
+    #   is done.
+    # ----------
+    def write_many(self, reports):
+        self.cond.acquire()
+        try:
+            for data in reports:
+                while len(self.writes) >= WRITE_QUEUE:
+                    wait = self.writes[0][0] - time.time()
+                    if wait > 0.0:
+                        self.cond.wait(wait)
+                    if self.writes and time.time() >= self.writes[0][0]:
+                        self.process(self.writes.popleft()[1])
+                due = time.time()
+                if self.writes:
+                    due = max(due, self.writes[-1][0])
+                self.writes.append((due + WRITE_DELAY, data))
+            self.cond.notify()
+        finally:
+            self.cond.release()
+
+    # ----------
+    # process()
+    #
+    #   Process one HID command like the firmware does.
+    # ----------
+    def process(self, data):
+        hid_type = ord(data[0])
+        self.cond.acquire()
+        if hid_type == 0x01:            # OUTPUT
+            self.output = data
+        elif hid_type == 0x02:          # GETINPUT
+            self.queue.append(self.make_input())
+        elif hid_type == 0x03:          # SETCONFIG1
+            self.config1 = data
+        elif hid_type == 0x04:          # GETCONFIG
+            self.queue.append(self.config1)
+            self.queue.append(self.output)
+        elif hid_type == 0x07:          # SETCONFIG2
+            (interval, period, hysteresis, window, servo_period,
+                    edge_mask) = struct.unpack('!BHHBBB', data[1:9])
+            if interval != 0:
+                interval = max(interval, BURST_INTERVAL_MIN)
+            if window == 0:
+                window = AVERAGE_WINDOW_DEFAULT
+            if servo_period == 0:
+                servo_period = SERVO_PERIOD_DEFAULT
+            servo_period = max(servo_period, SERVO_PERIOD_MIN)
+            edge_mask &= EDGE_INPUT_MASK
+            self.config2 = struct.pack('!BBHHBBB', 0x07, interval, period,
+                    hysteresis, window, servo_period, edge_mask)
+            self.report_interval = INTERVAL
+            if period != 0:
+                self.report_interval = period / 1000.0
+            self.next_input = time.time() + self.report_interval
+            self.burst_interval = interval
+            self.burst_tick = self.ticks(time.time())
+            self.next_burst = None
+            if interval != 0:
+                self.next_burst = time.time() + 0.001
+            self.edge_mask = edge_mask
+            self.edge_num = self.ticks(time.time()) // EDGE_PERIOD
+            self.next_edges = None
+            if edge_mask != 0:
+                self.next_edges = time.time() + 0.001
+        elif hid_type == 0x08:          # GETCONFIG2
+            self.queue.append(self.config2)
+        elif hid_type == 0x09:          # SETSEQUENCE
+            if self.seq_status[0] == SEQUENCE_IDLE:
+                index = ord(data[1])
+                rows = min(ord(data[2]), SEQUENCE_ROWS_PER_MSG)
+                for i in range(rows):
+                    if index + i < SEQUENCE_ROWS:
+                        self.seq_table[index + i] = struct.unpack('!HBBH',
+                                data[4 + i * 6:10 + i * 6])
+        elif hid_type == 0x0A:          # SEQUENCE
+            self.sequence(*struct.unpack('!BBBH', data[1:6]))
+            self.queue.append(self.make_sequence())
+        elif hid_type == 0x0B:          # SETPID
+            pwm = ord(data[1])
+            if pwm <= 1:
+                self.pid[pwm] = data[0:16]
+        elif hid_type == 0x0C:          # SETRULES
+            index, rows, total = struct.unpack('!BBB', data[1:4])
+            for i in range(min(rows, RULES_PER_MSG)):
+                if index + i < RULES:
+                    self.rules_loading[index + i] = data[4 + i * 6:10 + i * 6]
+            if index + rows >= total:
+                self.rules = self.rules_loading[0:min(total, RULES)]
+        self.cond.notify()
+        self.cond.release()
+
+    # ----------
+    # make_input()
+    # ----------
+    def make_input(self):
+        self.seq += 1
+        now = time.time()
+        stamp = int(now * 1000) & 0xFFFFFFFF
+        ticks = self.ticks(now) & 0xFFFFFFFF
+        pwm = struct.unpack('!2H', self.output[18:22])
+        counters = [self.seq & 0xFFFF, 0, 0, stamp & 0xFFFF, stamp >> 16]
+        for i in range(5):
+            if ord(self.config1[3 + i]) == MODE_PERIOD:
+                counters[i] = PERIOD_VALUE
+        return struct.pack('!BB5H2HHL2H', 0x81, self.seq & 0x1F,
+                *(counters + [(self.seq * 7) % 1024, 512, self.seq & 0xFFFF,
+                ticks] + list(pwm)))
+
+    # ----------
+    # make_burst()
+    #
+    #   Return an INPUTBURST report with the samples taken since the
+    #   last one, or None if there are none yet. Like the firmware's
+    #   sample ring we keep at most BURST_RING_SIZE - 1 samples.
+    # ----------
+    def make_burst(self, now):
+        interval = self.burst_interval
+        due = (self.ticks(now) - self.burst_tick) // interval
+        if due <= 0:
+            return None
+        if due >= BURST_RING_SIZE:
+            self.burst_tick += (due - BURST_RING_SIZE + 1) * interval
+            due = BURST_RING_SIZE - 1
+        count = min(due, BURST_SAMPLES)
+        first = self.burst_tick + interval
+
+        samples = []
+        for tick in range(first, first + count * interval, interval):
+            num = tick // interval
+            samples += [(((num // 1000) & 0x1F) << 11) | (num % 1024), 512]
+        samples += [0, 0] * (BURST_SAMPLES - count)
+        self.burst_tick += count * interval
+        return struct.pack('!BBBBL12H', 0x82, count, interval, 0,
+                first & 0xFFFFFFFF, *samples)
+
+    # ----------
+    # make_edges()
+    #
+    #   Return an EDGES report with the edges since the last one, or
+    #   None if there are none yet. Edges that would not have fit into
+    #   the firmware's queue are counted as lost.
+    # ----------
+    def make_edges(self, now):
+        due = self.ticks(now) // EDGE_PERIOD - self.edge_num
+        if due <= 0:
+            return None
+        lost = 0
+        if due >= EDGE_RING_SIZE:
+            lost = due - EDGE_RING_SIZE + 1
+            self.edge_num += lost
+            due = EDGE_RING_SIZE - 1
+        count = min(due, EDGES_PER_MSG)
+
+        events = []
+        for num in range(self.edge_num + 1, self.edge_num + count + 1):
+            state = self.edge_mask if num & 1 else 0
+            events += [(num * EDGE_PERIOD) & 0xFFFFFFFF, self.edge_mask, state]
+        events += [0, 0, 0] * (EDGES_PER_MSG - count)
+        self.edge_num += count
+        return struct.pack('!BBBB' + 'LBB' * EDGES_PER_MSG, 0x84, count,
+                min(lost, 0xFF), 0, *events)
+
+    # ----------
+    # sequence()
+    #
+    #   Start or stop the sequence player. Commands other than START
+    #   and STOP only ask for the status.
+    # ----------
+    def sequence(self, command, length, trigger, loops):
+        if command == 0:
+            self.seq_status = (SEQUENCE_IDLE,) + self.seq_status[1:]
+            self.seq_end = None
+        elif command == 1:
+            self.seq_status = (SEQUENCE_IDLE,) + self.seq_status[1:]
+            self.seq_end = None
+            if (trigger & 0x7F) > 5 or length == 0 or length > SEQUENCE_ROWS:
+                return
+            if trigger & 0x7F == 0:
+                self.seq_status = (SEQUENCE_RUNNING, length, 0, loops)
+                if loops != 0:
+                    last = self.seq_table[length - 1][0]
+                    self.seq_end = (time.time() +
+                            float(last + 1) * loops / TICKS_PER_SEC)
+            else:
+                self.seq_status = (SEQUENCE_ARMED, length, trigger, loops)
+
+    def make_sequence(self):
+        return struct.pack('!BBBBH', 0x0A, *self.seq_status)
+
+    def ticks(self, now):
+        return int((now - self.start) * TICKS_PER_SEC)
+
+    def close(self):
+        self.cond.acquire()
+        while self.writes:
+            self.process(self.writes.popleft()[1])
+        self.closed = True
+        self.cond.notify_all()
+        self.cond.release()
+
+
+# ----------
+# present()
+#
+#   Check if a given card is present in the system.
+# ----------
+def present(card_num):
+    card_num = int(card_num)
+    if card_num >= 0 and card_num < NUM_CARDS:
+        return 1
+    return 0
+
+
+# ----------
+# open()
+#
+#   Open a Open8055.
+# ----------
+def open(card_num):
+    card_num = int(card_num)
+    cards_lock.acquire()
+    try:
+        if card_num in cards:
+            raise Exception('card already open')
+        if not present(card_num):
+            raise Exception('card not present')
+        cards[card_num] = FakeCard(card_num)
+    finally:
+        cards_lock.release()
+
+
+# ----------
+# close()
+#
+#   Close a Open8055.
+# ----------
+def close(card_num):
+    card_num = int(card_num)
+    cards_lock.acquire()
+    try:
+        if card_num not in cards:
+            raise Exception('card not open')
+        cards.pop(card_num).close()
+    finally:
+        cards_lock.release()
+
+
+# ----------
+# read()
+#
+#   Read one HID report from an open card.
+# ----------
+def read(card_num):
+    card = _get_card(card_num)
+    return card.read().ljust(32, '\0')
+
+
+# ----------
+# write()
+#
+#   Send one HID command to an open card.
+# ----------
+def write(card_num, data):
+    if len(data) > 64:
+        raise ValueError('invalid HID packet data')
+    _get_card(card_num).write(data.ljust(32, '\0'))
+    return 32
+
+
+# ----------
+# write_many()
+#
+#   Queue HID commands, given back to back in 32 byte reports, for an
+#   open card without waiting for them.
+# ----------
+def write_many(card_num, data):
+    reports = [data[pos:pos + 32].ljust(32, '\0')
+            for pos in range(0, len(data), 32)]
+    _get_card(card_num).write_many(reports)
+    return len(reports)
+
+
+def _get_card(card_num):
+    card = cards.get(int(card_num))
+    if card is None:
+        raise Exception('card not open')
+    return card
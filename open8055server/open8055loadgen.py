@@ -0,0 +1,541 @@
+#!/usr/bin/env python
+
+# ----------------------------------------------------------------------
+# open8055loadgen.py
+#
+#	Load generator for the open8055server
+#
+#	Runs many simulated clients in a single select() loop. Each one
+#	connects, sends LIST, OPENs a card (the first client of a card
+#	controls it, all others observe) and then receives the report
+#	stream while the controllers SEND at a given rate. Clients can
+#	reconnect after a session length to also put load on the
+#	connection setup.
+#
+#	At the end it reports the connection setup latency, the message
+#	throughput and the end to end latency of INPUT reports. The latter
+#	needs the emulated cards of open8055iofake.py, which put a
+#	timestamp into every INPUT report. Use --spawn to start a local
+#	server with those cards.
+#
+# ----------------------------------------------------------------------
+#
+#  Copyright (c) 2012, Jan Wieck
+#  All rights reserved.
+#
+#  Redistribution and use in source and binary forms, with or without
+#  modification, are permitted provided that the following conditions are met:
+#      * Redistributions of source code must retain the above copyright
+#        notice, this list of conditions and the following disclaimer.
+#      * Redistributions in binary form must reproduce the above copyright
+#        notice, this list of conditions and the following disclaimer in the
+#        documentation and/or other materials provided with the distribution.
+#      * Neither the name of the <organization> nor the
+#        names of its contributors may be used to endorse or promote products
+#        derived from this software without specific prior written permission.
+#
+#  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+#  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+#  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+#  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+#  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+#  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+#  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+#  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+#  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+#  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+# ----------------------------------------------------------------------
+
+import errno
+import getopt
+import os
+import random
+import select
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+POLLIN = getattr(select, 'POLLIN', 1)
+POLLOUT = getattr(select, 'POLLOUT', 4)
+
+
+# ----------
+# Server side of --spawn. It replaces open8055io with the emulated
+# cards before the server module imports it.
+# ----------
+SPAWN_SCRIPT = """
+import sys
+sys.path.insert(0, sys.argv[1])
+import open8055iofake
+sys.modules['open8055io'] = open8055iofake
+import open8055server
+server = open8055server.Open8055Server()
+server.load_config([sys.argv[2]])
+server.create_server_socket()
+server.start()
+sys.stdin.read()
+server.shutdown()
+"""
+
+SPAWN_CONFIG = """
+[General]
+server_port = {0}
+users_file = {1}
+keep_open = true
+
+[Access]
+connect =       127.0.0.1/32    all     trust
+                ::1/128         all     trust
+                0.0.0.0/0       all     deny
+                ::/0            all     deny
+default =       %(connect)s
+"""
+
+
+def main(argv):
+    host = 'localhost'
+    port = 8055
+    num_clients = 100
+    num_cards = 4
+    duration = 10.0
+    send_rate = 10.0
+    session = 0.0
+    user = 'nobody'
+    password = 'dummy'
+    spawn = False
+
+    try:
+        opts, args = getopt.getopt(argv, '?c:d:hH:n:p:P:r:s:Su:', [
+                'cards=', 'duration=', 'help', 'host=', 'clients=',
+                'port=', 'password=', 'rate=', 'session=', 'spawn',
+                'user='])
+    except Exception as err:
+        sys.stderr.write('Error: ' + str(err) + '\n')
+        usage()
+        return 1
+
+    try:
+        for opt, arg in opts:
+            if opt in ('-h', '-?', '--help', ):
+                usage()
+                return 0
+            elif opt in ('-H', '--host', ):
+                host = arg
+            elif opt in ('-p', '--port', ):
+                port = int(arg)
+            elif opt in ('-n', '--clients', ):
+                num_clients = int(arg)
+            elif opt in ('-c', '--cards', ):
+                num_cards = int(arg)
+            elif opt in ('-d', '--duration', ):
+                duration = float(arg)
+            elif opt in ('-r', '--rate', ):
+                send_rate = float(arg)
+            elif opt in ('-s', '--session', ):
+                session = float(arg)
+            elif opt in ('-u', '--user', ):
+                user = arg
+            elif opt in ('-P', '--password', ):
+                password = arg
+            elif opt in ('-S', '--spawn', ):
+                spawn = True
+    except ValueError as err:
+        sys.stderr.write('Error: ' + str(err) + '\n')
+        return 1
+
+    if len(args) != 0 or num_clients < 1 or num_cards < 1:
+        usage()
+        return 1
+
+    # ----
+    # Start a local server with emulated cards if requested.
+    # ----
+    server = None
+    if spawn:
+        server, tmpfiles = spawn_server(port, num_cards)
+
+    try:
+        stats = LoadStats()
+        clients = [LoadClient(idx, idx % num_cards, idx < num_cards,
+                user, password, send_rate, session, stats)
+                for idx in range(0, num_clients)]
+        run(host, port, clients, duration, stats)
+    finally:
+        if server is not None:
+            server.stdin.close()
+            server.wait()
+            for fname in tmpfiles:
+                os.remove(fname)
+
+    stats.report(duration)
+    return 0
+
+
+# ----------
+# spawn_server()
+#
+#   Start an open8055server with emulated cards as a child process
+#   and wait until it accepts connections.
+# ----------
+def spawn_server(port, num_cards):
+    fd, users_fname = tempfile.mkstemp(prefix='open8055loadgen', suffix='.users')
+    os.close(fd)
+    fd, config_fname = tempfile.mkstemp(prefix='open8055loadgen', suffix='.conf')
+    os.write(fd, SPAWN_CONFIG.format(port, users_fname))
+    os.close(fd)
+
+    env = dict(os.environ)
+    env['OPEN8055FAKE_CARDS'] = str(num_cards)
+    server = subprocess.Popen([sys.executable, '-c', SPAWN_SCRIPT,
+            os.path.dirname(os.path.realpath(__file__)), config_fname],
+            stdin=subprocess.PIPE, env=env)
+
+    for _dummy in range(0, 100):
+        try:
+            socket.create_connection(('localhost', port)).close()
+            break
+        except socket.error:
+            time.sleep(0.1)
+
+    return server, (users_fname, config_fname)
+
+
+# ----------
+# run()
+#
+#   The event loop driving all clients.
+# ----------
+def run(host, port, clients, duration, stats):
+    addr = socket.getaddrinfo(host, port, 0, socket.SOCK_STREAM)[0]
+
+    # ----
+    # Spread the initial connects a little, like real clients would.
+    # ----
+    start = time.time()
+    for client in clients:
+        client.next_connect = start + random.random() * 0.5
+    stats.start = start
+    end = start + duration
+
+    if hasattr(select, 'poll'):
+        poller = select.poll()
+    else:
+        poller = None
+
+    while True:
+        now = time.time()
+        if now >= end:
+            break
+
+        timeout = end - now
+        for client in clients:
+            if client.sock is None and client.next_connect <= now:
+                client.connect(addr, now)
+            due = client.next_due()
+            if due is not None:
+                timeout = min(timeout, max(due - now, 0.0))
+
+        socks = {}
+        for client in clients:
+            if client.sock is not None:
+                socks[client.sock.fileno()] = client
+
+        if poller is not None:
+            for fd, client in socks.items():
+                mask = POLLIN
+                if client.outbuf or client.state == 'connecting':
+                    mask |= POLLOUT
+                poller.register(fd, mask)
+            try:
+                events = poller.poll(timeout * 1000.0)
+            except select.error as err:
+                if err.args[0] != errno.EINTR:
+                    raise
+                events = []
+            for fd in socks.keys():
+                poller.unregister(fd)
+        else:
+            rlist = socks.keys()
+            wlist = [fd for fd, client in socks.items()
+                    if client.outbuf or client.state == 'connecting']
+            rdy, wrdy, _dummy = select.select(rlist, wlist, (), timeout)
+            events = [(fd, POLLIN) for fd in rdy]
+            events += [(fd, POLLOUT) for fd in wrdy]
+
+        now = time.time()
+        for fd, mask in events:
+            client = socks[fd]
+            if client.sock is None:
+                continue
+            if mask & POLLOUT:
+                client.handle_write(now)
+            if client.sock is not None and mask & ~POLLOUT:
+                client.handle_read(now)
+
+        for client in clients:
+            client.handle_timers(now)
+
+    for client in clients:
+        client.close()
+    stats.end = time.time()
+
+
+# ----------------------------------------------------------------------
+# LoadClient
+#
+#   One simulated client.
+# ----------------------------------------------------------------------
+class LoadClient:
+    def __init__(self, idx, cardid, controller, user, password,
+            send_rate, session, stats):
+        self.idx = idx
+        self.cardid = cardid
+        self.controller = controller
+        self.user = user
+        self.password = password
+        self.send_rate = send_rate
+        self.session = session
+        self.stats = stats
+
+        self.sock = None
+        self.state = None
+        self.inbuf = ''
+        self.outbuf = ''
+        self.next_connect = 0.0
+        self.next_send = None
+        self.session_end = None
+        self.output_bits = 0
+
+    def connect(self, addr, now):
+        self.sock = socket.socket(addr[0], addr[1], addr[2])
+        self.sock.setblocking(0)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        rc = self.sock.connect_ex(addr[4])
+        if rc not in (0, errno.EINPROGRESS, errno.EWOULDBLOCK):
+            self.fail('connect: ' + os.strerror(rc), now)
+            return
+        self.state = 'connecting'
+        self.connect_start = now
+        self.inbuf = ''
+        self.outbuf = ''
+        self.stats.connects += 1
+
+    def next_due(self):
+        due = [t for t in (self.next_send, self.session_end) if t is not None]
+        if self.sock is None:
+            due.append(self.next_connect)
+        if not due:
+            return None
+        return min(due)
+
+    def handle_write(self, now):
+        if self.state == 'connecting':
+            rc = self.sock.getsockopt(socket.SOL_SOCKET, socket.SO_ERROR)
+            if rc != 0:
+                self.fail('connect: ' + os.strerror(rc), now)
+                return
+            self.state = 'hello'
+        if not self.outbuf:
+            return
+        try:
+            sent = self.sock.send(self.outbuf)
+        except socket.error as err:
+            if err.errno in (errno.EAGAIN, errno.EWOULDBLOCK, errno.EINTR):
+                return
+            self.fail(str(err), now)
+            return
+        self.outbuf = self.outbuf[sent:]
+
+    def handle_read(self, now):
+        try:
+            data = self.sock.recv(65536)
+        except socket.error as err:
+            if err.errno in (errno.EAGAIN, errno.EWOULDBLOCK, errno.EINTR):
+                return
+            self.fail(str(err), now)
+            return
+        if len(data) == 0:
+            self.fail('connection closed by server', now)
+            return
+        self.stats.bytes_in += len(data)
+
+        self.inbuf += data
+        while self.sock is not None:
+            idx = self.inbuf.find('\n')
+            if idx < 0:
+                break
+            line = self.inbuf[0:idx]
+            self.inbuf = self.inbuf[idx + 1:]
+            self.stats.msgs_in += 1
+            self.process_line(line.split(' '), now)
+
+    def process_line(self, args, now):
+        if args[0] == 'SALT':
+            self.stats.connect_latency.append(now - self.connect_start)
+            self.send('LIST {0} {1}\n'.format(self.user, self.password))
+            self.state = 'list'
+
+        elif args[0] == 'LIST':
+            self.open_start = now
+            self.send('OPEN {0} {1} {2}{3}\n'.format(self.cardid, self.user,
+                    self.password, '' if self.controller else ' OBSERVE'))
+            self.state = 'open'
+
+        elif args[0] == 'RECV' and args[1] == '129':
+            if self.state == 'open':
+                self.stats.open_latency.append(now - self.open_start)
+                self.state = 'run'
+                if self.controller and self.send_rate > 0.0:
+                    self.next_send = now + random.random() / self.send_rate
+                if self.session > 0.0:
+                    self.session_end = now + self.session
+            else:
+                stamp = int(args[6]) + (int(args[7]) << 16)
+                delta = ((int(now * 1000) & 0xFFFFFFFF) - stamp) & 0xFFFFFFFF
+                if delta < 0x80000000:
+                    self.stats.recv_latency.append(delta / 1000.0)
+            self.stats.inputs += 1
+
+        elif args[0] == 'ERROR':
+            self.stats.errors += 1
+            if ' '.join(args).find('controlled by another client') >= 0:
+                # ----
+                # Our predecessor's session is not finished yet.
+                # Retry the OPEN as observer.
+                # ----
+                self.controller = False
+                self.send('OPEN {0} {1} {2} OBSERVE\n'.format(self.cardid,
+                        self.user, self.password))
+
+    def handle_timers(self, now):
+        if self.sock is None:
+            return
+        if self.session_end is not None and now >= self.session_end:
+            self.close()
+            self.next_connect = now
+            return
+        if self.next_send is not None and now >= self.next_send:
+            # ----
+            # Controllers alternate between changing the outputs and
+            # asking for an INPUT report.
+            # ----
+            if self.output_bits & 1:
+                self.send('SEND 2\n')
+            else:
+                self.send('SEND 1 {0} 0 0 0 0 0 0 0 0 0 0 0\n'.format(
+                        self.output_bits & 0xFF))
+            self.output_bits += 1
+            self.stats.sends += 1
+            self.next_send += 1.0 / self.send_rate
+            if self.next_send < now:
+                self.next_send = now + 1.0 / self.send_rate
+
+    def send(self, msg):
+        self.outbuf += msg
+        self.stats.msgs_out += 1
+        self.stats.bytes_out += len(msg)
+        self.handle_write(time.time())
+
+    def fail(self, msg, now):
+        self.stats.failures += 1
+        if self.stats.failures <= 10:
+            sys.stderr.write('client {0}: {1}\n'.format(self.idx, msg))
+        self.close()
+        self.next_connect = now + 1.0
+
+    def close(self):
+        if self.sock is not None:
+            self.sock.close()
+        self.sock = None
+        self.state = None
+        self.next_send = None
+        self.session_end = None
+
+
+# ----------------------------------------------------------------------
+# LoadStats
+#
+#   Counters and latency samples of all clients.
+# ----------------------------------------------------------------------
+class LoadStats:
+    def __init__(self):
+        self.start = 0.0
+        self.end = 0.0
+        self.connects = 0
+        self.failures = 0
+        self.errors = 0
+        self.msgs_in = 0
+        self.msgs_out = 0
+        self.bytes_in = 0
+        self.bytes_out = 0
+        self.inputs = 0
+        self.sends = 0
+        self.connect_latency = []
+        self.open_latency = []
+        self.recv_latency = []
+
+    def report(self, duration):
+        elapsed = max(self.end - self.start, 0.001)
+        print 'duration            {0:.1f} s'.format(elapsed)
+        print 'connects            {0} ({1} failed)'.format(self.connects,
+                self.failures)
+        print 'ERROR responses     {0}'.format(self.errors)
+        print 'messages received   {0} ({1:.0f}/s, {2:.0f} kB/s)'.format(
+                self.msgs_in, self.msgs_in / elapsed,
+                self.bytes_in / elapsed / 1024.0)
+        print 'messages sent       {0} ({1:.0f}/s)'.format(
+                self.msgs_out, self.msgs_out / elapsed)
+        print 'INPUT reports       {0} ({1:.0f}/s)'.format(
+                self.inputs, self.inputs / elapsed)
+        print 'SEND commands       {0} ({1:.0f}/s)'.format(
+                self.sends, self.sends / elapsed)
+        print
+        print '{0:20s}{1:>10s}{2:>10s}{3:>10s}{4:>10s}{5:>10s}'.format(
+                'latency (ms)', 'samples', 'p50', 'p90', 'p99', 'max')
+        for name, samples in (('connect to SALT', self.connect_latency),
+                ('OPEN to INPUT', self.open_latency),
+                ('INPUT end to end', self.recv_latency)):
+            print '{0:20s}{1:>10d}{2:>10s}{3:>10s}{4:>10s}{5:>10s}'.format(
+                    name, len(samples),
+                    *[self.percentile(samples, p) for p in (50, 90, 99, 100)])
+
+    @staticmethod
+    def percentile(samples, pct):
+        if not samples:
+            return '-'
+        samples.sort()
+        idx = min(int(len(samples) * pct / 100.0), len(samples) - 1)
+        return '{0:.2f}'.format(samples[idx] * 1000.0)
+
+
+def usage():
+    sys.stderr.write("""usage: {0} [OPTIONS]
+
+    Run simulated clients against an open8055server and report
+    latency and throughput.
+
+Options:
+    -H, --host=HOST         server host (default localhost)
+    -p, --port=PORT         server port (default 8055)
+    -n, --clients=N         number of clients (default 100)
+    -c, --cards=N           number of cards to spread the clients
+                            over (default 4)
+    -d, --duration=SEC      test duration (default 10)
+    -r, --rate=N            SEND commands per second and card
+                            controlling client (default 10)
+    -s, --session=SEC       reconnect after SEC seconds, 0 means
+                            never (default 0)
+    -u, --user=USER         username for LIST and OPEN
+    -P, --password=PASS     password for LIST and OPEN
+    -S, --spawn             start a server with emulated cards
+                            (open8055iofake) on the given port
+    -h, --help              print this help
+
+""".format(os.path.basename(sys.argv[0])))
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
@@ -1,6 +1,9 @@
 #!/usr/bin/env python
 
 import ConfigParser
+import collections
+import errno
+import glob
 import hashlib
 import netaddr
 import os
@@ -31,6 +34,37 @@ MODE_RUN = 1
 MODE_STOP = 2
 MODE_STOPPED = 3
 
+# ----
+# Input item bits as used by SUBSCRIBE. These are the same as the
+# OPEN8055_INPUT_* definitions in open8055.h.
+# ----
+INPUT_I_ANY = 0x001F
+INPUT_COUNT1 = 0x0020
+INPUT_COUNT_ANY = 0x03E0
+INPUT_ADC1 = 0x0400
+INPUT_ADC_ANY = 0x0C00
+INPUT_ANY = 0x0FFF
+
+# ----
+# Report types every client receives, and those a client has to ask
+# for with ACCEPT, because older clients fail on them.
+# ----
+REPORTS_DEFAULT = (0x01, 0x03, 0x81)
+REPORTS_OPTIONAL = (0x07, 0x0A, 0x82, 0x84)
+
+# ----
+# STATS items that are exported as Prometheus gauges. All others
+# are counters.
+# ----
+STATS_GAUGES = ('queue_depth', 'queue_max', 'send_latency_avg',
+        'send_latency_max', 'write_queue')
+
+# ----
+# Direction of a record in a recording file.
+# ----
+RECORD_SEND = 0
+RECORD_RECV = 1
+
 # ----------------------------------------------------------------------
 # Open8055Server
 # ----------------------------------------------------------------------
@@ -55,6 +89,61 @@ class Open8055Server(threading.Thread):
         self.status = MODE_RUN
         self.lock = threading.Lock()
         self.clients = []
+        self.publisher = None
+        self.recorder = None
+
+        # ----
+        # The last CONFIG1, OUTPUT and INPUT report seen per card.
+        # Used to answer an OPEN without waiting for the card.
+        # ----
+        self.card_state = {}
+
+        # ----
+        # Counters per card, see Open8055CardStats. They survive closing
+        # and reopening a card.
+        # ----
+        self.card_stats = {}
+        self.metrics_next = None
+
+        # ----
+        # The [Access] lists compiled by load_config() and the users
+        # file. Both are reloaded when the files change or on SIGHUP.
+        # ----
+        self.access_lists = {}
+        self.users = {}
+        self.users_mtime = None
+        self.config_mtime = None
+        self.reload_check = 0.0
+
+        # ----
+        # Card reader threads hand everything they receive to the
+        # reactor through this queue and wake it up via the wakeup
+        # socket pair.
+        # ----
+        self.readers = []
+        self.events = collections.deque()
+        self.wakeup_rd, self.wakeup_wr = self.create_wakeup_sockets()
+
+    # ----------
+    # create_wakeup_sockets()
+    #
+    #   Create a connected pair of sockets used to interrupt select().
+    #   Windows can only select() on sockets and has no socketpair(),
+    #   so there we connect two over the loopback interface.
+    # ----------
+    def create_wakeup_sockets(self):
+        if hasattr(socket, 'socketpair'):
+            rd, wr = socket.socketpair()
+        else:
+            lsock = socket.socket(socket.AF_INET, socket.SOCK_STREAM, 0)
+            lsock.bind(('127.0.0.1', 0))
+            lsock.listen(1)
+            wr = socket.create_connection(lsock.getsockname())
+            rd, _dummy = lsock.accept()
+            lsock.close()
+        rd.setblocking(0)
+        wr.setblocking(0)
+        return rd, wr
 
     def create_server_socket(self):
         # ----
@@ -78,131 +167,552 @@ class Open8055Server(threading.Thread):
             self.sock.bind(('', port))
             self.sock.listen(10)
 
+        # ----
+        # Create the multicast publisher if configured.
+        # ----
+        group = self.config.get('Multicast', 'group').strip()
+        if group:
+            self.publisher = Open8055Publisher(group,
+                    self.config.getint('Multicast', 'port'),
+                    self.config.getint('Multicast', 'ttl'),
+                    self.config.get('Multicast', 'interface').strip())
+            log_info('publishing INPUT reports on {0} port {1}'.format(
+                    group, self.config.getint('Multicast', 'port')))
+
+        # ----
+        # Create the traffic recorder if configured.
+        # ----
+        directory = self.config.get('Record', 'directory').strip()
+        if directory:
+            self.recorder = Open8055Recorder(directory,
+                    self.config.getint('Record', 'max_size'),
+                    self.config.getint('Record', 'max_files'))
+            log_info('recording card traffic in ' + directory)
+
+        # ----
+        # Start the periodic metrics file if configured.
+        # ----
+        if self.config.get('Stats', 'prometheus_file').strip():
+            self.metrics_next = time.time()
+
     # ----
     # load_config()
+    #
+    #   Load the config file. A reload parses into a new parser and
+    #   only replaces the current configuration if that succeeds, so
+    #   that saving a file with an error doesn't take the server down.
     # ----
     def load_config(self, config_locations, is_reload = False):
-        self.config = ConfigParser.SafeConfigParser()
-
-        self.config.add_section('General')
-        self.config.set('General', 'server_port', '8055')
-        self.config.set('General', 'users_file', 'open8055.users')
-
-        self.config.add_section('Access')
-        self.config.set('Access', 'connect', """127.0.0.1/32    all     trust
+        config = ConfigParser.SafeConfigParser()
+
+        config.add_section('General')
+        config.set('General', 'server_port', '8055')
+        config.set('General', 'users_file', 'open8055.users')
+        config.set('General', 'keep_open', 'true')
+
+        config.add_section('Multicast')
+        config.set('Multicast', 'group', '')
+        config.set('Multicast', 'port', '8056')
+        config.set('Multicast', 'ttl', '1')
+        config.set('Multicast', 'interface', '')
+
+        config.add_section('Record')
+        config.set('Record', 'directory', '')
+        config.set('Record', 'max_size', '10485760')
+        config.set('Record', 'max_files', '10')
+
+        config.add_section('Stats')
+        config.set('Stats', 'prometheus_file', '')
+        config.set('Stats', 'interval', '10')
+
+        config.add_section('Write')
+        config.set('Write', 'interval', '1')
+        config.set('Write', 'client_rate', '500')
+        config.set('Write', 'client_burst', '10')
+        config.set('Write', 'max_queue', '64')
+
+        config.add_section('Access')
+        config.set('Access', 'connect', """127.0.0.1/32    all     trust
                         ::1/128     all     trust
                         0.0.0.0/0   all     deny
                         ::/0        all     deny""")
-        self.config.set('Access', 'default', """127.0.0.1/32    all     trust
+        config.set('Access', 'default', """127.0.0.1/32    all     trust
                         ::1/128     all     trust
                         0.0.0.0/0   all     deny
                         ::/0        all     deny""")
 
-        if not is_reload:
-            self.config_fname = None
-            for fname in config_locations:
-                if not os.path.exists(fname):
+        try:
+            if not is_reload:
+                config_fname = None
+                for fname in config_locations:
+                    if not os.path.exists(fname):
+                        continue
+                    try:
+                        config.read(fname)
+                    except Exception as err:
+                        log_error('cannot load {0}: {1}'.format(fname,
+                                str(err)))
+                        continue
+
+                    log_info('configuration loaded from {0}'.format(fname))
+                    config_fname = fname
+                    break
+            else:
+                config_fname = self.config_fname
+                if config_fname is not None:
+                    if config_fname not in config.read(config_fname):
+                        raise Exception('file cannot be read')
+
+            # ----
+            # The write scheduler settings are used for every write, so
+            # we convert them only once.
+            # ----
+            write_interval = config.getfloat('Write', 'interval') / 1000.0
+            write_rate = config.getfloat('Write', 'client_rate')
+            write_burst = max(config.getfloat('Write', 'client_burst'), 1.0)
+            write_max_queue = config.getint('Write', 'max_queue')
+
+            # ----
+            # Check the values that are read later, so that a bad one
+            # fails here.
+            # ----
+            config.getboolean('General', 'keep_open')
+            config.get('General', 'users_file')
+            config.get('Stats', 'prometheus_file')
+            config.getfloat('Stats', 'interval')
+
+            # ----
+            # Compile all access lists. On a reload a broken one keeps
+            # the old configuration in effect.
+            # ----
+            access_lists = {}
+            for option in config.options('Access'):
+                access_list = Open8055AccessList(config.get('Access', option))
+                if access_list.error is not None:
+                    if is_reload:
+                        raise Exception('access list {0}: {1}'.format(
+                                option, access_list.error))
+                    log_error('access list {0}: {1}'.format(option,
+                            access_list.error))
+                access_lists[option] = access_list
+        except Exception as err:
+            if not is_reload:
+                raise
+            log_error('cannot reload {0}: {1}, keeping the old '
+                    'configuration'.format(self.config_fname, str(err)))
+            self.config_mtime = self.get_mtime(self.config_fname)
+            return
+
+        if is_reload and config_fname is not None:
+            log_info('configuration reloaded from {0}'.format(config_fname))
+
+        self.config = config
+        self.config_fname = config_fname
+        if config_fname is not None:
+            self.config_mtime = self.get_mtime(config_fname)
+        self.write_interval = write_interval
+        self.write_rate = write_rate
+        self.write_burst = write_burst
+        self.write_max_queue = write_max_queue
+        self.access_lists = access_lists
+
+        self.load_users()
+
+    # ----------
+    # load_users()
+    #
+    #   Read the users file into memory. Plain text passwords are
+    #   converted to their md5 hash right here. A file that cannot be
+    #   read keeps the old users.
+    # ----------
+    def load_users(self):
+        fname = self.get_users_fname()
+        users = {}
+        self.users_mtime = self.get_mtime(fname)
+        try:
+            fd = open(fname, 'r')
+            for line in fd:
+                line = line.strip()
+                if len(line) == 0:
                     continue
                 try:
-                    self.config.read(fname)
-                except Exception as err:
-                    log_error('cannot load {0}: {1}'.format(fname, str(err)))
+                    auth_user, auth_issuper, auth_password = line.split(':')
+                except ValueError:
+                    log_error('{0}: invalid line "{1}"'.format(fname, line))
                     continue
-                
-                log_info('configuration loaded from {0}'.format(fname))
-                self.config_fname = fname
-                break
-        else:
+                if len(auth_password) != 35 or auth_password[0:3] != 'md5':
+                    auth_password = 'md5' + hashlib.md5(
+                            auth_password).hexdigest()
+                if auth_user not in users:
+                    users[auth_user] = (auth_issuper, auth_password)
+            fd.close()
+        except Exception as err:
+            log_error('{0}: {1}, keeping the old users'.format(
+                    self.config.get('General', 'users_file'), err))
+            return
+        self.users = users
+
+    # ----------
+    # get_users_fname()
+    #
+    #   Locate the users file. A relative name is relative to the
+    #   config file or, if there is none, to this script.
+    # ----------
+    def get_users_fname(self):
+        fname = self.config.get('General', 'users_file')
+        if not os.path.isabs(fname):
             if self.config_fname is not None:
-                self.config.read(self.config_fname)
-                
+                fname = os.path.realpath(os.path.join(
+                        os.path.dirname(
+                        os.path.realpath(self.config_fname)), fname))
+            else:
+                fname = os.path.realpath(os.path.join(
+                        os.path.dirname(os.path.realpath(__file__)), fname))
+        return fname
 
     # ----------
-    # run()
+    # get_mtime()
     # ----------
-    def run(self):
-        while True:
-            self.lock.acquire()
-            if self.status != MODE_RUN:
-                # ----
-                # On STOP notify all existing clients to close and
-                # wait for them to finish.
-                # ----
-                for client in self.clients:
-                    client.set_status(MODE_STOP)
+    def get_mtime(self, fname):
+        try:
+            return os.stat(fname).st_mtime
+        except OSError:
+            return None
 
-                for client in self.clients:
-                    client.join()
+    # ----------
+    # check_reload()
+    #
+    #   Reload the config file or the users file if it changed on
+    #   disk. Called before access checks, but looks at the files
+    #   at most once per second.
+    # ----------
+    def check_reload(self):
+        now = time.time()
+        if now < self.reload_check:
+            return
+        self.reload_check = now + 1.0
 
-                # ----
-                # Close the server socket.
-                # ----
-                self.sock.shutdown(socket.SHUT_RDWR)
-                self.sock.close()
+        if (self.config_fname is not None and
+                self.get_mtime(self.config_fname) != self.config_mtime):
+            self.load_config(None, True)
+        elif self.get_mtime(self.get_users_fname()) != self.users_mtime:
+            log_info('reloading ' + self.get_users_fname())
+            self.load_users()
 
-                # ----
-                # Finally set the status to STOPPED and end this thread.
-                # ----
-                self.status = MODE_STOPPED
-                self.lock.release()
-                return
-            self.lock.release()
 
-            # ----
-            # We are still in RUN mode. Wait for a new client to connect.
-            # ----
+    # ----------
+    # run()
+    #
+    #   The reactor. A single select() waits for new connections, client
+    #   sockets, cards that can be selected on and events posted by the
+    #   card reader threads. It only wakes up when there is something to
+    #   do or a client's timer is due.
+    # ----------
+    def run(self):
+        if self.config.getboolean('General', 'keep_open'):
+            self.open_present_cards()
+
+        while self.get_status() == MODE_RUN:
+            rlist = [self.sock, self.wakeup_rd]
+            wlist = []
+            timeout = None
+            now = time.time()
+            for reader in self.readers:
+                if reader.status != MODE_RUN:
+                    continue
+                if reader.fd is not None:
+                    rlist.append(reader.fd)
+                delay = reader.writes.delay(now)
+                if delay is not None and (timeout is None or delay < timeout):
+                    timeout = delay
+            for client in self.clients:
+                rlist.append(client.conn)
+                if client.outbuf:
+                    wlist.append(client.conn)
+                delay = client.timer_delay()
+                if delay is not None and (timeout is None or delay < timeout):
+                    timeout = delay
+            if self.metrics_next is not None:
+                delay = max(self.metrics_next - time.time(), 0.0)
+                if timeout is None or delay < timeout:
+                    timeout = delay
+
             try:
-                rdy, _dummy, _dummy = select.select((self.sock,), (), (), 2.0)
+                rdy, wrdy, _dummy = select.select(rlist, wlist, (), timeout)
             except Exception as err:
-                log_error('select() on server socket failed:' + str(err))
-                self.lock.acquire()
-                self.status = MODE_STOPPED
-                self.lock.release()
-                return
+                log_error('select() failed: ' + str(err))
+                break
+
+            if self.wakeup_rd in rdy:
+                try:
+                    self.wakeup_rd.recv(4096)
+                except socket.error:
+                    pass
+            self.process_events()
+
+            for reader in list(self.readers):
+                if reader.fd is not None and reader.fd in rdy:
+                    reader.handle_read()
+            self.process_events()
+
+            if self.sock in rdy:
+                if not self.accept_client():
+                    break
+
+            for client in self.clients:
+                if client.conn in wrdy:
+                    client.handle_write()
+                if client.conn in rdy:
+                    client.handle_read()
+                client.handle_timers()
 
             # ----
-            # Whenever we get a new client connection or the select() has
-            # timed out we try to clean up after terminated clients.
+            # Write what the clients queued for the cards.
             # ----
+            for reader in list(self.readers):
+                if reader.status == MODE_RUN:
+                    reader.writes.run()
+
+            if self.metrics_next is not None and self.metrics_next <= time.time():
+                self.write_metrics()
+
             self.reaper()
 
-            # ----
-            # If no client connected, just loop.
-            # ----
-            if len(rdy) == 0:
-                continue
+        # ----
+        # On STOP close all client connections and wait for the card
+        # readers to finish.
+        # ----
+        for client in self.clients:
+            client.close()
+        self.clients = []
 
-            # ----
-            # Accept new client connection.
-            # ----
+        for reader in list(self.readers):
+            reader.stop()
+        for reader in list(self.readers):
+            self.finish_reader(reader)
+
+        if self.recorder is not None:
+            self.recorder.close()
+
+        # ----
+        # Close the server socket.
+        # ----
+        self.sock.close()
+
+        # ----
+        # Finally set the status to STOPPED and end this thread.
+        # ----
+        self.set_status(MODE_STOPPED)
+
+    # ----------
+    # accept_client()
+    #
+    #   Accept a new client connection. Returns False if the server
+    #   socket is broken.
+    # ----------
+    def accept_client(self):
+        try:
+            conn, addr = self.sock.accept()
+        except socket.error as err:
+            if err.errno in (errno.EAGAIN, errno.EWOULDBLOCK, errno.EINTR,
+                    errno.ECONNABORTED):
+                return True
+            log_error('accept() on server socket failed:' + str(err))
+            return False
+
+        # ----
+        # Check the client address against the [Access] config section.
+        # ----
+        if not self.check_connect_access(addr):
+            log_error('client {0}: connect denied'.format(addr))
             try:
-                conn, addr = self.sock.accept()
-            except Exception as err:
-                log_error('accept() on server socket failed:' + str(err))
-                self.lock.acquire()
-                self.status = MODE_STOPPED
-                self.lock.release()
-                return
+                conn.send('ERROR access denied\n')
+                conn.shutdown(socket.SHUT_RDWR)
+                conn.close()
+            except:
+                pass
+            return True
 
-            # ----
-            # Check the client address against the [Access] config section.
-            # ----
-            if not self.check_connect_access(addr):
-                log_error('client {0}: connect denied'.format(addr))
-                try:
-                    conn.send('ERROR access denied\n')
-                    conn.shutdown(socket.SHUT_RDWR)
-                    conn.close()
-                    continue
-                except:
+        # ----
+        # The protocol consists of small request/response lines.
+        # Don't let Nagle's algorithm hold them back.
+        # ----
+        conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+        # ----
+        # Create a client for it and add it to the list.
+        # ----
+        self.clients.append(Open8055Client(self, conn, addr))
+        return True
+
+    # ----------
+    # post()
+    #
+    #   Called by card reader threads to queue an event for the
+    #   reactor.
+    # ----------
+    def post(self, event):
+        self.events.append(event)
+        try:
+            self.wakeup_wr.send('x')
+        except socket.error:
+            # A full socket buffer means a wakeup is pending anyway.
+            pass
+
+    # ----------
+    # process_events()
+    #
+    #   Handle everything the card readers posted.
+    # ----------
+    def process_events(self):
+        while self.events:
+            event = self.events.popleft()
+            reader = event[1]
+
+            if event[0] == 'data':
+                reader.process(event[2])
+
+            elif event[0] == 'error':
+                log_error('card {0}: {1}'.format(reader.cardid, event[2]))
+                self.get_card_stats(reader.cardid).read_errors += 1
+                self.card_state.pop(reader.cardid, None)
+                for client in reader.subscribers():
+                    client.send('ERROR ' + event[2] + '\n')
+                    client.close()
+
+            elif event[0] == 'stopped':
+                if reader in self.readers:
+                    self.finish_reader(reader)
+
+            elif event[0] == 'reload':
+                self.load_config(None, True)
+
+    # ----------
+    # open_card()
+    #
+    #   Open a card and start its reader. We queue a GETCONFIG message
+    #   for the card and the reader is going to suppress INPUT messages
+    #   until OUTPUT and CONFIG1 have been reported.
+    # ----------
+    def open_card(self, cardid):
+        open8055io.open(cardid)
+        reader = Open8055Reader(self, cardid)
+        self.readers.append(reader)
+        reader.start()
+        reader.writes.put(None, struct.pack('B', 0x04))
+        reader.writes.put(None, struct.pack('B', 0x08))
+        return reader
+
+    # ----------
+    # open_present_cards()
+    #
+    #   With keep_open, all cards present at startup are opened right
+    #   away and stay open. Their readers keep the card state current,
+    #   so that an OPEN is answered from memory.
+    # ----------
+    def open_present_cards(self):
+        for cardid in range(0, Open8055Server.MAX_CARDS):
+            try:
+                if not open8055io.present(cardid):
                     continue
+                self.open_card(cardid)
+                log_info('card {0} opened'.format(cardid))
+            except Exception as err:
+                log_error('card {0}: {1}'.format(cardid, str(err)))
 
-            # ----
-            # Create a client thread for it and add it to the list.
-            # ----
-            client = Open8055Client(self, conn, addr)
-            self.clients.append(client)
-            client.start()
+    # ----------
+    # finish_reader()
+    #
+    #   Wait for a stopped card reader thread to end and close the card.
+    # ----------
+    def finish_reader(self, reader):
+        if reader.fd is None:
+            reader.join()
+        self.readers.remove(reader)
+        reader.writes.clear()
+        self.card_state.pop(reader.cardid, None)
+        try:
+            open8055io.close(reader.cardid)
+        except Exception as err:
+            log_error('card {0}: {1}'.format(reader.cardid, str(err)))
+
+    # ----------
+    # write_card()
+    #
+    #   Send one HID report to a card and count it. Errors are counted
+    #   and raised again. Client commands don't come here directly but
+    #   through the card's Open8055WriteQueue.
+    #
+    #   This runs in the reactor, so if the IO module provides
+    #   write_many(), the report is only queued. An error of a queued
+    #   report is raised by a later call.
+    # ----------
+    def write_card(self, cardid, data):
+        stats = self.get_card_stats(cardid)
+        try:
+            if hasattr(open8055io, 'write_many'):
+                open8055io.write_many(cardid, data)
+            else:
+                open8055io.write(cardid, data)
+        except Exception:
+            stats.write_errors += 1
+            raise
+        stats.msgs_out += 1
+        stats.bytes_out += len(data)
+        if self.recorder is not None:
+            self.recorder.record(cardid, RECORD_SEND, data)
+
+    # ----------
+    # get_card_stats()
+    # ----------
+    def get_card_stats(self, cardid):
+        stats = self.card_stats.get(cardid)
+        if stats is None:
+            stats = Open8055CardStats()
+            self.card_stats[cardid] = stats
+        return stats
+
+    # ----------
+    # write_metrics()
+    #
+    #   Write all client and card counters to the [Stats] prometheus_file
+    #   in the Prometheus text format. The file is replaced atomically,
+    #   so the node_exporter textfile collector never sees a partial one.
+    # ----------
+    def write_metrics(self):
+        fname = self.config.get('Stats', 'prometheus_file').strip()
+        self.metrics_next = time.time() + max(
+                self.config.getfloat('Stats', 'interval'), 1.0)
+
+        lines = []
+        for kind, objects in (
+                ('client', [(client.stats_labels(), client.stats_items())
+                        for client in self.clients if not client.closed]),
+                ('card', [('card="{0}"'.format(cardid), stats.items())
+                        for cardid, stats in sorted(self.card_stats.items())])):
+            if not objects:
+                continue
+            for idx, (name, _dummy) in enumerate(objects[0][1]):
+                metric = 'open8055_{0}_{1}'.format(kind, name)
+                if name in STATS_GAUGES:
+                    lines.append('# TYPE {0} gauge\n'.format(metric))
+                else:
+                    metric += '_total'
+                    lines.append('# TYPE {0} counter\n'.format(metric))
+                for labels, items in objects:
+                    lines.append('{0}{{{1}}} {2}\n'.format(metric, labels,
+                            items[idx][1]))
+
+        try:
+            tmpname = fname + '.tmp'
+            fd = open(tmpname, 'w')
+            fd.write(''.join(lines))
+            fd.close()
+            if os.name == 'nt' and os.path.exists(fname):
+                os.remove(fname)
+            os.rename(tmpname, fname)
+        except Exception as err:
+            log_error('cannot write {0}: {1}'.format(fname, str(err)))
 
     # ----------
     # check_connect_access()
@@ -211,9 +721,9 @@ class Open8055Server(threading.Thread):
     #   of the config file.
     # ----------
     def check_connect_access(self, addr):
+        self.check_reload()
         try:
-            result = self.lookup_auth_method(addr[0], None,
-                    self.config.get('Access', 'connect'))
+            result = self.lookup_auth_method(addr[0], None, 'connect')
         except Exception as err:
             log_error('lookup_auth_method() failed: ' + str(err))
             return False
@@ -232,9 +742,9 @@ class Open8055Server(threading.Thread):
         # ----
         # Get the required authentication method based on client address.
         # ----
+        self.check_reload()
         try:
-            auth_required = self.lookup_auth_method(addr[0], user,
-                    self.config.get('Access', 'connect'))
+            auth_required = self.lookup_auth_method(addr[0], user, 'connect')
         except Exception as err:
             log_error('lookup_auth_method() failed: ' + str(err))
             return False
@@ -277,14 +787,14 @@ class Open8055Server(threading.Thread):
         # ----
         # Get the required authentication method based on client address.
         # ----
-        if self.config.has_option('Access', 'card_' + str(cardid)):
+        self.check_reload()
+        if 'card_' + str(cardid) in self.access_lists:
             access_list = 'card_' + str(cardid)
         else:
             access_list = 'default'
 
         try:
-            auth_required = self.lookup_auth_method(addr[0], user,
-                    self.config.get('Access', access_list))
+            auth_required = self.lookup_auth_method(addr[0], user, access_list)
         except Exception as err:
             log_error('lookup_auth_method() failed: ' + str(err))
             return False
@@ -320,137 +830,59 @@ class Open8055Server(threading.Thread):
     # check_user_password()
     # ----
     def check_user_password(self, user, password, salt):
-        try:
-            # ----
-            # Locate the users file
-            # ----
-            fname = self.config.get('General', 'users_file')
-            if not os.path.isabs(fname):
-                if self.config_fname is not None:
-                    fname = os.path.realpath(os.path.join(
-                            os.path.dirname(
-                            os.path.realpath(self.config_fname)), fname))
-                else:
-                    fname = os.path.realpath(os.path.join(
-                            os.path.dirname(os.path.realpath(__file__)), fname))
-
-            # ----
-            # Read the users file.
-            # ----
-            fd = open(fname, 'r')
-            while True:
-                line = fd.readline()
-                if len(line) == 0:
-                    break
-                auth_user, auth_issuper, auth_password = line.strip().split(':')
-                if auth_user != user:
-                    continue
-                if len(auth_password) != 35 or auth_password[0:3] != 'md5':
-                    auth_password = 'md5' + hashlib.md5(
-                            auth_password).hexdigest()
-                # ----
-                # This is the user. If the given password starts with 'md5'
-                # and is 35 characters long, we expect it to be the md5 hash
-                # of the SALT and the hashed real user password (double hash).
-                # This is done to prevent password repeat attacks.
-                # ----
-                if len(password) == 35 and password[0:3] == 'md5':
-                    salt_password = hashlib.md5(
-                            salt + auth_password[3:]).hexdigest()
-                    if password[3:] == salt_password:
-                        # ----
-                        # That matched. This is a double hashed md5.
-                        # ----
-                        fd.close()
-                        return True, bool(auth_issuper), 'md5'
-                # ----
-                # This is certainly not a double hashed md5. Test if it
-                # is a plain password.
-                # ----
-                if hashlib.md5(password).hexdigest() == auth_password[3:]:
-                    # ----
-                    # This matched, but is only 'plain' authentication.
-                    # ----
-                    fd.close()
-                    return True, bool(auth_issuper), 'plain'
+        if user not in self.users:
+            return False, False, 'none'
+        auth_issuper, auth_password = self.users[user]
 
+        # ----
+        # If the given password starts with 'md5' and is 35 characters
+        # long, we expect it to be the md5 hash of the SALT and the hashed
+        # real user password (double hash). This is done to prevent
+        # password repeat attacks.
+        # ----
+        if len(password) == 35 and password[0:3] == 'md5':
+            salt_password = hashlib.md5(
+                    salt + auth_password[3:]).hexdigest()
+            if password[3:] == salt_password:
                 # ----
-                # Password mismatch
+                # That matched. This is a double hashed md5.
                 # ----
-                fd.close()
-                return False, False, 'none'
+                return True, bool(auth_issuper), 'md5'
 
+        # ----
+        # This is certainly not a double hashed md5. Test if it
+        # is a plain password.
+        # ----
+        if hashlib.md5(password).hexdigest() == auth_password[3:]:
             # ----
-            # User not found in users file.
+            # This matched, but is only 'plain' authentication.
             # ----
-            fd.close()
-            return False, False, 'none'
-        except Exception as err:
-            log_error('{0}: {1}'.format(
-                    self.config.get('General', 'users_file'), err))
-            return False, False, 'none'
+            return True, bool(auth_issuper), 'plain'
+
+        # ----
+        # Password mismatch
+        # ----
+        return False, False, 'none'
             
     # ----------
     # lookup_auth_method()
     #
-    #   Try to match the give IP address to the narrowest network or
-    #   host address in the access list. 
+    #   Find the first entry of the named access list that matches
+    #   the IP address and user.
     # ----------
     def lookup_auth_method(self, ipaddr, user, access_list):
-        # ----
-        # We work everything IPV6 mapped
-        # ----
-        ipaddr = netaddr.IPAddress(ipaddr).ipv6()
-
-        re_comment = re.compile('^[ \t]*[#;]')
-        re_lines = re.compile('[ \t\r]*\n[ \t\r]*')
-        re_blank = re.compile('[ \t]+')
-
-        # ----
-        # Process the access list line by line, stop at the first match.
-        # ----
-        for line in re_lines.split(access_list.strip()):
-            # ----
-            # Ignore empty lines and comments.
-            # ----
-            if len(line) == 0:
-                continue
-            if re_comment.match(line):
-                continue
-            
-            # ----
-            # Split the line into network address, auth-user  and auth-result.
-            # Return the result if the ipaddr falls into the network.
-            # ----
-            network, auth_user, result = re_blank.split(line)
-            network = netaddr.IPNetwork(network).ipv6()
-            if user is not None and auth_user != 'all':
-                if user != auth_user:
-                    continue
-
-            if len(netaddr.all_matching_cidrs(ipaddr, (network, ))) > 0:
-                return result
-
-        # ----
-        # No match at all? This should not happen. The detault config
-        # contains "deny" lines for INADDR_ANY and its IPV6 counterpart.
-        # ----
-        return 'deny'
-        
-    # ----------
-    # reaper()
-    #
-    #   Check if any client threads have ended. Join them and
-    #   remove them from the list of clients.
-    # ----------
-    def reaper(self):
-        clients = []
-        for client in self.clients:
-            if client.get_status() == MODE_STOPPED:
-                client.join()
-            else:
-                clients.append(client)
-        self.clients = clients
+        if access_list not in self.access_lists:
+            raise Exception('no access list ' + access_list)
+        return self.access_lists[access_list].lookup(ipaddr, user)
+        
+    # ----------
+    # reaper()
+    #
+    #   Remove closed clients from the list of clients.
+    # ----------
+    def reaper(self):
+        self.clients = [client for client in self.clients
+                if not client.closed]
 
     # ----------
     # get_status()
@@ -472,30 +904,40 @@ class Open8055Server(threading.Thread):
     #   terminated.
     # ----------
     def shutdown(self):
+        self.set_status(MODE_STOP)
+        self.post(('wakeup', None))
+        self.join()
+
+    # ----------
+    # set_status()
+    # ----------
+    def set_status(self, status):
         self.lock.acquire()
-        self.status = MODE_STOP
+        self.status = status
         self.lock.release()
-        self.join()
 
         
 # ----------------------------------------------------------------------
 # Open8055Client
 #
-#   Class implementing the thread handling one client connection.
+#   Class handling one client connection. All methods are called by
+#   the reactor in the server thread.
 # ----------------------------------------------------------------------
-class Open8055Client(threading.Thread):
+class Open8055Client:
+    MAX_OUTBUF = 256 * 1024
+    INPUT_BACKLOG = 8 * 1024
+
     # ----------
     # __init__()
     # ----------
     def __init__(self, server, conn, addr):
-        threading.Thread.__init__(self)
-
         self.server = server
-        self.status = MODE_RUN
+        self.closed = False
 
-        self.lock = threading.Lock()
         self.conn = conn
+        self.conn.setblocking(0)
         self.inbuf = ''
+        self.outbuf = ''
         self.addr = addr
 
         self.user = None
@@ -503,163 +945,206 @@ class Open8055Client(threading.Thread):
 
         self.cardid = -1
         self.cardio = None
+        self.observer = False
+
+        self.reports = set(REPORTS_DEFAULT)
+        self.subscription = None
+        self.encoder = None
+        self.replay = None
+        self.pending_input = None
+        self.input_dropped = 0
+
+        # ----
+        # Counters reported by STATS.
+        # ----
+        self.msgs_in = 0
+        self.bytes_in = 0
+        self.msgs_out = 0
+        self.bytes_out = 0
+        self.queue_max = 0
+        self.outbuf_since = 0.0
+        self.send_latency_sum = 0.0
+        self.send_latency_max = 0.0
+        self.send_latency_count = 0
+        self.auth_time = 0.0
+        self.card_writes = 0
+        self.write_errors = 0
 
-    # ----------
-    # run()
-    # ----------
-    def run(self):
         # ----
         # Send HELLO and SALT messages to new client.
         # ----
+        self.send('HELLO {0} {1}\n'.format(
+            Open8055Server.SERVERNAME, Open8055Server.VERSION))
+        self.send('SALT ' + self.salt + '\n')
+
+    # ----------
+    # handle_read()
+    #
+    #   The client socket is readable. Receive what is there and
+    #   process all complete command lines.
+    # ----------
+    def handle_read(self):
+        if self.closed:
+            return
         try:
-            self.send('HELLO {0} {1}\n'.format(
-                Open8055Server.SERVERNAME, Open8055Server.VERSION))
-            self.send('SALT ' + self.salt + '\n')
-        except Exception as err:
+            data = self.conn.recv(4096)
+        except socket.error as err:
+            if err.errno in (errno.EAGAIN, errno.EWOULDBLOCK, errno.EINTR):
+                return
             log_error('client {0}: {1}'.format(str(self.addr), str(err)))
-            self.set_status(MODE_STOPPED)
+            self.close()
             return
 
         # ----
-        # Run until the main server thread tells us to STOP or
-        # the remote disconnects.
+        # Check of EOF
         # ----
-        while self.get_status() == MODE_RUN:
-            # ----
-            # See if we still have another command in the input buffer.
-            # ----
+        if len(data) == 0:
+            self.close()
+            return
+
+        self.inbuf += data
+        while not self.closed:
             idx = self.inbuf.find('\n')
             if idx < 0:
-                # ----
-                # No NEWLINE in there, wait for more data.
-                # ----
-                try:
-                    rdy, _dummy, _dummy = select.select(
-                            (self.conn,), (), (), 2.0)
-                except Exception as err:
-                    log_error('client {0}: {1}'.format(
-                            str(self.addr), str(err)))
-                    break
+                break
+            line = self.inbuf[0:idx]
+            self.inbuf = self.inbuf[idx + 1:]
+            self.msgs_in += 1
+            self.bytes_in += idx + 1
+            self.process_command(line)
 
-                if self.cardio:
-                    if self.cardio.get_status() == MODE_STOPPED:
-                        log_error('client {0}: {1}'.format(
-                                str(self.addr), 'cardio stopped unexpected'))
-                        break
+    # ----------
+    # process_command()
+    #
+    #   Split the command line by spaces and process it.
+    # ----------
+    def process_command(self, line):
+        args = line.strip().split(' ')
 
-                # ----
-                # If rdy is empty then this was just a timeout to check
-                # for STOP flag.
-                # ----
-                if len(rdy) == 0:
-                    continue
+        try:
+            if args[0].upper() == 'SEND':
+                self.cmd_send(args)
 
-                # ----
-                # Receive new data
-                # ----
-                try:
-                    data = self.conn.recv(256)
-                except Exception as err:
-                    log_error('client {0}: {1}'.format(
-                            str(self.addr), str(err)))
-                    break
+            elif args[0].upper() == 'LIST':
+                self.cmd_list(args)
 
-                # ----
-                # Check of EOF
-                # ----
-                if len(data) == 0:
-                    break
-                
-                # ----
-                # Add the data to the input buffer. If there's still
-                # no NEWLINE, wait for more.
-                # ----
-                self.inbuf += data
-                idx = self.inbuf.find('\n')
-                if idx < 0:
-                    continue
+            elif args[0].upper() == 'OPEN':
+                self.cmd_open(args)
 
-            # ----
-            # We have a NEWLINE in the input buffer. Consume the
-            # first line.
-            # ----
-            line = self.inbuf[0:idx]
-            self.inbuf = self.inbuf[idx + 1:]
+            elif args[0].upper() == 'SUBSCRIBE':
+                self.cmd_subscribe(args)
 
-            # ----
-            # Split the command line by spaces and process it.
-            # ----
-            args = line.strip().split(' ')
+            elif args[0].upper() == 'ENCODING':
+                self.cmd_encoding(args)
 
-            try:
-                if args[0].upper() == 'SEND':
-                    self.cmd_send(args)
+            elif args[0].upper() == 'ACCEPT':
+                self.cmd_accept(args)
 
-                elif args[0].upper() == 'LIST':
-                    self.cmd_list(args)
+            elif args[0].upper() == 'STATS':
+                self.cmd_stats(args)
 
-                elif args[0].upper() == 'OPEN':
-                    self.cmd_open(args)
+            elif args[0].upper() == 'REPLAY':
+                self.cmd_replay(args)
 
-                elif args[0].upper() == 'QUIT':
-                    self.set_status(MODE_STOP)
-                    break
+            elif args[0].upper() == 'QUIT':
+                self.close()
 
-                else:
-                    self.send('ERROR unknown command \'' +
-                            args[0].upper() + '\'\n')
+            else:
+                self.send('ERROR unknown command \'' +
+                        args[0].upper() + '\'\n')
 
-            except Exception as err:
-                log_error('client {0}: {1}'.format(str(self.addr), str(err)))
-                try:
-                    self.send('ERROR ' + str(err) + '\n')
-                except:
-                    pass
+        except Exception as err:
+            log_error('client {0}: {1}'.format(str(self.addr), str(err)))
+            self.send('ERROR ' + str(err) + '\n')
+
+    # ----------
+    # handle_write()
+    #
+    #   Send as much of the output buffer as the socket takes.
+    # ----------
+    def handle_write(self):
+        if self.closed or not self.outbuf:
+            return
+        try:
+            sent = self.conn.send(self.outbuf)
+        except socket.error as err:
+            if err.errno in (errno.EAGAIN, errno.EWOULDBLOCK, errno.EINTR):
+                return
+            log_error('client {0}: {1}'.format(str(self.addr), str(err)))
+            self.close()
+            return
+        self.outbuf = self.outbuf[sent:]
+        self.bytes_out += sent
 
         # ----
-        # Stop the reader thread if one exists.
+        # The send latency is how long data waited in the output
+        # buffer until the socket took all of it.
         # ----
+        if not self.outbuf:
+            latency = time.time() - self.outbuf_since
+            self.send_latency_sum += latency
+            self.send_latency_count += 1
+            self.send_latency_max = max(self.send_latency_max, latency)
+
+        if (self.pending_input is not None and
+                len(self.outbuf) <= self.INPUT_BACKLOG):
+            self.send_input_values(self.pending_input)
+
+    # ----------
+    # timer_delay()
+    #
+    #   Seconds until handle_timers() needs to be called, or None.
+    # ----------
+    def timer_delay(self):
+        delays = []
+        if self.subscription is not None:
+            delays.append(self.subscription.flush_delay())
+        if self.replay is not None:
+            delays.append(self.replay.delay())
+        delays = [delay for delay in delays if delay is not None]
+        if not delays:
+            return None
+        return min(delays)
+
+    # ----------
+    # handle_timers()
+    # ----------
+    def handle_timers(self):
+        if not self.closed:
+            self.flush_subscription()
+        if not self.closed and self.replay is not None:
+            self.run_replay()
+
+    # ----------
+    # close()
+    #
+    #   Stop the card reader, if there is one, and close the
+    #   connection. The reader closes the card once it has finished.
+    # ----------
+    def close(self):
+        if self.closed:
+            return
+        self.closed = True
+
         if self.cardio is not None:
-            try:
-                if self.cardio.get_status() != MODE_STOPPED:
-                    self.cardio.set_status(MODE_STOP)
-                    try:
-                        open8055io.write(self.cardid, struct.pack('B', 0x02))
-                    except Exception as err:
-                        log_error('client {0}: {1}'.format(
-                                str(self.addr), str(err)))
-                self.cardio.join()
-            except Exception as err:
-                log_error('client {0}: {1}'.format(str(self.addr), str(err)))
-                try:
-                    self.send('ERROR ' + str(err))
-                except:
-                    pass
+            self.cardio.detach(self)
+            self.cardio = None
 
         # ----
-        # Close the Open8055
+        # Close the remote connection, trying to get out what is
+        # still buffered.
         # ----
         try:
-            if self.cardid >= 0:
-                open8055io.close(self.cardid)
-        except Exception as err:
-            log_error('client {0}: {1}'.format(self.addr, str(err)))
-
-        # ----
-        # Close the remote connection.
-        # ----
+            if self.outbuf:
+                self.conn.send(self.outbuf)
+        except:
+            pass
         try:
-            if self.conn is not None:
-                self.conn.shutdown(socket.SHUT_RDWR)
-                self.conn.close()
-        except Exception as err:
-            log_error('client {0}: {1}'.format(self.addr, str(err)))
-
-        # ----
-        # Set the run status to STOPPED and end this thread.
-        # ----
-        self.set_status(MODE_STOPPED)
-        return
+            self.conn.shutdown(socket.SHUT_RDWR)
+        except:
+            pass
+        self.conn.close()
+        self.outbuf = ''
 
     # ----------
     # cmd_list()
@@ -670,8 +1155,10 @@ class Open8055Client(threading.Thread):
         if len(args) != 3:
             raise Exception('usage: LIST username password')
 
+        start = time.time()
         allowed = self.server.check_list_access(self.addr, 
                 args[1], args[2], self.salt)
+        self.auth_time += time.time() - start
         if not allowed:
             log_error('client {0}: LIST {1} ***** - permission denied'.format(
                     self.addr, args[1]))
@@ -688,35 +1175,77 @@ class Open8055Client(threading.Thread):
     # cmd_open()
     # ----------
     def cmd_open(self, args):
-        if len(args) != 4:
-            raise Exception('usage: OPEN cardid username password')
+        observe = False
+        if len(args) == 5 and args[4].upper() == 'OBSERVE':
+            observe = True
+        elif len(args) != 4:
+            raise Exception('usage: OPEN cardid username password [OBSERVE]')
         if self.cardid >= 0:
             raise Exception('already connected to card ' + str(self.cardid))
 
         cardid = int(args[1])
 
+        start = time.time()
         allowed = self.server.check_open_access(cardid, self.addr, 
                 args[2], args[3], self.salt)
+        self.auth_time += time.time() - start
         if not allowed:
             log_error('client {0}: OPEN {1} {2} ***** - permission denied'.format(
                     self.addr, args[1], args[2]))
             self.send('ERROR permission denied\n')
             return
 
-        open8055io.open(cardid)
+        # ----
+        # Any number of observers can share the card with at most one
+        # controlling client. If the card is already open, we just join.
+        # ----
+        cardio = None
+        for reader in list(self.server.readers):
+            if reader.cardid != cardid:
+                continue
+            if reader.status == MODE_RUN:
+                cardio = reader
+            else:
+                # ----
+                # The card is still in the process of being closed
+                # from a previous session.
+                # ----
+                self.server.finish_reader(reader)
+
+        if cardio is not None and not observe and cardio.controller is not None:
+            raise Exception('card {0} is controlled by another client'.format(
+                    cardid))
 
-        cardio = Open8055Reader(self, cardid)
-        cardio.start()
+        if cardio is None:
+            cardio = self.server.open_card(cardid)
+
+        if observe:
+            cardio.observers.append(self)
+        else:
+            cardio.controller = self
 
         self.cardid = cardid
         self.cardio = cardio
+        self.observer = observe
 
         # ----
-        # We send a GETCONFIG message to the card and the reader
-        # is going to suppress INPUT messages until OUTPUT and CONFIG1
-        # have been reported.
+        # If we know the card's state, answer with that right away. We
+        # only know it while a reader keeps it current, it is dropped
+        # when the card is closed, since another program or a power
+        # cycle may change it meanwhile. If we don't know it yet, ask
+        # the card again.
         # ----
-        open8055io.write(cardid, struct.pack('B', 0x04))
+        state = self.server.card_state.get(cardid, {})
+        if 0x03 in state and 0x01 in state and 0x81 in state:
+            self.send(''.join('RECV ' +
+                    ' '.join(str(elem) for elem in state[hid_type]) + '\n'
+                    for hid_type in (0x03, 0x01)))
+            self.send_state(0x07)
+            self.send_input(state[0x81])
+        else:
+            cardio.writes.put(self, struct.pack('B', 0x04))
+            if 0x07 in self.reports:
+                cardio.writes.put(self, struct.pack('B', 0x08))
 
     # ----------
     # cmd_send()
@@ -724,6 +1253,8 @@ class Open8055Client(threading.Thread):
     def cmd_send(self, args):
         if self.cardid < 0:
             raise Exception('not connected to a card')
+        if self.observer:
+            raise Exception('observers cannot SEND to the card')
 
         # ----
         # Get the HID command message format by type
@@ -747,6 +1278,24 @@ class Open8055Client(threading.Thread):
         elif hid_type == 0x06:          # SAVEALL
             msg_fmt = '!B'
             num_val = 1
+        elif hid_type == 0x07:          # SETCONFIG2
+            msg_fmt = '!BBHHBBB'
+            num_val = 7
+        elif hid_type == 0x08:          # GETCONFIG2
+            msg_fmt = '!B'
+            num_val = 1
+        elif hid_type == 0x09:          # SETSEQUENCE
+            msg_fmt = '!BBBx' + 'HBBH' * 4
+            num_val = 19
+        elif hid_type == 0x0A:          # SEQUENCE
+            msg_fmt = '!BBBBH'
+            num_val = 5
+        elif hid_type == 0x0B:          # SETPID
+            msg_fmt = '!BBBxHhhhHH'
+            num_val = 9
+        elif hid_type == 0x0C:          # SETRULES
+            msg_fmt = '!BBBB' + 'BBHH' * 4
+            num_val = 20
         elif hid_type == 0x7F:          # RESET
             log_info('client {0} sent RESET command'.format(self.addr))
             msg_fmt = '!B'
@@ -765,150 +1314,1166 @@ class Open8055Client(threading.Thread):
             vals.append(0)
 
         # ----
-        # Pack this into the binary message and send it to the card.
+        # Pack this into the binary message and queue it for the card.
+        # An explicit GETINPUT must be answered even if the INPUT
+        # report it causes would be filtered by the subscription.
         # ----
         data = struct.pack(msg_fmt, *vals)
+        if hid_type == 0x02 and self.subscription is not None:
+            self.subscription.force_next()
 
-        try:
-            open8055io.write(self.cardid, data)
-        except Exception as err:
-            self.set_status(MODE_STOP)
-            try:
-                self.client.send('ERROR from write ' + str(err) + '\n')
-            except:
-                pass
+        self.cardio.writes.put(self, data)
 
     # ----------
-    # send()
+    # cmd_replay()
     #
-    #   Send one message to the remote client. If that fails, log the
-    #   error, close the connection and re-raise the exception.
+    #   Play the SEND records of a recording file back to the card this
+    #   client controls, with the original timing divided by speed. The
+    #   file is looked up in the [Record] directory.
     # ----------
-    def send(self, msg):
-        self.lock.acquire()
-        try:
-            if self.conn:
-                self.conn.sendall(msg)
-        except Exception as err:
-            log_error('client {0}: {1}'.format(str(self.addr), str(err)))
+    def cmd_replay(self, args):
+        if len(args) not in (2, 3):
+            raise Exception('usage: REPLAY file [speed]')
+        if self.cardid < 0 or self.observer:
+            raise Exception('REPLAY requires a controlling OPEN')
+        if self.server.recorder is None:
+            raise Exception('recording is not enabled')
+        speed = 1.0
+        if len(args) == 3:
+            speed = float(args[2])
+        if speed <= 0.0:
+            raise Exception('invalid speed')
+
+        records = [(stamp, data)
+                for stamp, direction, data in self.server.recorder.load(args[1])
+                if direction == RECORD_SEND]
+        self.replay = Open8055Replay(records, speed)
+        self.send('REPLAY START {0}\n'.format(len(records)))
+        self.run_replay()
+
+    # ----------
+    # run_replay()
+    #
+    #   Queue all records of the replay that are due for the card.
+    # ----------
+    def run_replay(self):
+        replay = self.replay
+        for data in replay.due(time.time()):
             try:
-                self.conn.shutdown(socket.SHUT_RDWR)
-                self.conn.close()
-            except:
-                pass
-            self.conn = None
-            self.lock.release()
-            raise err
+                self.cardio.writes.put(self, data)
+            except Exception as err:
+                self.replay = None
+                self.send('ERROR ' + str(err) + '\n')
+                return
 
-        self.lock.release()
+        if replay.done():
+            self.replay = None
+            self.send('REPLAY END {0}\n'.format(replay.count))
 
     # ----------
-    # get_status()
+    # cmd_stats()
+    #
+    #   Report the counters of all clients and cards. The same
+    #   credentials as for LIST are required.
     # ----------
-    def get_status(self):
-        self.lock.acquire()
-        ret = self.status
-        self.lock.release()
-        return ret
+    def cmd_stats(self, args):
+        if len(args) != 3:
+            raise Exception('usage: STATS username password')
+
+        allowed = self.server.check_list_access(self.addr, 
+                args[1], args[2], self.salt)
+        if not allowed:
+            log_error('client {0}: STATS {1} ***** - permission denied'.format(
+                    self.addr, args[1]))
+            self.send('ERROR permission denied\n')
+            return
+
+        response = ''
+        for client in self.server.clients:
+            if client.closed:
+                continue
+            response += 'STATS client {0}:{1} card {2} {3}\n'.format(
+                    client.addr[0], client.addr[1], client.cardid,
+                    ' '.join('{0} {1}'.format(name, value)
+                            for name, value in client.stats_items()))
+        for cardid, stats in sorted(self.server.card_stats.items()):
+            response += 'STATS card {0} {1}\n'.format(cardid,
+                    ' '.join('{0} {1}'.format(name, value)
+                            for name, value in stats.items()))
+        self.send(response + 'STATS END\n')
 
     # ----------
-    # get_status()
+    # stats_items()
+    #
+    #   The counters of this client as (name, value) pairs.
     # ----------
-    def set_status(self, status):
-        self.lock.acquire()
-        self.status = status
-        self.lock.release()
+    def stats_items(self):
+        if self.send_latency_count > 0:
+            latency_avg = self.send_latency_sum / self.send_latency_count
+        else:
+            latency_avg = 0.0
+        return [
+            ('msgs_in', self.msgs_in),
+            ('bytes_in', self.bytes_in),
+            ('msgs_out', self.msgs_out),
+            ('bytes_out', self.bytes_out),
+            ('queue_depth', len(self.outbuf)),
+            ('queue_max', self.queue_max),
+            ('input_dropped', self.input_dropped),
+            ('send_latency_avg', '{0:.6f}'.format(latency_avg)),
+            ('send_latency_max', '{0:.6f}'.format(self.send_latency_max)),
+            ('auth_time', '{0:.6f}'.format(self.auth_time)),
+            ('card_writes', self.card_writes),
+            ('write_errors', self.write_errors),
+        ]
+
+    # ----------
+    # stats_labels()
+    #
+    #   The Prometheus labels identifying this client.
+    # ----------
+    def stats_labels(self):
+        return 'client="{0}:{1}",card="{2}"'.format(self.addr[0],
+                self.addr[1], self.cardid)
+
+    # ----------
+    # cmd_subscribe()
+    #
+    #   Set up server side filtering of INPUT reports. The change mask
+    #   uses the OPEN8055_INPUT_* bits. A report is only sent if one of
+    #   the masked items changed by more than the configured deadband
+    #   or counter delta, and never more often than max_rate per second.
+    #   "SUBSCRIBE ALL" turns filtering off again.
+    # ----------
+    def cmd_subscribe(self, args):
+        if len(args) == 2 and args[1].upper() == 'ALL':
+            self.subscription = None
+            return
+        if len(args) != 6:
+            raise Exception('usage: SUBSCRIBE mask adc1_deadband ' +
+                    'adc2_deadband counter_delta max_rate')
+
+        mask = int(args[1], 0)
+        deadband = [int(args[2]), int(args[3])]
+        counter_delta = int(args[4])
+        max_rate = float(args[5])
+        if (mask & ~INPUT_ANY or min(deadband) < 0 or counter_delta < 0
+                or max_rate < 0.0):
+            raise Exception('invalid SUBSCRIBE parameters')
+
+        self.subscription = Open8055Subscription(mask, deadband,
+                counter_delta, max_rate)
+
+    # ----------
+    # send_input()
+    #
+    #   Called by the reader with the unpacked values of an INPUT
+    #   report. Forwards the report unless the subscription filters
+    #   or delays it.
+    # ----------
+    def send_input(self, values):
+        subscription = self.subscription
+        if subscription is not None:
+            values = subscription.offer(values, time.time())
+            if values is None:
+                return
+        self.send_input_values(values)
+
+    # ----------
+    # flush_subscription()
+    #
+    #   Send a coalesced INPUT report that was held back by the
+    #   subscription's rate limit once it is due.
+    # ----------
+    def flush_subscription(self):
+        subscription = self.subscription
+        if subscription is None:
+            return
+        values = subscription.due(time.time())
+        if values is not None:
+            self.send_input_values(values)
+
+    # ----------
+    # cmd_encoding()
+    #
+    #   Select how INPUT reports are sent to this client. "ENCODING TEXT"
+    #   is the default RECV line. "ENCODING DELTA [keyframe_interval]"
+    #   sends DELTA lines with only the changed fields and a full RECV
+    #   line every keyframe_interval reports.
+    # ----------
+    def cmd_encoding(self, args):
+        if len(args) == 2 and args[1].upper() == 'TEXT':
+            encoder = None
+        elif len(args) in (2, 3) and args[1].upper() == 'DELTA':
+            keyframe_interval = 32
+            if len(args) == 3:
+                keyframe_interval = int(args[2])
+            if keyframe_interval < 1:
+                raise Exception('invalid keyframe interval')
+            encoder = Open8055DeltaEncoder(keyframe_interval)
+        else:
+            raise Exception('usage: ENCODING TEXT|DELTA [keyframe_interval]')
+
+        self.encoder = encoder
+
+    # ----------
+    # cmd_accept()
+    #
+    #   Ask for report types that are not sent by default. These are
+    #   CONFIG2 (7), SEQUENCE (10), INPUTBURST (130) and EDGES (132).
+    #   Cached CONFIG2 and SEQUENCE reports of the card are sent right
+    #   away.
+    # ----------
+    def cmd_accept(self, args):
+        if len(args) < 2:
+            raise Exception('usage: ACCEPT report_type ...')
+        types = [int(x, 0) for x in args[1:]]
+        for hid_type in types:
+            if hid_type not in REPORTS_OPTIONAL:
+                raise Exception('invalid report type {0}'.format(hid_type))
+
+        new_types = set(types) - self.reports
+        self.reports |= new_types
+        for hid_type in (0x07, 0x0A):
+            if hid_type in new_types:
+                self.send_state(hid_type)
+
+    # ----------
+    # send_state()
+    #
+    #   Send the cached report of one type of the client's card, if
+    #   there is one and the client accepts it.
+    # ----------
+    def send_state(self, hid_type):
+        if self.cardid < 0 or hid_type not in self.reports:
+            return
+        values = self.server.card_state.get(self.cardid, {}).get(hid_type)
+        if values is not None:
+            self.send('RECV ' + ' '.join(str(elem) for elem in values) + '\n')
+
+    # ----------
+    # send_input_values()
+    #
+    #   Send an INPUT report in the encoding the client asked for.
+    # ----------
+    def send_input_values(self, values):
+        # ----
+        # If the client is falling behind, keep only the latest INPUT
+        # report until the output buffer has drained.
+        # ----
+        if len(self.outbuf) > self.INPUT_BACKLOG:
+            if self.pending_input is not None:
+                self.input_dropped += 1
+            self.pending_input = values
+            return
+        self.pending_input = None
+
+        if self.encoder is not None:
+            msg = self.encoder.encode(values)
+        else:
+            msg = 'RECV ' + ' '.join(str(elem) for elem in values) + '\n'
+        self.send(msg)
+
+    # ----------
+    # send()
+    #
+    #   Queue one message for the remote client and try to send it
+    #   right away. A client that doesn't keep up with reading is
+    #   disconnected once too much output is pending.
+    # ----------
+    def send(self, msg):
+        if self.closed:
+            return
+        if not self.outbuf:
+            self.outbuf_since = time.time()
+        self.outbuf += msg
+        self.msgs_out += msg.count('\n')
+        self.queue_max = max(self.queue_max, len(self.outbuf))
+        if len(self.outbuf) > self.MAX_OUTBUF:
+            log_error('client {0}: output buffer overflow'.format(
+                    str(self.addr)))
+            self.outbuf = ''
+            self.close()
+            return
+        self.handle_write()
 
 
 # ----------------------------------------------------------------------
 # Open8055Reader
 #
 #   Class implementing a thread that reads data from an Open8055 card
-#   and sends it to the associated client.
+#   and posts it to the server's reactor, which calls process() for
+#   every report. The reports are forwarded to the controlling client
+#   and all observers of the card.
+#
+#   If the IO module provides fileno(), no thread is started. The
+#   reactor selects on the card's descriptor instead and calls
+#   handle_read(), which fetches all queued reports at once.
 # ----------------------------------------------------------------------
 class Open8055Reader(threading.Thread):
-    def __init__(self, client, cardid):
+    def __init__(self, server, cardid):
         threading.Thread.__init__(self)
 
-        self.client = client
+        self.server = server
+        self.controller = None
+        self.observers = []
         self.cardid = cardid
         self.startup = True
         self.had_config1 = False
         self.had_output = False
-        self.lock = threading.Lock()
         self.status = MODE_RUN
+        self.fd = None
+        self.writes = Open8055WriteQueue(server, cardid)
+
+    def start(self):
+        if hasattr(open8055io, 'fileno'):
+            self.fd = open8055io.fileno(self.cardid)
+        else:
+            threading.Thread.start(self)
 
     def run(self):
-        while self.get_status() == MODE_RUN:
+        while self.status == MODE_RUN:
             try:
                 data = open8055io.read(self.cardid)
             except Exception as err:
-                try:
-                    log_error('client {0}: {1}'.format(
-                            str(self.client.addr), str(err)))
-                    self.client.send('ERROR ' + str(err) + '\n')
-                    break
-                except:
-                    pass
+                if self.status == MODE_RUN:
+                    self.server.post(('error', self, str(err)))
+                break
 
+            if self.status == MODE_RUN:
+                self.server.post(('data', self, data))
+
+        # ----
+        # The reader loop exited. Terminate this thread.
+        # ----
+        self.status = MODE_STOPPED
+        self.server.post(('stopped', self))
+
+    # ----------
+    # handle_read()
+    #
+    #   Process all reports queued for a selectable card. Called by
+    #   the reactor when the card's descriptor is readable.
+    # ----------
+    def handle_read(self):
+        if self.status != MODE_RUN:
+            return
+        try:
+            data = open8055io.read_many(self.cardid, 0, 0)
+        except Exception as err:
+            self.server.post(('error', self, str(err)))
+            self.status = MODE_STOPPED
+            self.server.post(('stopped', self))
+            return
+
+        for pos in range(0, len(data), 32):
+            self.process(data[pos:pos + 32])
+
+    # ----------
+    # stop()
+    #
+    #   Tell the thread to stop. It is most likely blocked in a read,
+    #   so we ask the card for an INPUT report to wake it up. Commands
+    #   still queued for the card are written first.
+    # ----------
+    def stop(self):
+        self.controller = None
+        self.observers = []
+        if self.status != MODE_RUN:
+            return
+        if self.fd is not None:
+            self.status = MODE_STOPPED
+            self.writes.flush()
+            self.server.post(('stopped', self))
+            return
+        self.status = MODE_STOP
+        self.writes.flush()
+        try:
+            self.server.write_card(self.cardid, struct.pack('B', 0x02))
+        except Exception as err:
+            log_error('card {0}: {1}'.format(self.cardid, str(err)))
+
+    # ----------
+    # subscribers()
+    # ----------
+    def subscribers(self):
+        if self.controller is not None:
+            return [self.controller] + self.observers
+        return list(self.observers)
+
+    # ----------
+    # detach()
+    #
+    #   Remove a client from the card. The last one leaving stops
+    #   the reader, unless the server keeps cards open.
+    # ----------
+    def detach(self, client):
+        if self.controller is client:
+            self.controller = None
+        elif client in self.observers:
+            self.observers.remove(client)
+        if (self.controller is None and not self.observers and
+                not self.server.config.getboolean('General', 'keep_open')):
+            self.stop()
+
+    # ----------
+    # process()
+    #
+    #   Forward one report from the card to the subscribed clients.
+    #   Called by the reactor. Reports are also processed without
+    #   clients to keep the cached card state current.
+    # ----------
+    def process(self, data):
+        clients = self.subscribers()
+        if self.server.recorder is not None:
+            self.server.recorder.record(self.cardid, RECORD_RECV, data)
+
+        # ----
+        # In client startup mode we suppress all messages until
+        # we sent the CONFIG1 and OUTPUT messages.
+        # ----
+        hid_type = ord(data[0])
+        if self.startup:
+            if hid_type == 0x03:
+                self.had_config1 = True
+            elif hid_type == 0x01:
+                self.had_output = True
+            else:
+                if self.had_output and self.had_config1:
+                    self.startup = False
+                else:
+                    return
+
+        # ----
+        # Format the client message according to the report type.
+        # ----
+        if hid_type == 0x81:
+            msg_fmt = '!BB5H2HHL2H'
+        elif hid_type == 0x01:
+            msg_fmt = '!BB8H2HB'
+        elif hid_type == 0x03:
+            msg_fmt = '!B2B5B8B2B5HB'
+        elif hid_type == 0x07:
+            msg_fmt = '!BBHHBBB'
+        elif hid_type == 0x0A:
+            msg_fmt = '!BBBBH'
+        elif hid_type == 0x82:
+            msg_fmt = '!BBBBL12H'
+        elif hid_type == 0x84:
+            msg_fmt = '!BBBB' + 'LBB' * 4
+        else:
+            for client in clients:
+                client.send('ERROR unknown HID packet type ' +
+                        '0x{0:02X} received from card\n'.format(hid_type))
+                client.close()
+            return
+
+        values = struct.unpack(msg_fmt, data[0:struct.calcsize(msg_fmt)])
+        stats = self.server.get_card_stats(self.cardid)
+        stats.msgs_in += 1
+        stats.bytes_in += len(data)
+        if hid_type not in (0x82, 0x84):
+            self.server.card_state.setdefault(self.cardid, {})[hid_type] = values
+
+        # ----
+        # INPUT reports are also published via multicast. This is
+        # done before any client side filtering.
+        # ----
+        publisher = self.server.publisher
+        if hid_type == 0x81 and publisher is not None:
+            publisher.publish(self.cardid, values)
+
+        if hid_type == 0x81:
+            for client in clients:
+                client.send_input(values)
+        else:
+            msg = 'RECV ' + ' '.join(str(elem) for elem in values) + '\n'
+            for client in clients:
+                if hid_type in client.reports:
+                    client.send(msg)
+
+
+# ----------------------------------------------------------------------
+# Open8055WriteQueue
+#
+#   The commands waiting to be written to one card. The card takes at
+#   most one report per USB frame, so we write one command every
+#   [Write] interval. Every client has its own queue and the clients
+#   are served round robin, each limited by a token bucket of
+#   client_rate commands per second. A new OUTPUT, SETCONFIG1 or
+#   SETCONFIG2 command replaces one of the same type at the end of the
+#   client's queue, so a client sending faster than its share only
+#   delays its own state changes but never builds up a backlog. The
+#   resetCounter bits of merged OUTPUT commands are combined. All other
+#   commands are written in order. Commands of the server itself are
+#   queued for client None and not rate limited.
+# ----------------------------------------------------------------------
+class Open8055WriteQueue:
+    OUTPUT_RESET_COUNTER = 22
+
+    def __init__(self, server, cardid):
+        self.server = server
+        self.cardid = cardid
+        self.queues = collections.OrderedDict()
+        self.buckets = {}
+        self.next_write = 0.0
+
+    # ----------
+    # put()
+    #
+    #   Queue one command of a client.
+    # ----------
+    def put(self, client, data):
+        stats = self.server.get_card_stats(self.cardid)
+        queue = self.queues.get(client)
+        if queue is None:
+            queue = collections.deque()
+            self.queues[client] = queue
+
+        hid_type = ord(data[0])
+        if (queue and hid_type in (0x01, 0x03, 0x07) and
+                ord(queue[-1][0]) == hid_type):
+            if hid_type == 0x01:
+                pos = self.OUTPUT_RESET_COUNTER
+                data = (data[0:pos] + chr(ord(queue[-1][pos]) | ord(data[pos])) +
+                        data[pos + 1:])
+            queue[-1] = data
+            stats.writes_merged += 1
+            return
+
+        if len(queue) >= self.server.write_max_queue:
+            raise Exception('write queue for card {0} is full'.format(
+                    self.cardid))
+        queue.append(data)
+        stats.write_queue += 1
+
+    # ----------
+    # delay()
+    #
+    #   Seconds until run() can write the next command, or None if
+    #   nothing is queued.
+    # ----------
+    def delay(self, now):
+        delay = None
+        for client, queue in self.queues.items():
+            if not queue:
+                continue
+            bucket = self.buckets.get(client)
+            if bucket is None or client.closed:
+                wait = 0.0
+            else:
+                wait = bucket.delay(now)
+            if delay is None or wait < delay:
+                delay = wait
+        if delay is None:
+            return None
+        return max(delay, self.next_write - now)
+
+    # ----------
+    # run()
+    #
+    #   Write the next command if one is due. Only one per reactor
+    #   pass, so that one card can't hold up the others. delay() tells
+    #   the reactor when to come back for the rest.
+    # ----------
+    def run(self):
+        now = time.time()
+        if now < self.next_write:
+            return
+        entry = self.get(now)
+        if entry is None:
+            return
+        self.write(entry[0], entry[1])
+        self.next_write = now + self.server.write_interval
+
+    # ----------
+    # flush()
+    #
+    #   Write everything that is queued right away.
+    # ----------
+    def flush(self):
+        queues = self.clear()
+        for client, queue in queues.items():
+            for data in queue:
+                self.write(client, data)
+
+    # ----------
+    # clear()
+    #
+    #   Forget all queued commands and return them.
+    # ----------
+    def clear(self):
+        queues = self.queues
+        self.queues = collections.OrderedDict()
+        self.buckets = {}
+        self.server.get_card_stats(self.cardid).write_queue -= sum(
+                len(queue) for queue in queues.values())
+        return queues
+
+    # ----------
+    # get()
+    #
+    #   Take the next command from the first client in round robin
+    #   order that has one and a token for it. That client then moves
+    #   to the end of the order. Queues of clients that are gone are
+    #   written without limit and then forgotten.
+    # ----------
+    def get(self, now):
+        for client, queue in list(self.queues.items()):
+            if not queue:
+                if client is not None and client.closed:
+                    del self.queues[client]
+                    self.buckets.pop(client, None)
+                continue
+            if client is not None and not client.closed:
+                bucket = self.buckets.get(client)
+                if bucket is None:
+                    bucket = Open8055TokenBucket(self.server.write_rate,
+                            self.server.write_burst, now)
+                    self.buckets[client] = bucket
+                if not bucket.take(now):
+                    continue
+            data = queue.popleft()
+            del self.queues[client]
+            self.queues[client] = queue
+            self.server.get_card_stats(self.cardid).write_queue -= 1
+            return (client, data)
+        return None
+
+    # ----------
+    # write()
+    #
+    #   Write one command. A write error is reported to the client that
+    #   sent the command, which is then disconnected.
+    # ----------
+    def write(self, client, data):
+        try:
+            self.server.write_card(self.cardid, data)
+        except Exception as err:
+            if client is None or client.closed:
+                log_error('card {0}: {1}'.format(self.cardid, str(err)))
+                return
+            client.write_errors += 1
+            client.send('ERROR from write ' + str(err) + '\n')
+            client.close()
+            return
+        if client is not None:
+            client.card_writes += 1
+
+
+# ----------------------------------------------------------------------
+# Open8055TokenBucket
+#
+#   Allows rate events per second with bursts of up to burst events.
+#   A rate of zero means no limit.
+# ----------------------------------------------------------------------
+class Open8055TokenBucket:
+    def __init__(self, rate, burst, now):
+        self.rate = rate
+        self.burst = burst
+        self.tokens = burst
+        self.stamp = now
+
+    def refill(self, now):
+        self.tokens = min(self.tokens + (now - self.stamp) * self.rate,
+                self.burst)
+        self.stamp = now
+
+    def take(self, now):
+        if self.rate <= 0.0:
+            return True
+        self.refill(now)
+        if self.tokens < 1.0:
+            return False
+        self.tokens -= 1.0
+        return True
+
+    # ----------
+    # delay()
+    #
+    #   Seconds until the next token is available.
+    # ----------
+    def delay(self, now):
+        self.refill(now)
+        if self.tokens >= 1.0 or self.rate <= 0.0:
+            return 0.0
+        return (1.0 - self.tokens) / self.rate
+
+
+# ----------------------------------------------------------------------
+# Open8055AccessList
+#
+#   One [Access] list compiled into a binary trie over the IPV6 mapped
+#   network addresses. Every node holds the entries for exactly that
+#   network as (line index, user, method). A lookup walks the address
+#   bits and keeps the matching entry with the lowest line index, which
+#   is the same as processing the list top down and stopping at the
+#   first match.
+# ----------------------------------------------------------------------
+class Open8055AccessList:
+    re_comment = re.compile('^[ \t]*[#;]')
+    re_lines = re.compile('[ \t\r]*\n[ \t\r]*')
+    re_blank = re.compile('[ \t]+')
+
+    def __init__(self, text):
+        self.root = [None, None, []]
+        self.error = None
+        try:
+            self.compile(text)
+        except Exception as err:
+            self.error = str(err)
+
+    def compile(self, text):
+        for idx, line in enumerate(self.re_lines.split(text.strip())):
             # ----
-            # In client startup mode we suppress all messages until
-            # we sent the CONFIG1 and OUTPUT messages.
+            # Ignore empty lines and comments.
             # ----
-            hid_type = ord(data[0])
-            if self.startup:
-                if hid_type == 0x03:
-                    self.had_config1 = True
-                elif hid_type == 0x01:
-                    self.had_output = True
-                else:
-                    if self.had_output and self.had_config1:
-                        self.startup = False
-                    else:
-                        continue
+            if len(line) == 0:
+                continue
+            if self.re_comment.match(line):
+                continue
 
             # ----
-            # Format the client message according to the report type.
+            # Split the line into network address, auth-user and auth-result
+            # and add it to the node of that network.
             # ----
-            if hid_type == 0x81:
-                msg_fmt = '!BB5H2H'
-            elif hid_type == 0x01:
-                msg_fmt = '!BB8H2HB'
-            elif hid_type == 0x03:
-                msg_fmt = '!B2B5B8B2B5HB'
-            else:
-                try:
-                    self.client.send('ERROR unknown HID packet type ' +
-                            '0x{0:02X} received from card'.format(hid_type))
-                except:
-                    pass
+            network, auth_user, result = self.re_blank.split(line)
+            network = netaddr.IPNetwork(network).ipv6()
+            value = int(network.network)
+            node = self.root
+            for bit in range(127, 127 - network.prefixlen, -1):
+                branch = (value >> bit) & 1
+                if node[branch] is None:
+                    node[branch] = [None, None, []]
+                node = node[branch]
+            node[2].append((idx, auth_user, result))
+
+    def lookup(self, ipaddr, user):
+        if self.error is not None:
+            raise Exception(self.error)
+
+        # ----
+        # We work everything IPV6 mapped
+        # ----
+        value = int(netaddr.IPAddress(ipaddr).ipv6())
+
+        best = None
+        node = self.root
+        bit = 127
+        while node is not None:
+            for entry in node[2]:
+                if best is not None and entry[0] > best[0]:
+                    break
+                if user is not None and entry[1] != 'all' and entry[1] != user:
+                    continue
+                best = entry
+                break
+            if bit < 0:
                 break
+            node = node[(value >> bit) & 1]
+            bit -= 1
 
-            message = ' '.join(str(elem) for elem in 
-                    struct.unpack(msg_fmt, data[0:struct.calcsize(msg_fmt)]))
+        # ----
+        # No match at all? This should not happen. The detault config
+        # contains "deny" lines for INADDR_ANY and its IPV6 counterpart.
+        # ----
+        if best is None:
+            return 'deny'
+        return best[2]
+
+
+# ----------------------------------------------------------------------
+# Open8055Recorder
+#
+#   Records all traffic of the cards into one file per card. A file
+#   starts with the magic "O8055REC", a version byte and the card
+#   number as 16 bit integer. It is followed by records of
+#
+#       timestamp (double), direction (byte), length (byte), data
+#
+#   all in network byte order. The direction is RECORD_SEND for a
+#   command written to the card and RECORD_RECV for a report read
+#   from it. Files are named card<N>-<date>-<time>.rec, a new one is
+#   started when max_size is reached and only the newest max_files
+#   of a card are kept.
+# ----------------------------------------------------------------------
+class Open8055Recorder:
+    MAGIC = 'O8055REC'
+    VERSION = 1
+
+    def __init__(self, directory, max_size, max_files):
+        self.directory = directory
+        self.max_size = max_size
+        self.max_files = max(max_files, 1)
+        self.files = {}
+        self.failed = False
+
+    # ----------
+    # record()
+    # ----------
+    def record(self, cardid, direction, data):
+        if self.failed:
+            return
+        try:
+            entry = self.files.get(cardid)
+            if entry is None or entry[1] >= self.max_size:
+                entry = self.rotate(cardid)
+            rec = struct.pack('!dBB', time.time(), direction, len(data)) + data
+            entry[0].write(rec)
+            entry[1] += len(rec)
+        except Exception as err:
+            log_error('recording stopped: ' + str(err))
+            self.failed = True
+
+    # ----------
+    # rotate()
+    #
+    #   Start a new file for a card and remove the oldest ones.
+    # ----------
+    def rotate(self, cardid):
+        entry = self.files.pop(cardid, None)
+        if entry is not None:
+            entry[0].close()
+
+        now = time.time()
+        fname = os.path.join(self.directory, 'card{0}-{1}.{2:03d}.rec'.format(
+                cardid, time.strftime('%Y%m%d-%H%M%S', time.localtime(now)),
+                int(now * 1000) % 1000))
+        fd = open(fname, 'wb')
+        header = self.MAGIC + struct.pack('!BH', self.VERSION, cardid)
+        fd.write(header)
+        entry = [fd, len(header)]
+        self.files[cardid] = entry
+
+        old = sorted(glob.glob(os.path.join(self.directory,
+                'card{0}-*.rec'.format(cardid))))
+        for fname in old[:-self.max_files]:
+            os.remove(fname)
+        return entry
+
+    # ----------
+    # close()
+    # ----------
+    def close(self):
+        for entry in self.files.values():
+            entry[0].close()
+        self.files = {}
+
+    # ----------
+    # load()
+    #
+    #   Read a recording file from the recording directory. Returns
+    #   a list of (timestamp, direction, data) tuples.
+    # ----------
+    def load(self, fname):
+        if os.path.basename(fname) != fname or not fname.endswith('.rec'):
+            raise Exception('invalid recording file name')
 
-            try:
-                self.client.send('RECV ' + message + '\n')
-            except Exception as err:
-                log_error(str(err))
-                break
-            
         # ----
-        # The reader loop exited. Terminate this thread.
+        # Make sure the data of the file we are still writing is there.
         # ----
-        self.set_status(MODE_STOPPED)
-        return
+        for entry in self.files.values():
+            entry[0].flush()
 
-    def get_status(self):
-        #self.lock.acquire()
-        ret = self.status
-        #self.lock.release()
-        return ret
+        fd = open(os.path.join(self.directory, fname), 'rb')
+        data = fd.read()
+        fd.close()
 
-    def set_status(self, status):
-        #self.lock.acquire()
-        self.status = status
-        #self.lock.release()
+        hdrlen = len(self.MAGIC) + 3
+        if data[0:len(self.MAGIC)] != self.MAGIC:
+            raise Exception('not a recording file')
+
+        records = []
+        pos = hdrlen
+        while pos + 10 <= len(data):
+            stamp, direction, length = struct.unpack('!dBB', data[pos:pos + 10])
+            pos += 10
+            records.append((stamp, direction, data[pos:pos + length]))
+            pos += length
+        return records
+
+
+# ----------------------------------------------------------------------
+# Open8055Replay
+#
+#   A recording being played back by a client.
+# ----------------------------------------------------------------------
+class Open8055Replay:
+    def __init__(self, records, speed):
+        self.records = records
+        self.speed = speed
+        self.count = 0
+        self.start = time.time()
+        if records:
+            self.first = records[0][0]
+
+    # ----------
+    # due()
+    #
+    #   Return the data of all records that are due by now.
+    # ----------
+    def due(self, now):
+        result = []
+        while (self.count < len(self.records) and self.first +
+                (now - self.start) * self.speed >= self.records[self.count][0]):
+            result.append(self.records[self.count][1])
+            self.count += 1
+        return result
+
+    # ----------
+    # delay()
+    #
+    #   Seconds until the next record is due.
+    # ----------
+    def delay(self):
+        if self.done():
+            return 0.0
+        return max((self.records[self.count][0] - self.first) / self.speed -
+                (time.time() - self.start), 0.0)
+
+    def done(self):
+        return self.count >= len(self.records)
+
+
+# ----------------------------------------------------------------------
+# Open8055CardStats
+#
+#   Counters of one card, reported by STATS. msgs_in counts the reports
+#   forwarded to clients, msgs_out the HID commands written to the card.
+# ----------------------------------------------------------------------
+class Open8055CardStats:
+    def __init__(self):
+        self.msgs_in = 0
+        self.bytes_in = 0
+        self.msgs_out = 0
+        self.bytes_out = 0
+        self.read_errors = 0
+        self.write_errors = 0
+        self.writes_merged = 0
+        self.write_queue = 0
+
+    def items(self):
+        return [
+            ('msgs_in', self.msgs_in),
+            ('bytes_in', self.bytes_in),
+            ('msgs_out', self.msgs_out),
+            ('bytes_out', self.bytes_out),
+            ('read_errors', self.read_errors),
+            ('write_errors', self.write_errors),
+            ('writes_merged', self.writes_merged),
+            ('write_queue', self.write_queue),
+        ]
+
+
+# ----------------------------------------------------------------------
+# Open8055Publisher
+#
+#   Sends the INPUT reports of all open cards as UDP datagrams to a
+#   multicast group. Each datagram is a single text line
+#
+#       INPUT <cardid> <seq> <timestamp> <RECV values>
+#
+#   where seq is a per card sequence number, starting at 1, that lets
+#   listeners detect lost datagrams.
+# ----------------------------------------------------------------------
+class Open8055Publisher:
+    def __init__(self, group, port, ttl, interface):
+        self.addr = (group, port)
+        self.lock = threading.Lock()
+        self.seq = {}
+
+        if ':' in group:
+            self.sock = socket.socket(socket.AF_INET6, socket.SOCK_DGRAM, 0)
+            self.sock.setsockopt(socket.IPPROTO_IPV6,
+                    socket.IPV6_MULTICAST_HOPS, ttl)
+            self.sock.setsockopt(socket.IPPROTO_IPV6,
+                    socket.IPV6_MULTICAST_LOOP, 1)
+            if interface:
+                self.sock.setsockopt(socket.IPPROTO_IPV6,
+                        socket.IPV6_MULTICAST_IF, int(interface))
+        else:
+            self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, 0)
+            self.sock.setsockopt(socket.IPPROTO_IP,
+                    socket.IP_MULTICAST_TTL, ttl)
+            self.sock.setsockopt(socket.IPPROTO_IP,
+                    socket.IP_MULTICAST_LOOP, 1)
+            if interface:
+                self.sock.setsockopt(socket.IPPROTO_IP,
+                        socket.IP_MULTICAST_IF, socket.inet_aton(interface))
+
+    # ----------
+    # publish()
+    #
+    #   Send one INPUT report of a card to the group. A failing send
+    #   is logged but must not affect the TCP clients.
+    # ----------
+    def publish(self, cardid, values):
+        self.lock.acquire()
+        seq = (self.seq.get(cardid, 0) % 0xFFFFFFFF) + 1
+        self.seq[cardid] = seq
+        msg = 'INPUT {0} {1} {2:.6f} {3}\n'.format(cardid, seq, time.time(),
+                ' '.join(str(elem) for elem in values))
+        try:
+            self.sock.sendto(msg, self.addr)
+        except Exception as err:
+            log_error('multicast publish failed: ' + str(err))
+        self.lock.release()
+
+
+# ----------------------------------------------------------------------
+# Open8055DeltaEncoder
+#
+#   Encodes INPUT reports as the difference to the previous one sent.
+#   A DELTA line carries hex encoded bytes: a varint bitmask of the
+#   changed fields (bit 0 = inputBits, bits 1-5 = counters, bits 6-7 =
+#   ADC values, bit 8 = sequence number, bit 9 = timestamp, bits 10-11 =
+#   PWM values), followed by one zigzag varint delta per changed field.
+#   Deltas wrap at the field width, so a wrapping counter stays small.
+#   Every keyframe_interval reports a full RECV line is sent instead.
+# ----------------------------------------------------------------------
+class Open8055DeltaEncoder:
+    FIELD_BITS = (8, 16, 16, 16, 16, 16, 16, 16, 16, 32, 16, 16)
+
+    def __init__(self, keyframe_interval):
+        self.keyframe_interval = keyframe_interval
+        self.last = None
+        self.count = 0
+
+    def encode(self, values):
+        last = self.last
+        self.last = values
+        if last is None or self.count >= self.keyframe_interval:
+            self.count = 0
+            return 'RECV ' + ' '.join(str(elem) for elem in values) + '\n'
+        self.count += 1
+
+        mask = 0
+        deltas = ''
+        for idx, bits in enumerate(self.FIELD_BITS):
+            delta = (values[idx + 1] - last[idx + 1]) & ((1 << bits) - 1)
+            if delta == 0:
+                continue
+            if delta >= 1 << (bits - 1):
+                delta -= 1 << bits
+            mask |= 1 << idx
+            deltas += self.varint((delta << 1) ^ (delta >> bits))
+        return 'DELTA ' + (self.varint(mask) + deltas).encode('hex') + '\n'
+
+    @staticmethod
+    def varint(value):
+        result = ''
+        while value >= 0x80:
+            result += chr((value & 0x7F) | 0x80)
+            value >>= 7
+        return result + chr(value)
+
+
+# ----------------------------------------------------------------------
+# Open8055Subscription
+#
+#   Filter and rate limit for the INPUT reports sent to one client.
+#   Reports that pass the filter while the rate limit is in effect
+#   are coalesced, only the latest one is kept and sent when due.
+# ----------------------------------------------------------------------
+class Open8055Subscription:
+    def __init__(self, mask, deadband, counter_delta, max_rate):
+        self.mask = mask
+        self.deadband = deadband
+        self.counter_delta = max(counter_delta, 1)
+        if max_rate > 0.0:
+            self.interval = 1.0 / max_rate
+        else:
+            self.interval = 0.0
+
+        self.last_sent = None
+        self.last_time = 0.0
+        self.pending = None
+        self.forced = False
+
+    # ----------
+    # offer()
+    #
+    #   Present a new INPUT report (tuple of msgType, inputBits,
+    #   5 counters, 2 ADC values, sequence number and timestamp).
+    #   Returns the values to send right now or None.
+    # ----------
+    def offer(self, values, now):
+        if self.forced:
+            self.forced = False
+        elif self.pending is None and not self.changed(values):
+            return None
+
+        if now - self.last_time < self.interval:
+            self.pending = values
+            return None
+
+        self.pending = None
+        self.last_sent = values
+        self.last_time = now
+        return values
+
+    # ----------
+    # due()
+    #
+    #   Return the coalesced report if there is one and the rate
+    #   limit allows sending it now.
+    # ----------
+    def due(self, now):
+        if self.pending is None or now - self.last_time < self.interval:
+            return None
+        values = self.pending
+        self.pending = None
+        self.last_sent = values
+        self.last_time = now
+        return values
+
+    # ----------
+    # flush_delay()
+    #
+    #   Seconds until a pending report becomes due, None if there
+    #   is none.
+    # ----------
+    def flush_delay(self):
+        if self.pending is None:
+            return None
+        return max(self.last_time + self.interval - time.time(), 0.0)
+
+    # ----------
+    # force_next()
+    #
+    #   Let the next report pass regardless of the filter settings.
+    # ----------
+    def force_next(self):
+        self.forced = True
+
+    # ----------
+    # changed()
+    #
+    #   Check if any of the subscribed items changed significantly
+    #   compared to what the client has seen last.
+    # ----------
+    def changed(self, values):
+        last = self.last_sent
+        if last is None:
+            return True
+
+        if (values[1] ^ last[1]) & self.mask & INPUT_I_ANY:
+            return True
+
+        for port in range(0, 5):
+            if not self.mask & (INPUT_COUNT1 << port):
+                continue
+            delta = (values[2 + port] - last[2 + port]) & 0xFFFF
+            if min(delta, 0x10000 - delta) >= self.counter_delta:
+                return True
+
+        for port in range(0, 2):
+            if not self.mask & (INPUT_ADC1 << port):
+                continue
+            if abs(values[7 + port] - last[7 + port]) > self.deadband[port]:
+                return True
+
+        return False
 
 
 # ----------------------------------------------------------------------
@@ -960,6 +2525,13 @@ if os.name == 'posix':
                 log_error('Open8055server failed: ' + str(err))
                 sys.exit(2)
             
+            # ----
+            # The watchdog forwards SIGHUP to reload the configuration
+            # and users file.
+            # ----
+            signal.signal(signal.SIGHUP,
+                    lambda signum, frame: server.post(('reload', None)))
+
             # ----
             # Wait until either the server stopped on its own due to some
             # internal error, or the watchdog tells us to shutdown.
@@ -967,6 +2539,11 @@ if os.name == 'posix':
             while server.get_status() != MODE_STOPPED:
                 try:
                     rdy, _dummy, _dummy = select.select((p_rd,), (), (), 2.0)
+                except select.error as err:
+                    if err.args[0] == errno.EINTR:
+                        continue
+                    log_error('select() failed: ' + str(err))
+                    sys.exit(3)
                 except Exception as err:
                     log_error('select() failed: ' + str(err))
                     sys.exit(3)
@@ -988,12 +2565,27 @@ if os.name == 'posix':
         # ----
         signal.signal(signal.SIGINT, main_catch_signal)
         signal.signal(signal.SIGTERM, main_catch_signal)
+        hangup = []
+        def catch_sighup(signum, frame):
+            hangup.append(signum)
+            os.kill(server_pid, signal.SIGHUP)
+        signal.signal(signal.SIGHUP, catch_sighup)
 
-        try:
-            wpid, status = os.wait()
-        except:
-            os.close(p_wr)
-            wpid, status = os.wait()
+        # ----
+        # A SIGHUP interrupts the wait as well, but only SIGINT and
+        # SIGTERM shut the server down.
+        # ----
+        while True:
+            try:
+                wpid, status = os.wait()
+                break
+            except:
+                if hangup:
+                    del hangup[:]
+                    continue
+                os.close(p_wr)
+                wpid, status = os.wait()
+                break
 
         return status
 
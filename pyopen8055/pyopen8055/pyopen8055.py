@@ -118,22 +118,26 @@ class open8055_hid_input:
         self.input_bits = 0
         self.input_counter = [0, 0, 0, 0, 0]
         self.input_adc = [0, 0]
+        self.input_sequence = 0
+        self.input_timestamp = 0
 
     def get_binary_data(self):
-        return struct.pack("!BB5H2H16x",
+        return struct.pack("!BB5H2HHL10x",
                 self.msg_type, self.input_bits,
                 self.input_counter[0], self.input_counter[1],
                 self.input_counter[2], self.input_counter[3],
                 self.input_counter[4],
-                self.input_adc[0], self.input_adc[1])
+                self.input_adc[0], self.input_adc[1],
+                self.input_sequence, self.input_timestamp)
 
     def set_binary_data(self, data):
         (self.msg_type, self.input_bits,
                 self.input_counter[0], self.input_counter[1],
                 self.input_counter[2], self.input_counter[3],
                 self.input_counter[4],
-                self.input_adc[0], self.input_adc[1]
-            ) = struct.unpack("!BB5H2H16x", data)
+                self.input_adc[0], self.input_adc[1],
+                self.input_sequence, self.input_timestamp
+            ) = struct.unpack("!BB5H2HHL10x", data)
 
 ##########
 # Open8055 output command